@@ -0,0 +1,23 @@
+//
+// Benchmark Stubs.cpp: Stands in for the parts of Ps-H Scattering.cpp that the integration code uses, so that the
+//  benchmarks can be linked without the main program.
+//
+
+#include <string>
+using namespace std;
+
+long double	PI;
+
+
+// The engines report progress through this, which is not wanted in the benchmarks.
+void WriteProgress(string Desc, int &Prog, int i, int N)
+{
+	Prog++;
+	return;
+}
+
+
+string ShowTime(void)
+{
+	return string();
+}
@@ -0,0 +1,119 @@
+#!/bin/bash
+#
+# RunBenchmark.sh: Runs PsHScattering end to end on a synthetic short-range file from ShortRangeGenerator with the
+#  canned parameter files in this directory, and reports the wall time of each phase and the integration throughput.
+#  The phase times come from the program's own steady_clock timing report (results-<size>.txt.timing.json), so they
+#  leave out the startup and the output buffering.  The time of a phase is the largest over the MPI processes.  The
+#  number of points in a phase is the nominal size of its tensor-product rule,
+#  r1 * (r2 Leg + r2 Lag) * (r3 Leg + r3 Lag) * the last three counts, from the parameter file.  The throughput on
+#  the total line is over the integration phases only.
+#
+#  Usage: RunBenchmark.sh [-p PsHScattering] [-g ShortRangeGenerator] [-o Omega] [-l l] [-k kappa] [-n MPI processes]
+#                         [-d output directory] [small] [medium] [large]
+#   The sizes default to small and medium.  large is the same as param.txt.example and takes hours on one node.
+#   The program output for each size is kept in the output directory (bench-results by default).
+#
+
+Dir=$(cd "$(dirname "$0")" && pwd)
+Program="$Dir/../PsHScattering"
+Generator="$Dir/../ShortRangeGenerator"
+Omega=3
+LValue=1
+Kappa=0.5
+NumProcs=0
+OutDir=bench-results
+
+while getopts "p:g:o:l:k:n:d:h" Opt; do
+	case $Opt in
+		p) Program=$OPTARG ;;
+		g) Generator=$OPTARG ;;
+		o) Omega=$OPTARG ;;
+		l) LValue=$OPTARG ;;
+		k) Kappa=$OPTARG ;;
+		n) NumProcs=$OPTARG ;;
+		d) OutDir=$OPTARG ;;
+		*) sed -n '11,14s/^# \{0,1\}//p' "$0"; exit 1 ;;
+	esac
+done
+shift $((OPTIND-1))
+Sizes=${*:-small medium}
+
+for Exe in "$Program" "$Generator"; do
+	if [ ! -x "$Exe" ]; then
+		echo "$Exe does not exist.  Build it with make first, or give its location with -p or -g."
+		exit 1
+	fi
+done
+mkdir -p "$OutDir" || exit 1
+
+ShortFile="$OutDir/synthetic-omega$Omega-l$LValue.psh"
+"$Generator" $Omega $LValue "$ShortFile" || exit 2
+
+# Prints the nominal number of points of each integration phase as name=points, separated by |, with the phase
+#  names used in the timing report.
+NominalPoints()
+{
+	tr -d '\r' < "$1" | awk 'NR == 4 || NR == 6 || NR == 9 || NR == 11 || NR == 13 { printf "%.0f\n", $1 * ($2+$3) * ($4+$5) * $6 * $7 * $8 }' \
+		| awk 'BEGIN { split("long-long|long-long r23|short-long|short-long r23|short-long full", Name, "|") }
+			{ printf "%s%s=%s", (NR > 1 ? "|" : ""), Name[NR], $1 }'
+}
+
+echo "Omega: $Omega, l: $LValue, kappa: $Kappa, OpenMP threads: ${OMP_NUM_THREADS:-default}, MPI processes: ${NumProcs/#0/none}"
+printf "%-8s %-18s %10s %16s %12s %11s %13s %6s\n" "Size" "Phase" "Time (s)" "Points" "Points/s" "Rank imbal." "Thread imbal." "Idle"
+
+for Size in $Sizes; do
+	ParamFile="$Dir/param-$Size.txt"
+	if [ ! -f "$ParamFile" ]; then
+		echo "There is no parameter file for size $Size."
+		continue
+	fi
+	Log="$OutDir/log-$Size.txt"
+	if [ "$NumProcs" -gt 0 ]; then
+		Command=(mpirun -np "$NumProcs" "$Program")
+	else
+		Command=("$Program")
+	fi
+
+	Report="$OutDir/results-$Size.txt.timing.json"
+	rm -f "$Report"
+	"${Command[@]}" $Kappa "$ParamFile" "$ShortFile" "$OutDir/results-$Size.txt" > "$Log" 2>&1
+	if [ ! -f "$Report" ]; then
+		echo "PsHScattering did not finish for size $Size; see $Log."
+		continue
+	fi
+
+	# The report has one phase per line.  Phases that did not run (e.g. the qi = 0 terms for Omega = -1, or the MPI
+	#  setup without MPI) have no time and are skipped.
+	awk -v Size=$Size -v Points="$(NominalPoints "$ParamFile")" '
+		function Field(Line, Key)
+		{
+			if (!match(Line, "\"" Key "\": [-+0-9.eE]+"))
+				return 0
+			return substr(Line, RSTART + length(Key) + 4, RLENGTH - length(Key) - 4) + 0
+		}
+		BEGIN {
+			n = split(Points, Pairs, "|")
+			for (i = 1; i <= n; i++) {
+				split(Pairs[i], Pair, "=")
+				Count[Pair[1]] = Pair[2]
+			}
+		}
+		/"total_seconds"/ { Total = Field($0, "total_seconds") }
+		/"name"/ {
+			split($0, Quoted, "\"")
+			Name = Quoted[4]
+			Elapsed = Field($0, "max")
+			if (Elapsed <= 0) next
+			if (Count[Name] > 0) {
+				printf "%-8s %-18s %10.3f %16.0f %12.4g", Size, Name, Elapsed, Count[Name], Count[Name] / Elapsed
+				AllPoints += Count[Name]
+				IntTime += Elapsed
+			}
+			else
+				printf "%-8s %-18s %10.3f %16s %12s", Size, Name, Elapsed, "-", "-"
+			printf " %11.3f %13.3f %5.1f%%\n", Field($0, "rank_imbalance"), Field($0, "thread_imbalance"), 100 * Field($0, "idle_fraction")
+		}
+		END {
+			printf "%-8s %-18s %10.3f %16.0f %12.4g\n", Size, "total", Total, AllPoints, (IntTime > 0 ? AllPoints / IntTime : 0)
+		}' "$Report"
+done
@@ -17,6 +17,12 @@ void	ChangeOfInterval(vector <long double> &Abscissas, vector <long double> &Cha
 void	ChangeOfIntervalNoResize(vector <long double> &Abscissas, vector <long double> &ChangedAbscissas, long double a, long double b);
 int		GaussLegendre(vector <long double> &Abscissas, vector <long double> &Weights, int n);
 int		GaussLaguerre(vector <long double> &Abscissas, vector <long double> &Weights, int n);
+int		GaussKronrod(vector <long double> &Abscissas, vector <long double> &KronrodWeights, vector <long double> &GaussWeights, int n);
+int		SolveEmbeddedWeights(vector <vector <long double> > &A, int n, vector <long double> &EmbeddedWeights);
+int		LaguerreEmbedded(vector <long double> &Abscissas, vector <long double> &EmbeddedWeights);
+int		LegendreWithEstimate(vector <long double> &Abscissas, vector <long double> &Weights, vector <long double> &Ratios, int n, int ErrorEstimate);
+int		LaguerreWithEstimate(vector <long double> &Abscissas, vector <long double> &Weights, vector <long double> &Ratios, int n, int ErrorEstimate);
+int		TanhSinhWithEstimate(vector <long double> &Abscissas, vector <long double> &Weights, vector <long double> &Ratios, int n, int ErrorEstimate);
 
 
 // Returns whether a double is a finite number.
@@ -488,3 +494,463 @@ int GaussLaguerre(vector <long double> & Abscissas, vector <long double> & Weigh
 
 	return 0;
 }
+
+
+// Newton iteration for one of the Kronrod abscissas (a zero of the Stieltjes polynomial E_{n+1}) and its weight.
+//  This and the next two functions follow the kronrod routine by Piessens and Branders (Math. Comp. 28, 1974),
+//  where b holds the Chebyshev coefficients of E_{n+1}.
+static void KronrodAbscissa(int n, int m, long double Coeff2, bool Even, vector <long double> &b, long double &x, long double &w)
+{
+	long double ai, b0 = 0.0L, b1, b2, d0, d1, d2, Delta, Dif, f = 0.0L, fd = 0.0L, yy;
+	bool Done = (x == 0.0L);
+
+	for (int Iter = 0; Iter < 50; Iter++) {
+		b1 = 0.0L;
+		b2 = b[m];
+		yy = 4.0L * x*x - 2.0L;
+		d1 = 0.0L;
+		if (Even) {
+			ai = m + m + 1;
+			d2 = ai * b[m];
+			Dif = 2.0L;
+		}
+		else {
+			ai = m + 1;
+			d2 = 0.0L;
+			Dif = 1.0L;
+		}
+		for (int k = 1; k <= m; k++) {
+			ai = ai - Dif;
+			int i = m - k + 1;
+			b0 = b1;  b1 = b2;
+			d0 = d1;  d1 = d2;
+			b2 = yy * b1 - b0 + b[i-1];
+			if (!Even) i = i + 1;
+			d2 = yy * d1 - d0 + ai * b[i-1];
+		}
+		if (Even) {
+			f = x * (b2 - b1);
+			fd = d2 + d1;
+		}
+		else {
+			f = 0.5L * (b2 - b0);
+			fd = 4.0L * x * d2;
+		}
+
+		Delta = f / fd;
+		x = x - Delta;
+		if (Done)
+			break;
+		if (fabsl(Delta) <= 1e-18L)
+			Done = true;  // One more pass to polish the root.
+	}
+
+	// P_n(x) for the weight
+	d0 = 1.0L;
+	d1 = x;
+	for (int k = 1; k < n; k++) {
+		d2 = ((2.0L*k + 1.0L) * x * d1 - k * d0) / (k + 1.0L);
+		d0 = d1;
+		d1 = d2;
+	}
+	w = Coeff2 / (fd * d1);
+
+	return;
+}
+
+
+// Newton iteration for one of the Gauss abscissas (a zero of P_n), giving both its Kronrod and Gauss weights.
+static void KronrodGaussAbscissa(int n, int m, long double Coeff2, bool Even, vector <long double> &b, long double &x, long double &wKronrod, long double &wGauss)
+{
+	long double p0 = 1.0L, p1, p2 = 0.0L, pd0, pd1, pd2 = 0.0L, Delta, yy;
+	bool Done = (x == 0.0L);
+
+	for (int Iter = 0; Iter < 50; Iter++) {
+		p0 = 1.0L;  p1 = x;
+		pd0 = 0.0L;  pd1 = 1.0L;
+		for (int k = 1; k < n; k++) {
+			p2 = ((2.0L*k + 1.0L) * x * p1 - k * p0) / (k + 1.0L);
+			pd2 = ((2.0L*k + 1.0L) * (p1 + x * pd1) - k * pd0) / (k + 1.0L);
+			p0 = p1;  p1 = p2;
+			pd0 = pd1;  pd1 = pd2;
+		}
+
+		Delta = p2 / pd2;
+		x = x - Delta;
+		if (Done)
+			break;
+		if (fabsl(Delta) <= 1e-18L)
+			Done = true;
+	}
+
+	wGauss = 2.0L / (n * pd2 * p0);
+
+	p1 = 0.0L;
+	p2 = b[m];
+	yy = 4.0L * x*x - 2.0L;
+	for (int k = 1; k <= m; k++) {
+		p0 = p1;
+		p1 = p2;
+		p2 = yy * p1 - p0 + b[m-k];
+	}
+	if (Even)
+		wKronrod = wGauss + Coeff2 / (pd2 * x * (p2 - p1));
+	else
+		wKronrod = wGauss + 2.0L * Coeff2 / (pd2 * (p2 - p0));
+
+	return;
+}
+
+
+// Generates the 2n+1 point Gauss-Kronrod rule on [-1,1] that extends the n point Gauss-Legendre rule.  GaussWeights
+//  has the weights of the embedded Gauss rule and is 0 at the Kronrod-only abscissas.  The abscissas are sorted in
+//  increasing order like GaussLegendre.
+int GaussKronrod(vector <long double> &Abscissas, vector <long double> &KronrodWeights, vector <long double> &GaussWeights, int n)
+{
+	int m = (n + 1) / 2;
+	bool Even = (2 * m == n);
+	vector <long double> b(m+1), Tau(m), x(n+1), wK(n+1), wG(n+1);
+	long double an = n, ak = n;
+
+	if (n < 2) {
+		cout << "Gauss-Kronrod rule needs at least two Gauss points." << endl;
+		return -1;
+	}
+
+	// Chebyshev coefficients of the Stieltjes polynomial
+	Tau[0] = (an + 2.0L) / (an + an + 3.0L);
+	b[m-1] = Tau[0] - 1.0L;
+	for (int l = 1; l < m; l++) {
+		ak = ak + 2.0L;
+		Tau[l] = ((ak - 1.0L) * ak - an * (an + 1.0L)) * (ak + 2.0L) * Tau[l-1] / (ak * ((ak + 3.0L) * (ak + 2.0L) - an * (an + 1.0L)));
+		b[m-l-1] = Tau[l];
+		for (int ll = 1; ll <= l; ll++)
+			b[m-l-1] += Tau[ll-1] * b[m-l+ll-1];
+	}
+	b[m] = 1.0L;
+
+	// Initial approximations to the abscissas, which alternate between Kronrod and Gauss abscissas.
+	long double bb = sinl(PI / (4.0L * an + 2.0L));
+	long double x1 = sqrtl(1.0L - bb*bb);
+	long double s = 2.0L * bb * x1;
+	long double c = sqrtl(1.0L - s*s);
+	long double Coeff = 1.0L - (1.0L - 1.0L / an) / (8.0L * an*an);
+	long double xx = Coeff * x1, y;
+
+	// Coeff2 = 2^(2n+1) * n! * n! / (2n+1)!
+	long double Coeff2 = 2.0L / (2*n + 1);
+	for (int i = 1; i <= n; i++)
+		Coeff2 = Coeff2 * 4.0L * i / (n + i);
+
+	for (int k = 1; k <= n; k += 2) {
+		KronrodAbscissa(n, m, Coeff2, Even, b, xx, wK[k-1]);
+		wG[k-1] = 0.0L;
+		x[k-1] = xx;
+		y = x1;
+		x1 = y * c - bb * s;
+		bb = y * s + bb * c;
+		xx = (k == n) ? 0.0L : Coeff * x1;
+
+		KronrodGaussAbscissa(n, m, Coeff2, Even, b, xx, wK[k], wG[k]);
+		x[k] = xx;
+		y = x1;
+		x1 = y * c - bb * s;
+		bb = y * s + bb * c;
+		xx = Coeff * x1;
+	}
+	// For even n, the origin is the last Kronrod abscissa.
+	if (Even) {
+		xx = 0.0L;
+		KronrodAbscissa(n, m, Coeff2, Even, b, xx, wK[n]);
+		wG[n] = 0.0L;
+		x[n] = xx;
+	}
+
+	// x has the nonnegative abscissas in decreasing order, so fill in both halves from it.
+	Abscissas.resize(2*n+1);
+	KronrodWeights.resize(2*n+1);
+	GaussWeights.resize(2*n+1);
+	for (int i = 0; i <= n; i++) {
+		Abscissas[i] = -x[i];
+		Abscissas[2*n-i] = x[i];
+		KronrodWeights[i] = KronrodWeights[2*n-i] = wK[i];
+		GaussWeights[i] = GaussWeights[2*n-i] = wG[i];
+	}
+
+	return 0;
+}
+
+
+// Solves the m by m moment equations in A (with the right-hand side in the last column) by Gaussian elimination with
+//  partial pivoting.  The solution goes into every other entry of EmbeddedWeights, which has n entries.
+int SolveEmbeddedWeights(vector <vector <long double> > &A, int n, vector <long double> &EmbeddedWeights)
+{
+	int m = A.size();
+
+	for (int c = 0; c < m; c++) {
+		int Pivot = c;
+		for (int r = c+1; r < m; r++) {
+			if (fabsl(A[r][c]) > fabsl(A[Pivot][c]))
+				Pivot = r;
+		}
+		swap(A[c], A[Pivot]);
+		if (A[c][c] == 0.0L)
+			return -1;
+		for (int r = c+1; r < m; r++) {
+			long double f = A[r][c] / A[c][c];
+			for (int k = c; k <= m; k++)
+				A[r][k] -= f * A[c][k];
+		}
+	}
+
+	EmbeddedWeights.assign(n, 0.0L);
+	for (int r = m-1; r >= 0; r--) {
+		long double Sum = A[r][m];
+		for (int k = r+1; k < m; k++)
+			Sum -= A[r][k] * EmbeddedWeights[2*k];
+		EmbeddedWeights[2*r] = Sum / A[r][r];
+	}
+
+	return 0;
+}
+
+
+// There is no Kronrod extension of the Gauss-Laguerre rules in general, so the embedded rule here is the
+//  interpolatory rule on every other Gauss-Laguerre abscissa, exact for polynomials (times e^-x) of degree < (n+1)/2.
+//  That is about a quarter of the degree of the Gauss rule, so the difference between the two is essentially the error
+//  of the embedded rule.  It is a pessimistic bound on the error of the Gauss-Laguerre result, not an estimate of it.
+//  The moment equations are written with L_k(x) e^(-x/2), which is bounded by 1, to keep the system well-behaved.
+int LaguerreEmbedded(vector <long double> &Abscissas, vector <long double> &EmbeddedWeights)
+{
+	int n = Abscissas.size(), m = (n + 1) / 2;
+	vector <vector <long double> > A(m, vector <long double>(m+1, 0.0L));
+
+	for (int i = 0; i < m; i++) {
+		long double x = Abscissas[2*i], Scale = expl(-x / 2.0L);
+		long double L0 = 1.0L, L1 = 1.0L - x, L2;
+		A[0][i] = Scale;
+		if (m > 1) A[1][i] = L1 * Scale;
+		for (int k = 2; k < m; k++) {
+			L2 = ((2.0L*k - 1.0L - x) * L1 - (k - 1.0L) * L0) / k;
+			L0 = L1;
+			L1 = L2;
+			A[k][i] = L2 * Scale;
+		}
+	}
+	A[0][m] = 1.0L;  // Integral of L_k(x) e^-x is 1 for k = 0 and 0 otherwise.
+
+	if (SolveEmbeddedWeights(A, n, EmbeddedWeights) != 0) {
+		cout << "Singular system for the embedded Gauss-Laguerre rule." << endl;
+		return -1;
+	}
+	for (int i = 0; i < m; i++)
+		EmbeddedWeights[2*i] *= expl(-Abscissas[2*i] / 2.0L);
+
+	return 0;
+}
+
+
+// Gives the rule used for the Gauss-Legendre dimensions.  Without ErrorEstimate, this is the n point Gauss-Legendre
+//  rule and all ratios are 1.  With it, this is the Gauss-Kronrod rule extending the (n-1)/2 point Gauss rule, and
+//  Ratios has the ratio of the Gauss weight to the Kronrod weight at each abscissa (0 at the Kronrod-only abscissas).
+//  The Kronrod rule is used for the result, so the Gauss minus Kronrod difference is a bound on the error of the
+//  weaker rule, and usually well above the error of the result.  The Kronrod rule needs an odd number of points, so
+//  for even n the last point is left with a weight of 0.  Below 5 points there is no Kronrod pair, and the ratios are 1.
+int LegendreWithEstimate(vector <long double> &Abscissas, vector <long double> &Weights, vector <long double> &Ratios, int n, int ErrorEstimate)
+{
+	int m = (n - 1) / 2;
+
+	if (ErrorEstimate == 0 || m < 2) {
+		GaussLegendre(Abscissas, Weights, n);
+		Ratios.assign(Weights.size(), 1.0L);
+		return 0;
+	}
+
+	vector <long double> GaussWeights;
+	if (GaussKronrod(Abscissas, Weights, GaussWeights, m) != 0)
+		return -1;
+	Ratios.resize(2*m+1);
+	for (int i = 0; i < 2*m+1; i++)
+		Ratios[i] = GaussWeights[i] / Weights[i];
+	if (n > 2*m+1) {
+		Abscissas.push_back(0.0L);
+		Weights.push_back(0.0L);
+		Ratios.push_back(1.0L);
+	}
+
+	return 0;
+}
+
+
+// Same as LegendreWithEstimate for the Gauss-Laguerre dimensions, except that the result is always the n point
+//  Gauss-Laguerre rule and the ratios are to the weights of the embedded rule from LaguerreEmbedded.
+int LaguerreWithEstimate(vector <long double> &Abscissas, vector <long double> &Weights, vector <long double> &Ratios, int n, int ErrorEstimate)
+{
+	GaussLaguerre(Abscissas, Weights, n);
+	if (ErrorEstimate == 0 || n < 2) {
+		Ratios.assign(Weights.size(), 1.0L);
+		return 0;
+	}
+
+	vector <long double> EmbeddedWeights;
+	if (LaguerreEmbedded(Abscissas, EmbeddedWeights) != 0)
+		return -1;
+	Ratios.resize(Weights.size());
+	for (unsigned int i = 0; i < Weights.size(); i++)
+		Ratios[i] = EmbeddedWeights[i] / Weights[i];
+
+	return 0;
+}
+
+
+// Tanh-sinh (double exponential) rule on [0,1] with n points, which is made odd.  The points cluster at both ends
+//  like exp(-pi*sinh(t)), so a kink or integrable singularity at an endpoint does not slow the convergence.  The
+//  embedded rule is every other point with twice the step, so Ratios alternates between 2 and 0.
+int TanhSinhWithEstimate(vector <long double> &Abscissas, vector <long double> &Weights, vector <long double> &Ratios, int n, int ErrorEstimate)
+{
+	if (n < 3) n = 3;
+	n = n | 1;
+	Abscissas.resize(n);
+	Weights.resize(n);
+	Ratios.resize(n);
+
+	// Balances the truncation of [-T,T] against the step size.  This was tuned on the short-long r2 integrals, where
+	//  a fixed T with endpoint weights below the long double precision did much worse for n < 25.
+	long double T = 2.0L / 3.0L * logl(n);
+	long double h = 2.0L * T / (n - 1);
+	for (int k = 0; k < n; k++) {
+		long double t = -T + k * h;
+		long double e = expl(-PI * fabsl(sinhl(t)));  // Distance to the nearer endpoint is e/(1+e)
+		Abscissas[k] = t < 0.0L ? e / (1.0L + e) : 1.0L / (1.0L + e);
+		Weights[k] = h * PI * coshl(t) * e / ((1.0L + e) * (1.0L + e));
+		if (ErrorEstimate && n >= 5)
+			Ratios[k] = k % 2 == 0 ? 2.0L : 0.0L;
+		else
+			Ratios[k] = 1.0L;
+	}
+
+	return 0;
+}
+
+
+// Cusp threshold for a radial coordinate with weight r^Power exp(-Exponent*r): the distance past which the part of
+//  the integral beyond the cusp is negligible, so splitting there no longer changes the result.  This is where the
+//  upper incomplete gamma function Q(Power+1, Exponent*r) falls below 1e-14.
+long double AutoCuspThreshold(long double Exponent, int Power)
+{
+	long double x = Power > 0 ? Power : 1.0L;
+	while (1) {
+		long double Term = expl(-x), Sum = Term;
+		for (int k = 1; k <= Power; k++) {
+			Term = Term * x / k;
+			Sum += Term;
+		}
+		if (Sum < 1e-14L)
+			break;
+		x += 0.25L;
+	}
+	return x / Exponent;
+}
+
+
+CuspSplitRule::CuspSplitRule(int nLeg, int nLag, int ErrorEstimate, int Rule)
+{
+	this->Rule = Rule;
+	if (Rule == CUSP_DE)
+		TanhSinhWithEstimate(LowAbscissas, LowWeights, LowRatios, nLeg, ErrorEstimate);
+	else
+		LegendreWithEstimate(LowAbscissas, LowWeights, LowRatios, nLeg, ErrorEstimate);
+	LaguerreWithEstimate(LaguerreAbscissas, LaguerreWeights, LaguerreRatios, nLag, ErrorEstimate);
+	// The tanh-sinh rule does not always have the requested number of points.
+	nLow = LowAbscissas.size();
+	this->nLag = nLag;
+	MaxPoints = nLow + nLag;
+	return;
+}
+
+
+// Fills in the abscissas, weights (including the exponential) and embedded ratios and returns the number of points.
+//  Below the cusp threshold, the low rule is used over [0,Split] and shifted Gauss-Laguerre over [Split,inf).
+int CuspSplitRule::Build(long double Split, long double Cusp, long double Exponent, vector <long double> &Abscissas, vector <long double> &Weights, vector <long double> &Ratios)
+{
+	// These are often private to a thread, so they may not be allocated yet.
+	if ((int)Abscissas.size() < MaxPoints) {
+		Abscissas.resize(MaxPoints);
+		Weights.resize(MaxPoints);
+		Ratios.resize(MaxPoints);
+	}
+
+	// If the split is large enough, we just do Gauss-Laguerre.
+	if (Split > Cusp) {
+		for (int m = 0; m < nLag; m++) {
+			Weights[m] = LaguerreWeights[m] / Exponent;
+			Abscissas[m] = LaguerreAbscissas[m] / Exponent;
+			Ratios[m] = LaguerreRatios[m];
+		}
+		return nLag;
+	}
+
+	if (Rule == CUSP_DE) {
+		for (int m = 0; m < nLow; m++) {
+			Abscissas[m] = LowAbscissas[m] * Split;
+			Weights[m] = LowWeights[m] * expl(-Exponent*Abscissas[m]) * Split;
+			Ratios[m] = LowRatios[m];
+		}
+	}
+	else {
+		ChangeOfIntervalNoResize(LowAbscissas, Abscissas, 0.0L, Split);
+		for (int m = 0; m < nLow; m++) {
+			Weights[m] = LowWeights[m] * expl(-Exponent*Abscissas[m]) * (Split-0.0L)/2.0L;
+			Ratios[m] = LowRatios[m];
+		}
+	}
+
+	long double ExpSplit = expl(-Exponent*Split);
+	for (int m = nLow; m < nLow + nLag; m++) {
+		Abscissas[m] = (LaguerreAbscissas[m-nLow] + Split*Exponent) / Exponent;
+		Weights[m] = LaguerreWeights[m-nLow] * ExpSplit / Exponent;
+		Ratios[m] = LaguerreRatios[m-nLow];
+	}
+
+	return nLow + nLag;
+}
+
+
+AngularRule::AngularRule(int n, int Rule)
+{
+	this->n = n;
+	Cos.resize(n);
+	Weights.resize(n);
+	Nested = (Rule == PHI_MIDPOINT && n % 3 == 0);
+
+	if (Rule == PHI_GAUSS) {
+		// With phi = pi*t^2, the points cluster at phi = 0, where r23 can come close to 0 and the integrand is least
+		//  smooth.  The midpoint rule only converges about as 1/n^2 there.
+		vector <long double> Abscissas, GaussWeights;
+		GaussLegendre(Abscissas, GaussWeights, n);
+		for (int m = 0; m < n; m++) {
+			long double t = (Abscissas[m] + 1.0L) / 2.0L;
+			Cos[m] = cosl(PI*t*t);
+			Weights[m] = GaussWeights[m] * t * n;  // (1/2) * (2*pi*t) / (pi/n) for the change of variables
+		}
+	}
+	else {
+		// The midpoint angles are symmetric about pi/2, so the cosines of the second half are the negatives of the first.
+		for (int m = 0; m < (n+1)/2; m++) {
+			Cos[m] = cosl((2.0L*m + 1.0L)*PI/(2.0L*n));
+			Cos[n-1-m] = -Cos[m];
+		}
+		if (n % 2 == 1) Cos[n/2] = 0.0L;
+		Weights.assign(n, 1.0L);
+	}
+	return;
+}
+
+
+// Finds sqrt(a - b*cos(phi)) for every angle at once, which is how r23 (or r13 or r12) depends on phi.
+void AngularRule::Distances(long double a, long double b, long double *r)
+{
+	for (int m = 0; m < n; m++)
+		r[m] = sqrtl(a - b*Cos[m]);
+	return;
+}
@@ -0,0 +1,123 @@
+//
+// Integration Benchmark.cpp: Compares the cost of the short-long integration engines at matched accuracy.
+//  The tensor-product Gauss rules, Smolyak sparse grids and QMC are all run on the full (qi > 0) integrand for
+//  l = 0 to 3 and compared against a tensor-product Gauss reference with many points.
+//
+//  Usage: IntegrationBenchmark [Omega] [reference points] [kappa]
+//
+
+#include <iostream>
+#include <iomanip>
+#include <string>
+#include <stdlib.h>
+#include <omp.h>
+#include "Ps-H Scattering.h"
+using namespace std;
+
+extern long double PI;
+
+
+// Largest difference from the reference over all A and B values, relative to the largest reference value
+double MaxRelError(vector <double> &A, vector <double> &B, vector <double> &ARef, vector <double> &BRef)
+{
+	double MaxDiff = 0.0, MaxRef = 0.0;
+	for (unsigned int n = 0; n < ARef.size(); n++) {
+		MaxDiff = max(MaxDiff, max(fabs(A[n] - ARef[n]), fabs(B[n] - BRef[n])));
+		MaxRef = max(MaxRef, max(fabs(ARef[n]), fabs(BRef[n])));
+	}
+	return MaxDiff / MaxRef;
+}
+
+
+void RunGauss(int n, int l, double kappa, double mu, int shpower, int sf, int NumPowers, vector <rPowers> &Powers, int Omega, vector <double> &A, vector <double> &B)
+{
+	vector <double> AErr(2*NumPowers, 0.0), BErr(2*NumPowers, 0.0), ADeriv, BDeriv;
+	A.assign(2*NumPowers, 0.0);
+	B.assign(2*NumPowers, 0.0);
+	VecGaussIntegrationPhi23_PhiLCBar_PhiLSBar_Full(A, B, l, n, n, n, n, n, n, n, n, 100.0, 100.0, CUSP_GAUSS, PHI_MIDPOINT, kappa, mu, shpower, sf, NumPowers, Powers, Omega, 1.0, 1.0, 1.0, 0, AErr, BErr, 0, ADeriv, BDeriv);
+	return;
+}
+
+
+int main(int argc, char *argv[])
+{
+	int Omega = argc > 1 ? atoi(argv[1]) : 2;
+	int RefPoints = argc > 2 ? atoi(argv[2]) : 30;
+	double kappa = argc > 3 ? atof(argv[3]) : 0.4;
+	double Alpha = 0.6, Beta = 0.5, Gamma = 0.55, mu = 0.7;
+	int shpower = 7, sf = 1;
+	int TensorPoints[] = { 6, 9, 12, 15, 18, 21 };
+	int SparseLevels[] = { 1, 2, 3, 4, 5, 6 };
+	int QmcPoints[] = { 4096, 16384, 65536, 262144 };
+	double Tolerances[] = { 1e-2, 1e-3, 1e-4 };
+
+	PI = 3.1415926535897932384626433832795029L;
+	cout << setprecision(4);
+
+	int NumShortTerms = CalcPowerTableSize(Omega);
+	int NumPowers = CalcPowerTableSizeQiGt0(Omega, 0, 0, NumShortTerms);
+	cout << "Omega: " << Omega << " (" << NumPowers << " terms with qi > 0), kappa: " << kappa << ", reference: " << RefPoints << " Gauss points per dimension" << endl;
+
+	for (int l = 0; l <= 3; l++) {
+		vector <rPowers> Powers(NumPowers*2, rPowers(Alpha, Beta, Gamma));
+		vector <double> ARef, BRef, A, B, AErr(2*NumPowers), BErr(2*NumPowers);
+		double BestTime[3][3];  // Engine, tolerance
+		for (int e = 0; e < 3; e++)
+			for (int t = 0; t < 3; t++)
+				BestTime[e][t] = -1.0;
+
+		GenOmegaPowerTableQiGt0(Omega, l, 0, Powers, 0, NumShortTerms-1);
+		cout << endl << "l = " << l << endl;
+		double Time = omp_get_wtime();
+		RunGauss(RefPoints, l, kappa, mu, shpower, sf, NumPowers, Powers, Omega, ARef, BRef);
+		cout << "Reference: " << omp_get_wtime() - Time << " s" << endl;
+
+		cout << setw(8) << "Engine" << setw(12) << "Setting" << setw(12) << "Points" << setw(12) << "Time (s)" << setw(12) << "Rel. error" << endl;
+		for (int i = 0; i < 6; i++) {
+			int n = TensorPoints[i];
+			if (n >= RefPoints) break;
+			Time = omp_get_wtime();
+			RunGauss(n, l, kappa, mu, shpower, sf, NumPowers, Powers, Omega, A, B);
+			Time = omp_get_wtime() - Time;
+			double Err = MaxRelError(A, B, ARef, BRef);
+			// Every r2 and r3 interval is split at r1 with the 100.0 cusp used here.
+			cout << setw(8) << "Gauss" << setw(12) << n << setw(12) << (double)n*2*n*2*n*n*n*n << setw(12) << Time << setw(12) << Err << endl;
+			for (int t = 0; t < 3; t++)
+				if (Err < Tolerances[t] && BestTime[0][t] < 0.0) BestTime[0][t] = Time;
+		}
+		for (int i = 0; i < 6; i++) {
+			A.assign(2*NumPowers, 0.0);
+			B.assign(2*NumPowers, 0.0);
+			Time = omp_get_wtime();
+			SparseIntegrationPhi23_PhiLCBar_PhiLSBar_Full(A, B, l, SparseLevels[i], kappa, mu, shpower, sf, NumPowers, Powers, Omega, 0, AErr, BErr);
+			Time = omp_get_wtime() - Time;
+			double Err = MaxRelError(A, B, ARef, BRef);
+			cout << setw(8) << "Sparse" << setw(12) << SparseLevels[i] << setw(12) << SparseGridSize(SparseLevels[i]) << setw(12) << Time << setw(12) << Err << endl;
+			for (int t = 0; t < 3; t++)
+				if (Err < Tolerances[t] && BestTime[1][t] < 0.0) BestTime[1][t] = Time;
+		}
+		for (int i = 0; i < 4; i++) {
+			A.assign(2*NumPowers, 0.0);
+			B.assign(2*NumPowers, 0.0);
+			Time = omp_get_wtime();
+			QmcIntegrationPhi23_PhiLCBar_PhiLSBar_Full(A, B, l, QmcPoints[i], 8, kappa, mu, shpower, sf, NumPowers, Powers, Omega, AErr, BErr);
+			Time = omp_get_wtime() - Time;
+			double Err = MaxRelError(A, B, ARef, BRef);
+			cout << setw(8) << "QMC" << setw(12) << QmcPoints[i] << setw(12) << (double)QmcPoints[i]*8 << setw(12) << Time << setw(12) << Err << endl;
+			for (int t = 0; t < 3; t++)
+				if (Err < Tolerances[t] && BestTime[2][t] < 0.0) BestTime[2][t] = Time;
+		}
+
+		cout << "Time to reach a relative error of" << setw(12) << "Gauss" << setw(12) << "Sparse" << setw(12) << "QMC" << endl;
+		for (int t = 0; t < 3; t++) {
+			cout << setw(33) << Tolerances[t];
+			for (int e = 0; e < 3; e++) {
+				if (BestTime[e][t] < 0.0) cout << setw(12) << "-";
+				else cout << setw(12) << BestTime[e][t];
+			}
+			cout << endl;
+		}
+	}
+
+	return 0;
+}
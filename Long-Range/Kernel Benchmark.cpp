@@ -0,0 +1,474 @@
+//
+// Kernel Benchmark.cpp: Times the special functions and integrand pieces that the short-long integration spends its
+//  time in, so that changes to them can be checked for regressions.  Each benchmark is run for enough iterations to
+//  take at least the minimum time (in the same way as Google Benchmark), and the time per call and the number of
+//  integration points per second are reported.  The results can be saved as a JSON baseline that later runs are
+//  compared against.
+//
+//  Usage: KernelBenchmark [--omega=6] [--filter=name] [--min_time=0.2] [--out=file.json] [--baseline=file.json] [--threshold=10]
+//   --filter only runs the benchmarks with that substring in their name, and --threshold is the slowdown in percent
+//   relative to the baseline that counts as a regression.  The return value is 1 if there are any regressions.
+//
+
+#include <iostream>
+#include <iomanip>
+#include <fstream>
+#include <string>
+#include <map>
+#include <stdlib.h>
+#include <omp.h>
+#include "Ps-H Scattering.h"
+using namespace std;
+
+extern long double PI;
+
+// These are not in Ps-H Scattering.h, since only Vector Gaussian Integration.cpp and Long-Range.cpp use them.
+long double LaplacianC(int l, long double kappa, long double rho, long double mu, int shpower);
+long double AngR1Rho(int l, long double r1, long double r2, long double Cos12, long double Sin12, long double rho);
+long double AngR1Rhop(int l, long double r1, long double r3, long double Cos13, long double Sin13, long double rhop);
+long double AngR2Rho(int l, long double r1, long double r2, long double Cos12, long double Sin12, long double rho);
+long double AngR2Rhop(int l, long double r1, long double r3, long double Cos12, long double Cos13, long double Cos23, long double rhop);
+long double AngRhoRhop(int l, long double r1, long double r2, long double r3, long double r23, long double Cos12, long double Cos13, long double Cos23, long double rho, long double rhop);
+
+#define NUM_SAMPLES 1024  // Must be a power of 2
+#define LMAX_ANG 3  // The Bessel functions and angular terms are timed for l = 0 to this
+#define LMAX_LAPLACIAN 8  // All of the partial waves that LaplacianC has
+#define NUM_ABSCISSAS 40
+
+
+// Integration points spread over the region that the integrands are largest in.  The coordinates come from actual
+//  vectors r1, r2 and r3, so that every cosine is consistent with the distances.
+struct SamplePoint
+{
+	long double r1, r2, r3, r12, r13, r23, Cos12, Sin12, Cos13, Sin13, Cos23, rho, rhop;
+};
+
+
+// Everything the benchmarks need, set up once before any timing.  Sink takes the results so that the calls cannot
+//  be optimized away.
+struct BenchData
+{
+	vector <SamplePoint> Points;
+	long double kappa, mu, Sink;
+	int shpower, Omega, NumPowers;
+	vector <rPowers> Powers;
+	vector <long double> Abscissas, Changed, LUT, AccA, AccB;
+	vector <long double> r1Pow, r2Pow, r3Pow, r12Pow, r13Pow, r23Pow;
+};
+
+typedef void (*BenchFunc)(BenchData &Data, int Arg, long long Iterations);
+
+struct Benchmark
+{
+	string Name;
+	BenchFunc Func;
+	int Arg;
+	double PointsPerCall;
+};
+
+struct BenchResult
+{
+	string Name;
+	long long Iterations;
+	double NsPerCall, PointsPerSec;
+};
+
+
+// Uniform in [0,1) from a fixed seed, so that every run times the same points
+static double Uniform(unsigned long long &State)
+{
+	State = State * 6364136223846793005ULL + 1442695040888963407ULL;
+	return (State >> 11) * (1.0 / 9007199254740992.0);
+}
+
+
+static void RandomDirection(unsigned long long &State, long double *v)
+{
+	long double CosTheta = 2.0L * Uniform(State) - 1.0L, Phi = 2.0L * PI * Uniform(State);
+	long double SinTheta = sqrt(1.0L - CosTheta*CosTheta);
+	v[0] = SinTheta * cos(Phi);  v[1] = SinTheta * sin(Phi);  v[2] = CosTheta;
+}
+
+
+static long double Dot(long double *a, long double *b)
+{
+	return a[0]*b[0] + a[1]*b[1] + a[2]*b[2];
+}
+
+
+void GenSamplePoints(vector <SamplePoint> &Points)
+{
+	unsigned long long State = 12345;
+	long double u1[3] = { 0.0L, 0.0L, 1.0L }, u2[3], u3[3];
+
+	Points.resize(NUM_SAMPLES);
+	for (int i = 0; i < NUM_SAMPLES; i++) {
+		SamplePoint &p = Points[i];
+		p.r1 = 0.05L + 12.0L * Uniform(State);
+		p.r2 = 0.05L + 8.0L * Uniform(State);
+		p.r3 = 0.05L + 8.0L * Uniform(State);
+		RandomDirection(State, u2);
+		RandomDirection(State, u3);
+		p.Cos12 = Dot(u1, u2);  p.Cos13 = Dot(u1, u3);  p.Cos23 = Dot(u2, u3);
+		p.Sin12 = sqrt(1.0L - p.Cos12*p.Cos12);  p.Sin13 = sqrt(1.0L - p.Cos13*p.Cos13);
+		p.r12 = sqrt(p.r1*p.r1 + p.r2*p.r2 - 2.0L*p.r1*p.r2*p.Cos12);
+		p.r13 = sqrt(p.r1*p.r1 + p.r3*p.r3 - 2.0L*p.r1*p.r3*p.Cos13);
+		p.r23 = sqrt(p.r2*p.r2 + p.r3*p.r3 - 2.0L*p.r2*p.r3*p.Cos23);
+		p.rho = 0.5L * sqrt(p.r1*p.r1 + p.r2*p.r2 + 2.0L*p.r1*p.r2*p.Cos12);
+		p.rhop = 0.5L * sqrt(p.r1*p.r1 + p.r3*p.r3 + 2.0L*p.r1*p.r3*p.Cos13);
+
+		// The Legendre functions give a domain error if rounding pushes any of the cosines past 1.
+		long double x[5] = { (p.r1 + p.r2*p.Cos12) / (2.0L*p.rho), (p.r1 + p.r3*p.Cos13) / (2.0L*p.rhop), (p.r2 + p.r1*p.Cos12) / (2.0L*p.rho),
+			(p.r1*p.Cos12 + p.r3*p.Cos23) / (2.0L*p.rhop), (4.0L*p.rho*p.rho + 4.0L*p.rhop*p.rhop - p.r23*p.r23) / (8.0L*p.rho*p.rhop) };
+		bool Valid = p.rho > 0.01L && p.rhop > 0.01L;
+		for (int j = 0; j < 5; j++)
+			if (fabs(x[j]) > 1.0L - 1e-12L) Valid = false;
+		if (!Valid) i--;
+	}
+}
+
+
+void BenchBesselJl(BenchData &Data, int l, long long Iterations)
+{
+	long double Sum = 0.0L;
+	for (long long i = 0; i < Iterations; i++)
+		Sum += sf_bessel_jl(l, Data.kappa * Data.Points[i & (NUM_SAMPLES-1)].rho);
+	Data.Sink += Sum;
+}
+
+
+void BenchBesselNl(BenchData &Data, int l, long long Iterations)
+{
+	long double Sum = 0.0L;
+	for (long long i = 0; i < Iterations; i++)
+		Sum += sf_bessel_nl(l, Data.kappa * Data.Points[i & (NUM_SAMPLES-1)].rho);
+	Data.Sink += Sum;
+}
+
+
+void BenchFShielding(BenchData &Data, int, long long Iterations)
+{
+	long double Sum = 0.0L;
+	for (long long i = 0; i < Iterations; i++)
+		Sum += fshielding(Data.Points[i & (NUM_SAMPLES-1)].rho, Data.mu, Data.shpower);
+	Data.Sink += Sum;
+}
+
+
+void BenchFShielding1(BenchData &Data, int, long long Iterations)
+{
+	long double Sum = 0.0L;
+	for (long long i = 0; i < Iterations; i++)
+		Sum += fshielding1(Data.Points[i & (NUM_SAMPLES-1)].rho, Data.mu, Data.shpower);
+	Data.Sink += Sum;
+}
+
+
+void BenchFShielding2(BenchData &Data, int, long long Iterations)
+{
+	long double Sum = 0.0L;
+	for (long long i = 0; i < Iterations; i++)
+		Sum += fshielding2(Data.Points[i & (NUM_SAMPLES-1)].rho, Data.mu, Data.shpower);
+	Data.Sink += Sum;
+}
+
+
+void BenchLaplacianC(BenchData &Data, int l, long long Iterations)
+{
+	long double Sum = 0.0L;
+	for (long long i = 0; i < Iterations; i++)
+		Sum += LaplacianC(l, Data.kappa, Data.Points[i & (NUM_SAMPLES-1)].rho, Data.mu, Data.shpower);
+	Data.Sink += Sum;
+}
+
+
+void BenchAngR1Rho(BenchData &Data, int l, long long Iterations)
+{
+	long double Sum = 0.0L;
+	for (long long i = 0; i < Iterations; i++) {
+		SamplePoint &p = Data.Points[i & (NUM_SAMPLES-1)];
+		Sum += AngR1Rho(l, p.r1, p.r2, p.Cos12, p.Sin12, p.rho);
+	}
+	Data.Sink += Sum;
+}
+
+
+void BenchAngR1Rhop(BenchData &Data, int l, long long Iterations)
+{
+	long double Sum = 0.0L;
+	for (long long i = 0; i < Iterations; i++) {
+		SamplePoint &p = Data.Points[i & (NUM_SAMPLES-1)];
+		Sum += AngR1Rhop(l, p.r1, p.r3, p.Cos13, p.Sin13, p.rhop);
+	}
+	Data.Sink += Sum;
+}
+
+
+void BenchAngR2Rho(BenchData &Data, int l, long long Iterations)
+{
+	long double Sum = 0.0L;
+	for (long long i = 0; i < Iterations; i++) {
+		SamplePoint &p = Data.Points[i & (NUM_SAMPLES-1)];
+		Sum += AngR2Rho(l, p.r1, p.r2, p.Cos12, p.Sin12, p.rho);
+	}
+	Data.Sink += Sum;
+}
+
+
+void BenchAngR2Rhop(BenchData &Data, int l, long long Iterations)
+{
+	long double Sum = 0.0L;
+	for (long long i = 0; i < Iterations; i++) {
+		SamplePoint &p = Data.Points[i & (NUM_SAMPLES-1)];
+		Sum += AngR2Rhop(l, p.r1, p.r3, p.Cos12, p.Cos13, p.Cos23, p.rhop);
+	}
+	Data.Sink += Sum;
+}
+
+
+void BenchAngRhoRhop(BenchData &Data, int l, long long Iterations)
+{
+	long double Sum = 0.0L;
+	for (long long i = 0; i < Iterations; i++) {
+		SamplePoint &p = Data.Points[i & (NUM_SAMPLES-1)];
+		Sum += AngRhoRhop(l, p.r1, p.r2, p.r3, p.r23, p.Cos12, p.Cos13, p.Cos23, p.rho, p.rhop);
+	}
+	Data.Sink += Sum;
+}
+
+
+// Omega+l is the longest table in the integration routines.
+void BenchCreateRPowerLUT(BenchData &Data, int l, long long Iterations)
+{
+	for (long long i = 0; i < Iterations; i++) {
+		CreateRPowerLUT(Data.LUT, Data.Points[i & (NUM_SAMPLES-1)].r1, Data.Omega+l);
+		Data.Sink += Data.LUT[Data.Omega+l];
+	}
+}
+
+
+void BenchChangeOfInterval(BenchData &Data, int, long long Iterations)
+{
+	for (long long i = 0; i < Iterations; i++) {
+		SamplePoint &p = Data.Points[i & (NUM_SAMPLES-1)];
+		ChangeOfIntervalNoResize(Data.Abscissas, Data.Changed, fabs(p.r1 - p.r2), p.r1 + p.r2);
+		Data.Sink += Data.Changed[0];
+	}
+}
+
+
+// The innermost loop of VecGaussIntegrationPhi23_PhiLCBar_PhiLSBar_Full: the r23 power table for the next phi23
+//  abscissa and the contribution of that point to every term.
+void BenchAccumulatePowers(BenchData &Data, int, long long Iterations)
+{
+	for (long long i = 0; i < Iterations; i++) {
+		SamplePoint &p = Data.Points[i & (NUM_SAMPLES-1)];
+		CreateRPowerLUT(Data.r23Pow, p.r23, Data.Omega);
+		AccumulatePowers(Data.NumPowers, Data.Powers, Data.r1Pow, Data.r2Pow, Data.r3Pow, Data.r12Pow, Data.r13Pow, Data.r23Pow,
+			1e-3L, p.Cos12, p.Cos13, p.Cos23, p.Sin12, &Data.AccA[0], &Data.AccB[0]);
+	}
+	Data.Sink += Data.AccA[0] + Data.AccB[0];
+}
+
+
+// Finds the number of iterations that takes at least MinTime as Google Benchmark does: the count is increased
+//  from 1 until a run takes a tenth of MinTime, and then it is scaled up from that run's time.
+BenchResult RunBenchmark(Benchmark &b, BenchData &Data, double MinTime)
+{
+	BenchResult Result;
+	long long Iterations = 1;
+	double Time;
+
+	while (1) {
+		Time = omp_get_wtime();
+		b.Func(Data, b.Arg, Iterations);
+		Time = omp_get_wtime() - Time;
+		if (Time >= MinTime)
+			break;
+		if (Time < MinTime / 10.0)
+			Iterations *= 10;
+		else
+			Iterations = (long long)(Iterations * 1.4 * MinTime / Time) + 1;
+	}
+
+	Result.Name = b.Name;
+	Result.Iterations = Iterations;
+	Result.NsPerCall = Time / Iterations * 1e9;
+	Result.PointsPerSec = Iterations * b.PointsPerCall / Time;
+	return Result;
+}
+
+
+void AddBenchmark(vector <Benchmark> &Benchmarks, string Name, BenchFunc Func, int Arg, double PointsPerCall)
+{
+	Benchmark b;
+	b.Name = Name;  b.Func = Func;  b.Arg = Arg;  b.PointsPerCall = PointsPerCall;
+	Benchmarks.push_back(b);
+}
+
+
+// One benchmark per line, so that ReadBaseline does not need a full JSON parser.
+bool WriteBaseline(string FileName, int Omega, vector <BenchResult> &Results)
+{
+	ofstream Out(FileName.c_str());
+	if (!Out.is_open())
+		return false;
+	Out << setprecision(8);
+	Out << "{" << endl;
+	Out << "  \"omega\": " << Omega << "," << endl;
+	Out << "  \"benchmarks\": [" << endl;
+	for (unsigned int i = 0; i < Results.size(); i++) {
+		Out << "    {\"name\": \"" << Results[i].Name << "\", \"iterations\": " << Results[i].Iterations << ", \"ns_per_call\": " << Results[i].NsPerCall
+			<< ", \"points_per_second\": " << Results[i].PointsPerSec << "}" << (i+1 < Results.size() ? "," : "") << endl;
+	}
+	Out << "  ]" << endl;
+	Out << "}" << endl;
+	return true;
+}
+
+
+// Reads the time per call of every benchmark in a file from WriteBaseline.
+bool ReadBaseline(string FileName, map <string, double> &Baseline)
+{
+	ifstream In(FileName.c_str());
+	string Line;
+	if (!In.is_open())
+		return false;
+	while (getline(In, Line)) {
+		size_t NamePos = Line.find("\"name\": \""), TimePos = Line.find("\"ns_per_call\": ");
+		if (NamePos == string::npos || TimePos == string::npos)
+			continue;
+		NamePos += 9;
+		string Name = Line.substr(NamePos, Line.find('"', NamePos) - NamePos);
+		Baseline[Name] = atof(Line.c_str() + TimePos + 15);
+	}
+	return true;
+}
+
+
+int main(int argc, char *argv[])
+{
+	int Omega = 6;
+	double MinTime = 0.2, Threshold = 10.0;
+	string Filter, OutFile, BaselineFile;
+	vector <Benchmark> Benchmarks;
+	vector <BenchResult> Results;
+	map <string, double> Baseline;
+	BenchData Data;
+	int NumRegressions = 0;
+
+	PI = 3.1415926535897932384626433832795029L;
+
+	for (int i = 1; i < argc; i++) {
+		string Arg = argv[i];
+		size_t Eq = Arg.find('=');
+		string Value = Eq == string::npos ? string() : Arg.substr(Eq+1);
+		if (Arg.find("--omega=") == 0) Omega = atoi(Value.c_str());
+		else if (Arg.find("--filter=") == 0) Filter = Value;
+		else if (Arg.find("--min_time=") == 0) MinTime = atof(Value.c_str());
+		else if (Arg.find("--out=") == 0) OutFile = Value;
+		else if (Arg.find("--baseline=") == 0) BaselineFile = Value;
+		else if (Arg.find("--threshold=") == 0) Threshold = atof(Value.c_str());
+		else {
+			cout << "Unknown option: " << Arg << endl;
+			cout << "Usage: KernelBenchmark [--omega=6] [--filter=name] [--min_time=0.2] [--out=file.json] [--baseline=file.json] [--threshold=10]" << endl;
+			return 1;
+		}
+	}
+	if (!BaselineFile.empty() && !ReadBaseline(BaselineFile, Baseline)) {
+		cout << "Could not open the baseline file " << BaselineFile << endl;
+		return 1;
+	}
+
+	// The same values as Integration Benchmark.cpp
+	Data.kappa = 0.4L;
+	Data.mu = 0.7L;
+	Data.shpower = 7;
+	Data.Omega = Omega;
+	Data.Sink = 0.0L;
+	GenSamplePoints(Data.Points);
+
+	// The power table is the same as the one that the qi > 0 integrations get for l = 0.
+	int NumShortTerms = CalcPowerTableSize(Omega);
+	Data.NumPowers = CalcPowerTableSizeQiGt0(Omega, 0, 0, NumShortTerms);
+	Data.Powers.assign(Data.NumPowers*2, rPowers(0.6, 0.5, 0.55));
+	GenOmegaPowerTableQiGt0(Omega, 0, 0, Data.Powers, 0, NumShortTerms-1);
+	Data.AccA.assign(2*Data.NumPowers, 0.0L);
+	Data.AccB.assign(2*Data.NumPowers, 0.0L);
+	Data.LUT.resize(Omega+LMAX_ANG+1);
+	Data.r1Pow.resize(Omega+1);  Data.r2Pow.resize(Omega+1);  Data.r3Pow.resize(Omega+1);
+	Data.r12Pow.resize(Omega+1);  Data.r13Pow.resize(Omega+1);  Data.r23Pow.resize(Omega+1);
+	SamplePoint &p = Data.Points[0];
+	CreateRPowerLUT(Data.r1Pow, p.r1, Omega);  CreateRPowerLUT(Data.r2Pow, p.r2, Omega);  CreateRPowerLUT(Data.r3Pow, p.r3, Omega);
+	CreateRPowerLUT(Data.r12Pow, p.r12, Omega);  CreateRPowerLUT(Data.r13Pow, p.r13, Omega);
+	vector <long double> Weights;
+	GaussLegendre(Data.Abscissas, Weights, NUM_ABSCISSAS);
+	Data.Changed.resize(Data.Abscissas.size());
+
+	for (int l = 0; l <= LMAX_ANG; l++) {
+		AddBenchmark(Benchmarks, "sf_bessel_jl/" + to_string(l), BenchBesselJl, l, 1.0);
+		AddBenchmark(Benchmarks, "sf_bessel_nl/" + to_string(l), BenchBesselNl, l, 1.0);
+	}
+	AddBenchmark(Benchmarks, "fshielding", BenchFShielding, 0, 1.0);
+	AddBenchmark(Benchmarks, "fshielding1", BenchFShielding1, 0, 1.0);
+	AddBenchmark(Benchmarks, "fshielding2", BenchFShielding2, 0, 1.0);
+	for (int l = 0; l <= LMAX_LAPLACIAN; l++)
+		AddBenchmark(Benchmarks, "LaplacianC/" + to_string(l), BenchLaplacianC, l, 1.0);
+	for (int l = 0; l <= LMAX_ANG; l++) {
+		AddBenchmark(Benchmarks, "AngR1Rho/" + to_string(l), BenchAngR1Rho, l, 1.0);
+		AddBenchmark(Benchmarks, "AngR1Rhop/" + to_string(l), BenchAngR1Rhop, l, 1.0);
+		AddBenchmark(Benchmarks, "AngR2Rho/" + to_string(l), BenchAngR2Rho, l, 1.0);
+		AddBenchmark(Benchmarks, "AngR2Rhop/" + to_string(l), BenchAngR2Rhop, l, 1.0);
+		AddBenchmark(Benchmarks, "AngRhoRhop/" + to_string(l), BenchAngRhoRhop, l, 1.0);
+	}
+	AddBenchmark(Benchmarks, "CreateRPowerLUT/Omega+0", BenchCreateRPowerLUT, 0, 1.0);
+	AddBenchmark(Benchmarks, "CreateRPowerLUT/Omega+" + to_string(LMAX_ANG), BenchCreateRPowerLUT, LMAX_ANG, 1.0);
+	AddBenchmark(Benchmarks, "ChangeOfIntervalNoResize/" + to_string(NUM_ABSCISSAS), BenchChangeOfInterval, 0, NUM_ABSCISSAS);
+	AddBenchmark(Benchmarks, "AccumulatePowers/" + to_string(Data.NumPowers) + "x2", BenchAccumulatePowers, 0, 1.0);
+
+	cout << "Omega: " << Omega << " (" << Data.NumPowers << " terms with qi > 0), minimum time per benchmark: " << MinTime << " s" << endl;
+	cout << left << setw(32) << "Benchmark" << right << setw(14) << "ns/call" << setw(16) << "points/s" << setw(14) << "Iterations";
+	if (!Baseline.empty())
+		cout << setw(14) << "Baseline ns" << setw(10) << "Change";
+	cout << endl;
+
+	for (unsigned int i = 0; i < Benchmarks.size(); i++) {
+		if (!Filter.empty() && Benchmarks[i].Name.find(Filter) == string::npos)
+			continue;
+		BenchResult Result = RunBenchmark(Benchmarks[i], Data, MinTime);
+		Results.push_back(Result);
+
+		cout << left << setw(32) << Result.Name << right << fixed << setprecision(2) << setw(14) << Result.NsPerCall
+			<< scientific << setprecision(3) << setw(16) << Result.PointsPerSec << setw(14) << Result.Iterations;
+		if (!Baseline.empty()) {
+			map <string, double>::iterator Base = Baseline.find(Result.Name);
+			if (Base == Baseline.end() || Base->second <= 0.0) {
+				cout << setw(14) << "-";
+			}
+			else {
+				double Change = (Result.NsPerCall / Base->second - 1.0) * 100.0;
+				cout << fixed << setprecision(2) << setw(14) << Base->second << showpos << setw(9) << setprecision(1) << Change << "%" << noshowpos;
+				if (Change > Threshold) {
+					cout << "  slower";
+					NumRegressions++;
+				}
+			}
+		}
+		cout << endl;
+	}
+
+	if (!OutFile.empty()) {
+		if (WriteBaseline(OutFile, Omega, Results))
+			cout << "Results written to " << OutFile << endl;
+		else
+			cout << "Could not write the results to " << OutFile << endl;
+	}
+	if (!Baseline.empty())
+		cout << NumRegressions << " benchmarks are more than " << fixed << setprecision(1) << Threshold << "% slower than the baseline" << endl;
+
+	// Never true, but the compiler does not know that
+	if (Data.Sink == 1.2345L)
+		cout << " ";
+
+	return NumRegressions > 0 ? 1 : 0;
+}
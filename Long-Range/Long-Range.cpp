@@ -7,6 +7,7 @@
 #include <gsl/gsl_sf_bessel.h>
 #include <gsl/gsl_sf_legendre.h>
 #include "Ps-H Scattering.h"
+#include "Run Timing.h"
 
 
 //@TODO: In "Ps-H Scattering.h"
@@ -83,62 +84,86 @@ long double fshielding2(long double rho, long double mu, int n)
 };
 
 
-void GaussIntegrationPhi23_LongLong(int l, int nR1, int nR2Leg, int nR2Lag, int nR3Leg, int nR3Lag, int nR12, int nR13, int nPhi23, double CuspR2, double CuspR3, double kappa, double mu, int shpower, int sf, double &CLC, double &SLC, double &CLS, double &SLS)
+// Derivatives of f_sh, fshielding1 and fshielding2 with respect to mu.  f_sh is s(mu*rho)^n with
+//  s(x) = 1 - exp(-x) * (1 + x/2), so these follow from the derivatives of s with respect to x.
+void fshieldingMu(long double rho, long double mu, int n, long double &dfsh, long double &dfsh1, long double &dfsh2)
+{
+	long double x = mu*rho, ExpX = expl(-x);
+	long double s = 1.0L - ExpX * (1.0L + x / 2.0L);
+	long double s1 = 0.5L * ExpX * (1.0L + x), s2 = -0.5L * x * ExpX, s3 = 0.5L * (x - 1.0L) * ExpX;
+	long double sPow[4] = { 1.0L, 0.0L, 0.0L, 0.0L };  // s^(n-k), or 0 when n-k is negative (it is only multiplied by 0 then)
+
+	for (int k = 1; k <= 3 && k <= n; k++) {
+		sPow[k] = 1.0L;
+		for (int i = 0; i < n-k; i++)
+			sPow[k] *= s;
+	}
+
+	// Derivatives of f_sh with respect to x
+	long double g1 = n * sPow[1] * s1;
+	long double g2 = n * (n-1) * sPow[2] * s1*s1 + n * sPow[1] * s2;
+	long double g3 = n * (n-1) * (n-2) * sPow[3] * s1*s1*s1 + 3.0L * n * (n-1) * sPow[2] * s1*s2 + n * sPow[1] * s3;
+
+	// fshielding1 is mu*g1 and fshielding2 is mu^2*g2.
+	dfsh = rho * g1;
+	dfsh1 = g1 + mu*rho * g2;
+	dfsh2 = 2.0L * mu * g2 + mu*mu * rho * g3;
+	return;
+}
+
+
+// The error estimate for each of CLC, SLC, CLS and SLS is the sum of the magnitudes of the differences between the
+//  embedded and full rules along each dimension.
+void AddLongLongErrors(long double Diff[][4], double &CLCErr, double &SLCErr, double &CLSErr, double &SLSErr)
+{
+	long double Err[4] = { 0.0L, 0.0L, 0.0L, 0.0L };
+	for (int d = 0; d < NUM_EMBEDDED_DIMS; d++) {
+		for (int c = 0; c < 4; c++)
+			Err[c] += fabsl(Diff[d][c]);
+	}
+	CLCErr += Err[0];
+	SLCErr += Err[1];
+	CLSErr += Err[2];
+	SLSErr += Err[3];
+}
+
+
+void GaussIntegrationPhi23_LongLong(int l, int nR1, int nR2Leg, int nR2Lag, int nR3Leg, int nR3Lag, int nR12, int nR13, int nPhi23, double CuspR2, double CuspR3, int CuspRule, int PhiRule, double kappa, double mu, int shpower, int sf, double &CLC, double &SLC, double &CLS, double &SLS, int ErrorEstimate, double &CLCErr, double &SLCErr, double &CLSErr, double &SLSErr)
 {
 	long double r1, r2, r3;
-	vector <long double> LaguerreAbscissasR2, LaguerreWeightsR2, LegendreAbscissasR2, LegendreWeightsR2;
-	vector <long double> LaguerreAbscissasR3, LaguerreWeightsR3, LegendreAbscissasR3, LegendreWeightsR3;
 	vector <long double> LegendreAbscissasR12, LegendreWeightsR12;
 	vector <long double> LegendreAbscissasR13, LegendreWeightsR13;
 	vector <long double> r1Abscissas, r1Weights, r2Abscissas, r3Abscissas, r2Weights, r3Weights;
-	vector <long double> r12Array(nR12), r13Array(nR13);
+	vector <long double> r1Ratios, LegendreRatiosR12, LegendreRatiosR13, r2Ratios, r3Ratios;
+	long double TotalDiff[NUM_EMBEDDED_DIMS][4] = { { 0.0L } };  // Embedded rule minus full rule along each dimension for CLC, SLC, CLS and SLS
+	AngularRule Angles(nPhi23, PhiRule);
+	bool PhiEstimate = (ErrorEstimate && Angles.Nested);  // The coarse angular rule needs the midpoint rule with a multiple of 3 points.
 	int NumR2Points, NumR3Points, Prog = 0;
 	long double SqrtKappa = sqrt(kappa);
 
-	// Create the abscissas and weights for the needed number of points.
-	GaussLaguerre(r1Abscissas, r1Weights, nR1);
-	GaussLegendre(LegendreAbscissasR2, LegendreWeightsR2, nR2Leg);
-	GaussLaguerre(LaguerreAbscissasR2, LaguerreWeightsR2, nR2Lag);
-	GaussLegendre(LegendreAbscissasR3, LegendreWeightsR3, nR3Leg);
-	GaussLaguerre(LaguerreAbscissasR3, LaguerreWeightsR3, nR3Lag);
-	GaussLegendre(LegendreAbscissasR12, LegendreWeightsR12, nR12);
-	GaussLegendre(LegendreAbscissasR13, LegendreWeightsR13, nR13);
+	// Create the abscissas and weights for the needed number of points, along with the embedded rules.
+	LaguerreWithEstimate(r1Abscissas, r1Weights, r1Ratios, nR1, ErrorEstimate);
+	CuspSplitRule r2Rule(nR2Leg, nR2Lag, ErrorEstimate, CuspRule), r3Rule(nR3Leg, nR3Lag, ErrorEstimate, CuspRule);
+	LegendreWithEstimate(LegendreAbscissasR12, LegendreWeightsR12, LegendreRatiosR12, nR12, ErrorEstimate);
+	LegendreWithEstimate(LegendreAbscissasR13, LegendreWeightsR13, LegendreRatiosR13, nR13, ErrorEstimate);
+	vector <long double> r12Array(nR12), r13Array(nR13);
 
 	long double r1SumCLC = 0.0L, r1SumCLS = 0.0L, r1SumSLC = 0.0L, r1SumSLS = 0.0L;
-	#pragma omp parallel for shared(r1SumCLC,r1SumCLS,r1SumSLC,r1SumSLS,r1Abscissas,r1Weights) private(r1,r2,r3,r12Array,r13Array,r2Abscissas,r2Weights,r3Abscissas,r3Weights,NumR2Points,NumR3Points) schedule(guided,1)
+	#pragma omp parallel for shared(r1SumCLC,r1SumCLS,r1SumSLC,r1SumSLS,r1Abscissas,r1Weights,TotalDiff) private(r1,r2,r3,r12Array,r13Array,r2Abscissas,r2Weights,r3Abscissas,r3Weights,r2Ratios,r3Ratios,NumR2Points,NumR3Points) schedule(guided,1)
 	for (int i = 0; i < nR1; i++) {  // r1 integration
+		ThreadTimer Busy;
 		WriteProgress(string("Long-range - long-range"), Prog, i, nR1);
+		long double Diff[NUM_EMBEDDED_DIMS][4] = { { 0.0L } };
+		vector <long double> PhiDist(nPhi23);
 
 		// These are private, so they need to be initialized.
-		r2Abscissas.resize(nR2Leg + nR2Lag);
-		r2Weights.resize(nR2Leg + nR2Lag);
-		r3Abscissas.resize(nR3Leg + nR3Lag);
-		r3Weights.resize(nR3Leg + nR3Lag);
 		r12Array.resize(nR12);
 		r13Array.resize(nR13);
 
 		r1 = r1Abscissas[i];
 
-		// If r1 is large enough, we just do Gauss-Laguerre.
-		if (r1 > CuspR2) {
-			for (int m = 0; m < nR2Lag; m++) {
-				r2Weights[m] = LaguerreWeightsR2[m];
-				r2Abscissas[m] = LaguerreAbscissasR2[m];
-			}
-			NumR2Points = nR2Lag;
-		}
-		// Do Gauss-Legendre for r2 integration over [0,r1] and then Gauss-Laguerre over [r1,inf).
-		else {
-			ChangeOfIntervalNoResize(LegendreAbscissasR2, r2Abscissas, 0.0L, r1);
-			NumR2Points = nR2Leg + nR2Lag;
-			for (int m = 0; m < nR2Leg; m++) {
-				r2Weights[m] = LegendreWeightsR2[m] * exp(-r2Abscissas[m]) * (r1-0.0L)/2.0L;
-			}
-			for (int m = nR2Leg; m < NumR2Points; m++) {
-				r2Abscissas[m] = LaguerreAbscissasR2[m-nR2Leg] + r1;
-				r2Weights[m] = LaguerreWeightsR2[m-nR2Leg] * exp(-r1);
-			}
-		}
+		// Gauss-Laguerre only if r1 is large, or else split the r2 integration at r1 for the cusp.
+		NumR2Points = r2Rule.Build(r1, CuspR2, LONG_RANGE_DECAY, r2Abscissas, r2Weights, r2Ratios);
 
 		long double r2SumCLC = 0.0L, r2SumCLS = 0.0L, r2SumSLC = 0.0L, r2SumSLS = 0.0L;
 		for (int j = 0; j < NumR2Points; j++) {  // r2 integration
@@ -147,26 +172,8 @@ void GaussIntegrationPhi23_LongLong(int l, int nR1, int nR2Leg, int nR2Lag, int
 			long double b12 = fabs(r1+r2);
 			ChangeOfIntervalNoResize(LegendreAbscissasR12, r12Array, a12, b12);
 
-			// Gauss-Laguerre only if r1 is large.
-			if (r1 > CuspR3) {
-				for (int m = 0; m < nR3Lag; m++) {
-					r3Weights[m] = LaguerreWeightsR3[m];
-					r3Abscissas[m] = LaguerreAbscissasR3[m];
-				}
-				NumR3Points = nR3Lag;
-			}
-			// Do Gauss-Legendre for r3 integration over [0,r1] and then Gauss-Laguerre over [r1,inf).
-			else {
-				ChangeOfIntervalNoResize(LegendreAbscissasR3, r3Abscissas, 0.0L, r1);
-				NumR3Points = nR3Leg + nR3Lag;
-				for (int m = 0; m < nR3Leg; m++) {
-					r3Weights[m] = LegendreWeightsR3[m] * exp(-r3Abscissas[m]) * (r1-0.0L)/2.0L;
-				}
-				for (int m = nR3Leg; m < NumR3Points; m++) {
-					r3Abscissas[m] = LaguerreAbscissasR3[m-nR3Leg] + r1;
-					r3Weights[m] = LaguerreWeightsR3[m-nR3Leg] * exp(-r1);
-				}
-			}
+			// Gauss-Laguerre only if r1 is large, or else split the r3 integration at r1 for the cusp.
+			NumR3Points = r3Rule.Build(r1, CuspR3, LONG_RANGE_DECAY, r3Abscissas, r3Weights, r3Ratios);
 
 			long double r3SumCLC = 0.0L, r3SumCLS = 0.0, r3SumSLC = 0.0, r3SumSLS = 0.0;
 			for (int g = 0; g < NumR3Points; g++) {  // r3 integration
@@ -217,9 +224,12 @@ void GaussIntegrationPhi23_LongLong(int l, int nR1, int nR2Leg, int nR2Lag, int
 						long double dTau = r2 * r3 * r12 * r13;
 						
 						long double Phi23SumCLC = 0.0L, Phi23SumCLS = 0.0L, Phi23SumSLC = 0.0L, Phi23SumSLS = 0.0L;
+						long double PhiCoarse[4] = { 0.0L, 0.0L, 0.0L, 0.0L };  // Angles in the coarse midpoint rule for CLC, SLC, CLS and SLS
+						// The distances for every angle are found at once so that this vectorizes.
+						Angles.Distances(r2*r2 + r3*r3 - 2.0L*r2*r3*Cos12*Cos13, 2.0L*r2*r3*Sin12*Sin13, &PhiDist[0]);
 						for (int m = 1; m <= nPhi23; m++) {  // phi_23 integration
-							long double Phi23 = (2.0L*m - 1.0L)*PI/(2.0L*nPhi23);
-							long double r23 = sqrt(r2*r2 + r3*r3 - 2.0L*r2*r3*(Sin12*Sin13*cosl(Phi23) + Cos12*Cos13));
+							long double r23 = PhiDist[m-1];
+							long double dTauPhi = dTau * Angles.Weights[m-1];
 
 							long double Cos23 = (r2*r2 + r3*r3 - r23*r23) / (2.0L*r2*r3);
 							//long double Ang1 = 4.0L*rho*rho + 4.0L*rhop*rhop - r23*r23;
@@ -242,7 +252,7 @@ void GaussIntegrationPhi23_LongLong(int l, int nR1, int nR2Leg, int nR2Lag, int
 							//long double RetSLS = S23 * S23 * PotP;
 							//long double RetSLS = S22 * S23 * PotP * Ang;
 							long double RetSLS = S23 * S22 * Pot * Ang;
-							Phi23SumSLS += sf * ExpR1R2R3 * RetSLS * dTau;
+							Phi23SumSLS += sf * ExpR1R2R3 * RetSLS * dTauPhi;
 
 							// CLS
 							//long double RetCLS = C23 * S22 * Pot * Ang;
@@ -251,17 +261,25 @@ void GaussIntegrationPhi23_LongLong(int l, int nR1, int nR2Leg, int nR2Lag, int
 							//long double RetCLS = C23 * S23 * PotP;
 							//long double RetCLS = C22 * S23 * PotP * Ang;
 							long double RetCLS = C23 * S22 * Pot * Ang;
-							Phi23SumCLS += sf * ExpR1R2R3 * RetCLS * dTau;
+							Phi23SumCLS += sf * ExpR1R2R3 * RetCLS * dTauPhi;
 
 							// SLC
 							long double LCPart1 = C22 * Pot * Ang;
 							long double LCPart2 = SqrtKappa * ExpR12R3 * fshterm;
 							long double RetSLC = sf * S23 * LCPart1 - (S22 + sf * Ang * S23) * LCPart2;
-							Phi23SumSLC += ExpR1R2R3 * RetSLC * dTau;
+							Phi23SumSLC += ExpR1R2R3 * RetSLC * dTauPhi;
 
 							// CLC
 							long double RetCLC = sf * C23 * LCPart1 - (C22 + sf * Ang * C23) * LCPart2;
-							Phi23SumCLC += ExpR1R2R3 * RetCLC * dTau;
+							Phi23SumCLC += ExpR1R2R3 * RetCLC * dTauPhi;
+
+							// Every third angle is also an abscissa of the coarse midpoint rule.
+							if (PhiEstimate && m % 3 == 2) {
+								PhiCoarse[0] += ExpR1R2R3 * RetCLC * dTauPhi;
+								PhiCoarse[1] += ExpR1R2R3 * RetSLC * dTauPhi;
+								PhiCoarse[2] += sf * ExpR1R2R3 * RetCLS * dTauPhi;
+								PhiCoarse[3] += sf * ExpR1R2R3 * RetSLS * dTauPhi;
+							}
 
 							//// SLC
 							//long double fshtermp = fshielding1(rhop, mu, shpower) / rhop * (n2rhop + cosl(kappa*rhop)) - 0.5 * fshielding2(rhop, mu, shpower) * n2rhop;
@@ -282,21 +300,44 @@ void GaussIntegrationPhi23_LongLong(int l, int nR1, int nR2Leg, int nR2Lag, int
 						r13SumSLC += LegendreWeightsR13[p] * Phi23SumSLC / nPhi23 * (b13-a13)/2.0L;
 						r13SumCLS += LegendreWeightsR13[p] * Phi23SumCLS / nPhi23 * (b13-a13)/2.0L;
 						r13SumSLS += LegendreWeightsR13[p] * Phi23SumSLS / nPhi23 * (b13-a13)/2.0L;
+						if (ErrorEstimate) {
+							long double Sums[4] = { Phi23SumCLC, Phi23SumSLC, Phi23SumCLS, Phi23SumSLS };
+							long double W = TempCoeff * LegendreWeightsR12[k] * (b12-a12)/2.0L * LegendreWeightsR13[p] * (b13-a13)/2.0L / nPhi23;
+							for (int c = 0; c < 4; c++) {
+								Diff[4][c] += (LegendreRatiosR13[p] - 1.0L) * W * Sums[c];
+								if (PhiEstimate) Diff[5][c] += W * (3.0L * PhiCoarse[c] - Sums[c]);
+							}
+						}
 					}
 					r12SumCLC += LegendreWeightsR12[k] * r13SumCLC * (b12-a12)/2.0L;
 					r12SumSLC += LegendreWeightsR12[k] * r13SumSLC * (b12-a12)/2.0L;
 					r12SumCLS += LegendreWeightsR12[k] * r13SumCLS * (b12-a12)/2.0L;
 					r12SumSLS += LegendreWeightsR12[k] * r13SumSLS * (b12-a12)/2.0L;
+					if (ErrorEstimate) {
+						long double Sums[4] = { r13SumCLC, r13SumSLC, r13SumCLS, r13SumSLS };
+						for (int c = 0; c < 4; c++)
+							Diff[3][c] += (LegendreRatiosR12[k] - 1.0L) * TempCoeff * LegendreWeightsR12[k] * (b12-a12)/2.0L * Sums[c];
+					}
 				}
 				r3SumCLC += r3Weights[g] * r12SumCLC;
 				r3SumSLC += r3Weights[g] * r12SumSLC;
 				r3SumCLS += r3Weights[g] * r12SumCLS;
 				r3SumSLS += r3Weights[g] * r12SumSLS;
+				if (ErrorEstimate) {
+					long double Sums[4] = { r12SumCLC, r12SumSLC, r12SumCLS, r12SumSLS };
+					for (int c = 0; c < 4; c++)
+						Diff[2][c] += (r3Ratios[g] - 1.0L) * TempCoeff * Sums[c];
+				}
 			}
 			r2SumCLC += r2Weights[j] * r3SumCLC;
 			r2SumSLC += r2Weights[j] * r3SumSLC;
 			r2SumCLS += r2Weights[j] * r3SumCLS;
 			r2SumSLS += r2Weights[j] * r3SumSLS;
+			if (ErrorEstimate) {
+				long double Sums[4] = { r3SumCLC, r3SumSLC, r3SumCLS, r3SumSLS };
+				for (int c = 0; c < 4; c++)
+					Diff[1][c] += (r2Ratios[j] - 1.0L) * r1Weights[i] * r2Weights[j] * Sums[c];
+			}
 		}
 		//@TODO: Do I really need the atomic?
 		//#pragma omp atomic
@@ -304,6 +345,16 @@ void GaussIntegrationPhi23_LongLong(int l, int nR1, int nR2Leg, int nR2Lag, int
 		r1SumSLC += r1Weights[i] * r2SumSLC;
 		r1SumCLS += r1Weights[i] * r2SumCLS;
 		r1SumSLS += r1Weights[i] * r2SumSLS;
+
+		if (ErrorEstimate) {
+			long double Sums[4] = { r2SumCLC, r2SumSLC, r2SumCLS, r2SumSLS };
+			#pragma omp critical(embedded)
+			for (int c = 0; c < 4; c++) {
+				TotalDiff[0][c] += (r1Ratios[i] - 1.0L) * r1Weights[i] * Sums[c];
+				for (int d = 1; d < NUM_EMBEDDED_DIMS; d++)
+					TotalDiff[d][c] += Diff[d][c];
+			}
+		}
 	}
 
 	//@TODO: 4x P-wave?
@@ -317,6 +368,9 @@ void GaussIntegrationPhi23_LongLong(int l, int nR1, int nR2Leg, int nR2Lag, int
 	CLS += r1SumCLS;
 	SLS += r1SumSLS;
 
+	if (ErrorEstimate)
+		AddLongLongErrors(TotalDiff, CLCErr, SLCErr, CLSErr, SLSErr);
+
 	return;
 }
 
@@ -346,6 +400,7 @@ void GaussIntegrationPhi12_LongLong_R23Term(int l, int nR1, int nR2Leg, int nR2L
 	//#pragma omp parallel for shared(r1Sum,r1Abscissas,r1Weights,Powers) private(r1,r2,r3,r13,r23,r2Sum,r3Sum,r23sum,r2Abscissas,r2Weights,r3Abscissas,r3Weights,NumR2Points,NumR3Points)
 	#pragma omp parallel for shared(r1SumCLC,r1SumCLS,r1SumSLC,r1SumSLS,r1Abscissas,r1Weights) private(r1,r2,r3,r13Array,r23Array,r2Abscissas,r2Weights,r3Abscissas,r3Weights,NumR2Points,NumR3Points) schedule(guided,1)
 	for (int i = 0; i < nR1; i++) {  // r1 integration
+		ThreadTimer Busy;
 		WriteProgress(string("Long-range - Long-range r23"), Prog, i, nR1);
 
 		// These are private, so they need to be initialized.
@@ -544,62 +599,42 @@ void GaussIntegrationPhi12_LongLong_R23Term(int l, int nR1, int nR2Leg, int nR2L
 }
 
 
-void GaussIntegrationPhi13_LongLong_R23Term(int l, int nR1, int nR2Leg, int nR2Lag, int nR3Leg, int nR3Lag, int nR12, int nPhi13, int nR23, double CuspR2, double CuspR3, double kappa, double mu, int shpower, int sf, double &CLC, double &SLC, double &CLS, double &SLS)
+void GaussIntegrationPhi13_LongLong_R23Term(int l, int nR1, int nR2Leg, int nR2Lag, int nR3Leg, int nR3Lag, int nR12, int nPhi13, int nR23, double CuspR2, double CuspR3, int CuspRule, int PhiRule, double kappa, double mu, int shpower, int sf, double &CLC, double &SLC, double &CLS, double &SLS, int ErrorEstimate, double &CLCErr, double &SLCErr, double &CLSErr, double &SLSErr)
 {
 	long double r1, r2, r3;
-	vector <long double> LaguerreAbscissasR2, LaguerreWeightsR2, LegendreAbscissasR2, LegendreWeightsR2;
-	vector <long double> LaguerreAbscissasR3, LaguerreWeightsR3, LegendreAbscissasR3, LegendreWeightsR3;
 	vector <long double> LegendreAbscissasR23, LegendreWeightsR23;
 	vector <long double> LegendreAbscissasR12, LegendreWeightsR12;
 	vector <long double> r1Abscissas, r1Weights, r2Abscissas, r3Abscissas, r2Weights, r3Weights;
-	vector <long double> r12Array(nR12), r23Array(nR23);
+	vector <long double> r1Ratios, LegendreRatiosR23, LegendreRatiosR12, r2Ratios, r3Ratios;
+	long double TotalDiff[NUM_EMBEDDED_DIMS][4] = { { 0.0L } };  // Embedded rule minus full rule along each dimension for CLC, SLC, CLS and SLS
+	AngularRule Angles(nPhi13, PhiRule);
+	bool PhiEstimate = (ErrorEstimate && Angles.Nested);  // The coarse angular rule needs the midpoint rule with a multiple of 3 points.
 	int NumR2Points, NumR3Points, Prog = 0;
 	long double SqrtKappa = sqrt(kappa);
 
-	// Create the abscissas and weights for the needed number of points.
-	GaussLaguerre(r1Abscissas, r1Weights, nR1);
-	GaussLegendre(LegendreAbscissasR2, LegendreWeightsR2, nR2Leg);
-	GaussLaguerre(LaguerreAbscissasR2, LaguerreWeightsR2, nR2Lag);
-	GaussLegendre(LegendreAbscissasR3, LegendreWeightsR3, nR3Leg);
-	GaussLaguerre(LaguerreAbscissasR3, LaguerreWeightsR3, nR3Lag);
-	GaussLegendre(LegendreAbscissasR23, LegendreWeightsR23, nR23);
-	GaussLegendre(LegendreAbscissasR12, LegendreWeightsR12, nR12);
+	// Create the abscissas and weights for the needed number of points, along with the embedded rules.
+	LaguerreWithEstimate(r1Abscissas, r1Weights, r1Ratios, nR1, ErrorEstimate);
+	CuspSplitRule r2Rule(nR2Leg, nR2Lag, ErrorEstimate, CuspRule), r3Rule(nR3Leg, nR3Lag, ErrorEstimate, CuspRule);
+	LegendreWithEstimate(LegendreAbscissasR23, LegendreWeightsR23, LegendreRatiosR23, nR23, ErrorEstimate);
+	LegendreWithEstimate(LegendreAbscissasR12, LegendreWeightsR12, LegendreRatiosR12, nR12, ErrorEstimate);
+	vector <long double> r12Array(nR12), r23Array(nR23);
 
 	long double r1SumCLC = 0.0L, r1SumCLS = 0.0L, r1SumSLC = 0.0L, r1SumSLS = 0.0L;
-	#pragma omp parallel for shared(r1SumCLC,r1SumCLS,r1SumSLC,r1SumSLS,r1Abscissas,r1Weights) private(r1,r2,r3,r12Array,r23Array,r2Abscissas,r2Weights,r3Abscissas,r3Weights,NumR2Points,NumR3Points) schedule(guided,1)
+	#pragma omp parallel for shared(r1SumCLC,r1SumCLS,r1SumSLC,r1SumSLS,r1Abscissas,r1Weights,TotalDiff) private(r1,r2,r3,r12Array,r23Array,r2Abscissas,r2Weights,r3Abscissas,r3Weights,r2Ratios,r3Ratios,NumR2Points,NumR3Points) schedule(guided,1)
 	for (int i = 0; i < nR1; i++) {  // r1 integration
+		ThreadTimer Busy;
 		WriteProgress(string("Long-range - Long-range r23"), Prog, i, nR1);
+		long double Diff[NUM_EMBEDDED_DIMS][4] = { { 0.0L } };
+		vector <long double> PhiDist(nPhi13);
 
 		// These are private, so they need to be initialized.
-		r2Abscissas.resize(nR2Leg + nR2Lag);
-		r2Weights.resize(nR2Leg + nR2Lag);
-		r3Abscissas.resize(nR3Leg + nR3Lag);
-		r3Weights.resize(nR3Leg + nR3Lag);
 		r12Array.resize(nR12);
 		r23Array.resize(nR23);
 
 		r1 = r1Abscissas[i];
 
-		// If r1 is large enough, we just do Gauss-Laguerre.
-		if (r1 > CuspR2) {
-			for (int m = 0; m < nR2Lag; m++) {
-				r2Weights[m] = LaguerreWeightsR2[m];
-				r2Abscissas[m] = LaguerreAbscissasR2[m];
-			}
-			NumR2Points = nR2Lag;
-		}
-		// Do Gauss-Legendre for r2 integration over [0,r1] and then Gauss-Laguerre over [r1,inf).
-		else {
-			ChangeOfIntervalNoResize(LegendreAbscissasR2, r2Abscissas, 0.0L, r1);
-			NumR2Points = nR2Leg + nR2Lag;
-			for (int m = 0; m < nR2Leg; m++) {
-				r2Weights[m] = LegendreWeightsR2[m] * exp(-r2Abscissas[m]) * (r1-0.0L)/2.0L;
-			}
-			for (int m = nR2Leg; m < NumR2Points; m++) {
-				r2Abscissas[m] = LaguerreAbscissasR2[m-nR2Leg] + r1;
-				r2Weights[m] = LaguerreWeightsR2[m-nR2Leg] * exp(-r1);
-			}
-		}
+		// Gauss-Laguerre only if r1 is large, or else split the r2 integration at r1 for the cusp.
+		NumR2Points = r2Rule.Build(r1, CuspR2, LONG_RANGE_DECAY, r2Abscissas, r2Weights, r2Ratios);
 
 		long double r2SumCLC = 0.0L, r2SumCLS = 0.0L, r2SumSLC = 0.0L, r2SumSLS = 0.0L;
 		for (int j = 0; j < NumR2Points; j++) {  // r2 integration
@@ -608,26 +643,8 @@ void GaussIntegrationPhi13_LongLong_R23Term(int l, int nR1, int nR2Leg, int nR2L
 			long double b12 = fabs(r1+r2);
 			ChangeOfIntervalNoResize(LegendreAbscissasR12, r12Array, a12, b12);
 
-			// Gauss-Laguerre only if r2 is large.
-			if (r2 > CuspR3) {
-				for (int m = 0; m < nR3Lag; m++) {
-					r3Weights[m] = LaguerreWeightsR3[m];
-					r3Abscissas[m] = LaguerreAbscissasR3[m];
-				}
-				NumR3Points = nR3Lag;
-			}
-			// Do Gauss-Legendre for r3 integration over [0,r2] and then Gauss-Laguerre over [r2,inf).
-			else {
-				ChangeOfIntervalNoResize(LegendreAbscissasR3, r3Abscissas, 0.0L, r2);
-				NumR3Points = nR3Leg + nR3Lag;
-				for (int m = 0; m < nR3Leg; m++) {
-					r3Weights[m] = LegendreWeightsR3[m] * exp(-r3Abscissas[m]) * (r2-0.0L)/2.0L;
-				}
-				for (int m = nR3Leg; m < NumR3Points; m++) {
-					r3Abscissas[m] = LaguerreAbscissasR3[m-nR3Leg] + r2;
-					r3Weights[m] = LaguerreWeightsR3[m-nR3Leg] * exp(-r2);
-				}
-			}
+			// Gauss-Laguerre only if r2 is large, or else split the r3 integration at r2 for the cusp.
+			NumR3Points = r3Rule.Build(r2, CuspR3, LONG_RANGE_DECAY, r3Abscissas, r3Weights, r3Ratios);
 
 			long double r3SumCLC = 0.0L, r3SumCLS = 0.0L, r3SumSLC = 0.0L, r3SumSLS = 0.0L;
 			for (int g = 0; g < NumR3Points; g++) {  // r3 integration
@@ -661,9 +678,12 @@ void GaussIntegrationPhi13_LongLong_R23Term(int l, int nR1, int nR2Leg, int nR2L
 						long double dTau = r1 * r3 * r23 * r12;
 
 						long double Phi13SumCLC = 0.0L, Phi13SumCLS = 0.0L, Phi13SumSLC = 0.0L, Phi13SumSLS = 0.0L;
+						long double PhiCoarse[4] = { 0.0L, 0.0L, 0.0L, 0.0L };  // Angles in the coarse midpoint rule for CLC, SLC, CLS and SLS
+						// The distances for every angle are found at once so that this vectorizes.
+						Angles.Distances(r1*r1 + r3*r3 - 2.0L*r1*r3*Cos12*Cos23, 2.0L*r1*r3*Sin12*Sin23, &PhiDist[0]);
 						for (int m = 1; m <= nPhi13; m++) {  // phi_13 integration
-							long double Phi13 = (2.0L*m - 1.0L)*PI/(2.0L*nPhi13);
-							long double r13 = sqrt(r1*r1 + r3*r3 - 2.0L*r1*r3*(Sin12*Sin23*cosl(Phi13) + Cos12*Cos23));
+							long double r13 = PhiDist[m-1];
+							long double dTauPhi = dTau * Angles.Weights[m-1];
 							long double Cos13 = (r1*r1 + r3*r3 - r13*r13) / (2.0L*r1*r3);
 							long double rhop = 0.5L * sqrt(2.0L*(r1*r1 + r3*r3) - r13*r13);
 							long double j2rhop = sf_bessel_jl(2, kappa*rhop);
@@ -707,7 +727,7 @@ void GaussIntegrationPhi13_LongLong_R23Term(int l, int nR1, int nR2Leg, int nR2L
 							//long double RetSLS = S23 * S23 * PotP;
 							//long double RetSLS = S22 * S23 * PotP * Ang;
 							long double RetSLS = S23 * S22 * Pot * Ang;
-							Phi13SumSLS += sf * ExpR1R2R3 * RetSLS * dTau;
+							Phi13SumSLS += sf * ExpR1R2R3 * RetSLS * dTauPhi;
 
 							// CLS
 							//long double RetCLS = C23 * S22 * Pot * Ang;
@@ -716,41 +736,82 @@ void GaussIntegrationPhi13_LongLong_R23Term(int l, int nR1, int nR2Leg, int nR2L
 							//long double RetCLS = C23 * S23 * PotP;
 							//long double RetCLS = C22 * S23 * PotP * Ang;
 							long double RetCLS = C23 * S22 * Pot * Ang;
-							Phi13SumCLS += sf * ExpR1R2R3 * RetCLS * dTau;
+							Phi13SumCLS += sf * ExpR1R2R3 * RetCLS * dTauPhi;
 
 							// SLC
 							long double LCPart1 = C22 * Pot * Ang;
 							long double RetSLC = sf * S23 * LCPart1;
-							Phi13SumSLC += ExpR1R2R3 * RetSLC * dTau;
+							Phi13SumSLC += ExpR1R2R3 * RetSLC * dTauPhi;
 
 							// CLC
 							long double RetCLC = sf * C23 * LCPart1;
-							Phi13SumCLC += ExpR1R2R3 * RetCLC * dTau;
+							Phi13SumCLC += ExpR1R2R3 * RetCLC * dTauPhi;
+
+							// Every third angle is also an abscissa of the coarse midpoint rule.
+							if (PhiEstimate && m % 3 == 2) {
+								PhiCoarse[0] += ExpR1R2R3 * RetCLC * dTauPhi;
+								PhiCoarse[1] += ExpR1R2R3 * RetSLC * dTauPhi;
+								PhiCoarse[2] += sf * ExpR1R2R3 * RetCLS * dTauPhi;
+								PhiCoarse[3] += sf * ExpR1R2R3 * RetSLS * dTauPhi;
+							}
 						}
 						r12SumCLC += LegendreWeightsR12[p] * Phi13SumCLC / nPhi13 * (b12-a12)/2.0L;
 						r12SumSLC += LegendreWeightsR12[p] * Phi13SumSLC / nPhi13 * (b12-a12)/2.0L;
 						r12SumCLS += LegendreWeightsR12[p] * Phi13SumCLS / nPhi13 * (b12-a12)/2.0L;
 						r12SumSLS += LegendreWeightsR12[p] * Phi13SumSLS / nPhi13 * (b12-a12)/2.0L;
+						if (ErrorEstimate) {
+							long double Sums[4] = { Phi13SumCLC, Phi13SumSLC, Phi13SumCLS, Phi13SumSLS };
+							long double W = TempCoeff * LegendreWeightsR23[k] * (b23-a23)/2.0L * LegendreWeightsR12[p] * (b12-a12)/2.0L / nPhi13;
+							for (int c = 0; c < 4; c++) {
+								Diff[4][c] += (LegendreRatiosR12[p] - 1.0L) * W * Sums[c];
+								if (PhiEstimate) Diff[5][c] += W * (3.0L * PhiCoarse[c] - Sums[c]);
+							}
+						}
 					}
 					r23SumCLC += LegendreWeightsR23[k] * r12SumCLC * (b23-a23)/2.0L;
 					r23SumSLC += LegendreWeightsR23[k] * r12SumSLC * (b23-a23)/2.0L;
 					r23SumCLS += LegendreWeightsR23[k] * r12SumCLS * (b23-a23)/2.0L;
 					r23SumSLS += LegendreWeightsR23[k] * r12SumSLS * (b23-a23)/2.0L;
+					if (ErrorEstimate) {
+						long double Sums[4] = { r12SumCLC, r12SumSLC, r12SumCLS, r12SumSLS };
+						for (int c = 0; c < 4; c++)
+							Diff[3][c] += (LegendreRatiosR23[k] - 1.0L) * TempCoeff * LegendreWeightsR23[k] * (b23-a23)/2.0L * Sums[c];
+					}
 				}
 				r3SumCLC += r3Weights[g] * r23SumCLC;
 				r3SumSLC += r3Weights[g] * r23SumSLC;
 				r3SumCLS += r3Weights[g] * r23SumCLS;
 				r3SumSLS += r3Weights[g] * r23SumSLS;
+				if (ErrorEstimate) {
+					long double Sums[4] = { r23SumCLC, r23SumSLC, r23SumCLS, r23SumSLS };
+					for (int c = 0; c < 4; c++)
+						Diff[2][c] += (r3Ratios[g] - 1.0L) * TempCoeff * Sums[c];
+				}
 			}
 			r2SumCLC += r2Weights[j] * r3SumCLC;
 			r2SumSLC += r2Weights[j] * r3SumSLC;
 			r2SumCLS += r2Weights[j] * r3SumCLS;
 			r2SumSLS += r2Weights[j] * r3SumSLS;
+			if (ErrorEstimate) {
+				long double Sums[4] = { r3SumCLC, r3SumSLC, r3SumCLS, r3SumSLS };
+				for (int c = 0; c < 4; c++)
+					Diff[1][c] += (r2Ratios[j] - 1.0L) * r1Weights[i] * r2Weights[j] * Sums[c];
+			}
 		}
 		r1SumCLC += r1Weights[i] * r2SumCLC;
 		r1SumSLC += r1Weights[i] * r2SumSLC;
 		r1SumCLS += r1Weights[i] * r2SumCLS;
 		r1SumSLS += r1Weights[i] * r2SumSLS;
+
+		if (ErrorEstimate) {
+			long double Sums[4] = { r2SumCLC, r2SumSLC, r2SumCLS, r2SumSLS };
+			#pragma omp critical(embedded)
+			for (int c = 0; c < 4; c++) {
+				TotalDiff[0][c] += (r1Ratios[i] - 1.0L) * r1Weights[i] * Sums[c];
+				for (int d = 1; d < NUM_EMBEDDED_DIMS; d++)
+					TotalDiff[d][c] += Diff[d][c];
+			}
+		}
 	}
 
 	//r1SumCLC /= 2.0L;
@@ -763,5 +824,8 @@ void GaussIntegrationPhi13_LongLong_R23Term(int l, int nR1, int nR2Leg, int nR2L
 	CLS += r1SumCLS;
 	SLS += r1SumSLS;
 
+	if (ErrorEstimate)
+		AddLongLongErrors(TotalDiff, CLCErr, SLCErr, CLSErr, SLSErr);
+
 	return;
 }
@@ -0,0 +1,173 @@
+//
+// Matrix Element File.h: Binary container for the long-range matrix elements, written by PsHScattering and read by
+//  Phase in place of the text results file.  The layout is
+//   "PSHMATEL", version, header fields, ARow, B, checksum
+//  with everything little-endian.  Strings and arrays are stored as a 32-bit count followed by the entries.  The
+//  checksum is a 64-bit FNV-1a hash of all of the bytes before it.
+//
+
+#ifndef MATRIX_ELEMENT_FILE_H
+#define MATRIX_ELEMENT_FILE_H
+
+#include <vector>
+#include <string>
+#include <fstream>
+#include <iostream>
+#include <cstring>
+using namespace std;
+
+#define MATRIXELEM_MAGIC "PSHMATEL"
+// Version 2 added Derivatives and QmcErrorEstimate to the end of Quadrature.
+#define MATRIXELEM_VERSION 2
+
+struct MatrixElemData
+{
+	string Problem;  // Same as the first line of the text file, e.g. "P-Wave Singlet Ps-H: 1st formalism"
+	int LValue, IsTriplet, Ordering, Omega, NumSets, ShPower;
+	double Alpha, Beta, Gamma, Kappa, Mu, Lambda1, Lambda2, Lambda3, r2Cusp, r3Cusp;
+	vector <int> Quadrature;  // Integration settings of the run, in the order of QuadratureSettings
+	double SLS, SLC;
+	vector <double> ARow, B;  // Both include the 0 (long-range) entry first
+};
+
+
+inline unsigned long long MatrixElemChecksum(const char *Data, size_t Len)
+{
+	unsigned long long Hash = 14695981039346656037ULL;
+	for (size_t i = 0; i < Len; i++) {
+		Hash ^= (unsigned char)Data[i];
+		Hash *= 1099511628211ULL;
+	}
+	return Hash;
+}
+
+
+inline bool IsLittleEndian(void)
+{
+	int Endian = 1;
+	return *(char*)&Endian == 1;
+}
+
+
+template <class T> inline void AppendRaw(vector <char> &Buf, const T *Value, size_t Count)
+{
+	const char *p = (const char*)Value;
+	Buf.insert(Buf.end(), p, p + Count*sizeof(T));
+}
+
+
+template <class T> inline bool ExtractRaw(const char *&p, const char *End, T *Value, size_t Count)
+{
+	if ((size_t)(End - p) < Count*sizeof(T))
+		return false;
+	memcpy(Value, p, Count*sizeof(T));
+	p += Count*sizeof(T);
+	return true;
+}
+
+
+inline int WriteMatrixElemFile(const char *FileName, MatrixElemData &M)
+{
+	vector <char> Buf;
+	int Version = MATRIXELEM_VERSION, Len;
+	int Ints[6] = { M.LValue, M.IsTriplet, M.Ordering, M.Omega, M.NumSets, M.ShPower };
+	double Doubles[12] = { M.Alpha, M.Beta, M.Gamma, M.Kappa, M.Mu, M.Lambda1, M.Lambda2, M.Lambda3, M.r2Cusp, M.r3Cusp, M.SLS, M.SLC };
+
+	if (!IsLittleEndian()) {
+		cout << "The binary matrix element file is only written on little-endian machines." << endl;
+		return -1;
+	}
+
+	AppendRaw(Buf, MATRIXELEM_MAGIC, 8);
+	AppendRaw(Buf, &Version, 1);
+	Len = M.Problem.size();
+	AppendRaw(Buf, &Len, 1);
+	AppendRaw(Buf, M.Problem.c_str(), Len);
+	AppendRaw(Buf, Ints, 6);
+	AppendRaw(Buf, Doubles, 12);
+	Len = M.Quadrature.size();
+	AppendRaw(Buf, &Len, 1);
+	if (Len > 0) AppendRaw(Buf, &M.Quadrature[0], Len);
+	Len = M.ARow.size();
+	AppendRaw(Buf, &Len, 1);
+	AppendRaw(Buf, &M.ARow[0], Len);
+	AppendRaw(Buf, &M.B[0], Len);
+	unsigned long long Checksum = MatrixElemChecksum(&Buf[0], Buf.size());
+	AppendRaw(Buf, &Checksum, 1);
+
+	ofstream Out(FileName, ios::out | ios::binary);
+	if (Out.fail()) {
+		cout << "Could not open " << FileName << " for writing." << endl;
+		return -1;
+	}
+	Out.write(&Buf[0], Buf.size());
+	Out.close();
+	return Out.fail() ? -1 : 0;
+}
+
+
+inline bool IsMatrixElemFile(const char *Data, size_t Size)
+{
+	return Size >= 8 && memcmp(Data, MATRIXELEM_MAGIC, 8) == 0;
+}
+
+
+// Reads the container from memory (usually a mapped file).  Returns -1 if it is damaged or from a newer version.
+inline int ParseMatrixElemFile(const char *Data, size_t Size, MatrixElemData &M)
+{
+	const char *p = Data + 8, *End = Data + Size - sizeof(unsigned long long);
+	int Version, Len;
+	int Ints[6];
+	double Doubles[12];
+	unsigned long long Checksum;
+
+	if (!IsMatrixElemFile(Data, Size) || Size < 8 + sizeof(int) + sizeof(unsigned long long) || !IsLittleEndian()) {
+		cout << "Not a binary matrix element file." << endl;
+		return -1;
+	}
+	memcpy(&Checksum, End, sizeof(unsigned long long));
+	if (Checksum != MatrixElemChecksum(Data, End - Data)) {
+		cout << "The checksum of the binary matrix element file does not match...exiting." << endl;
+		return -1;
+	}
+
+	ExtractRaw(p, End, &Version, 1);
+	if (Version > MATRIXELEM_VERSION) {
+		cout << "The binary matrix element file is version " << Version << ", but only up to " << MATRIXELEM_VERSION << " can be read." << endl;
+		return -1;
+	}
+
+	bool Good = ExtractRaw(p, End, &Len, 1) && Len >= 0 && (size_t)(End - p) >= (size_t)Len;
+	if (Good) {
+		M.Problem.assign(p, Len);
+		p += Len;
+	}
+	Good = Good && ExtractRaw(p, End, Ints, 6) && ExtractRaw(p, End, Doubles, 12);
+	Good = Good && ExtractRaw(p, End, &Len, 1) && Len >= 0;
+	if (Good) {
+		M.Quadrature.resize(Len);
+		Good = Len == 0 || ExtractRaw(p, End, &M.Quadrature[0], Len);
+	}
+	Good = Good && ExtractRaw(p, End, &Len, 1) && Len > 0;
+	if (Good) {
+		M.ARow.resize(Len);
+		M.B.resize(Len);
+		Good = ExtractRaw(p, End, &M.ARow[0], Len) && ExtractRaw(p, End, &M.B[0], Len);
+	}
+	if (!Good) {
+		cout << "The binary matrix element file is truncated...exiting." << endl;
+		return -1;
+	}
+
+	M.LValue = Ints[0];  M.IsTriplet = Ints[1];  M.Ordering = Ints[2];
+	M.Omega = Ints[3];  M.NumSets = Ints[4];  M.ShPower = Ints[5];
+	M.Alpha = Doubles[0];  M.Beta = Doubles[1];  M.Gamma = Doubles[2];
+	M.Kappa = Doubles[3];  M.Mu = Doubles[4];
+	M.Lambda1 = Doubles[5];  M.Lambda2 = Doubles[6];  M.Lambda3 = Doubles[7];
+	M.r2Cusp = Doubles[8];  M.r3Cusp = Doubles[9];
+	M.SLS = Doubles[10];  M.SLC = Doubles[11];
+
+	return 0;
+}
+
+#endif
@@ -10,146 +10,107 @@
 #endif
 #include <mkl_lapack.h>
 #include <complex>
+#include <algorithm>
 
 typedef complex<double> dcmplx;
 
-// Uses the LAPACK dgesv function to solve our system of linear equations to find the Kohn phaseshift.
-//  An example of the usage of dgesv is available at http://software.intel.com/sites/products/documentation/hpc/mkl/lapack/mkl_lapack_examples/dgesv.htm.
-double Kohn(int NumShortTerms, vector <double> &ARow, vector <double> &B, vector <double> ShortTerms, double SLS)
+// All three Kohn variants solve a system whose bottom-right block is the same symmetric short-range matrix S, bordered
+//  by ARow and/or B.  S is factored once with the Bunch-Kaufman LDL^T (dsytrf), and each method then only needs the
+//  Schur complement of its border, which comes from the 2x2 matrix G = [a b]^T S^-1 [a b] with a = ARow[1..N] and
+//  b = B[1..N].
+int FactorKohn(int NumShortTerms, const vector <double> &ARow, const vector <double> &B, const vector <double> &ShortTerms, KohnFactor &Factor)
 {
-	MKL_INT n, nrhs, lda, ldb, info;
-	vector <double> A((NumShortTerms+1)*(NumShortTerms+1)), X(NumShortTerms+1);
+	MKL_INT n = NumShortTerms, nrhs = 2, lwork = -1, info;
+	double WorkSize;
 
-	// Fill in first row and column of A
-	for (int i = 0; i < NumShortTerms+1; i++) {
-		A[i] = ARow[i];
-		A[i*(NumShortTerms+1)] = ARow[i];
+	Factor.Info = -1;
+	if ((int)ShortTerms.size() != NumShortTerms*NumShortTerms || (int)ARow.size() < NumShortTerms+1 || (int)B.size() < NumShortTerms+1) {
+		cout << "The short-range terms are not available, so the phase shifts cannot be calculated." << endl;
+		return Factor.Info;
 	}
 
-	// Copy short-range terms to bottom-right NumShortTerms x NumShortTerms submatrix of A.
-	for (int i = 0; i < NumShortTerms; i++) {
-		for (int j = 0; j < NumShortTerms; j++) {
-			A[(i+1)*(NumShortTerms+1) + (j+1)] = ShortTerms[i*NumShortTerms + j];
-		}
+	Factor.LDL = ShortTerms;
+	Factor.ipiv.resize(NumShortTerms);
+	dsytrf("U", &n, &Factor.LDL[0], &n, &Factor.ipiv[0], &WorkSize, &lwork, &info);
+	lwork = (MKL_INT)WorkSize;
+	vector <double> Work(max((int)lwork, 1));
+	dsytrf("U", &n, &Factor.LDL[0], &n, &Factor.ipiv[0], &Work[0], &lwork, &info);
+	if (info != 0) {
+		cout << "LAPACK Error: " << info << endl;
+		Factor.Info = info;
+		return info;
 	}
 
-	// Operate on X, as LAPACK overwrites original.
-	X = B;
-
-	vector <int> ipiv(NumShortTerms+1);
-	n = lda = ldb = NumShortTerms+1;
-	nrhs = 1;
-	dgesv(&n, &nrhs, &A[0], &lda, &ipiv[0], &X[0], &ldb, &info);
+	// Columns of Y are S^-1 a and S^-1 b.
+	vector <double> Y(2*NumShortTerms);
+	copy(ARow.begin()+1, ARow.begin()+NumShortTerms+1, Y.begin());
+	copy(B.begin()+1, B.begin()+NumShortTerms+1, Y.begin()+NumShortTerms);
+	dsytrs("U", &n, &nrhs, &Factor.LDL[0], &n, &Factor.ipiv[0], &Y[0], &n, &info);
 	if (info != 0) {
 		cout << "LAPACK Error: " << info << endl;
-		return 0.0;
+		Factor.Info = info;
+		return info;
 	}
 
-	double PsiLS = -X[0] * B[0];
-	for (int i = 1; i < (NumShortTerms+1); i++) {
-		PsiLS += -X[i] * B[i];
+	Factor.Gaa = Factor.Gab = Factor.Gbb = 0.0;
+	for (int i = 0; i < NumShortTerms; i++) {
+		Factor.Gaa += ARow[i+1] * Y[i];
+		Factor.Gab += B[i+1] * Y[i];
+		Factor.Gbb += B[i+1] * Y[NumShortTerms+i];
 	}
-	PsiLS = -(PsiLS + SLS);
 
-	double PhaseShift = atan(PsiLS);
-	return PhaseShift;
+	Factor.Info = 0;
+	return 0;
 }
 
 
-// Uses the LAPACK dgesv function to solve our system of linear equations to find the inverse Kohn (Rubinow) phaseshift.
-double InverseKohn(int NumShortTerms, vector <double> &ARow, vector <double> &B, vector <double> ShortTerms, double SLS)
+// Kohn phaseshift: the border is ARow with right-hand side B.
+double Kohn(const vector <double> &ARow, const vector <double> &B, const KohnFactor &Factor, double SLS)
 {
-	MKL_INT n, nrhs, lda, ldb, info;
-	vector <double> A((NumShortTerms+1)*(NumShortTerms+1)), X(NumShortTerms+1), XCopy(NumShortTerms+1);
-	double CLC = ARow[0];
+	if (Factor.Info != 0)
+		return 0.0;
 
-	// Copy short-range terms to bottom-right NumShortTerms x NumShortTerms submatrix of A.
-	for (int i = 0; i < NumShortTerms; i++) {
-		for (int j = 0; j < NumShortTerms; j++) {
-			A[(i+1)*(NumShortTerms+1) + (j+1)] = ShortTerms[i*NumShortTerms + j];
-		}
-	}
+	// X[0] from the Schur complement, then X.B = X[0] (B[0] - a^T S^-1 b) + b^T S^-1 b
+	double X0 = (B[0] - Factor.Gab) / (ARow[0] - Factor.Gaa);
+	double PsiLS = X0 * (B[0] - Factor.Gab) + Factor.Gbb - SLS;
 
-	// Swap the (phi,LS) terms with (phi,LC) terms
-	X = ARow;
-	XCopy = ARow;
-	X[0] = B[0] + 1.0;  // Use (S,LC) = (C,LS) + 1
-	XCopy[0] = X[0];
+	double PhaseShift = atan(PsiLS);
+	return PhaseShift;
+}
 
-	for (int i = 1; i < NumShortTerms+1; i++) {
-		A[i] = B[i];  // First row of A now has (S,Lphi) terms.
-		A[i*(NumShortTerms+1)] = B[i];  // Put (S,Lphi) = (phi,LS) terms in first column.
-	}
-	A[0] = SLS;
 
-	// LAPACK requires calls by reference, so we have to define all these variables.
-	vector <int> ipiv(NumShortTerms+1);
-	n = lda = ldb = NumShortTerms+1;
-	nrhs = 1;
-	dgesv(&n, &nrhs, &A[0], &lda, &ipiv[0], &X[0], &ldb, &info);
-	if (info != 0) {
-		cout << "LAPACK Error: " << info << endl;
+// Inverse Kohn (Rubinow) phaseshift: the border is B with corner SLS and right-hand side ARow, with
+//  (S,LC) = (C,LS) + 1 in place of ARow[0].
+double InverseKohn(const vector <double> &ARow, const vector <double> &B, const KohnFactor &Factor, double SLS)
+{
+	if (Factor.Info != 0)
 		return 0.0;
-	}
 
-	double PsiLS = -X[0] * XCopy[0];
-	for (int i = 1; i < (NumShortTerms+1); i++) {
-		PsiLS += -X[i] * XCopy[i];
-	}
-	PsiLS = (PsiLS + CLC);
+	double CLC = ARow[0];
+	double SLC = B[0] + 1.0;
+	double X0 = (SLC - Factor.Gab) / (SLS - Factor.Gbb);
+	double PsiLS = -(X0 * (SLC - Factor.Gab) + Factor.Gaa) + CLC;
 
 	double PhaseShift = atan(1.0/PsiLS);
 	return PhaseShift;
 }
 
 
-// Uses the LAPACK dgesv function to solve our system of linear equations to find the complex Kohn phaseshift (T-matrix).
-double ComplexKohnT(int NumShortTerms, vector <double> &ARow, vector <double> &B, vector <double> ShortTerms, double SLS)
+// Complex Kohn phaseshift (T-matrix): the border is c = ARow + i B.  Since S is real, c^T S^-1 c and c^T S^-1 b
+//  come straight from G, and no complex factorization is needed.
+double ComplexKohnT(const vector <double> &ARow, const vector <double> &B, const KohnFactor &Factor, double SLS)
 {
-	MKL_INT n, nrhs, lda, ldb, info;
-	//double *A = new double[(NumShortTerms+1)*(NumShortTerms+1)];
-	vector <dcmplx> A((NumShortTerms+1)*(NumShortTerms+1));
-	vector <dcmplx> X(NumShortTerms+1);
+	if (Factor.Info != 0)
+		return 0.0;
+
 	double CLC = ARow[0], CLS = B[0];
 	double SLC = CLS + 1.0;  // Use (S,LC) = (C,LS) + 1
-
-	// Copy short-range terms to bottom-right NumShortTerms x NumShortTerms submatrix of A.
-	for (int i = 0; i < NumShortTerms; i++) {
-		for (int j = 0; j < NumShortTerms; j++) {
-			A[(i+1)*(NumShortTerms+1) + (j+1)] = ShortTerms[i*NumShortTerms + j];
-		}
-	}
-
-	// Fill in the rest of A
-	A[0] = dcmplx(CLC - SLS, CLS + SLC);
-	for (int i = 1; i < NumShortTerms+1; i++) {
-		A[i] = dcmplx(ARow[i], B[i]);
-		A[i*(NumShortTerms+1)] = A[i];
-	}
-
-	// Fill in B (or X)
-	X[0] = dcmplx(CLS, SLS);
-	for (int i = 1; i < NumShortTerms+1; i++) {
-		X[i] = B[i];
-	}
-	vector <dcmplx> BComp(NumShortTerms+1);
-	BComp = X;
-
-	// LAPACK requires calls by reference, so we have to define all these variables.
-	vector <int> ipiv(NumShortTerms+1);
-	n = lda = ldb = NumShortTerms+1;
-	nrhs = 1;
-	zgesv(&n, &nrhs, (MKL_Complex16*)&A[0], &lda, &ipiv[0], (MKL_Complex16*)&X[0], &ldb, &info);
-	if (info != 0) {
-		cout << "LAPACK Error: " << info << endl;
-		return 0.0;
-	}
+	dcmplx A0(CLC - SLS, CLS + SLC), R0(CLS, SLS);
+	dcmplx cSc(Factor.Gaa - Factor.Gbb, 2.0 * Factor.Gab), cSb(Factor.Gab, Factor.Gbb);
 
 	// Equation () of notes
-	dcmplx PsiLS = -X[0] * BComp[0];
-	for (int i = 1; i < (NumShortTerms+1); i++) {
-		PsiLS += -X[i] * BComp[i];
-	}
+	dcmplx X0 = (R0 - cSb) / (A0 - cSc);
+	dcmplx PsiLS = -(X0 * (R0 - cSb) + Factor.Gbb);
 	dcmplx T = -(PsiLS + SLS);
 	// Go from T matrix element to K.
 	dcmplx K = T / (1.0 + dcmplx(0,1) * T);
@@ -158,4 +119,3 @@ double ComplexKohnT(int NumShortTerms, vector <double> &ARow, vector <double> &B
 	double PhaseShift = atan(K.real());
 	return PhaseShift;
 }
-
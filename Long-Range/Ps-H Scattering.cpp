@@ -9,6 +9,8 @@
 #endif
 
 #include "Ps-H Scattering.h"
+#include "Matrix Element File.h"
+#include "Run Timing.h"
 #include <iostream>
 #include <iomanip>
 #include <string>
@@ -39,6 +41,9 @@ int main(int argc, char *argv[])
 	double **PhiHPhi, **PhiPhi;
 	vector <double> B(1, 0.0), ARow(1, 0.0), ShortTerms;
 	double SLS = 0.0, SLC = 0.0;
+	vector <double> BErr(1, 0.0), ARowErr(1, 0.0);
+	vector <vector <double> > BDeriv, ARowDeriv;  // Indexed by DERIV_MU, DERIV_ALPHA, etc.
+	double SLSErr = 0.0, SLCErr = 0.0;
 	QuadPoints q;
 	int sf, l;
 	double r2Cusp, r3Cusp;
@@ -46,15 +51,13 @@ int main(int argc, char *argv[])
 	ifstream ParameterFile, FileShortRange;
 	ofstream OutFile;
 	//int NodeStart, NodeEnd;
-	time_t TimeStart, TimeEnd;
+	RunTimer &Timer = GetRunTimer();  // Starts timing the whole run
 #ifdef USE_MPI
 	char ProcessorName[MPI_MAX_PROCESSOR_NAME];
 	MPI_Status MpiStatus;
 	int MpiError, ProcNameLen;
 #endif
 
-	//@TODO: Will MPI time be different?
-	TimeStart = time(NULL);
 	//omp_set_num_threads(1);
 
 	// Initialize global constants.
@@ -72,6 +75,7 @@ int main(int argc, char *argv[])
 	// MPI initialization
 	//@TODO: Check MpiError.
 #ifdef USE_MPI
+	Timer.Begin(PHASE_MPI_SETUP);
 	MpiError = MPI_Init(&argc, &argv);  // All MPI programs start with MPI_Init; all 'N' processes exist thereafter.
 	MpiError = MPI_Comm_size(MPI_COMM_WORLD, &TotalNodes);  // Find out how big the SPMD world is
 	MpiError = MPI_Comm_rank(MPI_COMM_WORLD, &Node);  // and what this process's rank is.
@@ -106,11 +110,13 @@ int main(int argc, char *argv[])
 		MpiError = MPI_Send(&ThreadStrLen, 1, MPI_INT, 0, 0, MPI_COMM_WORLD);
 		MpiError = MPI_Send((void*)ThreadString, ThreadStrLen, MPI_CHAR, 0, 0, MPI_COMM_WORLD);
 	}
+	Timer.End();
 #else
 	Node = 0;
 #endif
 
 	if (Node == 0) {
+		Timer.Begin(PHASE_PARAMS);
 		ParameterFile.open(argv[2]);
 		OutFile.open(argv[4]);
 		if (!ParameterFile.is_open()) {
@@ -177,9 +183,44 @@ int main(int argc, char *argv[])
 		cout << "Short-long 2/r23 with qi = 0:  " << q.ShortLongr23_r1 << " " << q.ShortLongr23_r2Leg << " " << q.ShortLongr23_r2Lag << " " << q.ShortLongr23_r3Leg << " " << q.ShortLongr23_r3Lag << " " << q.ShortLongr23_r12 << " " << q.ShortLongr23_phi13 << " " << q.ShortLongr23_r23 << endl;
 		cout << "Short-long (full) with qi > 0: " << q.ShortLongQiGt0_r1 << " " << q.ShortLongQiGt0_r2Leg << " " << q.ShortLongQiGt0_r2Lag << " " << q.ShortLongQiGt0_r3Leg << " " << q.ShortLongQiGt0_r3Lag << " " << q.ShortLongQiGt0_r12 << " " << q.ShortLongQiGt0_r13 << " " << q.ShortLongQiGt0_phi23 << endl;
 		cout << endl;
+		// Cusp thresholds of 0 are chosen automatically.  The long-long integrations use the same thresholds, and
+		//  their integrands only decay like exp(-LONG_RANGE_DECAY * r), so the exponent is capped at that.  Otherwise a
+		//  large beta or gamma would put the threshold where the long-long part beyond the cusp still matters.
+		if (r2Cusp <= 0.0)
+			r2Cusp = AutoCuspThreshold(min(LONG_RANGE_DECAY, Beta + Lambda2), Omega + l + 2);
+		if (r3Cusp <= 0.0)
+			r3Cusp = AutoCuspThreshold(min(LONG_RANGE_DECAY, Gamma + Lambda3), Omega + 2);
 		cout << "Cusp parameters" << endl;
 		cout << r2Cusp << " " << r3Cusp << endl;
+		if (q.CuspRule == CUSP_DE)
+			cout << "Tanh-sinh rules are used below the cusps." << endl;
+		if (q.PhiRule == PHI_GAUSS)
+			cout << "Gauss-Legendre rules in sqrt(phi/pi) are used for the phi integrations." << endl;
 		cout << endl;
+		if (q.Engine == ENGINE_QMC) {
+			cout << "Short-long terms use scrambled Sobol QMC: " << q.QmcPoints << " points, " << q.QmcShifts << " randomizations" << endl;
+			cout << "The short-long quadrature points above are not used." << endl << endl;
+		}
+		else if (q.Engine == ENGINE_SPARSE) {
+			cout << "Short-long terms use a level " << q.SparseLevel << " Smolyak sparse grid: " << SparseGridSize(q.SparseLevel) << " points" << endl;
+			cout << "The short-long quadrature points above are not used." << endl << endl;
+		}
+		if (q.ErrorEstimate) {
+			cout << "Calculating embedded error estimates" << endl;
+			if (q.PhiRule != PHI_MIDPOINT)
+				cout << "Angular error estimates are skipped, since they need the midpoint rule in phi." << endl;
+			else if (q.LongLong_phi23 % 3 != 0 || q.LongLongr23_phi12 % 3 != 0 || q.ShortLong_phi23 % 3 != 0 || q.ShortLongr23_phi13 % 3 != 0 || q.ShortLongQiGt0_phi23 % 3 != 0)
+				cout << "Angular error estimates are skipped for any phi integration that does not use a multiple of 3 points." << endl;
+			cout << endl;
+		}
+		if (q.Derivatives) {
+			if (q.Engine != ENGINE_GAUSS) {
+				cout << "Derivatives need the Gauss product rules for the short-long terms and are skipped." << endl << endl;
+				q.Derivatives = 0;
+			}
+			else
+				cout << "Calculating derivatives of the short-long terms with respect to mu, alpha, beta and gamma" << endl << endl;
+		}
 
 		if (NumShortTerms > 0) {
 			// Allocate memory for the overlap matrix and point PhiPhiP to rows of PhiPhi so we
@@ -208,10 +249,12 @@ int main(int argc, char *argv[])
 			//@TODO: Remove next line.
 			//memset(ShortTerms, 0, NumShortTerms*NumShortTerms*4*sizeof(double));  // Initialize to all 0.
 		}
+		Timer.End();
 	}
 
 	//@TODO: Check results of MpiError.
 #ifdef USE_MPI
+	Timer.Begin(PHASE_MPI_SETUP);
 	MpiError = MPI_Bcast(&Omega, 1, MPI_INT, 0, MPI_COMM_WORLD);
 	MpiError = MPI_Bcast(&NumShortTerms, 1, MPI_INT, 0, MPI_COMM_WORLD);
 	MpiError = MPI_Bcast(&Ordering, 1, MPI_INT, 0, MPI_COMM_WORLD);
@@ -231,11 +274,14 @@ int main(int argc, char *argv[])
 	MpiError = MPI_Bcast(&l, 1, MPI_INT, 0, MPI_COMM_WORLD);
 	MpiError = MPI_Bcast(&ShPower, 1, MPI_INT, 0, MPI_COMM_WORLD);
 	MpiError = MPI_Bcast(&q, sizeof(q), MPI_UNSIGNED_CHAR, 0, MPI_COMM_WORLD);
+	Timer.End();
 #endif
 
 
 	ARow.resize(NumShortTerms*2+1);
 	B.resize(NumShortTerms*2+1);
+	ARowErr.resize(NumShortTerms*2+1, 0.0);
+	BErr.resize(NumShortTerms*2+1, 0.0);
 	//@TODO: Remove next line.
 	//memset(ARow, 0, (NumShortTerms+1)*sizeof(double));  // Initialize to all 0.
 	//memset(B, 0, (NumShortTerms+1)*sizeof(double));  // Initialize to all 0.
@@ -245,11 +291,16 @@ int main(int argc, char *argv[])
 	vector <vector <rPowers> > PowerTableQi0Array(TotalNodes), PowerTableQiGt0Array(TotalNodes);
 	vector <double> AResultsQi0, BResultsQi0, AResultsQiGt0, BResultsQiGt0;
 	vector <double> AResultsQi0Final, BResultsQi0Final, AResultsQiGt0Final, BResultsQiGt0Final;
+	vector <double> AErrorsQi0, BErrorsQi0, AErrorsQiGt0, BErrorsQiGt0;
+	vector <double> AErrorsQi0Final, BErrorsQi0Final, AErrorsQiGt0Final, BErrorsQiGt0Final;
+	vector <double> ADerivsQi0, BDerivsQi0, ADerivsQiGt0, BDerivsQiGt0;  // NUM_DERIVS blocks laid out like the results
+	vector <double> ADerivsQi0Final, BDerivsQi0Final, ADerivsQiGt0Final, BDerivsQiGt0Final;
 	int NumTerms, NumTermsQi0, NumTermsQiGt0;
 
 	NumTerms = CalcPowerTableSize(Omega);
 
 	if (Node == 0) {
+		Timer.Begin(PHASE_TABLES);
 		NumTermsQi0 = CalcPowerTableSizeQi0(Omega, Ordering, 0, NumShortTerms);
 		NumTermsQiGt0 = CalcPowerTableSizeQiGt0(Omega, Ordering, 0, NumShortTerms);
 
@@ -264,10 +315,28 @@ int main(int argc, char *argv[])
 		BResultsQi0Final.resize(NumTermsQi0*2, 0.0);
 		BResultsQiGt0Final.resize(NumTermsQiGt0*2, 0.0);
 
+		AErrorsQi0.resize(NumTermsQi0*2, 0.0);
+		AErrorsQiGt0.resize(NumTermsQiGt0*2, 0.0);
+		BErrorsQi0.resize(NumTermsQi0*2, 0.0);
+		BErrorsQiGt0.resize(NumTermsQiGt0*2, 0.0);
+
+		AErrorsQi0Final.resize(NumTermsQi0*2, 0.0);
+		AErrorsQiGt0Final.resize(NumTermsQiGt0*2, 0.0);
+		BErrorsQi0Final.resize(NumTermsQi0*2, 0.0);
+		BErrorsQiGt0Final.resize(NumTermsQiGt0*2, 0.0);
+
+		if (q.Derivatives) {
+			ADerivsQi0Final.resize(NUM_DERIVS*NumTermsQi0*2, 0.0);
+			ADerivsQiGt0Final.resize(NUM_DERIVS*NumTermsQiGt0*2, 0.0);
+			BDerivsQi0Final.resize(NUM_DERIVS*NumTermsQi0*2, 0.0);
+			BDerivsQiGt0Final.resize(NUM_DERIVS*NumTermsQiGt0*2, 0.0);
+		}
+
 		PowerTableQi0.resize(NumTermsQi0*2, rPowers(Alpha, Beta, Gamma));
 		PowerTableQiGt0.resize(NumTermsQiGt0*2, rPowers(Alpha, Beta, Gamma));
 		GenOmegaPowerTableQi0(Omega, l, Ordering, PowerTableQi0, 0, NumShortTerms-1);
 		GenOmegaPowerTableQiGt0(Omega, l, Ordering, PowerTableQiGt0, 0, NumShortTerms-1);
+		Timer.End();
 	}
 
 
@@ -275,6 +344,7 @@ int main(int argc, char *argv[])
 	double NumTermsQi0Proc, NumTermsQiGt0Proc;
 	vector <int> NumTermsQi0Array(TotalNodes), NumTermsQiGt0Array(TotalNodes);
 
+	Timer.Begin(PHASE_MPI_SETUP);
 	MpiError = MPI_Barrier(MPI_COMM_WORLD);
 	// Tell all processes what terms they should be evaluating.
 	if (Node == 0) {
@@ -369,6 +439,10 @@ int main(int argc, char *argv[])
 		AResultsQiGt0.resize(NumTermsQiGt0*2);
 		BResultsQi0.resize(NumTermsQi0*2);
 		BResultsQiGt0.resize(NumTermsQiGt0*2);
+		AErrorsQi0.resize(NumTermsQi0*2, 0.0);
+		AErrorsQiGt0.resize(NumTermsQiGt0*2, 0.0);
+		BErrorsQi0.resize(NumTermsQi0*2, 0.0);
+		BErrorsQiGt0.resize(NumTermsQiGt0*2, 0.0);
 
 		MpiError = MPI_Recv(&PowerTableQi0[0], sizeof(rPowers)*NumTermsQi0, MPI_INT, 0, 0, MPI_COMM_WORLD, &MpiStatus);
 		MpiError = MPI_Recv(&PowerTableQiGt0[0], sizeof(rPowers)*NumTermsQiGt0, MPI_INT, 0, 0, MPI_COMM_WORLD, &MpiStatus);
@@ -399,6 +473,7 @@ int main(int argc, char *argv[])
 	}
 	//cout << "Node " << Node << ": " << NodeStart << " " << NodeEnd << endl;
 	MpiError = MPI_Barrier(MPI_COMM_WORLD);
+	Timer.End();
 #endif
 //#ifdef USE_MPI
 //	MpiError = MPI_Barrier(MPI_COMM_WORLD);
@@ -429,14 +504,24 @@ int main(int argc, char *argv[])
 //	NodeEnd = NumTermsProc * (Node+1) - 1;
 //#endif//USE_MPI
 
+	// Each node only keeps the derivatives for its own terms, so these are sized after the terms are split up.
+	if (q.Derivatives) {
+		ADerivsQi0.resize(NUM_DERIVS*NumTermsQi0*2, 0.0);
+		ADerivsQiGt0.resize(NUM_DERIVS*NumTermsQiGt0*2, 0.0);
+		BDerivsQi0.resize(NUM_DERIVS*NumTermsQi0*2, 0.0);
+		BDerivsQiGt0.resize(NUM_DERIVS*NumTermsQiGt0*2, 0.0);
+	}
+
 	//TimeStart = time(NULL);
 	//CalcARowAndBVector(Node, NumTerms, Omega, PowerTable, AResults, ARow, BResults, B, SLS, q, r2Cusp, r3Cusp, Alpha, Beta, Gamma, Kappa, Mu, sf);
-	CalcARowAndBVector(Node, NumTermsQi0, NumTermsQiGt0, Omega, PowerTableQi0, PowerTableQiGt0, AResultsQi0, AResultsQiGt0, ARow, BResultsQi0, BResultsQiGt0, B, SLS, SLC, l, q, r2Cusp, r3Cusp, Alpha, Beta, Gamma, Kappa, Mu, Lambda1, Lambda2, Lambda3, ShPower, sf);
+	CalcARowAndBVector(Node, NumTermsQi0, NumTermsQiGt0, Omega, PowerTableQi0, PowerTableQiGt0, AResultsQi0, AResultsQiGt0, ARow, BResultsQi0, BResultsQiGt0, B, SLS, SLC, l, q, r2Cusp, r3Cusp, Alpha, Beta, Gamma, Kappa, Mu, Lambda1, Lambda2, Lambda3, ShPower, sf,
+		AErrorsQi0, AErrorsQiGt0, ARowErr, BErrorsQi0, BErrorsQiGt0, BErr, SLSErr, SLCErr, ADerivsQi0, ADerivsQiGt0, BDerivsQi0, BDerivsQiGt0);
 	//TimeEnd = time(NULL);
 	//cout << "Time elapsed: " << difftime(TimeEnd, TimeStart) << endl;
 	//OutFile << "Time elapsed: " << difftime(TimeEnd, TimeStart) << endl;
 	
 
+	Timer.Begin(PHASE_GATHER);
 #ifdef USE_MPI
 	if (Node == 0) {
 		//@TODO: Temporary
@@ -455,6 +540,37 @@ int main(int argc, char *argv[])
 			BResultsQiGt0Final[i] = BResultsQiGt0[i];
 			BResultsQiGt0Final[NumTermsQiGt0Temp+i] = BResultsQiGt0[NumTermsQiGt0+i];
 		}
+		if (q.ErrorEstimate || q.QmcErrorEstimate) {
+			for (int i = 0; i < NumTermsQi0; i++) {
+				AErrorsQi0Final[i] = AErrorsQi0[i];
+				AErrorsQi0Final[NumTermsQi0Temp+i] = AErrorsQi0[NumTermsQi0+i];
+				BErrorsQi0Final[i] = BErrorsQi0[i];
+				BErrorsQi0Final[NumTermsQi0Temp+i] = BErrorsQi0[NumTermsQi0+i];
+			}
+			for (int i = 0; i < NumTermsQiGt0; i++) {
+				AErrorsQiGt0Final[i] = AErrorsQiGt0[i];
+				AErrorsQiGt0Final[NumTermsQiGt0Temp+i] = AErrorsQiGt0[NumTermsQiGt0+i];
+				BErrorsQiGt0Final[i] = BErrorsQiGt0[i];
+				BErrorsQiGt0Final[NumTermsQiGt0Temp+i] = BErrorsQiGt0[NumTermsQiGt0+i];
+			}
+		}
+		if (q.Derivatives) {
+			for (int d = 0; d < NUM_DERIVS; d++) {
+				int Qi0Final = d*NumTermsQi0Temp*2, Qi0 = d*NumTermsQi0*2, QiGt0Final = d*NumTermsQiGt0Temp*2, QiGt0 = d*NumTermsQiGt0*2;
+				for (int i = 0; i < NumTermsQi0; i++) {
+					ADerivsQi0Final[Qi0Final+i] = ADerivsQi0[Qi0+i];
+					ADerivsQi0Final[Qi0Final+NumTermsQi0Temp+i] = ADerivsQi0[Qi0+NumTermsQi0+i];
+					BDerivsQi0Final[Qi0Final+i] = BDerivsQi0[Qi0+i];
+					BDerivsQi0Final[Qi0Final+NumTermsQi0Temp+i] = BDerivsQi0[Qi0+NumTermsQi0+i];
+				}
+				for (int i = 0; i < NumTermsQiGt0; i++) {
+					ADerivsQiGt0Final[QiGt0Final+i] = ADerivsQiGt0[QiGt0+i];
+					ADerivsQiGt0Final[QiGt0Final+NumTermsQiGt0Temp+i] = ADerivsQiGt0[QiGt0+NumTermsQiGt0+i];
+					BDerivsQiGt0Final[QiGt0Final+i] = BDerivsQiGt0[QiGt0+i];
+					BDerivsQiGt0Final[QiGt0Final+NumTermsQiGt0Temp+i] = BDerivsQiGt0[QiGt0+NumTermsQiGt0+i];
+				}
+			}
+		}
 
 		cout << " Node " << Node << " (" << ProcessorName << ") finished computation at " << ShowTime() << endl;
 		// ResultsQi0 and ResultsQiGt0 already have process 0's results.
@@ -472,6 +588,31 @@ int main(int argc, char *argv[])
 			MpiError = MPI_Recv(&BResultsQi0Final[NumTermsQi0Temp+nQi0], NumTermsQi0Array[i], MPI_DOUBLE, i, 0, MPI_COMM_WORLD, &MpiStatus);
 			MpiError = MPI_Recv(&AResultsQiGt0Final[NumTermsQiGt0Temp+nQiGt0], NumTermsQiGt0Array[i], MPI_DOUBLE, i, 0, MPI_COMM_WORLD, &MpiStatus);
 			MpiError = MPI_Recv(&BResultsQiGt0Final[NumTermsQiGt0Temp+nQiGt0], NumTermsQiGt0Array[i], MPI_DOUBLE, i, 0, MPI_COMM_WORLD, &MpiStatus);
+			// The error estimates follow in the same order.
+			if (q.ErrorEstimate || q.QmcErrorEstimate) {
+				MpiError = MPI_Recv(&AErrorsQi0Final[nQi0], NumTermsQi0Array[i], MPI_DOUBLE, i, 0, MPI_COMM_WORLD, &MpiStatus);
+				MpiError = MPI_Recv(&BErrorsQi0Final[nQi0], NumTermsQi0Array[i], MPI_DOUBLE, i, 0, MPI_COMM_WORLD, &MpiStatus);
+				MpiError = MPI_Recv(&AErrorsQiGt0Final[nQiGt0], NumTermsQiGt0Array[i], MPI_DOUBLE, i, 0, MPI_COMM_WORLD, &MpiStatus);
+				MpiError = MPI_Recv(&BErrorsQiGt0Final[nQiGt0], NumTermsQiGt0Array[i], MPI_DOUBLE, i, 0, MPI_COMM_WORLD, &MpiStatus);
+				MpiError = MPI_Recv(&AErrorsQi0Final[NumTermsQi0Temp+nQi0], NumTermsQi0Array[i], MPI_DOUBLE, i, 0, MPI_COMM_WORLD, &MpiStatus);
+				MpiError = MPI_Recv(&BErrorsQi0Final[NumTermsQi0Temp+nQi0], NumTermsQi0Array[i], MPI_DOUBLE, i, 0, MPI_COMM_WORLD, &MpiStatus);
+				MpiError = MPI_Recv(&AErrorsQiGt0Final[NumTermsQiGt0Temp+nQiGt0], NumTermsQiGt0Array[i], MPI_DOUBLE, i, 0, MPI_COMM_WORLD, &MpiStatus);
+				MpiError = MPI_Recv(&BErrorsQiGt0Final[NumTermsQiGt0Temp+nQiGt0], NumTermsQiGt0Array[i], MPI_DOUBLE, i, 0, MPI_COMM_WORLD, &MpiStatus);
+			}
+			// And then the derivatives, one block at a time.
+			if (q.Derivatives) {
+				for (int d = 0; d < NUM_DERIVS; d++) {
+					int Qi0Final = d*NumTermsQi0Temp*2 + nQi0, QiGt0Final = d*NumTermsQiGt0Temp*2 + nQiGt0;
+					MpiError = MPI_Recv(&ADerivsQi0Final[Qi0Final], NumTermsQi0Array[i], MPI_DOUBLE, i, 0, MPI_COMM_WORLD, &MpiStatus);
+					MpiError = MPI_Recv(&BDerivsQi0Final[Qi0Final], NumTermsQi0Array[i], MPI_DOUBLE, i, 0, MPI_COMM_WORLD, &MpiStatus);
+					MpiError = MPI_Recv(&ADerivsQiGt0Final[QiGt0Final], NumTermsQiGt0Array[i], MPI_DOUBLE, i, 0, MPI_COMM_WORLD, &MpiStatus);
+					MpiError = MPI_Recv(&BDerivsQiGt0Final[QiGt0Final], NumTermsQiGt0Array[i], MPI_DOUBLE, i, 0, MPI_COMM_WORLD, &MpiStatus);
+					MpiError = MPI_Recv(&ADerivsQi0Final[NumTermsQi0Temp+Qi0Final], NumTermsQi0Array[i], MPI_DOUBLE, i, 0, MPI_COMM_WORLD, &MpiStatus);
+					MpiError = MPI_Recv(&BDerivsQi0Final[NumTermsQi0Temp+Qi0Final], NumTermsQi0Array[i], MPI_DOUBLE, i, 0, MPI_COMM_WORLD, &MpiStatus);
+					MpiError = MPI_Recv(&ADerivsQiGt0Final[NumTermsQiGt0Temp+QiGt0Final], NumTermsQiGt0Array[i], MPI_DOUBLE, i, 0, MPI_COMM_WORLD, &MpiStatus);
+					MpiError = MPI_Recv(&BDerivsQiGt0Final[NumTermsQiGt0Temp+QiGt0Final], NumTermsQiGt0Array[i], MPI_DOUBLE, i, 0, MPI_COMM_WORLD, &MpiStatus);
+				}
+			}
 		}
 	}
 	else {
@@ -486,13 +627,47 @@ int main(int argc, char *argv[])
 		MpiError = MPI_Send(&BResultsQi0[NumTermsQi0], NumTermsQi0, MPI_DOUBLE, 0, 0, MPI_COMM_WORLD);
 		MpiError = MPI_Send(&AResultsQiGt0[NumTermsQiGt0], NumTermsQiGt0, MPI_DOUBLE, 0, 0, MPI_COMM_WORLD);
 		MpiError = MPI_Send(&BResultsQiGt0[NumTermsQiGt0], NumTermsQiGt0, MPI_DOUBLE, 0, 0, MPI_COMM_WORLD);
+		// The error estimates follow in the same order.
+		if (q.ErrorEstimate || q.QmcErrorEstimate) {
+			MpiError = MPI_Send(&AErrorsQi0[0], NumTermsQi0, MPI_DOUBLE, 0, 0, MPI_COMM_WORLD);
+			MpiError = MPI_Send(&BErrorsQi0[0], NumTermsQi0, MPI_DOUBLE, 0, 0, MPI_COMM_WORLD);
+			MpiError = MPI_Send(&AErrorsQiGt0[0], NumTermsQiGt0, MPI_DOUBLE, 0, 0, MPI_COMM_WORLD);
+			MpiError = MPI_Send(&BErrorsQiGt0[0], NumTermsQiGt0, MPI_DOUBLE, 0, 0, MPI_COMM_WORLD);
+			MpiError = MPI_Send(&AErrorsQi0[NumTermsQi0], NumTermsQi0, MPI_DOUBLE, 0, 0, MPI_COMM_WORLD);
+			MpiError = MPI_Send(&BErrorsQi0[NumTermsQi0], NumTermsQi0, MPI_DOUBLE, 0, 0, MPI_COMM_WORLD);
+			MpiError = MPI_Send(&AErrorsQiGt0[NumTermsQiGt0], NumTermsQiGt0, MPI_DOUBLE, 0, 0, MPI_COMM_WORLD);
+			MpiError = MPI_Send(&BErrorsQiGt0[NumTermsQiGt0], NumTermsQiGt0, MPI_DOUBLE, 0, 0, MPI_COMM_WORLD);
+		}
+		// And then the derivatives, one block at a time.
+		if (q.Derivatives) {
+			for (int d = 0; d < NUM_DERIVS; d++) {
+				int Qi0 = d*NumTermsQi0*2, QiGt0 = d*NumTermsQiGt0*2;
+				MpiError = MPI_Send(&ADerivsQi0[Qi0], NumTermsQi0, MPI_DOUBLE, 0, 0, MPI_COMM_WORLD);
+				MpiError = MPI_Send(&BDerivsQi0[Qi0], NumTermsQi0, MPI_DOUBLE, 0, 0, MPI_COMM_WORLD);
+				MpiError = MPI_Send(&ADerivsQiGt0[QiGt0], NumTermsQiGt0, MPI_DOUBLE, 0, 0, MPI_COMM_WORLD);
+				MpiError = MPI_Send(&BDerivsQiGt0[QiGt0], NumTermsQiGt0, MPI_DOUBLE, 0, 0, MPI_COMM_WORLD);
+				MpiError = MPI_Send(&ADerivsQi0[Qi0+NumTermsQi0], NumTermsQi0, MPI_DOUBLE, 0, 0, MPI_COMM_WORLD);
+				MpiError = MPI_Send(&BDerivsQi0[Qi0+NumTermsQi0], NumTermsQi0, MPI_DOUBLE, 0, 0, MPI_COMM_WORLD);
+				MpiError = MPI_Send(&ADerivsQiGt0[QiGt0+NumTermsQiGt0], NumTermsQiGt0, MPI_DOUBLE, 0, 0, MPI_COMM_WORLD);
+				MpiError = MPI_Send(&BDerivsQiGt0[QiGt0+NumTermsQiGt0], NumTermsQiGt0, MPI_DOUBLE, 0, 0, MPI_COMM_WORLD);
+			}
+		}
 	}
 #else
 	AResultsQi0Final = AResultsQi0;
 	BResultsQi0Final = BResultsQi0;
 	AResultsQiGt0Final = AResultsQiGt0;
 	BResultsQiGt0Final = BResultsQiGt0;
+	AErrorsQi0Final = AErrorsQi0;
+	BErrorsQi0Final = BErrorsQi0;
+	AErrorsQiGt0Final = AErrorsQiGt0;
+	BErrorsQiGt0Final = BErrorsQiGt0;
+	ADerivsQi0Final = ADerivsQi0;
+	BDerivsQi0Final = BDerivsQi0;
+	ADerivsQiGt0Final = ADerivsQiGt0;
+	BDerivsQiGt0Final = BDerivsQiGt0;
 #endif
+	Timer.End();
 
 	if (Node == 0) {
 		//@TODO: Put directly into A and B
@@ -507,6 +682,35 @@ int main(int argc, char *argv[])
 			B[i+1] = BResults[i];
 		}
 
+		if (q.ErrorEstimate || q.QmcErrorEstimate) {
+			CombineResults(Omega, Ordering, AErrorsQi0Final, AErrorsQiGt0Final, AResults, 0, NumShortTerms);
+			CombineResults(Omega, Ordering, BErrorsQi0Final, BErrorsQiGt0Final, BResults, 0, NumShortTerms);
+			for (int i = 0; i < NumShortTerms*2; i++) {
+				ARowErr[i+1] = AResults[i];
+				BErr[i+1] = BResults[i];
+			}
+		}
+
+		// The long-long terms in ARow[0] and B[0] do not have a short-range term, so they only depend on mu.  That
+		//  derivative is not calculated, and they are left at 0.
+		if (q.Derivatives) {
+			int SizeQi0 = AResultsQi0Final.size(), SizeQiGt0 = AResultsQiGt0Final.size();
+			ARowDeriv.assign(NUM_DERIVS, vector <double>(NumShortTerms*2+1, 0.0));
+			BDeriv.assign(NUM_DERIVS, vector <double>(NumShortTerms*2+1, 0.0));
+			for (int d = 0; d < NUM_DERIVS; d++) {
+				vector <double> Qi0(ADerivsQi0Final.begin() + d*SizeQi0, ADerivsQi0Final.begin() + (d+1)*SizeQi0);
+				vector <double> QiGt0(ADerivsQiGt0Final.begin() + d*SizeQiGt0, ADerivsQiGt0Final.begin() + (d+1)*SizeQiGt0);
+				CombineResults(Omega, Ordering, Qi0, QiGt0, AResults, 0, NumShortTerms);
+				Qi0.assign(BDerivsQi0Final.begin() + d*SizeQi0, BDerivsQi0Final.begin() + (d+1)*SizeQi0);
+				QiGt0.assign(BDerivsQiGt0Final.begin() + d*SizeQiGt0, BDerivsQiGt0Final.begin() + (d+1)*SizeQiGt0);
+				CombineResults(Omega, Ordering, Qi0, QiGt0, BResults, 0, NumShortTerms);
+				for (int i = 0; i < NumShortTerms*2; i++) {
+					ARowDeriv[d][i+1] = AResults[i];
+					BDeriv[d][i+1] = BResults[i];
+				}
+			}
+		}
+
 		int Multiplier;
 		if (l == 0) Multiplier = 1;  // S-wave only has a single symmetry
 		else Multiplier = 2;
@@ -580,10 +784,50 @@ int main(int argc, char *argv[])
 		OutFile << endl << "SLC Term" << endl << SLC << endl;
 		OutFile << "SLC - CLS: " << SLC - B[0] << endl << endl;
 
+		if (q.ErrorEstimate || q.QmcErrorEstimate) {
+			cout << "A matrix row error estimate" << endl;
+			OutFile << "A matrix row error estimate" << endl;
+			for (int i = 0; i < NumShortTerms*Multiplier+1; i++) {
+				cout << i << " " << ARowErr[i] << endl;
+				OutFile << i << " " << ARowErr[i] << endl;
+			}
+			cout << endl << "B vector error estimate" << endl;
+			OutFile << endl << "B vector error estimate" << endl;
+			for (int i = 0; i < NumShortTerms*Multiplier+1; i++) {
+				cout << i << " " << BErr[i] << endl;
+				OutFile << i << " " << BErr[i] << endl;
+			}
+			cout << endl << "SLS error estimate: " << SLSErr << endl;
+			cout << "SLC error estimate: " << SLCErr << endl << endl;
+			OutFile << endl << "SLS error estimate: " << SLSErr << endl;
+			OutFile << "SLC error estimate: " << SLCErr << endl << endl;
+		}
+
+		if (q.Derivatives) {
+			cout << "A matrix row derivatives (mu, alpha, beta, gamma)" << endl;
+			OutFile << "A matrix row derivatives (mu, alpha, beta, gamma)" << endl;
+			for (int i = 1; i < NumShortTerms*Multiplier+1; i++) {
+				cout << i << " " << ARowDeriv[DERIV_MU][i] << " " << ARowDeriv[DERIV_ALPHA][i] << " " << ARowDeriv[DERIV_ALPHA+1][i] << " " << ARowDeriv[DERIV_ALPHA+2][i] << endl;
+				OutFile << i << " " << ARowDeriv[DERIV_MU][i] << " " << ARowDeriv[DERIV_ALPHA][i] << " " << ARowDeriv[DERIV_ALPHA+1][i] << " " << ARowDeriv[DERIV_ALPHA+2][i] << endl;
+			}
+			cout << endl << "B vector derivatives (alpha, beta, gamma)" << endl;
+			OutFile << endl << "B vector derivatives (alpha, beta, gamma)" << endl;
+			for (int i = 1; i < NumShortTerms*Multiplier+1; i++) {
+				cout << i << " " << BDeriv[DERIV_ALPHA][i] << " " << BDeriv[DERIV_ALPHA+1][i] << " " << BDeriv[DERIV_ALPHA+2][i] << endl;
+				OutFile << i << " " << BDeriv[DERIV_ALPHA][i] << " " << BDeriv[DERIV_ALPHA+1][i] << " " << BDeriv[DERIV_ALPHA+2][i] << endl;
+			}
+			cout << endl;
+			OutFile << endl;
+		}
+
 		double KohnPhase, InvKohnPhase, ComplexKohnPhase;
-		KohnPhase = Kohn(NumShortTerms, ARow, B, ShortTerms, SLS);
-		InvKohnPhase = InverseKohn(NumShortTerms, ARow, B, ShortTerms, SLS);
-		ComplexKohnPhase = ComplexKohnT(NumShortTerms, ARow, B, ShortTerms, SLS);
+		KohnFactor Factor;
+		Timer.Begin(PHASE_KOHN);
+		FactorKohn(NumShortTerms, ARow, B, ShortTerms, Factor);
+		KohnPhase = Kohn(ARow, B, Factor, SLS);
+		InvKohnPhase = InverseKohn(ARow, B, Factor, SLS);
+		ComplexKohnPhase = ComplexKohnT(ARow, B, Factor, SLS);
+		Timer.End();
 		cout << "Kohn phase shift: " << KohnPhase << endl;
 		cout << "Inverse Kohn phase shift: " << InvKohnPhase << endl;
 		cout << "Complex Kohn phase shift: " << ComplexKohnPhase << endl << endl;
@@ -600,14 +844,29 @@ int main(int argc, char *argv[])
 		CrossSection = 4.0 * PI * sin(ComplexKohnPhase) * sin(ComplexKohnPhase);
 		cout << "Complex (T-matrix) Kohn partial wave cross section: " << CrossSection << endl << endl;
 		OutFile << "Complex (T-matrix) Kohn partial wave cross section: " << CrossSection << endl << endl;
+
+		// Binary copy of the matrix elements, which Phase can read in place of the text file
+		MatrixElemData M;
+		M.Problem = ProblemString(l, IsTriplet);
+		M.LValue = l;  M.IsTriplet = IsTriplet;  M.Ordering = Ordering;  M.Omega = Omega;  M.NumSets = 1;  M.ShPower = ShPower;
+		M.Alpha = Alpha;  M.Beta = Beta;  M.Gamma = Gamma;  M.Kappa = Kappa;  M.Mu = Mu;
+		M.Lambda1 = Lambda1;  M.Lambda2 = Lambda2;  M.Lambda3 = Lambda3;  M.r2Cusp = r2Cusp;  M.r3Cusp = r3Cusp;
+		M.Quadrature = QuadratureSettings(q);
+		M.SLS = SLS;  M.SLC = SLC;
+		M.ARow.assign(ARow.begin(), ARow.begin() + NumShortTerms*Multiplier+1);
+		M.B.assign(B.begin(), B.begin() + NumShortTerms*Multiplier+1);
+		string BinName = string(argv[4]) + ".psme";
+		if (WriteMatrixElemFile(BinName.c_str(), M) == 0)
+			cout << "Matrix elements also written to " << BinName << endl << endl;
 	}
 
 
+	WriteTimingReport(Node, TotalNodes, string(argv[4]) + ".timing.json", OutFile, Omega, l, NumShortTerms, q.Engine);
+
 	// Cleanup
 	if (Node == 0) {
-		TimeEnd = time(NULL);
-		cout << "Time elapsed: " << difftime(TimeEnd, TimeStart) << endl;
-		OutFile << "Time elapsed: " << difftime(TimeEnd, TimeStart) << endl;
+		cout << "Time elapsed: " << Timer.Total() << endl;
+		OutFile << "Time elapsed: " << Timer.Total() << endl;
 		ParameterFile.close();
 		OutFile.close();
 		FileShortRange.close();
@@ -671,11 +930,59 @@ void ReadParamFile(ifstream &ParameterFile, QuadPoints &q, double &Mu, int &ShPo
 	getline(ParameterFile, Line);
 	getline(ParameterFile, Line);
 	ParameterFile >> Lambda1 >> Lambda2 >> Lambda3;
+	// The error estimate setting is optional so that older parameter files still work.
+	getline(ParameterFile, Line);
+	getline(ParameterFile, Line);
+	if (!(ParameterFile >> q.ErrorEstimate))
+		q.ErrorEstimate = 0;
+	// So is the integration engine for the short-long terms.
+	getline(ParameterFile, Line);
+	getline(ParameterFile, Line);
+	if (!(ParameterFile >> q.Engine >> q.QmcPoints >> q.QmcShifts >> q.SparseLevel)) {
+		q.Engine = ENGINE_GAUSS;
+		q.QmcPoints = 65536;
+		q.QmcShifts = 8;
+		q.SparseLevel = 4;
+	}
+	// And the rule used below the r2 and r3 cusps.
+	getline(ParameterFile, Line);
+	getline(ParameterFile, Line);
+	if (!(ParameterFile >> q.CuspRule))
+		q.CuspRule = CUSP_GAUSS;
+	// And the rule for the phi integrations.
+	getline(ParameterFile, Line);
+	getline(ParameterFile, Line);
+	if (!(ParameterFile >> q.PhiRule))
+		q.PhiRule = PHI_MIDPOINT;
+	// And whether to calculate the derivatives with respect to mu and the nonlinear parameters.
+	getline(ParameterFile, Line);
+	getline(ParameterFile, Line);
+	if (!(ParameterFile >> q.Derivatives))
+		q.Derivatives = 0;
+	q.QmcErrorEstimate = q.Engine == ENGINE_QMC;  // The randomizations always give an error estimate.
 
 	return;
 }
 
 
+// Lists the integration settings in the order stored in the binary matrix element file. New fields go at the end,
+//  along with a bump of MATRIXELEM_VERSION.
+vector <int> QuadratureSettings(QuadPoints &q)
+{
+	int Settings[] = {
+		q.LongLong_r1, q.LongLong_r2Leg, q.LongLong_r2Lag, q.LongLong_r3Leg, q.LongLong_r3Lag, q.LongLong_r12, q.LongLong_r13, q.LongLong_phi23,
+		q.LongLongr23_r1, q.LongLongr23_r2Leg, q.LongLongr23_r2Lag, q.LongLongr23_r3Leg, q.LongLongr23_r3Lag, q.LongLongr23_phi12, q.LongLongr23_r13, q.LongLongr23_r23,
+		q.ShortLong_r1, q.ShortLong_r2Leg, q.ShortLong_r2Lag, q.ShortLong_r3Leg, q.ShortLong_r3Lag, q.ShortLong_r12, q.ShortLong_r13, q.ShortLong_phi23,
+		q.ShortLongr23_r1, q.ShortLongr23_r2Leg, q.ShortLongr23_r2Lag, q.ShortLongr23_r3Leg, q.ShortLongr23_r3Lag, q.ShortLongr23_r12, q.ShortLongr23_phi13, q.ShortLongr23_r23,
+		q.ShortLongQiGt0_r1, q.ShortLongQiGt0_r2Leg, q.ShortLongQiGt0_r2Lag, q.ShortLongQiGt0_r3Leg, q.ShortLongQiGt0_r3Lag, q.ShortLongQiGt0_r12, q.ShortLongQiGt0_r13, q.ShortLongQiGt0_phi23,
+		q.ErrorEstimate, q.Engine, q.QmcPoints, q.QmcShifts, q.SparseLevel, q.CuspRule, q.PhiRule,
+		q.Derivatives, q.QmcErrorEstimate
+	};
+
+	return vector <int>(Settings, Settings + sizeof(Settings)/sizeof(int));
+}
+
+
 bool ReadShortHeader(ifstream &FileShortRange, int &Omega, int &IsTriplet, int &Ordering, int &NumShortTerms, double &Alpha, double &Beta, double &Gamma, int &LValue)
 {
 	int MagicNum, Version, HeaderLen, DataFormat, NumShortTerms1, NumShortTerms2, Formalism, IntType, NumSets, VarLen;
@@ -767,7 +1074,9 @@ string ShowTime()
 
 void CalcARowAndBVector(int Node, int NumTermsQi0, int NumTermsQiGt0, int Omega, vector <rPowers> &PowerTableQi0, vector <rPowers> &PowerTableQiGt0, vector <double> &AResultsQi0,
 			  vector <double> &AResultsQiGt0, vector <double> &ARow, vector <double> &BResultsQi0, vector <double> &BResultsQiGt0, vector <double> &B, double &SLS, double &SLC, int l, QuadPoints &q, double r2Cusp,
-			  double r3Cusp, double alpha, double beta, double gamma, double kappa, double mu, double lambda1, double lambda2, double lambda3, int shpower, int sf)
+			  double r3Cusp, double alpha, double beta, double gamma, double kappa, double mu, double lambda1, double lambda2, double lambda3, int shpower, int sf,
+			  vector <double> &AErrorsQi0, vector <double> &AErrorsQiGt0, vector <double> &ARowErr, vector <double> &BErrorsQi0, vector <double> &BErrorsQiGt0, vector <double> &BErr, double &SLSErr, double &SLCErr,
+			  vector <double> &ADerivsQi0, vector <double> &ADerivsQiGt0, vector <double> &BDerivsQi0, vector <double> &BDerivsQiGt0)
 {
 	//int NumTermsSub = NodeEnd-NodeStart+1;
 	vector <rPowers> PowerTableSub;
@@ -784,57 +1093,73 @@ void CalcARowAndBVector(int Node, int NumTermsQi0, int NumTermsQiGt0, int Omega,
 		SLS = 0.0;
 
 		if (Node == 0) cout << "Starting long-long calculations at " << ShowTime() << endl;
-		GaussIntegrationPhi23_LongLong(l, q.LongLong_r1, q.LongLong_r2Leg, q.LongLong_r2Lag, q.LongLong_r3Leg, q.LongLong_r3Lag, q.LongLong_r12, q.LongLong_r13, q.LongLong_phi23, r2Cusp, r3Cusp, kappa, mu, shpower, sf, ARow[0], SLC, B[0], SLS);
+		ARowErr[0] = 0.0;
+		BErr[0] = 0.0;
+		SLSErr = 0.0;
+		SLCErr = 0.0;
+		GetRunTimer().Begin(PHASE_LONGLONG);
+		GaussIntegrationPhi23_LongLong(l, q.LongLong_r1, q.LongLong_r2Leg, q.LongLong_r2Lag, q.LongLong_r3Leg, q.LongLong_r3Lag, q.LongLong_r12, q.LongLong_r13, q.LongLong_phi23, r2Cusp, r3Cusp, q.CuspRule, q.PhiRule, kappa, mu, shpower, sf, ARow[0], SLC, B[0], SLS,
+			q.ErrorEstimate, ARowErr[0], SLCErr, BErr[0], SLSErr);
 
 		cout << "SLS w/o r23 term: " << SLS << endl;
 		cout << "SLC w/o r23 term: " << SLC << endl;
 		cout << "CLS w/o r23 term: " << B[0] << endl;
 		cout << "CLC w/o r23 term: " << ARow[0] << endl;
+		if (q.ErrorEstimate)
+			cout << "Error estimates (SLS, SLC, CLS, CLC): " << SLSErr << " " << SLCErr << " " << BErr[0] << " " << ARowErr[0] << endl;
 		cout << endl;
 
 		if (Node == 0) cout << endl << "Starting long-long r23 term calculations at " << ShowTime() << endl;
 		double CLCTemp = 0.0, SLSTemp = 0.0, SLCTemp = 0.0, CLSTemp = 0.0;
+		double CLCTempErr = 0.0, SLSTempErr = 0.0, SLCTempErr = 0.0, CLSTempErr = 0.0;
+		GetRunTimer().Begin(PHASE_LONGLONG_R23);
 		//GaussIntegrationPhi12_LongLong_R23Term(q.LongLongr23_r1, q.LongLongr23_r2Leg, q.LongLongr23_r2Lag, q.LongLongr23_r3Leg, q.LongLongr23_r3Lag, q.LongLongr23_phi12, q.LongLongr23_r13, q.LongLongr23_r23, r2Cusp, r3Cusp, kappa, mu, sf, CLCTemp, SLCTemp, CLSTemp, SLSTemp);
-		GaussIntegrationPhi13_LongLong_R23Term(l, q.LongLongr23_r1, q.LongLongr23_r2Leg, q.LongLongr23_r2Lag, q.LongLongr23_r3Leg, q.LongLongr23_r3Lag, q.LongLongr23_phi12, q.LongLongr23_r13, q.LongLongr23_r23, r2Cusp, r3Cusp, kappa, mu, shpower, sf, CLCTemp, SLCTemp, CLSTemp, SLSTemp);
+		GaussIntegrationPhi13_LongLong_R23Term(l, q.LongLongr23_r1, q.LongLongr23_r2Leg, q.LongLongr23_r2Lag, q.LongLongr23_r3Leg, q.LongLongr23_r3Lag, q.LongLongr23_phi12, q.LongLongr23_r13, q.LongLongr23_r23, r2Cusp, r3Cusp, q.CuspRule, q.PhiRule, kappa, mu, shpower, sf, CLCTemp, SLCTemp, CLSTemp, SLSTemp,
+			q.ErrorEstimate, CLCTempErr, SLCTempErr, CLSTempErr, SLSTempErr);
 
 		cout << "SLS r23 term: " << SLSTemp << endl;
 		cout << "SLC r23 term: " << SLCTemp << endl;
 		cout << "CLS r23 term: " << CLSTemp << endl;
-		cout << "CLC r23 term: " << CLCTemp << endl << endl;
+		cout << "CLC r23 term: " << CLCTemp << endl;
+		if (q.ErrorEstimate)
+			cout << "Error estimates (SLS, SLC, CLS, CLC): " << SLSTempErr << " " << SLCTempErr << " " << CLSTempErr << " " << CLCTempErr << endl;
+		cout << endl;
 		ARow[0] += CLCTemp;
 		SLS += SLSTemp;
 		SLC += SLCTemp;
 		B[0] += CLSTemp;
+		ARowErr[0] += CLCTempErr;
+		SLSErr += SLSTempErr;
+		SLCErr += SLCTempErr;
+		BErr[0] += CLSTempErr;
 
 		cout << "SLS Term: " << SLS << endl;
 		cout << "SLC Term: " << SLC << endl;
 		cout << "CLS Term: " << B[0] << endl;
 		cout << "CLC Term: " << ARow[0] << endl << endl;
 		cout << "SLC - CLS = " << SLC - B[0] << endl << endl;
+		GetRunTimer().End();
 	}
 
+	ShortLongEngine Engine = GetShortLongEngine(q.Engine);
+
 	if (NumTermsQi0 > 0) {  // Skips when no terms with qi == 0
 		if (Node == 0) cout << "Starting short-long calculations at " << ShowTime() << endl;
-		VecGaussIntegrationPhi23_PhiLCBar_PhiLSBar(AResultsQi0, BResultsQi0, l, q.ShortLong_r1, q.ShortLong_r2Leg, q.ShortLong_r2Lag, q.ShortLong_r3Leg, q.ShortLong_r3Lag, q.ShortLong_r12, q.ShortLong_r13, q.ShortLong_phi23, r2Cusp, r3Cusp, kappa, mu, shpower, sf, NumTermsQi0, PowerTableQi0, Omega, lambda1, lambda2, lambda3);
+		GetRunTimer().Begin(PHASE_SHORTLONG);
+		Engine(Node, AResultsQi0, BResultsQi0, false, l, q, r2Cusp, r3Cusp, kappa, mu, shpower, sf, NumTermsQi0, PowerTableQi0, Omega, lambda1, lambda2, lambda3, AErrorsQi0, BErrorsQi0, ADerivsQi0, BDerivsQi0);
+		GetRunTimer().End();
 		#ifdef USE_MPI
 		//MpiError = MPI_Barrier(MPI_COMM_WORLD);
 		Buffer = "Finished short-long on node " + to_string(Node) + "\n";
 		//MpiError = MPI_File_write_shared(MpiLog, (void*)Buffer.c_str(), Buffer.length(), MPI_CHAR, &MpiStatus);
 		#endif
-
-		if (Node == 0) cout << "Starting short-long r23 term calculations at " << ShowTime() << endl;
-		VecGaussIntegrationPhi13_PhiLCBar_PhiLSBar_R23Term(AResultsQi0, BResultsQi0, l, q.ShortLongr23_r1, q.ShortLongr23_r2Leg, q.ShortLongr23_r2Lag, q.ShortLongr23_r3Leg, q.ShortLongr23_r3Lag, q.ShortLongr23_r12, q.ShortLongr23_phi13, q.ShortLongr23_r23, r2Cusp, r3Cusp, kappa, mu, shpower, sf, NumTermsQi0, PowerTableQi0, Omega, lambda1, lambda2, lambda3);
-		//VecGaussIntegrationPhi12_PhiLCBar_PhiLSBar_R23Term(AResultsQi0, BResultsQi0, q.ShortLongr23_r1, q.ShortLongr23_r2Leg, q.ShortLongr23_r2Lag, q.ShortLongr23_r3Leg, q.ShortLongr23_r3Lag, q.ShortLongr23_r12, q.ShortLongr23_phi13, q.ShortLongr23_r23, r2Cusp, r3Cusp, kappa, mu, sf, NumTermsQi0, PowerTableQi0, Omega, lambda1, lambda2, lambda3);
-		#ifdef USE_MPI
-		//MpiError = MPI_Barrier(MPI_COMM_WORLD);
-		Buffer = "Finished short-long r23 term on node " + to_string(Node) + "\n";
-		//MpiError = MPI_File_write_shared(MpiLog, (void*)Buffer.c_str(), Buffer.length(), MPI_CHAR, &MpiStatus);
-		#endif
 	}
 
 	if (NumTermsQiGt0 > 0) {  // Skips when no terms with qi > 0
 		if (Node == 0) cout << "Starting short-long full calculations at " << ShowTime() << endl;
-		VecGaussIntegrationPhi23_PhiLCBar_PhiLSBar_Full(AResultsQiGt0, BResultsQiGt0, l, q.ShortLongQiGt0_r1, q.ShortLongQiGt0_r2Leg, q.ShortLongQiGt0_r2Lag, q.ShortLongQiGt0_r3Leg, q.ShortLongQiGt0_r3Lag, q.ShortLongQiGt0_r12,q. ShortLongQiGt0_r13, q.ShortLongQiGt0_phi23, r2Cusp, r3Cusp, kappa, mu, shpower, sf, NumTermsQiGt0, PowerTableQiGt0, Omega, lambda1, lambda2, lambda3);
+		GetRunTimer().Begin(PHASE_SHORTLONG_FULL);
+		Engine(Node, AResultsQiGt0, BResultsQiGt0, true, l, q, r2Cusp, r3Cusp, kappa, mu, shpower, sf, NumTermsQiGt0, PowerTableQiGt0, Omega, lambda1, lambda2, lambda3, AErrorsQiGt0, BErrorsQiGt0, ADerivsQiGt0, BDerivsQiGt0);
+		GetRunTimer().End();
 		#ifdef USE_MPI
 		Buffer = "Finished short-long full on node " + to_string(Node) + "\n";
 		//MpiError = MPI_File_write_shared(MpiLog, (void*)Buffer.c_str(), Buffer.length(), MPI_CHAR, &MpiStatus);
@@ -845,6 +1170,63 @@ void CalcARowAndBVector(int Node, int NumTermsQi0, int NumTermsQiGt0, int Omega,
 }
 
 
+// Tensor-product Gauss rules.  Terms with qi == 0 have the 2/r23 term done separately in coordinates that remove the
+//  singularity, and terms with qi > 0 use the full integrand.
+void ShortLongGauss(int Node, vector <double> &AResults, vector <double> &BResults, bool QiGt0, int l, QuadPoints &q, double r2Cusp, double r3Cusp, double kappa, double mu, int shpower, int sf,
+			int NumPowers, vector <rPowers> &Powers, int Omega, double lambda1, double lambda2, double lambda3, vector <double> &AErrors, vector <double> &BErrors,
+			vector <double> &ADerivs, vector <double> &BDerivs)
+{
+	if (QiGt0) {
+		VecGaussIntegrationPhi23_PhiLCBar_PhiLSBar_Full(AResults, BResults, l, q.ShortLongQiGt0_r1, q.ShortLongQiGt0_r2Leg, q.ShortLongQiGt0_r2Lag, q.ShortLongQiGt0_r3Leg, q.ShortLongQiGt0_r3Lag, q.ShortLongQiGt0_r12, q.ShortLongQiGt0_r13, q.ShortLongQiGt0_phi23, r2Cusp, r3Cusp, q.CuspRule, q.PhiRule, kappa, mu, shpower, sf, NumPowers, Powers, Omega, lambda1, lambda2, lambda3, q.ErrorEstimate, AErrors, BErrors, q.Derivatives, ADerivs, BDerivs);
+		return;
+	}
+
+	VecGaussIntegrationPhi23_PhiLCBar_PhiLSBar(AResults, BResults, l, q.ShortLong_r1, q.ShortLong_r2Leg, q.ShortLong_r2Lag, q.ShortLong_r3Leg, q.ShortLong_r3Lag, q.ShortLong_r12, q.ShortLong_r13, q.ShortLong_phi23, r2Cusp, r3Cusp, q.CuspRule, q.PhiRule, kappa, mu, shpower, sf, NumPowers, Powers, Omega, lambda1, lambda2, lambda3, q.ErrorEstimate, AErrors, BErrors, q.Derivatives, ADerivs, BDerivs);
+	if (Node == 0) cout << "Starting short-long r23 term calculations at " << ShowTime() << endl;
+	GetRunTimer().Begin(PHASE_SHORTLONG_R23);  // Ended by CalcARowAndBVector
+	VecGaussIntegrationPhi13_PhiLCBar_PhiLSBar_R23Term(AResults, BResults, l, q.ShortLongr23_r1, q.ShortLongr23_r2Leg, q.ShortLongr23_r2Lag, q.ShortLongr23_r3Leg, q.ShortLongr23_r3Lag, q.ShortLongr23_r12, q.ShortLongr23_phi13, q.ShortLongr23_r23, r2Cusp, r3Cusp, q.CuspRule, q.PhiRule, kappa, mu, shpower, sf, NumPowers, Powers, Omega, lambda1, lambda2, lambda3, q.ErrorEstimate, AErrors, BErrors, q.Derivatives, ADerivs, BDerivs);
+	//VecGaussIntegrationPhi12_PhiLCBar_PhiLSBar_R23Term(AResults, BResults, q.ShortLongr23_r1, q.ShortLongr23_r2Leg, q.ShortLongr23_r2Lag, q.ShortLongr23_r3Leg, q.ShortLongr23_r3Lag, q.ShortLongr23_r12, q.ShortLongr23_phi13, q.ShortLongr23_r23, r2Cusp, r3Cusp, kappa, mu, sf, NumPowers, Powers, Omega, lambda1, lambda2, lambda3);
+	return;
+}
+
+
+// Randomized quasi-Monte Carlo.  The full integrand is used for both sets of terms, since the 2/r23 singularity is
+//  integrable and does not need the separate coordinates here.  The unnamed parameters are only there to match
+//  ShortLongEngine.
+void ShortLongQmc(int, vector <double> &AResults, vector <double> &BResults, bool, int l, QuadPoints &q, double, double, double kappa, double mu, int shpower, int sf,
+			int NumPowers, vector <rPowers> &Powers, int Omega, double, double, double, vector <double> &AErrors, vector <double> &BErrors,
+			vector <double> &, vector <double> &)
+{
+	QmcIntegrationPhi23_PhiLCBar_PhiLSBar_Full(AResults, BResults, l, q.QmcPoints, q.QmcShifts, kappa, mu, shpower, sf, NumPowers, Powers, Omega, AErrors, BErrors);
+	return;
+}
+
+
+// Smolyak sparse grid.  Like the QMC engine, this uses the full integrand for both sets of terms.
+void ShortLongSparse(int, vector <double> &AResults, vector <double> &BResults, bool, int l, QuadPoints &q, double, double, double kappa, double mu, int shpower, int sf,
+			int NumPowers, vector <rPowers> &Powers, int Omega, double, double, double, vector <double> &AErrors, vector <double> &BErrors,
+			vector <double> &, vector <double> &)
+{
+	SparseIntegrationPhi23_PhiLCBar_PhiLSBar_Full(AResults, BResults, l, q.SparseLevel, kappa, mu, shpower, sf, NumPowers, Powers, Omega, q.ErrorEstimate, AErrors, BErrors);
+	return;
+}
+
+
+ShortLongEngine GetShortLongEngine(int Engine)
+{
+	switch (Engine)
+	{
+		case ENGINE_QMC:
+			return ShortLongQmc;
+		case ENGINE_SPARSE:
+			return ShortLongSparse;
+		case ENGINE_GAUSS:
+		default:
+			return ShortLongGauss;
+	}
+}
+
+
 // We calculate terms with qi == 0 and qi > 0 separately, so this recombines them back into a single set.
 void CombineResults(int Omega, int Ordering, vector <double> &ResultsQi0, vector <double> &ResultsQiGt0, vector <double> &Results, int Start, int End)
 {
@@ -958,100 +1340,27 @@ void CombineResults(int Omega, int Ordering, vector <double> &ResultsQi0, vector
 //}
 
 
+// Problem description on the first line of the results file, which Phase uses to identify the problem.
+string ProblemString(int LValue, int IsTriplet)
+{
+	const char Waves[] = "SPDFGHIKL";
+
+	if (LValue < 0 || LValue > 8)
+		return string("");
+
+	string Problem = string(1, Waves[LValue]) + "-Wave " + (IsTriplet == 0 ? "Singlet" : "Triplet") + " Ps-H";
+	if (LValue == 1 || LValue == 2)
+		Problem += ": 1st formalism";
+	return Problem;
+}
+
+
 void WriteHeader(ofstream &OutFile, int &LValue, int &IsTriplet)
 {
-	switch (LValue)
-	{
-		case 0:  // S-Wave
-			if (IsTriplet == 0) {
-				cout << "S-Wave Singlet Ps-H" << endl;
-				OutFile << "S-Wave Singlet Ps-H" << endl;
-			}
-			else {
-				cout << "S-Wave Triplet Ps-H" << endl;
-				OutFile << "S-Wave Triplet Ps-H" << endl;
-			}
-			break;
-		case 1:
-			if (IsTriplet == 0) {
-				cout << "P-Wave Singlet Ps-H: 1st formalism" << endl;
-				OutFile << "P-Wave Singlet Ps-H: 1st formalism" << endl;
-			}
-			else {
-				cout << "P-Wave Triplet Ps-H: 1st formalism" << endl;
-				OutFile << "P-Wave Triplet Ps-H: 1st formalism" << endl;
-			}
-			break;
-		case 2:
-			if (IsTriplet == 0) {
-				cout << "D-Wave Singlet Ps-H: 1st formalism" << endl;
-				OutFile << "D-Wave Singlet Ps-H: 1st formalism" << endl;
-			}
-			else {
-				cout << "D-Wave Triplet Ps-H: 1st formalism" << endl;
-				OutFile << "D-Wave Triplet Ps-H: 1st formalism" << endl;
-			}
-			break;
-		case 3:  // F-Wave
-			if (IsTriplet == 0) {
-				cout << "F-Wave Singlet Ps-H" << endl;
-				OutFile << "F-Wave Singlet Ps-H" << endl;
-			}
-			else {
-				cout << "F-Wave Triplet Ps-H" << endl;
-				OutFile << "F-Wave Triplet Ps-H" << endl;
-			}
-			break;
-		case 4:  // G-Wave
-			if (IsTriplet == 0) {
-				cout << "G-Wave Singlet Ps-H" << endl;
-				OutFile << "G-Wave Singlet Ps-H" << endl;
-			}
-			else {
-				cout << "G-Wave Triplet Ps-H" << endl;
-				OutFile << "G-Wave Triplet Ps-H" << endl;
-			}
-			break;
-		case 5:  // H-Wave
-			if (IsTriplet == 0) {
-				cout << "H-Wave Singlet Ps-H" << endl;
-				OutFile << "H-Wave Singlet Ps-H" << endl;
-			}
-			else {
-				cout << "H-Wave Triplet Ps-H" << endl;
-				OutFile << "H-Wave Triplet Ps-H" << endl;
-			}
-			break;
-		case 6:  // I-Wave
-			if (IsTriplet == 0) {
-				cout << "I-Wave Singlet Ps-H" << endl;
-				OutFile << "I-Wave Singlet Ps-H" << endl;
-			}
-			else {
-				cout << "I-Wave Triplet Ps-H" << endl;
-				OutFile << "I-Wave Triplet Ps-H" << endl;
-			}
-			break;
-		case 7:  // K-Wave
-			if (IsTriplet == 0) {
-				cout << "K-Wave Singlet Ps-H" << endl;
-				OutFile << "K-Wave Singlet Ps-H" << endl;
-			}
-			else {
-				cout << "K-Wave Triplet Ps-H" << endl;
-				OutFile << "K-Wave Triplet Ps-H" << endl;
-			}
-			break;
-		case 8:  // L-Wave
-			if (IsTriplet == 0) {
-				cout << "L-Wave Singlet Ps-H" << endl;
-				OutFile << "L-Wave Singlet Ps-H" << endl;
-			}
-			else {
-				cout << "L-Wave Triplet Ps-H" << endl;
-				OutFile << "L-Wave Triplet Ps-H" << endl;
-			}
-			break;
+	string Problem = ProblemString(LValue, IsTriplet);
+	if (Problem != "") {
+		cout << Problem << endl;
+		OutFile << Problem << endl;
 	}
 
 	return;
@@ -1089,6 +1398,107 @@ void WriteProgress(string Desc, int &Prog, int i, int N)
 }
 
 
+// Writes the time of each phase on every process to FileName (next to the results file) and a summary to the screen
+//  and the results file.  The other processes send their times to node 0, so this has to be called on all of them.
+//  The load imbalance is the maximum over the mean: of the phase times across processes, and of the busy times of
+//  the OpenMP threads on each process.  The idle fraction is the part of the threads' time in a phase not spent in
+//  an iteration of one of the integration loops.  Each phase is on its own line so that scripts can read it easily.
+void WriteTimingReport(int Node, int TotalNodes, string FileName, ofstream &OutFile, int Omega, int l, int NumShortTerms, int Engine)
+{
+	RunTimer &Timer = GetRunTimer();
+	vector <int> Threads(TotalNodes);
+	vector <vector <double> > Seconds(TotalNodes), Busy(TotalNodes);  // Busy is indexed by phase * threads + thread.
+	double Total = Timer.Total();
+	Timer.End();
+
+	Threads[Node] = Timer.NumThreads;
+	Seconds[Node] = Timer.Seconds;
+	for (int p = 0; p < NUM_PHASES; p++)
+		Busy[Node].insert(Busy[Node].end(), Timer.ThreadBusy[p].begin(), Timer.ThreadBusy[p].end());
+
+#ifdef USE_MPI
+	MPI_Status MpiStatus;
+	int MpiError;
+	if (Node == 0) {
+		for (int i = 1; i < TotalNodes; i++) {
+			MpiError = MPI_Recv(&Threads[i], 1, MPI_INT, i, 0, MPI_COMM_WORLD, &MpiStatus);
+			Seconds[i].resize(NUM_PHASES);
+			Busy[i].resize(NUM_PHASES * Threads[i]);
+			MpiError = MPI_Recv(&Seconds[i][0], NUM_PHASES, MPI_DOUBLE, i, 0, MPI_COMM_WORLD, &MpiStatus);
+			MpiError = MPI_Recv(&Busy[i][0], NUM_PHASES * Threads[i], MPI_DOUBLE, i, 0, MPI_COMM_WORLD, &MpiStatus);
+		}
+	}
+	else {
+		MpiError = MPI_Send(&Threads[Node], 1, MPI_INT, 0, 0, MPI_COMM_WORLD);
+		MpiError = MPI_Send(&Seconds[Node][0], NUM_PHASES, MPI_DOUBLE, 0, 0, MPI_COMM_WORLD);
+		MpiError = MPI_Send(&Busy[Node][0], NUM_PHASES * Threads[Node], MPI_DOUBLE, 0, 0, MPI_COMM_WORLD);
+		return;
+	}
+#endif
+
+	ofstream Report(FileName.c_str());
+	if (Report.fail())
+		cerr << "Unable to open file " << FileName << " for writing the timing report." << endl;
+	Report << setprecision(6);
+	Report << "{" << endl;
+	Report << "\"omega\": " << Omega << ", \"l\": " << l << ", \"terms\": " << NumShortTerms << ", \"engine\": " << Engine
+		<< ", \"ranks\": " << TotalNodes << ", \"total_seconds\": " << Total << "," << endl;
+	Report << "\"threads\": [";
+	for (int i = 0; i < TotalNodes; i++)
+		Report << (i > 0 ? ", " : "") << Threads[i];
+	Report << "]," << endl;
+	Report << "\"phases\": [" << endl;
+
+	cout << endl << setprecision(4) << "Phase                    Max (s)    Mean (s)  Rank imbal.  Thread imbal.      Idle" << endl;
+	OutFile << endl << setprecision(4) << "Phase                    Max (s)    Mean (s)  Rank imbal.  Thread imbal.      Idle" << endl;
+	for (int p = 0; p < NUM_PHASES; p++) {
+		double Min = Seconds[0][p], Max = Seconds[0][p], Mean = 0.0;
+		double WorstThreadImbal = 1.0, SumIdle = 0.0;
+		stringstream RankList, ThreadList;
+
+		for (int i = 0; i < TotalNodes; i++) {
+			double t = Seconds[i][p], BusyMax = 0.0, BusyMean = 0.0, Idle = 0.0;
+			Min = min(Min, t);
+			Max = max(Max, t);
+			Mean += t / TotalNodes;
+			RankList << (i > 0 ? ", " : "") << t;
+
+			// Phases without a threaded loop (or not run on this process) have no busy time.
+			ThreadList << (i > 0 ? ", " : "") << "[";
+			for (int j = 0; j < Threads[i]; j++) {
+				double b = Busy[i][p*Threads[i] + j];
+				BusyMax = max(BusyMax, b);
+				BusyMean += b / Threads[i];
+				ThreadList << (j > 0 ? ", " : "") << b;
+			}
+			ThreadList << "]";
+			if (BusyMean > 0.0)
+				WorstThreadImbal = max(WorstThreadImbal, BusyMax / BusyMean);
+			if (BusyMean > 0.0 && t > 0.0)
+				Idle = max(0.0, 1.0 - BusyMean / t);
+			SumIdle += Idle / TotalNodes;
+		}
+
+		Report << "{\"name\": \"" << PhaseName(p) << "\", \"seconds\": [" << RankList.str() << "], \"min\": " << Min << ", \"max\": " << Max
+			<< ", \"mean\": " << Mean << ", \"rank_imbalance\": " << (Mean > 0.0 ? Max / Mean : 1.0) << ", \"thread_busy\": [" << ThreadList.str()
+			<< "], \"thread_imbalance\": " << WorstThreadImbal << ", \"idle_fraction\": " << SumIdle << "}" << (p < NUM_PHASES-1 ? "," : "") << endl;
+
+		if (Max > 0.0) {
+			cout << left << setw(24) << PhaseName(p) << right << setw(9) << Max << setw(12) << Mean << setw(13) << Max / Mean
+				<< setw(15) << WorstThreadImbal << setw(10) << SumIdle << endl;
+			OutFile << left << setw(24) << PhaseName(p) << right << setw(9) << Max << setw(12) << Mean << setw(13) << Max / Mean
+				<< setw(15) << WorstThreadImbal << setw(10) << SumIdle << endl;
+		}
+	}
+	Report << "]" << endl << "}" << endl;
+	Report.close();
+
+	cout << "Timing report written to " << FileName << endl << setprecision(18);
+	OutFile << setprecision(18);
+	return;
+}
+
+
 // From http://notfaq.wordpress.com/2006/08/30/c-convert-int-to-string/
 template <class T> string to_string(const T& t)
 {
@@ -39,10 +39,45 @@ typedef struct
 	int ShortLong_r1, ShortLong_r2Leg, ShortLong_r2Lag, ShortLong_r3Leg, ShortLong_r3Lag, ShortLong_r12, ShortLong_r13, ShortLong_phi23;
 	int ShortLongr23_r1, ShortLongr23_r2Leg, ShortLongr23_r2Lag, ShortLongr23_r3Leg, ShortLongr23_r3Lag, ShortLongr23_r12, ShortLongr23_phi13, ShortLongr23_r23;
 	int ShortLongQiGt0_r1, ShortLongQiGt0_r2Leg, ShortLongQiGt0_r2Lag, ShortLongQiGt0_r3Leg, ShortLongQiGt0_r3Lag, ShortLongQiGt0_r12, ShortLongQiGt0_r13, ShortLongQiGt0_phi23;
+
+	int ErrorEstimate;  // Whether to compute embedded error estimates for each integration
+
+	int Engine;  // Integration engine for the short-long terms (ENGINE_GAUSS, ENGINE_QMC or ENGINE_SPARSE)
+	int QmcPoints, QmcShifts;  // Number of QMC points and independent randomizations
+	int SparseLevel;  // Smolyak level of the sparse grid
+
+	int CuspRule;  // Rule for r2 and r3 below the cusp (CUSP_GAUSS or CUSP_DE)
+	int PhiRule;  // Rule for the phi integrations (PHI_MIDPOINT or PHI_GAUSS)
+
+	int Derivatives;  // Whether to also compute the short-long derivatives with respect to mu, alpha, beta and gamma
+
+	int QmcErrorEstimate;  // Set with the QMC engine, whose randomizations always give short-long error estimates
 } QuadPoints;
 
+#define ENGINE_GAUSS 0
+#define ENGINE_QMC 1
+#define ENGINE_SPARSE 2
+
+#define CUSP_GAUSS 0  // Gauss-Legendre below the cusp and shifted Gauss-Laguerre above it
+#define CUSP_DE 1  // Tanh-sinh below the cusp and shifted Gauss-Laguerre above it
+
+// Decay rate in r2 and r3 of the long-long integrands, which is the exponent of their Gauss-Laguerre rules
+#define LONG_RANGE_DECAY 1.0
+
+#define PHI_MIDPOINT 0  // Midpoint rule in phi
+#define PHI_GAUSS 1  // Gauss-Legendre in sqrt(phi/pi)
+
+// Number of integration dimensions with an embedded error estimate: r1, r2, r3, the two Legendre distances and the angle
+#define NUM_EMBEDDED_DIMS 6
+
+// Blocks of the derivative vectors, each laid out like AResults and BResults
+#define NUM_DERIVS 4
+#define DERIV_MU 0
+#define DERIV_ALPHA 1  // DERIV_BETA and DERIV_GAMMA follow.
+
 template <class T> string to_string(const T& t);
 void	ReadParamFile(ifstream &ParameterFile, QuadPoints &q, double &Mu, int &ShPower, double &Lambda1, double &Lambda2, double &Lambda3, double &r2Cusp, double &r3Cusp);
+vector <int> QuadratureSettings(QuadPoints &q);
 bool	ReadShortHeader(ifstream &FileShortRange, int &Omega, int &IsTriplet, int &Ordering, int &NumShortTerms, double &Alpha, double &Beta, double &Gamma, int &l);
 void	ShowDateTime(ofstream &OutFile);
 string	ShowTime(void);
@@ -50,9 +85,28 @@ long double	PsWaveFn(double r12);
 long double	HWaveFn(double r3);
 void	CalcARowAndBVector(int Node, int NumTermsQi0, int NumTermsQiGt0, int Omega, vector <rPowers> &PowerTableQi0, vector <rPowers> &PowerTableQiGt0, vector <double> &AResultsQi0,
 			  vector <double> &AResultsQiGt0, vector <double> &ARow, vector <double> &BResultsQi0, vector <double> &BResultsQiGt0, vector <double> &B, double &SLS, double &SLC, int l, QuadPoints &q, double r2Cusp,
-			  double r3Cusp, double alpha, double beta, double gamma, double kappa, double mu, double lambda1, double lambda2, double lambda3, int shpower, int sf);
+			  double r3Cusp, double alpha, double beta, double gamma, double kappa, double mu, double lambda1, double lambda2, double lambda3, int shpower, int sf,
+			  vector <double> &AErrorsQi0, vector <double> &AErrorsQiGt0, vector <double> &ARowErr, vector <double> &BErrorsQi0, vector <double> &BErrorsQiGt0, vector <double> &BErr, double &SLSErr, double &SLCErr,
+			  vector <double> &ADerivsQi0, vector <double> &ADerivsQiGt0, vector <double> &BDerivsQi0, vector <double> &BDerivsQiGt0);
 void	CombineResults(int Omega, int Ordering, vector <double> &ResultsQi0, vector <double> &ResultsQiGt0, vector <double> &Results, int Start, int End);
+string	ProblemString(int LValue, int IsTriplet);
 void	WriteHeader(ofstream &OutFile, int &LValue, int &IsTriplet);
+void	WriteTimingReport(int Node, int TotalNodes, string FileName, ofstream &OutFile, int Omega, int l, int NumShortTerms, int Engine);
+
+// Integrates the short-long terms for either the qi == 0 or qi > 0 power table.
+typedef	void (*ShortLongEngine)(int Node, vector <double> &AResults, vector <double> &BResults, bool QiGt0, int l, QuadPoints &q, double r2Cusp, double r3Cusp, double kappa, double mu, int shpower, int sf,
+			int NumPowers, vector <rPowers> &Powers, int Omega, double lambda1, double lambda2, double lambda3, vector <double> &AErrors, vector <double> &BErrors,
+			vector <double> &ADerivs, vector <double> &BDerivs);
+void	ShortLongGauss(int Node, vector <double> &AResults, vector <double> &BResults, bool QiGt0, int l, QuadPoints &q, double r2Cusp, double r3Cusp, double kappa, double mu, int shpower, int sf,
+			int NumPowers, vector <rPowers> &Powers, int Omega, double lambda1, double lambda2, double lambda3, vector <double> &AErrors, vector <double> &BErrors,
+			vector <double> &ADerivs, vector <double> &BDerivs);
+void	ShortLongQmc(int Node, vector <double> &AResults, vector <double> &BResults, bool QiGt0, int l, QuadPoints &q, double r2Cusp, double r3Cusp, double kappa, double mu, int shpower, int sf,
+			int NumPowers, vector <rPowers> &Powers, int Omega, double lambda1, double lambda2, double lambda3, vector <double> &AErrors, vector <double> &BErrors,
+			vector <double> &ADerivs, vector <double> &BDerivs);
+void	ShortLongSparse(int Node, vector <double> &AResults, vector <double> &BResults, bool QiGt0, int l, QuadPoints &q, double r2Cusp, double r3Cusp, double kappa, double mu, int shpower, int sf,
+			int NumPowers, vector <rPowers> &Powers, int Omega, double lambda1, double lambda2, double lambda3, vector <double> &AErrors, vector <double> &BErrors,
+			vector <double> &ADerivs, vector <double> &BDerivs);
+ShortLongEngine	GetShortLongEngine(int Engine);
 
 typedef	double (*FuncPtr)(rPowers &, double, double, double, double, double, double, double, double, double, double, int);
 
@@ -71,12 +125,86 @@ void	ChangeOfInterval(vector <long double> &Abscissas, vector <long double> &Cha
 void	ChangeOfIntervalNoResize(vector <long double> &Abscissas, vector <long double> &ChangedAbscissas, long double a, long double b);
 int		GaussLegendre(vector <long double> &Abscissas, vector <long double> &Weights, int n);
 int		GaussLaguerre(vector <long double> &Abscissas, vector <long double> &Weights, int n);
+int		GaussKronrod(vector <long double> &Abscissas, vector <long double> &KronrodWeights, vector <long double> &GaussWeights, int n);
+int		LaguerreEmbedded(vector <long double> &Abscissas, vector <long double> &EmbeddedWeights);
+int		LegendreWithEstimate(vector <long double> &Abscissas, vector <long double> &Weights, vector <long double> &Ratios, int n, int ErrorEstimate);
+int		LaguerreWithEstimate(vector <long double> &Abscissas, vector <long double> &Weights, vector <long double> &Ratios, int n, int ErrorEstimate);
+int		TanhSinhWithEstimate(vector <long double> &Abscissas, vector <long double> &Weights, vector <long double> &Ratios, int n, int ErrorEstimate);
+long double	AutoCuspThreshold(long double Exponent, int Power);
+
+// Rule for r2 or r3 with weight exp(-Exponent*r), split at the distance of the cusp (r1 or r2) when that is no larger
+//  than the cusp threshold.  Above the threshold, this is just Gauss-Laguerre.
+class CuspSplitRule
+{
+	public:
+		CuspSplitRule(int nLeg, int nLag, int ErrorEstimate, int Rule);
+		int Build(long double Split, long double Cusp, long double Exponent, vector <long double> &Abscissas, vector <long double> &Weights, vector <long double> &Ratios);
+
+		int MaxPoints;  // Most points that Build can return
+	private:
+		int nLow, nLag;
+		vector <long double> LowAbscissas, LowWeights, LowRatios;  // On [-1,1] for Gauss-Legendre and [0,1] for tanh-sinh
+		vector <long double> LaguerreAbscissas, LaguerreWeights, LaguerreRatios;
+		int Rule;
+};
+
+// Abscissas for the phi integrations over [0,pi], which only enter through cos(phi).  The cosines are tabulated once
+//  for each number of points instead of being recomputed for every outer abscissa.  Weights are relative to the
+//  midpoint weight pi/n, so they are all 1 for the midpoint rule.
+class AngularRule
+{
+	public:
+		AngularRule(int n, int Rule);
+		void Distances(long double a, long double b, long double *r);
+
+		int n;
+		bool Nested;  // Whether every third angle is a midpoint rule with n/3 points for the error estimate
+		vector <long double> Cos, Weights;
+};
 
 // Vector Gaussian Integration.cpp
-void	VecGaussIntegrationPhi23_PhiLCBar_PhiLSBar(vector <double> &AResults, vector <double> &BResults, int l, int nR1, int nR2Leg, int nR2Lag, int nR3Leg, int nR3Lag, int nR12, int nR13, int nPhi23, double CuspR2, double CuspR3, double kappa, double mu, int shpower, int sf, int NumPowers, vector <rPowers> &Powers, int Omega, double Lambda1, double Lambda2, double Lambda3);
-void	VecGaussIntegrationPhi13_PhiLCBar_PhiLSBar_R23Term(vector <double> &AResults, vector <double> &BResults, int l, int nR1, int nR2Leg, int nR2Lag, int nR3Leg, int nR3Lag, int nR12, int nPhi13, int nR23, double CuspR2, double CuspR3, double kappa, double mu, int shpower, int sf, int NumPowers, vector <rPowers> &Powers, int Omega, double Lambda1, double Lambda2, double Lambda3);
+// The full short-range - long-range integrand, including the 2/r23 term.  Every integration engine evaluates the
+//  integrand through this, so SetR12 and SetR13 can be hoisted out of the inner loops of the product rules.
+class ShortLongIntegrand
+{
+	public:
+		ShortLongIntegrand(int l, long double kappa, long double mu, int shpower, int sf, bool MuDerivs = false);
+		void SetR12(long double r1, long double r2, long double r3, long double r12);
+		void SetR13(long double r13);
+		long double R23(long double Phi23);
+		void R23(AngularRule &Phi, long double *r23);
+		long double SetUnitCube(long double *u, long double a1, long double a2, long double a3, long double &r23);
+		void OuterTerms(long double r23, long double &fOuterC1, long double &fOuterS1, long double &fOuterC2, long double &fOuterS2, long double *fOuterMu = NULL);
+
+		long double r1, r2, r3, r12, r13;
+	private:
+		int l, shpower, sf;
+		bool MuDerivs;  // Whether SetR13 also finds d/dmu of the shielding terms
+		long double kappa, mu;
+		long double Cos12, Sin12, Cos13, Sin13, rho, rhop, jlrho, nlrho, jlrhop, nlrhop, ExpR12R3, ExpR13R2;
+		long double S22, S23, AngPhi1S22, AngPhi1S23, AngPhi2S22, fshrho, fshrhop, fsh1rho, fsh1rhop;
+		long double dfshrho, dfshrhop, dfsh1rho, dfsh1rhop;  // d/dmu of the shielding terms
+};
+
+void	AccumulatePowers(int NumPowers, vector <rPowers> &Powers, vector <long double> &r1Pow, vector <long double> &r2Pow, vector <long double> &r3Pow, vector <long double> &r12Pow, vector <long double> &r13Pow, vector <long double> &r23Pow,
+			long double CoeffFinal, long double fOuterC1, long double fOuterS1, long double fOuterC2, long double fOuterS2, long double *AccA, long double *AccB);
+void	AccumulatePowersA(int NumPowers, vector <rPowers> &Powers, vector <long double> &r1Pow, vector <long double> &r2Pow, vector <long double> &r3Pow, vector <long double> &r12Pow, vector <long double> &r13Pow, vector <long double> &r23Pow,
+			long double CoeffFinal, long double fOuterC1, long double fOuterC2, long double *AccA);
+void	CreateRPowerLUT(vector <long double> &LUT, long double r, int Omega);
+void	VecGaussIntegrationPhi23_PhiLCBar_PhiLSBar(vector <double> &AResults, vector <double> &BResults, int l, int nR1, int nR2Leg, int nR2Lag, int nR3Leg, int nR3Lag, int nR12, int nR13, int nPhi23, double CuspR2, double CuspR3, int CuspRule, int PhiRule, double kappa, double mu, int shpower, int sf, int NumPowers, vector <rPowers> &Powers, int Omega, double Lambda1, double Lambda2, double Lambda3, int ErrorEstimate, vector <double> &AErrors, vector <double> &BErrors, int Derivatives, vector <double> &ADerivs, vector <double> &BDerivs);
+void	VecGaussIntegrationPhi13_PhiLCBar_PhiLSBar_R23Term(vector <double> &AResults, vector <double> &BResults, int l, int nR1, int nR2Leg, int nR2Lag, int nR3Leg, int nR3Lag, int nR12, int nPhi13, int nR23, double CuspR2, double CuspR3, int CuspRule, int PhiRule, double kappa, double mu, int shpower, int sf, int NumPowers, vector <rPowers> &Powers, int Omega, double Lambda1, double Lambda2, double Lambda3, int ErrorEstimate, vector <double> &AErrors, vector <double> &BErrors, int Derivatives, vector <double> &ADerivs, vector <double> &BDerivs);
 void	VecGaussIntegrationPhi12_PhiLCBar_PhiLSBar_R23Term(vector <double> &AResults, vector <double> &BResults, int l, int nR1, int nR2Leg, int nR2Lag, int nR3Leg, int nR3Lag, int nPhi12, int nR13, int nR23, double CuspR2, double CuspR3, double kappa, double mu, int shpower, int sf, int NumPowers, vector <rPowers> &Powers, int Omega, double Lambda1, double Lambda2, double Lambda3);
-void	VecGaussIntegrationPhi23_PhiLCBar_PhiLSBar_Full(vector <double> &AResults, vector <double> &BResults, int l, int nR1, int nR2Leg, int nR2Lag, int nR3Leg, int nR3Lag, int nR12, int nR13, int nPhi23, double CuspR2, double CuspR3, double kappa, double mu, int shpower, int sf, int NumPowers, vector <rPowers> &Powers, int Omega, double Lambda1, double Lambda2, double Lambda3);
+void	VecGaussIntegrationPhi23_PhiLCBar_PhiLSBar_Full(vector <double> &AResults, vector <double> &BResults, int l, int nR1, int nR2Leg, int nR2Lag, int nR3Leg, int nR3Lag, int nR12, int nR13, int nPhi23, double CuspR2, double CuspR3, int CuspRule, int PhiRule, double kappa, double mu, int shpower, int sf, int NumPowers, vector <rPowers> &Powers, int Omega, double Lambda1, double Lambda2, double Lambda3, int ErrorEstimate, vector <double> &AErrors, vector <double> &BErrors, int Derivatives, vector <double> &ADerivs, vector <double> &BDerivs);
+
+// Quasi-Monte Carlo Integration.cpp
+void	QmcIntegrationPhi23_PhiLCBar_PhiLSBar_Full(vector <double> &AResults, vector <double> &BResults, int l, int NumPoints, int NumShifts, double kappa, double mu, int shpower, int sf,
+			int NumPowers, vector <rPowers> &Powers, int Omega, vector <double> &AErrors, vector <double> &BErrors);
+
+// Sparse Grid Integration.cpp
+void	Fejer2(int k, vector <long double> &Abscissas, vector <long double> &Weights);
+void	SparseIntegrationPhi23_PhiLCBar_PhiLSBar_Full(vector <double> &AResults, vector <double> &BResults, int l, int Level, double kappa, double mu, int shpower, int sf,
+			int NumPowers, vector <rPowers> &Powers, int Omega, int ErrorEstimate, vector <double> &AErrors, vector <double> &BErrors);
+int		SparseGridSize(int Level);
 
 // Short-Range.cpp
 double	Phi(rPowers &rp, double r1, double r2, double r3, double r12, double r13, double r23);
@@ -98,15 +226,25 @@ long double	sf_bessel_nl(int l, long double x);
 long double	fshielding(long double rho, long double mu, int power);
 long double	fshielding1(long double rho, long double mu, int power);
 long double	fshielding2(long double rho, long double mu, int power);
-void	GaussIntegrationPhi23_LongLong(int l, int nR1, int nR2Leg, int nR2Lag, int nR3Leg, int nR3Lag, int nR12, int nR13, int nPhi23, double CuspR2, double CuspR3, double kappa, double mu, int shpower, int sf, double &CLC, double &SLC, double &CLS, double &SLS);
+void	fshieldingMu(long double rho, long double mu, int power, long double &dfsh, long double &dfsh1, long double &dfsh2);
+void	GaussIntegrationPhi23_LongLong(int l, int nR1, int nR2Leg, int nR2Lag, int nR3Leg, int nR3Lag, int nR12, int nR13, int nPhi23, double CuspR2, double CuspR3, int CuspRule, int PhiRule, double kappa, double mu, int shpower, int sf, double &CLC, double &SLC, double &CLS, double &SLS, int ErrorEstimate, double &CLCErr, double &SLCErr, double &CLSErr, double &SLSErr);
 void	GaussIntegrationPhi12_LongLong_R23Term(int l, int nR1, int nR2Leg, int nR2Lag, int nR3Leg, int nR3Lag, int nPhi12, int nR13, int nR23, double CuspR2, double CuspR3, double kappa, double mu, int shpower, int sf, double &CLC, double &SLC, double &CLS, double &SLS);
-void	GaussIntegrationPhi13_LongLong_R23Term(int l, int nR1, int nR2Leg, int nR2Lag, int nR3Leg, int nR3Lag, int nR12, int nPhi13, int nR23, double CuspR2, double CuspR3, double kappa, double mu, int shpower, int sf, double &CLC, double &SLC, double &CLS, double &SLS);
+void	GaussIntegrationPhi13_LongLong_R23Term(int l, int nR1, int nR2Leg, int nR2Lag, int nR3Leg, int nR3Lag, int nR12, int nPhi13, int nR23, double CuspR2, double CuspR3, int CuspRule, int PhiRule, double kappa, double mu, int shpower, int sf, double &CLC, double &SLC, double &CLS, double &SLS, int ErrorEstimate, double &CLCErr, double &SLCErr, double &CLSErr, double &SLSErr);
 
 // Phase Shift.cpp
-double	Kohn(int NumShortTerms, vector <double> &ARow, vector <double> &B, vector <double> ShortTerms, double SLS);
-double	InverseKohn(int NumShortTerms, vector <double> &ARow, vector <double> &B, vector <double> ShortTerms, double SLS);
-double	LuccheseKohn(int NumShortTerms, vector <double> &ARow, vector <double> &B, vector <double> ShortTerms, double SLS);
-double	ComplexKohnT(int NumShortTerms, vector <double> &ARow, vector <double> &B, vector <double> ShortTerms, double SLS);
+// Shared LDL^T factorization of the short-range block, with the border products G = [a b]^T S^-1 [a b].
+struct KohnFactor
+{
+	int Info;  // 0 if the factorization succeeded
+	vector <double> LDL;
+	vector <int> ipiv;
+	double Gaa, Gab, Gbb;
+};
+
+int	FactorKohn(int NumShortTerms, const vector <double> &ARow, const vector <double> &B, const vector <double> &ShortTerms, KohnFactor &Factor);
+double	Kohn(const vector <double> &ARow, const vector <double> &B, const KohnFactor &Factor, double SLS);
+double	InverseKohn(const vector <double> &ARow, const vector <double> &B, const KohnFactor &Factor, double SLS);
+double	ComplexKohnT(const vector <double> &ARow, const vector <double> &B, const KohnFactor &Factor, double SLS);
 
 
 #endif//PSH_SCATTERING_H
@@ -0,0 +1,202 @@
+// Randomized quasi-Monte Carlo integration of the short-range - long-range terms.  This is an alternative to the
+//  tensor-product Gauss rules in Vector Gaussian Integration.cpp, whose cost grows as the product of the point counts
+//  in all of the dimensions.  The integration is done over r1, r2, r3, r12, r13 and phi23 with scrambled Sobol points,
+//  and the error estimate comes from the spread of several independent randomizations.
+
+#include <vector>
+#include <iostream>
+#include <iomanip>
+#include <cstdio>
+#include <omp.h>
+#include "Ps-H Scattering.h"
+#include "Run Timing.h"
+using namespace std;
+
+extern long double PI;
+
+#define QMC_DIMS 6
+#define QMC_BITS 32
+
+
+// Primitive polynomials and initial direction numbers for dimensions 2-6 from S. Joe and F. Y. Kuo,
+//  "Constructing Sobol sequences with better two-dimensional projections" (new-joe-kuo-6.21201).
+//  The first dimension is the van der Corput sequence.
+static const int SobolS[QMC_DIMS-1] = { 1, 2, 3, 3, 4 };
+static const int SobolA[QMC_DIMS-1] = { 0, 1, 1, 2, 1 };
+static const int SobolM[QMC_DIMS-1][4] = { {1}, {1, 3}, {1, 3, 1}, {1, 1, 1}, {1, 1, 3, 3} };
+
+
+// xorshift64* generator for the scrambling.  A fixed seed gives every node the same point set, since each node
+//  only integrates its own part of the power table.
+class QmcRandom
+{
+	public:
+		QmcRandom(unsigned long long Seed) { State = Seed ? Seed : 0x9E3779B97F4A7C15ULL; return; }
+		unsigned int Next(void)
+		{
+			State ^= State >> 12;
+			State ^= State << 25;
+			State ^= State >> 27;
+			return (unsigned int)((State * 0x2545F4914F6CDD1DULL) >> 32);
+		}
+	private:
+		unsigned long long State;
+};
+
+
+static unsigned int Parity(unsigned int v)
+{
+	v ^= v >> 16;
+	v ^= v >> 8;
+	v ^= v >> 4;
+	v ^= v >> 2;
+	v ^= v >> 1;
+	return v & 1;
+}
+
+
+// Direction numbers for each dimension, with bit 31 as the first binary digit.
+void SobolDirections(vector <vector <unsigned int> > &V)
+{
+	V.resize(QMC_DIMS);
+	for (int d = 0; d < QMC_DIMS; d++)
+		V[d].resize(QMC_BITS);
+
+	for (int i = 0; i < QMC_BITS; i++)
+		V[0][i] = 1u << (31-i);
+
+	for (int d = 1; d < QMC_DIMS; d++) {
+		int s = SobolS[d-1], a = SobolA[d-1];
+		for (int i = 0; i < s; i++)
+			V[d][i] = (unsigned int)SobolM[d-1][i] << (31-i);
+		for (int i = s; i < QMC_BITS; i++) {
+			V[d][i] = V[d][i-s] ^ (V[d][i-s] >> s);
+			for (int k = 1; k < s; k++) {
+				if ((a >> (s-1-k)) & 1)
+					V[d][i] ^= V[d][i-k];
+			}
+		}
+	}
+	return;
+}
+
+
+// Random linear matrix scrambling (Matousek) followed by a random digital shift.  The scrambling matrix is lower
+//  triangular with ones on the diagonal, so the scrambled direction numbers still generate a (t,s)-sequence.
+void ScrambleDirections(vector <vector <unsigned int> > &V, vector <vector <unsigned int> > &VScr, vector <unsigned int> &Shift, QmcRandom &Rand)
+{
+	VScr = V;
+	Shift.resize(QMC_DIMS);
+	for (int d = 0; d < QMC_DIMS; d++) {
+		unsigned int Rows[QMC_BITS];
+		for (int k = 0; k < QMC_BITS; k++) {
+			int p = 31 - k;  // Bit position of digit k+1
+			unsigned int Higher = ~((2u << p) - 1u);  // Digits before this one
+			Rows[k] = (1u << p) | (Rand.Next() & Higher);
+		}
+		for (int i = 0; i < QMC_BITS; i++) {
+			unsigned int v = 0;
+			for (int k = 0; k < QMC_BITS; k++)
+				v |= Parity(Rows[k] & V[d][i]) << (31-k);
+			VScr[d][i] = v;
+		}
+		Shift[d] = Rand.Next();
+	}
+	return;
+}
+
+
+// Integrates the full short-long integrand (including the 2/r23 term) with NumShifts independent randomizations
+//  of NumPoints Sobol points each.  The mean is added to AResults and BResults, and its standard error is added to
+//  AErrors and BErrors.  The radial coordinates are sampled from the short-range exponentials alone, and r12, r13 and
+//  phi23 are uniform over their ranges.  There are no lambda parameters here: sampling with the faster decay of the
+//  Gauss-Laguerre mappings leaves the variance nearly infinite along r1 = r2.
+void QmcIntegrationPhi23_PhiLCBar_PhiLSBar_Full(vector <double> &AResults, vector <double> &BResults, int l, int NumPoints, int NumShifts, double kappa, double mu, int shpower, int sf,
+					int NumPowers, vector <rPowers> &Powers, int Omega, vector <double> &AErrors, vector <double> &BErrors)
+{
+	vector <vector <unsigned int> > V, VScr;
+	vector <unsigned int> Shift;
+	vector <vector <long double> > Shifts(NumShifts, vector <long double>(4*NumPowers, 0.0L));  // A then B results for each randomization
+	long double a1 = Powers[0].alpha, a2 = Powers[0].beta, a3 = Powers[0].gamma;
+	int Prog = 0;
+	QmcRandom Rand(0x5DEECE66DULL);
+
+	if (NumShifts < 2) {
+		cout << "At least 2 randomizations are needed for the QMC error estimate...using 2." << endl;
+		NumShifts = 2;
+		Shifts.resize(NumShifts, vector <long double>(4*NumPowers, 0.0L));
+	}
+
+	SobolDirections(V);
+
+	for (int r = 0; r < NumShifts; r++) {
+		ScrambleDirections(V, VScr, Shift, Rand);
+
+		#pragma omp parallel shared(VScr,Shift,Powers,Shifts)
+		{
+			vector <long double> TempA(2*NumPowers, 0.0L), TempB(2*NumPowers, 0.0L);
+			vector <long double> r1Pow(Omega+l+1), r2Pow(Omega+l+1), r3Pow(Omega+1), r12Pow(Omega+1), r13Pow(Omega+1), r23Pow(Omega+1);
+			ShortLongIntegrand Pt(l, kappa, mu, shpower, sf);
+			long double u[QMC_DIMS];
+
+			#pragma omp for schedule(static)
+			for (int i = 0; i < NumPoints; i++) {
+				ThreadTimer Busy;
+				// The point is found directly from the Gray code of i, so the iterations are independent.
+				unsigned int Gray = (unsigned int)i ^ ((unsigned int)i >> 1);
+				for (int d = 0; d < QMC_DIMS; d++) {
+					unsigned int x = Shift[d];
+					for (int b = 0; Gray >> b; b++) {
+						if ((Gray >> b) & 1)
+							x ^= VScr[d][b];
+					}
+					u[d] = ((long double)x + 0.5L) / 4294967296.0L;  // Never exactly 0 or 1
+				}
+
+				long double r23;
+				long double CoeffFinal = Pt.SetUnitCube(u, a1, a2, a3, r23) / NumPoints;
+
+				CreateRPowerLUT(r1Pow, Pt.r1, Omega+l);
+				CreateRPowerLUT(r2Pow, Pt.r2, Omega+l);
+				CreateRPowerLUT(r3Pow, Pt.r3, Omega);
+				CreateRPowerLUT(r12Pow, Pt.r12, Omega);
+				CreateRPowerLUT(r13Pow, Pt.r13, Omega);
+				CreateRPowerLUT(r23Pow, r23, Omega);
+
+				long double fOuterC1, fOuterS1, fOuterC2, fOuterS2;
+				Pt.OuterTerms(r23, fOuterC1, fOuterS1, fOuterC2, fOuterS2);
+				AccumulatePowers(NumPowers, Powers, r1Pow, r2Pow, r3Pow, r12Pow, r13Pow, r23Pow, CoeffFinal, fOuterC1, fOuterS1, fOuterC2, fOuterS2, &TempA[0], &TempB[0]);
+			}
+
+			#pragma omp critical(qmc)
+			for (int n = 0; n < 2*NumPowers; n++) {
+				Shifts[r][n] += TempA[n];
+				Shifts[r][2*NumPowers+n] += TempB[n];
+			}
+		}
+
+		WriteProgress(string("PhiLS and PhiLC QMC"), Prog, r, NumShifts);
+	}
+
+	// Mean and standard error of the mean over the randomizations
+	for (int n = 0; n < 4*NumPowers; n++) {
+		long double Mean = 0.0L, Var = 0.0L;
+		for (int r = 0; r < NumShifts; r++)
+			Mean += Shifts[r][n];
+		Mean /= NumShifts;
+		for (int r = 0; r < NumShifts; r++)
+			Var += (Shifts[r][n] - Mean) * (Shifts[r][n] - Mean);
+		long double StdErr = sqrtl(Var / (NumShifts * (NumShifts - 1.0L)));
+
+		if (n < 2*NumPowers) {
+			AResults[n] += Mean;
+			AErrors[n] += StdErr;
+		}
+		else {
+			BResults[n-2*NumPowers] += Mean;
+			BErrors[n-2*NumPowers] += StdErr;
+		}
+	}
+
+	return;
+}
@@ -0,0 +1,108 @@
+//
+// Run Timing.h: Wall time of each phase of PsHScattering, with steady_clock so that it is not affected by changes
+//  to the system clock.  Each process has one RunTimer (from GetRunTimer), and only one phase is running at a time:
+//  Begin ends the current phase and starts the next one, and time spent in the same phase more than once (MPI setup)
+//  is added up.  Inside the OpenMP loops of the integrations, a ThreadTimer at the top of the loop body adds the time
+//  of that iteration to the busy time of its thread, which shows how evenly the work is split between threads.
+//  The busy times are not kept when no phase is running (in the benchmark programs, for example).
+//
+
+#ifndef RUN_TIMING_H
+#define RUN_TIMING_H
+
+#include <vector>
+#include <chrono>
+#include <omp.h>
+using namespace std;
+
+#define PHASE_PARAMS 0
+#define PHASE_TABLES 1
+#define PHASE_MPI_SETUP 2
+#define PHASE_LONGLONG 3
+#define PHASE_LONGLONG_R23 4
+#define PHASE_SHORTLONG 5  // qi = 0, and everything except the r23 term
+#define PHASE_SHORTLONG_R23 6  // The 2/r23 term with qi = 0 (Gauss product rules only)
+#define PHASE_SHORTLONG_FULL 7  // qi > 0
+#define PHASE_GATHER 8
+#define PHASE_KOHN 9
+#define NUM_PHASES 10
+
+inline const char *PhaseName(int Phase)
+{
+	static const char *Names[NUM_PHASES] = { "parameter read", "table generation", "MPI setup", "long-long", "long-long r23", "short-long",
+		"short-long r23", "short-long full", "gather", "Kohn solves" };
+	return Names[Phase];
+}
+
+class RunTimer
+{
+	public:
+		RunTimer()
+		{
+			Start = chrono::steady_clock::now();
+			Current = -1;
+			NumThreads = omp_get_max_threads();
+			Seconds.assign(NUM_PHASES, 0.0);
+			ThreadBusy.assign(NUM_PHASES, vector <double>(NumThreads, 0.0));
+		}
+
+		void Begin(int Phase)
+		{
+			End();
+			Current = Phase;
+			PhaseStart = chrono::steady_clock::now();
+		}
+
+		void End(void)
+		{
+			if (Current >= 0)
+				Seconds[Current] += chrono::duration <double>(chrono::steady_clock::now() - PhaseStart).count();
+			Current = -1;
+		}
+
+		// Since the timer was created, which is at the start of the program
+		double Total(void)
+		{
+			return chrono::duration <double>(chrono::steady_clock::now() - Start).count();
+		}
+
+		int Current, NumThreads;
+		vector <double> Seconds;  // Indexed by phase
+		vector <vector <double> > ThreadBusy;  // Indexed by phase and then OpenMP thread
+	private:
+		chrono::steady_clock::time_point Start, PhaseStart;
+};
+
+
+// The same timer everywhere in the process, without needing a global definition in each program
+inline RunTimer &GetRunTimer(void)
+{
+	static RunTimer Timer;
+	return Timer;
+}
+
+
+class ThreadTimer
+{
+	public:
+		ThreadTimer()
+		{
+			Phase = GetRunTimer().Current;
+			if (Phase >= 0)
+				Start = chrono::steady_clock::now();
+		}
+
+		~ThreadTimer()
+		{
+			RunTimer &Timer = GetRunTimer();
+			int Thread = omp_get_thread_num();
+			if (Phase >= 0 && Thread < Timer.NumThreads)  // Each thread only writes its own entry.
+				Timer.ThreadBusy[Phase][Thread] += chrono::duration <double>(chrono::steady_clock::now() - Start).count();
+		}
+
+	private:
+		int Phase;
+		chrono::steady_clock::time_point Start;
+};
+
+#endif
@@ -0,0 +1,106 @@
+//
+// Short-Range Generator.cpp: Writes a synthetic short-range file in the binary format that ReadShortHeader reads, so
+//  that PsHScattering can be run and timed without going through the Fortran programs first.  The matrix elements
+//  are not physical, but PhiPhi is positive definite with a condition number below 5, and PhiHPhi is chosen so that
+//  the short-range - short-range block of A stays positive definite for kappa up to 2.  The long-range
+//  integrations only use the header, so their timings are the same as for a real file with this Omega and l.
+//
+//  Usage: ShortRangeGenerator Omega l output.psh [IsTriplet] [Ordering] [alpha beta gamma]
+//
+
+#include <iostream>
+#include <fstream>
+#include <vector>
+#include <stdlib.h>
+#include <math.h>
+#include "Ps-H Scattering.h"
+using namespace std;
+
+#define SHORT_MAGIC 0x31487350  // "PsH1"
+#define SHORT_VERSION 1
+#define SHORT_HEADER_LEN 80
+#define SHORT_DATA_FORMAT 8  // Matrix elements are doubles
+
+
+// The same layout as ReadShortHeader expects: 13 ints, the 3 nonlinear parameters and the length of the variable
+//  part of the header (none here).
+bool WriteShortHeader(ofstream &Out, int Omega, int NumShortTerms, int LValue, int IsTriplet, int Ordering, double Alpha, double Beta, double Gamma)
+{
+	int Ints[13] = { SHORT_MAGIC, SHORT_VERSION, SHORT_HEADER_LEN, SHORT_DATA_FORMAT, Omega, NumShortTerms, NumShortTerms, LValue,
+		1 /* Formalism */, IsTriplet, Ordering, 0 /* Integration type */, 1 /* Number of sets */ };
+	double Params[3] = { Alpha, Beta, Gamma };
+	int VarLen = 0;
+
+	Out.write((char*)Ints, sizeof(Ints));
+	Out.write((char*)Params, sizeof(Params));
+	Out.write((char*)&VarLen, sizeof(int));
+	return !Out.fail();
+}
+
+
+// <phi_i|phi_j> = 1 on the diagonal and 0.5 * 0.4^|i-j| off of it.  The off-diagonal entries in each row add up to
+//  less than 2/3, so the eigenvalues are between 1/3 and 5/3.  <phi_i|H|phi_j> adds a diagonal between 0.5 and 1 to
+//  0.25 <phi_i|phi_j>.  Both are stored row by row, as in the files from the Fortran programs.
+void GenShortMatrices(int Size, vector <double> &PhiPhi, vector <double> &PhiHPhi)
+{
+	PhiPhi.resize(Size*Size);
+	PhiHPhi.resize(Size*Size);
+	for (int i = 0; i < Size; i++) {
+		for (int j = 0; j < Size; j++) {
+			PhiPhi[i*Size+j] = i == j ? 1.0 : 0.5 * pow(0.4, abs(i-j));
+			PhiHPhi[i*Size+j] = 0.25 * PhiPhi[i*Size+j];
+		}
+		PhiHPhi[i*Size+i] += 0.5 + 0.5 * i / Size;
+	}
+}
+
+
+int main(int argc, char *argv[])
+{
+	int Omega, l, IsTriplet = 0, Ordering = 0, NumShortTerms;
+	double Alpha = 0.6, Beta = 0.5, Gamma = 0.55;
+	vector <double> PhiPhi, PhiHPhi;
+
+	if (argc < 4 || argc == 7 || argc == 8 || argc > 9) {
+		cerr << "Usage: ShortRangeGenerator Omega l output.psh [IsTriplet] [Ordering] [alpha beta gamma]" << endl;
+		return 1;
+	}
+	Omega = atoi(argv[1]);
+	l = atoi(argv[2]);
+	if (argc > 4) IsTriplet = atoi(argv[4]);
+	if (argc > 5) Ordering = atoi(argv[5]);
+	if (argc > 6) {
+		Alpha = atof(argv[6]);
+		Beta = atof(argv[7]);
+		Gamma = atof(argv[8]);
+	}
+
+	// The same limits that ReadShortHeader checks
+	if (Omega < -1 || l < 0 || l > 8 || (IsTriplet != 0 && IsTriplet != 1) || (Ordering != 0 && Ordering != 1) || Alpha <= 0.0 || Beta <= 0.0 || Gamma <= 0.0) {
+		cerr << "Omega must be at least -1, l from 0 to 8, IsTriplet and Ordering 0 or 1, and alpha, beta and gamma positive." << endl;
+		return 2;
+	}
+
+	ofstream Out(argv[3], ios::out | ios::binary);
+	if (Out.fail()) {
+		cerr << "Unable to open file " << argv[3] << " for writing." << endl;
+		return 3;
+	}
+
+	// PsHScattering reads (2*NumShortTerms)^2 entries for each matrix, one block for each symmetry.
+	NumShortTerms = CalcPowerTableSize(Omega);
+	WriteShortHeader(Out, Omega, NumShortTerms, l, IsTriplet, Ordering, Alpha, Beta, Gamma);
+	if (NumShortTerms > 0) {
+		GenShortMatrices(NumShortTerms*2, PhiPhi, PhiHPhi);
+		Out.write((char*)&PhiPhi[0], PhiPhi.size()*sizeof(double));
+		Out.write((char*)&PhiHPhi[0], PhiHPhi.size()*sizeof(double));
+	}
+	Out.close();
+	if (Out.fail()) {
+		cerr << "Could not write " << argv[3] << endl;
+		return 3;
+	}
+
+	cout << "Wrote " << argv[3] << ": Omega = " << Omega << ", l = " << l << ", " << NumShortTerms << " terms" << endl;
+	return 0;
+}
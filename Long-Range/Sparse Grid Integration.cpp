@@ -0,0 +1,209 @@
+// Smolyak sparse grid integration of the short-range - long-range terms.  This is built on nested Fejer type 2 rules in
+//  each of r1, r2, r3, r12, r13 and phi23 over the same unit cube mapping as the QMC engine, so the number of points is
+//  set by a single level instead of eight point counts.  The rules are open, so the infinite radial mappings are never
+//  evaluated at u = 1.
+
+#include <vector>
+#include <map>
+#include <iostream>
+#include <iomanip>
+#include <cstdio>
+#include <cstdlib>
+#include <omp.h>
+#include "Ps-H Scattering.h"
+#include "Run Timing.h"
+using namespace std;
+
+extern long double PI;
+
+#define SPARSE_DIMS 6
+#define SPARSE_KEY_BITS 10  // Bits per dimension in a point key, so levels up to 9 are allowed
+
+
+// Fejer type 2 rule on [0,1] with n = 2^k - 1 points.  The points of level k are every other point of level k+1.
+void Fejer2(int k, vector <long double> &Abscissas, vector <long double> &Weights)
+{
+	int n = (1 << k) - 1;
+	Abscissas.resize(n);
+	Weights.resize(n);
+	for (int j = 1; j <= n; j++) {
+		long double Theta = j * PI / (n + 1);
+		long double Sum = 0.0L;
+		for (int p = 1; p <= (n + 1) / 2; p++)
+			Sum += sinl((2*p - 1) * Theta) / (2*p - 1);
+		Abscissas[j-1] = 0.5L * (1.0L - cosl(Theta));
+		Weights[j-1] = 2.0L * sinl(Theta) / (n + 1) * Sum;  // Half of the [-1,1] weight
+	}
+	return;
+}
+
+
+long double Binomial(int n, int k)
+{
+	long double b = 1.0L;
+	for (int i = 1; i <= k; i++)
+		b = b * (n - k + i) / i;
+	return b;
+}
+
+
+// Adds the Smolyak combination technique weights for the given level to the combined weight of each distinct point.
+//  Points are keyed by their index at the finest level MaxK in every dimension, which works because the rules are
+//  nested.  Which tells whether this is the main level (0) or the level below it for the error estimate (1).
+void SmolyakWeights(int Level, int MaxK, int Which, map <unsigned long long, pair <long double, long double> > &Points)
+{
+	int L = Level + SPARSE_DIMS;  // Sum of the 1-D levels, each of which is at least 1
+	vector <vector <long double> > Abscissas(MaxK+1), Weights(MaxK+1);
+	for (int k = 1; k <= MaxK; k++)
+		Fejer2(k, Abscissas[k], Weights[k]);
+
+	// Loop over all multi-indices with 1 <= k[d] and sum(k) <= L, keeping the last SPARSE_DIMS layers.
+	int k[SPARSE_DIMS];
+	for (int d = 0; d < SPARSE_DIMS; d++)
+		k[d] = 1;
+	while (1) {
+		int Sum = 0;
+		for (int d = 0; d < SPARSE_DIMS; d++)
+			Sum += k[d];
+		if (Sum <= L && Sum >= L - SPARSE_DIMS + 1) {
+			long double Coeff = ((L - Sum) % 2 ? -1.0L : 1.0L) * Binomial(SPARSE_DIMS-1, L - Sum);
+
+			// Tensor product of the 1-D rules with levels k
+			int j[SPARSE_DIMS];
+			for (int d = 0; d < SPARSE_DIMS; d++)
+				j[d] = 0;
+			while (1) {
+				unsigned long long Key = 0;
+				long double w = Coeff;
+				for (int d = 0; d < SPARSE_DIMS; d++) {
+					Key = (Key << SPARSE_KEY_BITS) | ((unsigned long long)(j[d] + 1) << (MaxK - k[d]));
+					w *= Weights[k[d]][j[d]];
+				}
+				if (Which == 0) Points[Key].first += w;
+				else Points[Key].second += w;
+
+				int d = 0;
+				for (; d < SPARSE_DIMS; d++) {
+					if (++j[d] < (int)Weights[k[d]].size()) break;
+					j[d] = 0;
+				}
+				if (d == SPARSE_DIMS) break;
+			}
+		}
+
+		// Next multi-index with sum(k) <= L
+		int d = 0;
+		for (; d < SPARSE_DIMS; d++) {
+			k[d]++;
+			int Total = 0;
+			for (int e = 0; e < SPARSE_DIMS; e++)
+				Total += k[e];
+			if (Total <= L) break;
+			k[d] = 1;
+		}
+		if (d == SPARSE_DIMS) break;
+	}
+	return;
+}
+
+
+// Integrates the full short-long integrand (including the 2/r23 term) with a Smolyak sparse grid of the given level.
+//  The error estimate is the difference from the grid one level lower, which shares most of its points.
+void SparseIntegrationPhi23_PhiLCBar_PhiLSBar_Full(vector <double> &AResults, vector <double> &BResults, int l, int Level, double kappa, double mu, int shpower, int sf,
+					int NumPowers, vector <rPowers> &Powers, int Omega, int ErrorEstimate, vector <double> &AErrors, vector <double> &BErrors)
+{
+	map <unsigned long long, pair <long double, long double> > PointMap;
+	vector <unsigned long long> Keys;
+	vector <long double> Weights, WeightsLower;
+	vector <long double> AFinal(2*NumPowers, 0.0L), BFinal(2*NumPowers, 0.0L), ALower(2*NumPowers, 0.0L), BLower(2*NumPowers, 0.0L);
+	long double a1 = Powers[0].alpha, a2 = Powers[0].beta, a3 = Powers[0].gamma;
+	int Prog = 0;
+
+	if (Level < 0 || Level + 1 >= SPARSE_KEY_BITS) {
+		cout << "Sparse grid level must be between 0 and " << SPARSE_KEY_BITS - 2 << "...exiting." << endl;
+		exit(7);
+	}
+	ErrorEstimate = ErrorEstimate && Level > 0;
+
+	// The finest 1-D level used by the grid is Level+1.
+	int MaxK = Level + 1;
+	SmolyakWeights(Level, MaxK, 0, PointMap);
+	if (ErrorEstimate)
+		SmolyakWeights(Level - 1, MaxK, 1, PointMap);
+
+	// Points whose weights cancel completely are skipped.
+	for (map <unsigned long long, pair <long double, long double> >::iterator it = PointMap.begin(); it != PointMap.end(); it++) {
+		if (it->second.first == 0.0L && it->second.second == 0.0L)
+			continue;
+		Keys.push_back(it->first);
+		Weights.push_back(it->second.first);
+		WeightsLower.push_back(it->second.second);
+	}
+	int NumPoints = Keys.size();
+
+	#pragma omp parallel shared(Keys,Weights,WeightsLower,Powers,AFinal,BFinal,ALower,BLower)
+	{
+		vector <long double> TempA(2*NumPowers, 0.0L), TempB(2*NumPowers, 0.0L), TempALower(2*NumPowers, 0.0L), TempBLower(2*NumPowers, 0.0L);
+		vector <long double> r1Pow(Omega+l+1), r2Pow(Omega+l+1), r3Pow(Omega+1), r12Pow(Omega+1), r13Pow(Omega+1), r23Pow(Omega+1);
+		ShortLongIntegrand Pt(l, kappa, mu, shpower, sf);
+		long double u[SPARSE_DIMS];
+		unsigned long long Mask = (1ULL << SPARSE_KEY_BITS) - 1;
+
+		#pragma omp for schedule(guided)
+		for (int i = 0; i < NumPoints; i++) {
+			ThreadTimer Busy;
+			for (int d = 0; d < SPARSE_DIMS; d++) {
+				long double Index = (long double)((Keys[i] >> (SPARSE_KEY_BITS * (SPARSE_DIMS-1-d))) & Mask);
+				u[d] = 0.5L * (1.0L - cosl(Index * PI / (1 << MaxK)));
+			}
+
+			long double r23;
+			long double Coeff = Pt.SetUnitCube(u, a1, a2, a3, r23);
+
+			CreateRPowerLUT(r1Pow, Pt.r1, Omega+l);
+			CreateRPowerLUT(r2Pow, Pt.r2, Omega+l);
+			CreateRPowerLUT(r3Pow, Pt.r3, Omega);
+			CreateRPowerLUT(r12Pow, Pt.r12, Omega);
+			CreateRPowerLUT(r13Pow, Pt.r13, Omega);
+			CreateRPowerLUT(r23Pow, r23, Omega);
+
+			long double fOuterC1, fOuterS1, fOuterC2, fOuterS2;
+			Pt.OuterTerms(r23, fOuterC1, fOuterS1, fOuterC2, fOuterS2);
+			if (Weights[i] != 0.0L)
+				AccumulatePowers(NumPowers, Powers, r1Pow, r2Pow, r3Pow, r12Pow, r13Pow, r23Pow, Coeff * Weights[i], fOuterC1, fOuterS1, fOuterC2, fOuterS2, &TempA[0], &TempB[0]);
+			if (ErrorEstimate && WeightsLower[i] != 0.0L)
+				AccumulatePowers(NumPowers, Powers, r1Pow, r2Pow, r3Pow, r12Pow, r13Pow, r23Pow, Coeff * WeightsLower[i], fOuterC1, fOuterS1, fOuterC2, fOuterS2, &TempALower[0], &TempBLower[0]);
+
+			if (i % 1000 == 0)
+				WriteProgress(string("PhiLS and PhiLC sparse grid"), Prog, i, (NumPoints + 999) / 1000);
+		}
+
+		#pragma omp critical(sparse)
+		for (int n = 0; n < 2*NumPowers; n++) {
+			AFinal[n] += TempA[n];
+			BFinal[n] += TempB[n];
+			ALower[n] += TempALower[n];
+			BLower[n] += TempBLower[n];
+		}
+	}
+
+	for (int n = 0; n < 2*NumPowers; n++) {
+		AResults[n] += AFinal[n];
+		BResults[n] += BFinal[n];
+		if (ErrorEstimate) {
+			AErrors[n] += fabsl(AFinal[n] - ALower[n]);
+			BErrors[n] += fabsl(BFinal[n] - BLower[n]);
+		}
+	}
+
+	return;
+}
+
+
+// Number of distinct points in the sparse grid of a given level, for reporting.
+int SparseGridSize(int Level)
+{
+	map <unsigned long long, pair <long double, long double> > PointMap;
+	SmolyakWeights(Level, Level + 1, 0, PointMap);
+	return PointMap.size();
+}
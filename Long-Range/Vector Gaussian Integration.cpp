@@ -5,6 +5,7 @@
 #include <omp.h>
 #include <gsl/gsl_sf_legendre.h>
 #include "Ps-H Scattering.h"
+#include "Run Timing.h"
 using namespace std;
 
 extern long double PI;
@@ -30,6 +31,133 @@ long double ipow1(long double a, int ex)
 }
 
 
+// Running sums for the embedded error estimates in the vectorized integrations.  The innermost loop accumulates
+//  into the last level, and each level is folded into the one outside it when its loop index finishes.  The fold
+//  also picks up the change from swapping in the embedded weight for that abscissa, so the innermost loop does no
+//  extra work.  The first half of each array is for A and the second half is for B.
+class EmbeddedSums
+{
+	public:
+		EmbeddedSums(int Size) : Sums(NUM_EMBEDDED_DIMS-1, vector <long double>(Size, 0.0L)), Coarse(Size, 0.0L), Diff(NUM_EMBEDDED_DIMS, vector <long double>(Size, 0.0L)) { return; }
+
+		// Folds Sums[Level] into Sums[Level-1], where Ratio is the embedded weight over the full weight.
+		void Fold(int Level, long double Ratio)
+		{
+			vector <long double> &Inner = Sums[Level], &Outer = Sums[Level-1], &d = Diff[Level];
+			for (unsigned int n = 0; n < Inner.size(); n++) {
+				d[n] += (Ratio - 1.0L) * Inner[n];
+				Outer[n] += Inner[n];
+				Inner[n] = 0.0L;
+			}
+		}
+
+		// The midpoint rule with nPhi/3 points uses every third angle of the nPhi point rule with 3 times the weight,
+		//  so the difference is 3*Coarse - (Fine + Coarse).
+		void FoldCoarse()
+		{
+			vector <long double> &Fine = Sums.back(), &d = Diff.back();
+			for (unsigned int n = 0; n < Fine.size(); n++) {
+				d[n] += 2.0L * Coarse[n] - Fine[n];
+				Fine[n] += Coarse[n];
+				Coarse[n] = 0.0L;
+			}
+		}
+
+		// Adds the differences for this r1 abscissa into Total.
+		void AddDiff(vector <vector <long double> > &Total, long double r1Ratio)
+		{
+			for (unsigned int n = 0; n < Sums[0].size(); n++) {
+				Total[0][n] += (r1Ratio - 1.0L) * Sums[0][n];
+				for (int d = 1; d < NUM_EMBEDDED_DIMS; d++)
+					Total[d][n] += Diff[d][n];
+			}
+		}
+
+		vector <vector <long double> > Sums;  // Sums[0] is the total for the current r1 abscissa.
+		vector <long double> Coarse;  // Innermost sum over the angles in the coarse midpoint rule
+		vector <vector <long double> > Diff;  // Embedded rule minus full rule along each dimension
+};
+
+
+// The error estimate for each matrix element is the sum of the magnitudes of the differences along each dimension.
+void AddEmbeddedErrors(vector <vector <long double> > &Diff, vector <double> &AErrors, vector <double> &BErrors, int NumPowers)
+{
+	for (int n = 0; n < 2*NumPowers; n++) {
+		long double AErr = 0.0L, BErr = 0.0L;
+		for (int d = 0; d < NUM_EMBEDDED_DIMS; d++) {
+			AErr += fabsl(Diff[d][n]);
+			BErr += fabsl(Diff[d][2*NumPowers+n]);
+		}
+		AErrors[n] += AErr;
+		BErrors[n] += BErr;
+	}
+}
+
+
+// Derivatives of the matrix elements for a single r1 abscissa with respect to mu and the exponents of the short-range
+//  terms.  The short-range terms have exp(-alpha*r1 - beta*r2 - gamma*r3), so d/dalpha of an integral is the same
+//  integral with an extra factor of -r1, and likewise for beta and gamma.  These come from what each r1, r2 and r3
+//  abscissa adds to the running totals, so only d/dmu needs anything in the inner loops.  The running totals are the
+//  embedded sums with error estimates and TempAResults and TempBResults otherwise.  The derivatives with respect to
+//  lambda are 0, since lambda only changes the quadrature.
+class ParamDerivSums
+{
+	public:
+		ParamDerivSums(int Size) : Sums(NUM_DERIVS, vector <long double>(2*Size, 0.0L)), Mark(3, vector <long double>(2*Size, 0.0L)), Now(2*Size, 0.0L) { return; }
+
+		// Records the running totals when the r2 (Level 1) or r3 (Level 2) loop moves to a new abscissa.
+		template <class T> void Start(int Level, EmbeddedSums &Emb, vector <T> &TempA, vector <T> &TempB)
+		{
+			Totals(Level, Emb, TempA, TempB, Mark[Level]);
+		}
+
+		// Adds -r times what the abscissa r at this level (0 for r1) added to the running totals.  This has to be
+		//  called before the embedded sums for the level are folded.
+		template <class T> void Finish(int Level, long double r, EmbeddedSums &Emb, vector <T> &TempA, vector <T> &TempB)
+		{
+			vector <long double> &d = Sums[DERIV_ALPHA+Level], &m = Mark[Level];
+			int Size = m.size() / 2;
+			Totals(Level, Emb, TempA, TempB, Now);
+			for (int n = 0; n < 2*Size; n++)
+				d[n] -= r * (Now[n] - m[n]);
+		}
+
+		// Adds the derivatives for this r1 abscissa into ADerivs and BDerivs.  The B side does not depend on mu.
+		void AddTo(vector <double> &ADerivs, vector <double> &BDerivs)
+		{
+			int Size = Mark[0].size() / 2;
+			for (int d = 0; d < NUM_DERIVS; d++) {
+				for (int n = 0; n < Size; n++) {
+					ADerivs[d*Size+n] += Sums[d][n];
+					BDerivs[d*Size+n] += Sums[d][Size+n];
+				}
+			}
+		}
+
+		vector <vector <long double> > Sums;  // A and then B for each derivative.  The inner loops add d/dmu of A to the first half of Sums[DERIV_MU].
+	private:
+		// Copies the running totals for this level (A and then B) into Out.
+		template <class T> void Totals(int Level, EmbeddedSums &Emb, vector <T> &TempA, vector <T> &TempB, vector <long double> &Out)
+		{
+			int Size = Out.size() / 2;
+			if (Emb.Sums[0].empty()) {
+				for (int n = 0; n < Size; n++) {
+					Out[n] = TempA[n];
+					Out[Size+n] = TempB[n];
+				}
+			}
+			else {
+				vector <long double> &e = Emb.Sums[Level];
+				for (int n = 0; n < 2*Size; n++)
+					Out[n] = e[n];
+			}
+		}
+
+		vector <vector <long double> > Mark;  // Running totals at the start of the current abscissa
+		vector <long double> Now;  // Running totals at the end of it
+};
+
+
 // Assumes that the LUT has already been allocated properly.
 void CreateRPowerLUT(vector <long double> &LUT, long double r, int Omega)
 {
@@ -166,8 +294,9 @@ long double AngR2Rhop(int l, long double r1, long double r3, long double Cos12,
 }
 
 
-// This is part of the Laplacian (plus kappa^2 term) acting on the parts of C22 depending on rho.
-long double LaplacianC(int l, long double kappa, long double rho, long double mu, int shpower)
+// This is part of the Laplacian (plus kappa^2 term) acting on the parts of C22 depending on rho.  It is linear in the
+//  first and second derivatives of the shielding function, fsh1 and fsh2, so passing d/dmu of those gives d/dmu of this.
+long double LaplacianCShielding(int l, long double kappa, long double rho, long double fsh1, long double fsh2)
 {
 	long double LC, kapparho = kappa*rho;
 	long double kapparho2 = kapparho*kapparho;
@@ -182,35 +311,35 @@ long double LaplacianC(int l, long double kappa, long double rho, long double mu
 	switch (l)
 	{
 		case 0:  // S-Wave
-			LC = -2.0L * kappa * SinKR * fshielding1(rho, mu, shpower) + CosKR * fshielding2(rho, mu, shpower);
+			LC = -2.0L * kappa * SinKR * fsh1 + CosKR * fsh2;
 			LC /= 2.0L * kapparho;
 			break;
 		case 1:  // P-Wave
-			LC = 2.0L * ((kapparho*kapparho - 1.0L) * CosKR - kapparho * SinKR) * fshielding1(rho, mu, shpower);
-			LC += rho * (CosKR + kapparho * SinKR) * fshielding2(rho, mu, shpower);
+			LC = 2.0L * ((kapparho*kapparho - 1.0L) * CosKR - kapparho * SinKR) * fsh1;
+			LC += rho * (CosKR + kapparho * SinKR) * fsh2;
 			LC /= 2.0L * kapparho*kapparho * rho;
 			break;
 		case 2:  // D-Wave
 			//cout << "What about the minus sign?" << endl;
 			//cout << "CosKR / SinKR" << endl;
 			//LC = fshielding1(rho, mu, shpower) / rho * (2.0L * n2rho - kappa*rho * n1rho) - 0.5L * fshielding2(rho, mu, shpower) * n2rho;
-			LC = 2.0L * (3.0L * (kapparho*kapparho - 2.0L) * CosKR + kapparho * (kapparho*kapparho - 6.0L) * SinKR) * fshielding1(rho, mu, shpower);
-			LC -= rho * ((kapparho*kapparho - 3.0L) * CosKR - 3.0L * kapparho * SinKR) * fshielding2(rho, mu, shpower);
+			LC = 2.0L * (3.0L * (kapparho*kapparho - 2.0L) * CosKR + kapparho * (kapparho*kapparho - 6.0L) * SinKR) * fsh1;
+			LC -= rho * ((kapparho*kapparho - 3.0L) * CosKR - 3.0L * kapparho * SinKR) * fsh2;
 			LC /= 2.0L * kapparho*kapparho*kapparho * rho;
 			break;
 		case 3:  // F-Wave
-			LC = 2.0L * ((45.0L - 21.0L * kapparho*kapparho + kapparho*kapparho*kapparho*kapparho) * CosKR + 3.0L * kapparho * (15.0L - 2.0L * kapparho*kapparho) * SinKR) * fshielding1(rho, mu, shpower);
-			LC += rho * (3.0L * (2.0L * kapparho*kapparho - 5.0L) * CosKR + kapparho * (kapparho*kapparho - 15.0L) * SinKR) * fshielding2(rho, mu, shpower);
+			LC = 2.0L * ((45.0L - 21.0L * kapparho*kapparho + kapparho*kapparho*kapparho*kapparho) * CosKR + 3.0L * kapparho * (15.0L - 2.0L * kapparho*kapparho) * SinKR) * fsh1;
+			LC += rho * (3.0L * (2.0L * kapparho*kapparho - 5.0L) * CosKR + kapparho * (kapparho*kapparho - 15.0L) * SinKR) * fsh2;
 			LC /= -2.0L * kapparho*kapparho*kapparho*kapparho * rho;
 			break;
 		case 4:  // G-Wave
-			LC = 2.0L * (5.0L * (84.0L - 39.0L * kapparho2 + 2.0L * kapparho4) * CosKR + kapparho * (420.0L-55.0L * kapparho2+kapparho4) * SinKR) * fshielding1(rho, mu, shpower);
-			LC -= rho * ((105.0L - 45.0L * kapparho2 + kapparho4) * CosKR+5.0L * kapparho * (21.0L-2.0L * kapparho2) * SinKR) * fshielding2(rho, mu, shpower);
+			LC = 2.0L * (5.0L * (84.0L - 39.0L * kapparho2 + 2.0L * kapparho4) * CosKR + kapparho * (420.0L-55.0L * kapparho2+kapparho4) * SinKR) * fsh1;
+			LC -= rho * ((105.0L - 45.0L * kapparho2 + kapparho4) * CosKR+5.0L * kapparho * (21.0L-2.0L * kapparho2) * SinKR) * fsh2;
 			LC /= -2.0L * kapparho*kapparho*kapparho*kapparho*kapparho * rho;
 			break;
 		case 5:  // H-Wave
-			LC = 2.0L * ((-4725.0L+2205.0L * kapparho2 - 120.0L * kapparho4+kapparho2*kapparho4) * CosKR-15.0L * kapparho * (315.0L-42.0L * kapparho2+kapparho4) * SinKR) * fshielding1(rho, mu, shpower);
-			LC += rho * (15.0L * (63.0L-28.0L * kapparho2+kapparho4) * CosKR+kapparho * (945.0L-105.0L * kapparho2+kapparho4) * SinKR) * fshielding2(rho, mu, shpower);
+			LC = 2.0L * ((-4725.0L+2205.0L * kapparho2 - 120.0L * kapparho4+kapparho2*kapparho4) * CosKR-15.0L * kapparho * (315.0L-42.0L * kapparho2+kapparho4) * SinKR) * fsh1;
+			LC += rho * (15.0L * (63.0L-28.0L * kapparho2+kapparho4) * CosKR+kapparho * (945.0L-105.0L * kapparho2+kapparho4) * SinKR) * fsh2;
 			LC /= 2.0L * kapparho2*kapparho4 * rho;
 			break;
 		case 6:  // I-Wave
@@ -224,18 +353,18 @@ long double LaplacianC(int l, long double kappa, long double rho, long double mu
 			long double LC2 = -62370.0L + 8505.0L * kapparho2 - 231.0L * kapparho4 + kapparho6;
 			long double LC3 = 10395.0L - 4725.0L * kapparho2 + 210.0L * kapparho4 - kapparho6;
 			long double LC4 = 495.0L - 60.0L * kapparho2 + kapparho4;
-			LC = 2.0L * (21.0L * LC1 * CosKR + kapparho * LC2 * SinKR) * fshielding1(rho, mu, shpower);
-			LC += rho * (LC3 * CosKR + 21.0L * kapparho * LC4 * SinKR) * fshielding2(rho, mu, shpower);
+			LC = 2.0L * (21.0L * LC1 * CosKR + kapparho * LC2 * SinKR) * fsh1;
+			LC += rho * (LC3 * CosKR + 21.0L * kapparho * LC4 * SinKR) * fsh2;
 			LC = LC / (-2.0L * kapparho7 * rho);
 			break;
 		case 7:  // K-Wave
-			LC = 2.0L * ((945945.0L-446985.0L * kapparho2+26775.0L * kapparho4-406.0L * kapparho2*kapparho4 + kapparho4*kapparho4) * CosKR+7.0L * kapparho * (135135.0L-18810.0L * kapparho2+558.0L * kapparho4-4.0L * kapparho2*kapparho4) * SinKR) * fshielding1(rho, mu, shpower);
-			LC += rho * (7.0L * (-19305.0L+8910.0L * kapparho2-450.0L * kapparho4+4.0L * kapparho2*kapparho4) * CosKR+kapparho * (-135135.0L+17325.0L * kapparho2-378.0L * kapparho4+kapparho2*kapparho4) * SinKR) * fshielding2(rho, mu, shpower);
+			LC = 2.0L * ((945945.0L-446985.0L * kapparho2+26775.0L * kapparho4-406.0L * kapparho2*kapparho4 + kapparho4*kapparho4) * CosKR+7.0L * kapparho * (135135.0L-18810.0L * kapparho2+558.0L * kapparho4-4.0L * kapparho2*kapparho4) * SinKR) * fsh1;
+			LC += rho * (7.0L * (-19305.0L+8910.0L * kapparho2-450.0L * kapparho4+4.0L * kapparho2*kapparho4) * CosKR+kapparho * (-135135.0L+17325.0L * kapparho2-378.0L * kapparho4+kapparho2*kapparho4) * SinKR) * fsh2;
 			LC /= 2.0L * kapparho4*kapparho4 * rho;
 			break;
 		case 8:  // L-Wave
-			LC = 2.0L * (9.0L * (1801800.0L - 855855.0L * kapparho*kapparho + 53130.0L * kapparho*kapparho*kapparho*kapparho - 910.0L * kappa*kappa*kappa*kappa*kappa*kappa * rho*rho*rho*rho*rho*rho + 4.0L * kappa*kappa*kappa*kappa*kappa*kappa*kappa*kappa * rho*rho*rho*rho*rho*rho*rho*rho) * CosKR + kapparho * (16216200.0L - 2297295.0L * kapparho*kapparho + 72765.0L * kapparho*kapparho*kapparho*kapparho - 666.0L * kappa*kappa*kappa*kappa*kappa*kappa * rho*rho*rho*rho*rho*rho + kappa*kappa*kappa*kappa*kappa*kappa*kappa*kappa * rho*rho*rho*rho*rho*rho*rho*rho) * SinKR) * fshielding1(rho, mu, shpower);
-			LC -= rho * ((2027025.0L - 945945.0L * kapparho * kapparho + 51975.0L * kapparho*kapparho*kapparho*kapparho - 630.0L * kappa*kappa*kappa*kappa*kappa*kappa * rho*rho*rho*rho*rho*rho + kappa*kappa*kappa*kappa*kappa*kappa*kappa*kappa * rho*rho*rho*rho*rho*rho*rho*rho) * CosKR - 9.0L * kapparho * (-225225.0L + 30030.0L * kapparho*kapparho - 770.0L * kapparho*kapparho*kapparho*kapparho + 4.0L * kappa*kappa*kappa*kappa*kappa*kappa * rho*rho*rho*rho*rho*rho) * SinKR) * fshielding2(rho, mu, shpower);
+			LC = 2.0L * (9.0L * (1801800.0L - 855855.0L * kapparho*kapparho + 53130.0L * kapparho*kapparho*kapparho*kapparho - 910.0L * kappa*kappa*kappa*kappa*kappa*kappa * rho*rho*rho*rho*rho*rho + 4.0L * kappa*kappa*kappa*kappa*kappa*kappa*kappa*kappa * rho*rho*rho*rho*rho*rho*rho*rho) * CosKR + kapparho * (16216200.0L - 2297295.0L * kapparho*kapparho + 72765.0L * kapparho*kapparho*kapparho*kapparho - 666.0L * kappa*kappa*kappa*kappa*kappa*kappa * rho*rho*rho*rho*rho*rho + kappa*kappa*kappa*kappa*kappa*kappa*kappa*kappa * rho*rho*rho*rho*rho*rho*rho*rho) * SinKR) * fsh1;
+			LC -= rho * ((2027025.0L - 945945.0L * kapparho * kapparho + 51975.0L * kapparho*kapparho*kapparho*kapparho - 630.0L * kappa*kappa*kappa*kappa*kappa*kappa * rho*rho*rho*rho*rho*rho + kappa*kappa*kappa*kappa*kappa*kappa*kappa*kappa * rho*rho*rho*rho*rho*rho*rho*rho) * CosKR - 9.0L * kapparho * (-225225.0L + 30030.0L * kapparho*kapparho - 770.0L * kapparho*kapparho*kapparho*kapparho + 4.0L * kappa*kappa*kappa*kappa*kappa*kappa * rho*rho*rho*rho*rho*rho) * SinKR) * fsh2;
 			LC /= 2.0L * kapparho*kapparho*kapparho*kapparho*kapparho*kapparho*kapparho*kapparho*kapparho * rho;
 			break;
 		default:
@@ -247,26 +376,196 @@ long double LaplacianC(int l, long double kappa, long double rho, long double mu
 }
 
 
-void VecGaussIntegrationPhi23_PhiLCBar_PhiLSBar(vector <double> &AResults, vector <double> &BResults, int l, int nR1, int nR2Leg, int nR2Lag, int nR3Leg, int nR3Lag, int nR12, int nR13, int nPhi23, double CuspR2, double CuspR3, double kappa, double mu, int shpower, int sf, int NumPowers, vector <rPowers> &Powers, int Omega, double Lambda1, double Lambda2, double Lambda3)
+long double LaplacianC(int l, long double kappa, long double rho, long double mu, int shpower)
+{
+	return LaplacianCShielding(l, kappa, rho, fshielding1(rho, mu, shpower), fshielding2(rho, mu, shpower));
+}
+
+
+ShortLongIntegrand::ShortLongIntegrand(int l, long double kappa, long double mu, int shpower, int sf, bool MuDerivs)
+{
+	this->l = l;
+	this->kappa = kappa;
+	this->mu = mu;
+	this->shpower = shpower;
+	this->sf = sf;
+	this->MuDerivs = MuDerivs;
+	return;
+}
+
+
+// Sets up the parts of the integrand that depend only on r1, r2, r3 and r12.
+void ShortLongIntegrand::SetR12(long double r1, long double r2, long double r3, long double r12)
+{
+	this->r1 = r1;
+	this->r2 = r2;
+	this->r3 = r3;
+	this->r12 = r12;
+	Cos12 = (r1*r1 + r2*r2 - r12*r12) / (2.0L*r1*r2);
+	Sin12 = sqrtl(1.0L - Cos12*Cos12);
+	rho = 0.5L * sqrtl(2.0L*(r1*r1 + r2*r2) - r12*r12);
+	jlrho = sf_bessel_jl(l, kappa*rho);
+	nlrho = sf_bessel_nl(l, kappa*rho);
+	ExpR12R3 = expl(-(r12/2.0L + r3));
+	return;
+}
+
+
+// Sets up the parts of the integrand that depend on r13 but not on phi23.  SetR12 has to be called first.
+void ShortLongIntegrand::SetR13(long double r13)
+{
+	this->r13 = r13;
+	Cos13 = (r1*r1 + r3*r3 - r13*r13) / (2.0L*r1*r3);
+	Sin13 = sqrtl(1.0L - Cos13*Cos13);
+	rhop = 0.5L * sqrtl(2.0L*(r1*r1 + r3*r3) - r13*r13);
+	jlrhop = sf_bessel_jl(l, kappa*rhop);
+	nlrhop = sf_bessel_nl(l, kappa*rhop);
+	ExpR13R2 = expl(-(r13/2.0L + r2));
+
+	// Phi1LS part
+	S22 = ExpR12R3 * jlrho;  // S22
+	S23 = ExpR13R2 * jlrhop;  // S23
+	AngPhi1S22 = AngR1Rho(l, r1, r2, Cos12, Sin12, rho);
+	AngPhi1S23 = AngR1Rhop(l, r1, r3, Cos13, Sin13, rhop);
+	// Phi2LS part
+	AngPhi2S22 = AngR2Rho(l, r1, r2, Cos12, Sin12, rho);
+	// Phi1LC part
+	//@TODO: Would this be better to do as the other form with phi and P_23 phi?
+	fshrho = fshielding(rho, mu, shpower);
+	fshrhop = fshielding(rhop, mu, shpower);
+	fsh1rho = LaplacianC(l, kappa, rho, mu, shpower);
+	fsh1rhop = LaplacianC(l, kappa, rhop, mu, shpower);
+	if (MuDerivs) {
+		long double dfsh1, dfsh2;
+		fshieldingMu(rho, mu, shpower, dfshrho, dfsh1, dfsh2);
+		dfsh1rho = LaplacianCShielding(l, kappa, rho, dfsh1, dfsh2);
+		fshieldingMu(rhop, mu, shpower, dfshrhop, dfsh1, dfsh2);
+		dfsh1rhop = LaplacianCShielding(l, kappa, rhop, dfsh1, dfsh2);
+	}
+	return;
+}
+
+
+// Finds r23 from the angle phi23 between the r1-r2 and r1-r3 planes.
+long double ShortLongIntegrand::R23(long double Phi23)
+{
+	return sqrtl(r2*r2 + r3*r3 - 2.0L*r2*r3*(Sin12*Sin13*cosl(Phi23) + Cos12*Cos13));
+}
+
+
+// Finds r23 for every angle of the rule at once.
+void ShortLongIntegrand::R23(AngularRule &Phi, long double *r23)
+{
+	Phi.Distances(r2*r2 + r3*r3 - 2.0L*r2*r3*Cos12*Cos13, 2.0L*r2*r3*Sin12*Sin13, r23);
+	return;
+}
+
+
+// Maps a point u in the 6-D unit cube to r1, r2, r3, r12, r13 and phi23 for the QMC and sparse grid engines.  The
+//  radial coordinates are exponentially distributed with rates a1, a2 and a3, and r12, r13 and phi23 are uniform over
+//  their ranges.  Returns the full weight of the point relative to the Gauss kernels, apart from the rule weight.
+long double ShortLongIntegrand::SetUnitCube(long double *u, long double a1, long double a2, long double a3, long double &r23)
+{
+	long double r1 = -logl(1.0L - u[0]) / a1;
+	long double r2 = -logl(1.0L - u[1]) / a2;
+	long double r3 = -logl(1.0L - u[2]) / a3;
+	long double a12 = fabsl(r1-r2), b12 = r1+r2;
+	long double a13 = fabsl(r1-r3), b13 = r1+r3;
+
+	SetR12(r1, r2, r3, a12 + u[3]*(b12-a12));
+	SetR13(a13 + u[4]*(b13-a13));
+	r23 = R23(PI * u[5]);
+
+	// The factor of 4 matches the (b-a) Legendre scaling in the Gauss kernels.
+	return sqrtl(kappa) * 0.70710678118654752440L * 4.0L * PI * (b12-a12) * (b13-a13) * r2 * r3 * r12 * r13 / (a1 * a2 * a3);
+}
+
+
+// Calculates the long-range parts of the integrand for the phi1 and phi2 short-range terms.  If fOuterMu is given, it
+//  gets d/dmu of fOuterC1 and fOuterC2, which needs MuDerivs to have been set.
+void ShortLongIntegrand::OuterTerms(long double r23, long double &fOuterC1, long double &fOuterS1, long double &fOuterC2, long double &fOuterS2, long double *fOuterMu)
+{
+	long double Cos23 = (r2*r2 + r3*r3 - r23*r23) / (2.0L*r2*r3);
+	long double PotP = 2.0L/r1 - 2.0L/r3 - 2.0L/r12 + 2.0L/r23;
+	long double Pot = 2.0L/r1 - 2.0L/r2 - 2.0L/r13 + 2.0L/r23;
+
+	// Phi1LS part
+	fOuterS1 = AngPhi1S22 * Pot * S22 + sf * AngPhi1S23 * PotP * S23;
+
+	// Phi1LC part
+	fOuterC1 = -AngPhi1S22 * ExpR12R3 * (Pot * nlrho * fshrho + fsh1rho);
+	fOuterC1 -= sf * AngPhi1S23 * ExpR13R2 * (PotP * nlrhop * fshrhop + fsh1rhop);
+
+	// Phi2LS part
+	long double AngPhi2S23 = AngR2Rhop(l, r1, r3, Cos12, Cos13, Cos23, rhop);
+	fOuterS2 = AngPhi2S22 * Pot * S22 + sf * AngPhi2S23 * PotP * S23;
+
+	// Phi2LC part
+	fOuterC2 = -AngPhi2S22 * ExpR12R3 * (Pot * nlrho * fshrho + fsh1rho);
+	fOuterC2 -= sf * AngPhi2S23 * ExpR13R2 * (PotP * nlrhop * fshrhop + fsh1rhop);
+
+	if (fOuterMu != NULL) {
+		fOuterMu[0] = -AngPhi1S22 * ExpR12R3 * (Pot * nlrho * dfshrho + dfsh1rho) - sf * AngPhi1S23 * ExpR13R2 * (PotP * nlrhop * dfshrhop + dfsh1rhop);
+		fOuterMu[1] = -AngPhi2S22 * ExpR12R3 * (Pot * nlrho * dfshrho + dfsh1rho) - sf * AngPhi2S23 * ExpR13R2 * (PotP * nlrhop * dfshrhop + dfsh1rhop);
+	}
+	return;
+}
+
+
+// Adds the contribution of a single integration point to every term in the power table.  The first NumPowers
+//  entries of AccA and AccB are for phi1, and the next NumPowers are for phi2.
+void AccumulatePowers(int NumPowers, vector <rPowers> &Powers, vector <long double> &r1Pow, vector <long double> &r2Pow, vector <long double> &r3Pow, vector <long double> &r12Pow, vector <long double> &r13Pow, vector <long double> &r23Pow,
+					  long double CoeffFinal, long double fOuterC1, long double fOuterS1, long double fOuterC2, long double fOuterS2, long double *AccA, long double *AccB)
+{
+	for (int n = 0; n < NumPowers; n++) {
+		rPowers *rp = &Powers[n];
+		long double Common = r12Pow[rp->mi] * r3Pow[rp->ni] * r13Pow[rp->pi] * r23Pow[rp->qi] * CoeffFinal;
+		long double Phi1andCoeff = r1Pow[rp->ki] * r2Pow[rp->li] * Common;
+		AccA[n] += Phi1andCoeff * fOuterC1;
+		AccB[n] += Phi1andCoeff * fOuterS1;
+		rp = &Powers[NumPowers+n];
+		long double Phi2andCoeff = r1Pow[rp->ki] * r2Pow[rp->li] * Common;
+		AccA[NumPowers+n] += Phi2andCoeff * fOuterC2;
+		AccB[NumPowers+n] += Phi2andCoeff * fOuterS2;
+	}
+	return;
+}
+
+
+// The same as AccumulatePowers for the A side only, which is all that d/dmu needs.
+void AccumulatePowersA(int NumPowers, vector <rPowers> &Powers, vector <long double> &r1Pow, vector <long double> &r2Pow, vector <long double> &r3Pow, vector <long double> &r12Pow, vector <long double> &r13Pow, vector <long double> &r23Pow,
+					  long double CoeffFinal, long double fOuterC1, long double fOuterC2, long double *AccA)
+{
+	for (int n = 0; n < NumPowers; n++) {
+		rPowers *rp = &Powers[n];
+		long double Common = r12Pow[rp->mi] * r3Pow[rp->ni] * r13Pow[rp->pi] * r23Pow[rp->qi] * CoeffFinal;
+		AccA[n] += r1Pow[rp->ki] * r2Pow[rp->li] * Common * fOuterC1;
+		rp = &Powers[NumPowers+n];
+		AccA[NumPowers+n] += r1Pow[rp->ki] * r2Pow[rp->li] * Common * fOuterC2;
+	}
+	return;
+}
+
+
+void VecGaussIntegrationPhi23_PhiLCBar_PhiLSBar(vector <double> &AResults, vector <double> &BResults, int l, int nR1, int nR2Leg, int nR2Lag, int nR3Leg, int nR3Lag, int nR12, int nR13, int nPhi23, double CuspR2, double CuspR3, int CuspRule, int PhiRule, double kappa, double mu, int shpower, int sf, int NumPowers, vector <rPowers> &Powers, int Omega, double Lambda1, double Lambda2, double Lambda3, int ErrorEstimate, vector <double> &AErrors, vector <double> &BErrors, int Derivatives, vector <double> &ADerivs, vector <double> &BDerivs)
 {
-	vector <long double> LaguerreAbscissasR2, LaguerreWeightsR2, LegendreAbscissasR2, LegendreWeightsR2;
-	vector <long double> LaguerreAbscissasR3, LaguerreWeightsR3, LegendreAbscissasR3, LegendreWeightsR3;
 	vector <long double> LegendreAbscissasR12, LegendreWeightsR12;
 	vector <long double> LegendreAbscissasR13, LegendreWeightsR13;
 	vector <long double> r1Abscissas, r1Weights, r2Abscissas, r2Weights, r3Abscissas, r3Weights;
 	vector <long double> r12Array, r13Array;
+	vector <long double> r1Ratios, LegendreRatiosR12, LegendreRatiosR13, r2Ratios, r3Ratios;
+	vector <vector <long double> > Diff(NUM_EMBEDDED_DIMS, vector <long double>(ErrorEstimate ? 4*NumPowers : 0, 0.0L));
+	AngularRule Angles(nPhi23, PhiRule);
+	bool PhiEstimate = (ErrorEstimate && Angles.Nested);  // The coarse angular rule needs the midpoint rule with a multiple of 3 points.
 	int NumR2Points, NumR3Points, Prog = 0;
 	vector <long double> r1Pow(Omega+l+1), r2Pow(Omega+l+1), r3Pow(Omega+1), r12Pow(Omega+1), r13Pow(Omega+1), r23Pow(Omega+1);
 	long double SqrtKappa = sqrtl(kappa);
 
-	// Create the abscissas and weights for the needed number of points.
-	GaussLaguerre(r1Abscissas, r1Weights, nR1);
-	GaussLegendre(LegendreAbscissasR2, LegendreWeightsR2, nR2Leg);
-	GaussLaguerre(LaguerreAbscissasR2, LaguerreWeightsR2, nR2Lag);
-	GaussLegendre(LegendreAbscissasR3, LegendreWeightsR3, nR3Leg);
-	GaussLaguerre(LaguerreAbscissasR3, LaguerreWeightsR3, nR3Lag);
-	GaussLegendre(LegendreAbscissasR12, LegendreWeightsR12, nR12);
-	GaussLegendre(LegendreAbscissasR13, LegendreWeightsR13, nR13);
+	// Create the abscissas and weights for the needed number of points, along with the embedded rules.
+	LaguerreWithEstimate(r1Abscissas, r1Weights, r1Ratios, nR1, ErrorEstimate);
+	CuspSplitRule r2Rule(nR2Leg, nR2Lag, ErrorEstimate, CuspRule), r3Rule(nR3Leg, nR3Lag, ErrorEstimate, CuspRule);
+	LegendreWithEstimate(LegendreAbscissasR12, LegendreWeightsR12, LegendreRatiosR12, nR12, ErrorEstimate);
+	LegendreWithEstimate(LegendreAbscissasR13, LegendreWeightsR13, LegendreRatiosR13, nR13, ErrorEstimate);
 
 	r1Abscissas.resize(nR1);
 	r1Weights.resize(nR1);
@@ -275,17 +574,26 @@ void VecGaussIntegrationPhi23_PhiLCBar_PhiLSBar(vector <double> &AResults, vecto
 		r1Weights[m] = r1Weights[m] / (Powers[0].alpha + Lambda1);
 	}
 
-	#pragma omp parallel for shared(r1Abscissas,r1Weights,Powers) private(r12Array,r13Array,r2Abscissas,r2Weights,r3Abscissas,r3Weights,NumR2Points,NumR3Points) schedule(guided,1)
+	#pragma omp parallel for shared(r1Abscissas,r1Weights,Powers) private(r12Array,r13Array,r2Abscissas,r2Weights,r3Abscissas,r3Weights,r2Ratios,r3Ratios,NumR2Points,NumR3Points) schedule(guided,1)
 	for (int i = 0; i < nR1; i++) {  // r1 integration
+		ThreadTimer Busy;
 		vector <double> TempAResults(2*NumPowers, 0.0L), TempBResults(2*NumPowers, 0.0L);
 		vector <long double> r1Pow(Omega+l+1), r2Pow(Omega+l+1), r3Pow(Omega+1), r12Pow(Omega+1), r13Pow(Omega+1), r23Pow(Omega+1);
+		vector <long double> PhiDist(nPhi23);
+		EmbeddedSums Emb(ErrorEstimate ? 4*NumPowers : 0);
+		// With error estimates, the innermost loop accumulates into the embedded sums instead of TempAResults and TempBResults.
+		long double *FineA = NULL, *FineB = NULL, *CoarseA = NULL, *CoarseB = NULL;
+		if (ErrorEstimate) {
+			FineA = &Emb.Sums.back()[0];
+			FineB = &Emb.Sums.back()[2*NumPowers];
+			CoarseA = PhiEstimate ? &Emb.Coarse[0] : FineA;
+			CoarseB = PhiEstimate ? &Emb.Coarse[2*NumPowers] : FineB;
+		}
+		ParamDerivSums Der(Derivatives ? 2*NumPowers : 0);
+		long double *MuA = Derivatives ? &Der.Sums[DERIV_MU][0] : NULL;
 
 		WriteProgress(string("PhiLS and PhiLC"), Prog, i, nR1);
 
-		r2Abscissas.resize(nR2Leg + nR2Lag);
-		r2Weights.resize(nR2Leg + nR2Lag);
-		r3Abscissas.resize(nR3Leg + nR3Lag);
-		r3Weights.resize(nR3Leg + nR3Lag);
 		r12Array.resize(nR12);
 		r13Array.resize(nR13);
 
@@ -294,60 +602,24 @@ void VecGaussIntegrationPhi23_PhiLCBar_PhiLSBar(vector <double> &AResults, vecto
 		/*vector <double> r1Pow2(r1Pow.size());
 		for (int p = 0; p < r1Pow.size(); p++)
 			r1Pow2[p] = r1Pow[p];*/
-		long double ExpR1L2 = expl(-(Powers[0].beta + Lambda2)*r1);
-		long double ExpR1L3 = expl(-(Powers[0].gamma + Lambda3)*r1);
-
-		// If r1 is large enough, we just do Gauss-Laguerre.
-		if (r1 > CuspR2) {
-			for (int m = 0; m < nR2Lag; m++) {
-				r2Weights[m] = LaguerreWeightsR2[m] / (Powers[0].beta + Lambda2);
-				r2Abscissas[m] = LaguerreAbscissasR2[m] / (Powers[0].beta + Lambda2);
-			}
-			NumR2Points = nR2Lag;
-		}
-		// Do Gauss-Legendre for r2 integration over [0,r1] and then Gauss-Laguerre over [r1,inf).
-		else {
-			ChangeOfIntervalNoResize(LegendreAbscissasR2, r2Abscissas, 0.0L, r1);
-			NumR2Points = nR2Leg + nR2Lag;
-			for (int m = 0; m < nR2Leg; m++) {
-				r2Weights[m] = LegendreWeightsR2[m] * expl(-(Powers[0].beta + Lambda2)*r2Abscissas[m]) * (r1-0.0L)/2.0L;
-			}
-			for (int m = nR2Leg; m < NumR2Points; m++) {
-				r2Abscissas[m] = (LaguerreAbscissasR2[m-nR2Leg] + r1*(Powers[0].beta + Lambda2)) / (Powers[0].beta + Lambda2);
-				r2Weights[m] = LaguerreWeightsR2[m-nR2Leg] * ExpR1L2 / (Powers[0].beta + Lambda2);
-			}
-		}
+
+		// Gauss-Laguerre only if r1 is large, or else split the r2 integration at r1 for the cusp.
+		NumR2Points = r2Rule.Build(r1, CuspR2, Powers[0].beta + Lambda2, r2Abscissas, r2Weights, r2Ratios);
 
 		for (int j = 0; j < NumR2Points; j++) {  // r2 integration
 			long double r2 = r2Abscissas[j];
+			if (Derivatives) Der.Start(1, Emb, TempAResults, TempBResults);
 			long double a12 = fabs(r1-r2);
 			long double b12 = fabs(r1+r2);
 			CreateRPowerLUT(r2Pow, r2, Omega+l);
 			ChangeOfIntervalNoResize(LegendreAbscissasR12, r12Array, a12, b12);
 
-			// Cusp unimportant, so only do Gauss-Laguerre integration
-			if (r1 > CuspR3) {
-				for (int m = 0; m < nR3Lag; m++) {
-					r3Weights[m] = LaguerreWeightsR3[m] / (Powers[0].gamma + Lambda3);
-					r3Abscissas[m] = LaguerreAbscissasR3[m] / (Powers[0].gamma + Lambda3);
-				}
-				NumR3Points = nR3Lag;
-			}
-			// Do Gauss-Legendre for r3 integration over [0,r1] and then Gauss-Laguerre over [r1,inf).
-			else {
-				ChangeOfIntervalNoResize(LegendreAbscissasR3, r3Abscissas, 0.0L, r1);
-				NumR3Points = nR3Leg + nR3Lag;
-				for (int m = 0; m < nR3Leg; m++) {
-					r3Weights[m] = LegendreWeightsR3[m] * expl(-(Powers[0].gamma + Lambda3)*r3Abscissas[m]) * (r1-0.0L)/2.0L;
-				}
-				for (int m = nR3Leg; m < NumR3Points; m++) {
-					r3Abscissas[m] = (LaguerreAbscissasR3[m-nR3Leg] + r1*(Powers[0].gamma + Lambda3)) / (Powers[0].gamma + Lambda3);
-					r3Weights[m] = LaguerreWeightsR3[m-nR3Leg] * ExpR1L3 / (Powers[0].gamma + Lambda3);
-				}
-			}
+			// Gauss-Laguerre only if r1 is large, or else split the r3 integration at r1 for the cusp.
+			NumR3Points = r3Rule.Build(r1, CuspR3, Powers[0].gamma + Lambda3, r3Abscissas, r3Weights, r3Ratios);
 
 			for (int g = 0; g < NumR3Points; g++) {  // r3 integration
 				long double r3 = r3Abscissas[g];
+				if (Derivatives) Der.Start(2, Emb, TempAResults, TempBResults);
 				long double a13 = fabs(r1-r3);
 				long double b13 = fabs(r1+r3);
 				long double Coeff = r3Weights[g] * r2Weights[j] * r1Weights[i] * SqrtKappa * 0.70710678118654752440L * PI/nPhi23 * expl(Lambda1*r1 + Lambda2*r2 + Lambda3*r3);
@@ -401,6 +673,16 @@ void VecGaussIntegrationPhi23_PhiLCBar_PhiLSBar(vector <double> &AResults, vecto
 						long double AngPhi1C23 = AngPhi1S23;
 						long double fOuterC1 = -AngPhi1C22 * ExpR12R3 * (Pot * nlrho * fshrho + fsh1rho);
 						fOuterC1 -= sf * AngPhi1C23 * ExpR13R2 * (PotP * nlrhop * fshrhop + fsh1rhop);
+						// d/dmu of the shielding terms and of fOuterC1
+						long double dfshrho = 0.0L, dfshrhop = 0.0L, dfsh1rho = 0.0L, dfsh1rhop = 0.0L, fOuterC1Mu = 0.0L;
+						if (Derivatives) {
+							long double dfsh1, dfsh2;
+							fshieldingMu(rho, mu, shpower, dfshrho, dfsh1, dfsh2);
+							dfsh1rho = LaplacianCShielding(l, kappa, rho, dfsh1, dfsh2);
+							fshieldingMu(rhop, mu, shpower, dfshrhop, dfsh1, dfsh2);
+							dfsh1rhop = LaplacianCShielding(l, kappa, rhop, dfsh1, dfsh2);
+							fOuterC1Mu = -AngPhi1C22 * ExpR12R3 * (Pot * nlrho * dfshrho + dfsh1rho) - sf * AngPhi1C23 * ExpR13R2 * (PotP * nlrhop * dfshrhop + dfsh1rhop);
+						}
 
 						// Phi2LS part
 						//long double AngPhi2S22 = 1.0L - 3.0L/8.0L * r1*r1 * Sin12*Sin12 / (rho*rho);
@@ -408,9 +690,11 @@ void VecGaussIntegrationPhi23_PhiLCBar_PhiLSBar(vector <double> &AResults, vecto
 						// Phi2LC part
 						long double AngPhi2C22 = AngPhi2S22;
 
+						// The distances for every angle are found at once so that this vectorizes.
+						Angles.Distances(r2*r2 + r3*r3 - 2.0L*r2*r3*Cos12*Cos13, 2.0L*r2*r3*Sin12*Sin13, &PhiDist[0]);
 						for (int m = 1; m <= nPhi23; m++) {  // phi_23 integration
-							long double Phi23 = (2.0L*m - 1.0L)*PI/(2.0L*nPhi23);
-							long double r23 = sqrtl(r2*r2 + r3*r3 - 2.0L*r2*r3*(Sin12*Sin13*cosl(Phi23) + Cos12*Cos13));
+							long double r23 = PhiDist[m-1];
+							long double CoeffPhi = CoeffFinal * Angles.Weights[m-1];
 							long double Cos23 = (r2*r2 + r3*r3 - r23*r23) / (2.0L*r2*r3);
 							CreateRPowerLUT(r23Pow, r23, Omega);
 
@@ -426,21 +710,55 @@ void VecGaussIntegrationPhi23_PhiLCBar_PhiLSBar(vector <double> &AResults, vecto
 							fOuterC2 -= sf * AngPhi2C23 * ExpR13R2 * (PotP * nlrhop * fshrhop + fsh1rhop);
 
 							// Combine with phi for final values
-							for (int n = 0; n < NumPowers; n++) {
-								rPowers *rp = &Powers[n];
-								long double Common = r12Pow[rp->mi] * r3Pow[rp->ni] * r13Pow[rp->pi] * r23Pow[rp->qi] * CoeffFinal;
-								long double Phi1andCoeff = r1Pow[rp->ki] * r2Pow[rp->li] * Common;
-								TempAResults[n] += Phi1andCoeff * fOuterC1;
-								TempBResults[n] += Phi1andCoeff * fOuterS1;
-								rp = &Powers[NumPowers+n];
-								long double Phi2andCoeff = r1Pow[rp->ki] * r2Pow[rp->li] * Common;
-								TempAResults[NumPowers+n] += Phi2andCoeff * fOuterC2;
-								TempBResults[NumPowers+n] += Phi2andCoeff * fOuterS2;
+							if (ErrorEstimate) {
+								bool IsCoarse = (m % 3 == 2);  // Every third angle is also an abscissa of the coarse midpoint rule.
+								AccumulatePowers(NumPowers, Powers, r1Pow, r2Pow, r3Pow, r12Pow, r13Pow, r23Pow, CoeffPhi, fOuterC1, fOuterS1, fOuterC2, fOuterS2,
+									IsCoarse ? CoarseA : FineA, IsCoarse ? CoarseB : FineB);
+							}
+							else {
+								for (int n = 0; n < NumPowers; n++) {
+									rPowers *rp = &Powers[n];
+									long double Common = r12Pow[rp->mi] * r3Pow[rp->ni] * r13Pow[rp->pi] * r23Pow[rp->qi] * CoeffPhi;
+									long double Phi1andCoeff = r1Pow[rp->ki] * r2Pow[rp->li] * Common;
+									TempAResults[n] += Phi1andCoeff * fOuterC1;
+									TempBResults[n] += Phi1andCoeff * fOuterS1;
+									rp = &Powers[NumPowers+n];
+									long double Phi2andCoeff = r1Pow[rp->ki] * r2Pow[rp->li] * Common;
+									TempAResults[NumPowers+n] += Phi2andCoeff * fOuterC2;
+									TempBResults[NumPowers+n] += Phi2andCoeff * fOuterS2;
+								}
 							}
+							if (Derivatives) {
+								long double fOuterC2Mu = -AngPhi2C22 * ExpR12R3 * (Pot * nlrho * dfshrho + dfsh1rho) - sf * AngPhi2C23 * ExpR13R2 * (PotP * nlrhop * dfshrhop + dfsh1rhop);
+								AccumulatePowersA(NumPowers, Powers, r1Pow, r2Pow, r3Pow, r12Pow, r13Pow, r23Pow, CoeffPhi, fOuterC1Mu, fOuterC2Mu, MuA);
+							}
+						}
+						if (ErrorEstimate) {
+							if (PhiEstimate) Emb.FoldCoarse();
+							Emb.Fold(4, LegendreRatiosR13[p]);
 						}
 					}
+					if (ErrorEstimate) Emb.Fold(3, LegendreRatiosR12[k]);
 				}
+				if (Derivatives) Der.Finish(2, r3, Emb, TempAResults, TempBResults);
+				if (ErrorEstimate) Emb.Fold(2, r3Ratios[g]);
 			}
+			if (Derivatives) Der.Finish(1, r2, Emb, TempAResults, TempBResults);
+			if (ErrorEstimate) Emb.Fold(1, r2Ratios[j]);
+		}
+
+		if (ErrorEstimate) {
+			for (int n = 0; n < 2*NumPowers; n++) {
+				TempAResults[n] = Emb.Sums[0][n];
+				TempBResults[n] = Emb.Sums[0][2*NumPowers+n];
+			}
+			#pragma omp critical(embedded)
+			Emb.AddDiff(Diff, r1Ratios[i]);
+		}
+		if (Derivatives) {
+			Der.Finish(0, r1, Emb, TempAResults, TempBResults);
+			#pragma omp critical(derivs)
+			Der.AddTo(ADerivs, BDerivs);
 		}
 
 		//#pragma omp critical(build)
@@ -452,29 +770,31 @@ void VecGaussIntegrationPhi23_PhiLCBar_PhiLSBar(vector <double> &AResults, vecto
 		}
 	}
 
+	if (ErrorEstimate)
+		AddEmbeddedErrors(Diff, AErrors, BErrors, NumPowers);
+
 	return;
 }
 
 
-void VecGaussIntegrationPhi13_PhiLCBar_PhiLSBar_R23Term(vector <double> &AResults, vector <double> &BResults, int l, int nR1, int nR2Leg, int nR2Lag, int nR3Leg, int nR3Lag, int nR12, int nPhi13, int nR23, double CuspR2, double CuspR3, double kappa, double mu, int shpower, int sf, int NumPowers, vector <rPowers> &Powers, int Omega, double Lambda1, double Lambda2, double Lambda3)
+void VecGaussIntegrationPhi13_PhiLCBar_PhiLSBar_R23Term(vector <double> &AResults, vector <double> &BResults, int l, int nR1, int nR2Leg, int nR2Lag, int nR3Leg, int nR3Lag, int nR12, int nPhi13, int nR23, double CuspR2, double CuspR3, int CuspRule, int PhiRule, double kappa, double mu, int shpower, int sf, int NumPowers, vector <rPowers> &Powers, int Omega, double Lambda1, double Lambda2, double Lambda3, int ErrorEstimate, vector <double> &AErrors, vector <double> &BErrors, int Derivatives, vector <double> &ADerivs, vector <double> &BDerivs)
 {
-	vector <long double> LaguerreAbscissasR2, LaguerreWeightsR2, LegendreAbscissasR2, LegendreWeightsR2;
-	vector <long double> LaguerreAbscissasR3, LaguerreWeightsR3, LegendreAbscissasR3, LegendreWeightsR3;
 	vector <long double> LegendreAbscissasR12, LegendreWeightsR12;
 	vector <long double> LegendreAbscissasR23, LegendreWeightsR23;
 	vector <long double> r1Abscissas, r1Weights, r2Abscissas, r3Abscissas, r2Weights, r3Weights;
 	vector <long double> r23Array, r12Array;
+	vector <long double> r1Ratios, LegendreRatiosR12, LegendreRatiosR23, r2Ratios, r3Ratios;
+	vector <vector <long double> > Diff(NUM_EMBEDDED_DIMS, vector <long double>(ErrorEstimate ? 4*NumPowers : 0, 0.0L));
+	AngularRule Angles(nPhi13, PhiRule);
+	bool PhiEstimate = (ErrorEstimate && Angles.Nested);  // The coarse angular rule needs the midpoint rule with a multiple of 3 points.
 	int NumR2Points, NumR3Points, Prog = 0;
 	long double SqrtKappa = sqrtl(kappa);
 
-	// Create the abscissas and weights for the needed number of points.
-	GaussLaguerre(r1Abscissas, r1Weights, nR1);
-	GaussLegendre(LegendreAbscissasR2, LegendreWeightsR2, nR2Leg);
-	GaussLaguerre(LaguerreAbscissasR2, LaguerreWeightsR2, nR2Lag);
-	GaussLegendre(LegendreAbscissasR3, LegendreWeightsR3, nR3Leg);
-	GaussLaguerre(LaguerreAbscissasR3, LaguerreWeightsR3, nR3Lag);
-	GaussLegendre(LegendreAbscissasR12, LegendreWeightsR12, nR12);
-	GaussLegendre(LegendreAbscissasR23, LegendreWeightsR23, nR23);
+	// Create the abscissas and weights for the needed number of points, along with the embedded rules.
+	LaguerreWithEstimate(r1Abscissas, r1Weights, r1Ratios, nR1, ErrorEstimate);
+	CuspSplitRule r2Rule(nR2Leg, nR2Lag, ErrorEstimate, CuspRule), r3Rule(nR3Leg, nR3Lag, ErrorEstimate, CuspRule);
+	LegendreWithEstimate(LegendreAbscissasR12, LegendreWeightsR12, LegendreRatiosR12, nR12, ErrorEstimate);
+	LegendreWithEstimate(LegendreAbscissasR23, LegendreWeightsR23, LegendreRatiosR23, nR23, ErrorEstimate);
 
 	r1Abscissas.resize(nR1);
 	r1Weights.resize(nR1);
@@ -483,74 +803,49 @@ void VecGaussIntegrationPhi13_PhiLCBar_PhiLSBar_R23Term(vector <double> &AResult
 		r1Weights[m] = r1Weights[m] / (Powers[0].alpha + Lambda1);
 	}
 	
-	#pragma omp parallel for shared(r1Abscissas,r1Weights,Powers) private(r12Array,r23Array,r2Abscissas,r2Weights,r3Abscissas,r3Weights,NumR2Points,NumR3Points) schedule(guided,1)
+	#pragma omp parallel for shared(r1Abscissas,r1Weights,Powers) private(r12Array,r23Array,r2Abscissas,r2Weights,r3Abscissas,r3Weights,r2Ratios,r3Ratios,NumR2Points,NumR3Points) schedule(guided,1)
 	for (int i = 0; i < nR1; i++) {  // r1 integration
+		ThreadTimer Busy;
 		vector <long double> TempAResults(2*NumPowers, 0.0L), TempBResults(2*NumPowers, 0.0L);
 		vector <long double> r1Pow(Omega+l+1), r2Pow(Omega+l+1), r3Pow(Omega+1), r12Pow(Omega+1), r13Pow(Omega+1), r23Pow(Omega+1);
+		vector <long double> PhiDist(nPhi13);
+		EmbeddedSums Emb(ErrorEstimate ? 4*NumPowers : 0);
+		// With error estimates, the innermost loop accumulates into the embedded sums instead.
+		long double *FineA = &TempAResults[0], *FineB = &TempBResults[0], *CoarseA = FineA, *CoarseB = FineB;
+		if (ErrorEstimate) {
+			FineA = &Emb.Sums.back()[0];
+			FineB = &Emb.Sums.back()[2*NumPowers];
+			CoarseA = PhiEstimate ? &Emb.Coarse[0] : FineA;
+			CoarseB = PhiEstimate ? &Emb.Coarse[2*NumPowers] : FineB;
+		}
+		ParamDerivSums Der(Derivatives ? 2*NumPowers : 0);
+		long double *MuA = Derivatives ? &Der.Sums[DERIV_MU][0] : NULL;
 
 		WriteProgress(string("PhiLS and PhiLC R23"), Prog, i, nR1);
 
-		r2Abscissas.resize(nR2Leg + nR2Lag);
-		r2Weights.resize(nR2Leg + nR2Lag);
-		r3Abscissas.resize(nR3Leg + nR3Lag);
-		r3Weights.resize(nR3Leg + nR3Lag);
 		r12Array.resize(nR12);
 		r23Array.resize(nR23);
 
 		long double r1 = r1Abscissas[i];
 		CreateRPowerLUT(r1Pow, r1, Omega+l);
-		long double ExpR1L2 = expl(-(Powers[0].beta + Lambda2)*r1);
 
-		// If r1 is large enough, we just do Gauss-Laguerre.
-		if (r1 > CuspR2) {
-			for (int m = 0; m < nR2Lag; m++) {
-				r2Weights[m] = LaguerreWeightsR2[m] / (Powers[0].beta + Lambda2);
-				r2Abscissas[m] = LaguerreAbscissasR2[m] / (Powers[0].beta + Lambda2);
-			}
-			NumR2Points = nR2Lag;
-		}
-		// Do Gauss-Legendre for r2 integration over [0,r1] and then Gauss-Laguerre over [r1,inf).
-		else {
-			ChangeOfIntervalNoResize(LegendreAbscissasR2, r2Abscissas, 0.0L, r1);
-			NumR2Points = nR2Leg + nR2Lag;
-			for (int m = 0; m < nR2Leg; m++) {
-				r2Weights[m] = LegendreWeightsR2[m] * expl(-(Powers[0].beta + Lambda2)*r2Abscissas[m]) * (r1-0.0L)/2.0L;
-			}
-			for (int m = nR2Leg; m < NumR2Points; m++) {
-				r2Abscissas[m] = (LaguerreAbscissasR2[m-nR2Leg] + r1*(Powers[0].beta + Lambda2)) / (Powers[0].beta + Lambda2);
-				r2Weights[m] = LaguerreWeightsR2[m-nR2Leg] * ExpR1L2 / (Powers[0].beta + Lambda2);
-			}
-		}
+		// Gauss-Laguerre only if r1 is large, or else split the r2 integration at r1 for the cusp.
+		NumR2Points = r2Rule.Build(r1, CuspR2, Powers[0].beta + Lambda2, r2Abscissas, r2Weights, r2Ratios);
 
 		for (int j = 0; j < NumR2Points; j++) {  // r2 integration
 			long double r2 = r2Abscissas[j];
+			if (Derivatives) Der.Start(1, Emb, TempAResults, TempBResults);
 			long double a12 = fabs(r1-r2);
 			long double b12 = fabs(r1+r2);
 			CreateRPowerLUT(r2Pow, r2, Omega+l);
 			ChangeOfIntervalNoResize(LegendreAbscissasR12, r12Array, a12, b12);
 
-			if (r2 > CuspR3) {
-				for (int m = 0; m < nR3Lag; m++) {
-					r3Weights[m] = LaguerreWeightsR3[m] / (Powers[0].gamma + Lambda3);
-					r3Abscissas[m] = LaguerreAbscissasR3[m] / (Powers[0].gamma + Lambda3);
-				}
-				NumR3Points = nR3Lag;
-			}
-			// Do Gauss-Legendre for r3 integration over [0,r2] and then Gauss-Laguerre over [r2,inf).
-			else {
-				ChangeOfIntervalNoResize(LegendreAbscissasR3, r3Abscissas, 0.0L, r2);
-				NumR3Points = nR3Leg + nR3Lag;
-				for (int m = 0; m < nR3Leg; m++) {
-					r3Weights[m] = LegendreWeightsR3[m] * expl(-(Powers[0].gamma + Lambda3)*r3Abscissas[m]) * (r2-0.0L)/2.0L;
-				}
-				for (int m = nR3Leg; m < NumR3Points; m++) {
-					r3Abscissas[m] = (LaguerreAbscissasR3[m-nR3Leg] + r2*(Powers[0].gamma + Lambda3)) / (Powers[0].gamma + Lambda3);
-					r3Weights[m] = LaguerreWeightsR3[m-nR3Leg] * expl(-(Powers[0].gamma + Lambda3)*r2) / (Powers[0].gamma + Lambda3);
-				}
-			}
+			// Gauss-Laguerre only if r2 is large, or else split the r3 integration at r2 for the cusp.
+			NumR3Points = r3Rule.Build(r2, CuspR3, Powers[0].gamma + Lambda3, r3Abscissas, r3Weights, r3Ratios);
 
 			for (int g = 0; g < NumR3Points; g++) {  // r3 integration
 				long double r3 = r3Abscissas[g];
+				if (Derivatives) Der.Start(2, Emb, TempAResults, TempBResults);
 				long double a23 = fabs(r2-r3);
 				long double b23 = fabs(r2+r3);
 				long double Coeff = r3Weights[g] * r2Weights[j] * r1Weights[i] * SqrtKappa * 0.70710678118654752440L * PI/nPhi13 * expl(Lambda1*r1 + Lambda2*r2 + Lambda3*r3);
@@ -591,11 +886,19 @@ void VecGaussIntegrationPhi13_PhiLCBar_PhiLSBar_R23Term(vector <double> &AResult
 						// Phi2LC
 						long double AngPhi2C22 = AngPhi2S22;
 						long double fOuterC2Part = -AngPhi2C22 * ExpR12R3 * (Pot * nlrho * fshrho);
+						// d/dmu of the shielding function (this term has no Laplacian part)
+						long double dfshrho = 0.0L, dfshrhop, dfsh1, dfsh2;
+						if (Derivatives)
+							fshieldingMu(rho, mu, shpower, dfshrho, dfsh1, dfsh2);
 
+						// The distances for every angle are found at once so that this vectorizes.
+						Angles.Distances(r1*r1 + r3*r3 - 2.0L*r1*r3*Cos12*Cos23, 2.0L*r1*r3*Sin12*Sin23, &PhiDist[0]);
 						for (int m = 1; m <= nPhi13; m++) {  // phi_13 integration
-							//long double Phi13 = (2.0L*m - 1.0L)*PI/(2.0L*nPhi13);
-							long double Phi13 = (2*m - 1)*PI/(2*nPhi13);
-							long double r13 = sqrtl(r1*r1 + r3*r3 - 2.0L*r1*r3*(Sin12*Sin23*cosl(Phi13) + Cos12*Cos23));
+							// Every third angle is also an abscissa of the coarse midpoint rule.
+							bool IsCoarse = (m % 3 == 2);
+							long double *AccA = IsCoarse ? CoarseA : FineA, *AccB = IsCoarse ? CoarseB : FineB;
+							long double r13 = PhiDist[m-1];
+							long double CoeffPhi = CoeffFinal * Angles.Weights[m-1];
 							long double Cos13 = (r1*r1 + r3*r3 - r13*r13) / (2.0L*r1*r3);
 							long double Sin13 = sqrtl(1.0L - Cos13*Cos13);
 							CreateRPowerLUT(r13Pow, r13, Omega);
@@ -631,19 +934,48 @@ void VecGaussIntegrationPhi13_PhiLCBar_PhiLSBar_R23Term(vector <double> &AResult
 
 							for (int n = 0; n < NumPowers; n++) {
 								rPowers *rp = &Powers[n];
-								long double Common = r12Pow[rp->mi] * r3Pow[rp->ni] * r13Pow[rp->pi] * r23Pow[rp->qi] * CoeffFinal;
+								long double Common = r12Pow[rp->mi] * r3Pow[rp->ni] * r13Pow[rp->pi] * r23Pow[rp->qi] * CoeffPhi;
 								long double Phi1andCoeff = r1Pow[rp->ki] * r2Pow[rp->li] * Common;
-								TempAResults[n] += Phi1andCoeff * fOuterC1;
-								TempBResults[n] += Phi1andCoeff * fOuterS1;
+								AccA[n] += Phi1andCoeff * fOuterC1;
+								AccB[n] += Phi1andCoeff * fOuterS1;
 								rp = &Powers[NumPowers+n];
 								long double Phi2andCoeff = r1Pow[rp->ki] * r2Pow[rp->li] * Common;
-								TempAResults[NumPowers+n] += Phi2andCoeff * fOuterC2;
-								TempBResults[NumPowers+n] += Phi2andCoeff * fOuterS2;
+								AccA[NumPowers+n] += Phi2andCoeff * fOuterC2;
+								AccB[NumPowers+n] += Phi2andCoeff * fOuterS2;
+							}
+							if (Derivatives) {
+								fshieldingMu(rhop, mu, shpower, dfshrhop, dfsh1, dfsh2);
+								long double fOuterC1Mu = -AngPhi1C22 * ExpR12R3 * (Pot * nlrho * dfshrho) - sf * AngPhi1C23 * ExpR13R2 * (PotP * nlrhop * dfshrhop);
+								long double fOuterC2Mu = -AngPhi2C22 * ExpR12R3 * (Pot * nlrho * dfshrho) - sf * AngPhi2C23 * ExpR13R2 * (PotP * nlrhop * dfshrhop);
+								AccumulatePowersA(NumPowers, Powers, r1Pow, r2Pow, r3Pow, r12Pow, r13Pow, r23Pow, CoeffPhi, fOuterC1Mu, fOuterC2Mu, MuA);
 							}
 						}
+						if (ErrorEstimate) {
+							if (PhiEstimate) Emb.FoldCoarse();
+							Emb.Fold(4, LegendreRatiosR12[p]);
+						}
 					}
+					if (ErrorEstimate) Emb.Fold(3, LegendreRatiosR23[k]);
 				}
+				if (Derivatives) Der.Finish(2, r3, Emb, TempAResults, TempBResults);
+				if (ErrorEstimate) Emb.Fold(2, r3Ratios[g]);
 			}
+			if (Derivatives) Der.Finish(1, r2, Emb, TempAResults, TempBResults);
+			if (ErrorEstimate) Emb.Fold(1, r2Ratios[j]);
+		}
+
+		if (ErrorEstimate) {
+			for (int n = 0; n < 2*NumPowers; n++) {
+				TempAResults[n] = Emb.Sums[0][n];
+				TempBResults[n] = Emb.Sums[0][2*NumPowers+n];
+			}
+			#pragma omp critical(embedded)
+			Emb.AddDiff(Diff, r1Ratios[i]);
+		}
+		if (Derivatives) {
+			Der.Finish(0, r1, Emb, TempAResults, TempBResults);
+			#pragma omp critical(derivs)
+			Der.AddTo(ADerivs, BDerivs);
 		}
 
 		//#pragma omp critical(build)
@@ -655,6 +987,9 @@ void VecGaussIntegrationPhi13_PhiLCBar_PhiLSBar_R23Term(vector <double> &AResult
 		}
 	}
 
+	if (ErrorEstimate)
+		AddEmbeddedErrors(Diff, AErrors, BErrors, NumPowers);
+
 	return;
 }
 
@@ -850,26 +1185,25 @@ void VecGaussIntegrationPhi13_PhiLCBar_PhiLSBar_R23Term(vector <double> &AResult
 //}
 
 
-void VecGaussIntegrationPhi23_PhiLCBar_PhiLSBar_Full(vector <double> &AResults, vector <double> &BResults, int l, int nR1, int nR2Leg, int nR2Lag, int nR3Leg, int nR3Lag, int nR12, int nR13, int nPhi23, double CuspR2, double CuspR3, double kappa, double mu, int shpower, int sf, int NumPowers, vector <rPowers> &Powers, int Omega, double Lambda1, double Lambda2, double Lambda3)
+void VecGaussIntegrationPhi23_PhiLCBar_PhiLSBar_Full(vector <double> &AResults, vector <double> &BResults, int l, int nR1, int nR2Leg, int nR2Lag, int nR3Leg, int nR3Lag, int nR12, int nR13, int nPhi23, double CuspR2, double CuspR3, int CuspRule, int PhiRule, double kappa, double mu, int shpower, int sf, int NumPowers, vector <rPowers> &Powers, int Omega, double Lambda1, double Lambda2, double Lambda3, int ErrorEstimate, vector <double> &AErrors, vector <double> &BErrors, int Derivatives, vector <double> &ADerivs, vector <double> &BDerivs)
 {
-	vector <long double> LaguerreAbscissasR2, LaguerreWeightsR2, LegendreAbscissasR2, LegendreWeightsR2;
-	vector <long double> LaguerreAbscissasR3, LaguerreWeightsR3, LegendreAbscissasR3, LegendreWeightsR3;
 	vector <long double> LegendreAbscissasR12, LegendreWeightsR12;
 	vector <long double> LegendreAbscissasR13, LegendreWeightsR13;
 	vector <long double> r1Abscissas, r1Weights, r2Abscissas, r2Weights, r3Abscissas, r3Weights;
 	vector <long double> r12Array, r13Array;
+	vector <long double> r1Ratios, LegendreRatiosR12, LegendreRatiosR13, r2Ratios, r3Ratios;
+	vector <vector <long double> > Diff(NUM_EMBEDDED_DIMS, vector <long double>(ErrorEstimate ? 4*NumPowers : 0, 0.0L));
+	AngularRule Angles(nPhi23, PhiRule);
+	bool PhiEstimate = (ErrorEstimate && Angles.Nested);  // The coarse angular rule needs the midpoint rule with a multiple of 3 points.
 	int NumR2Points, NumR3Points, Prog = 0;
 	vector <long double> r1Pow(Omega+2), r2Pow(Omega+2), r3Pow(Omega+1), r12Pow(Omega+1), r13Pow(Omega+1), r23Pow(Omega+1);
 	long double SqrtKappa = sqrtl(kappa);
 
-	// Create the abscissas and weights for the needed number of points.
-	GaussLaguerre(r1Abscissas, r1Weights, nR1);
-	GaussLegendre(LegendreAbscissasR2, LegendreWeightsR2, nR2Leg);
-	GaussLaguerre(LaguerreAbscissasR2, LaguerreWeightsR2, nR2Lag);
-	GaussLegendre(LegendreAbscissasR3, LegendreWeightsR3, nR3Leg);
-	GaussLaguerre(LaguerreAbscissasR3, LaguerreWeightsR3, nR3Lag);
-	GaussLegendre(LegendreAbscissasR12, LegendreWeightsR12, nR12);
-	GaussLegendre(LegendreAbscissasR13, LegendreWeightsR13, nR13);
+	// Create the abscissas and weights for the needed number of points, along with the embedded rules.
+	LaguerreWithEstimate(r1Abscissas, r1Weights, r1Ratios, nR1, ErrorEstimate);
+	CuspSplitRule r2Rule(nR2Leg, nR2Lag, ErrorEstimate, CuspRule), r3Rule(nR3Leg, nR3Lag, ErrorEstimate, CuspRule);
+	LegendreWithEstimate(LegendreAbscissasR12, LegendreWeightsR12, LegendreRatiosR12, nR12, ErrorEstimate);
+	LegendreWithEstimate(LegendreAbscissasR13, LegendreWeightsR13, LegendreRatiosR13, nR13, ErrorEstimate);
 
 	r1Abscissas.resize(nR1);
 	r1Weights.resize(nR1);
@@ -878,74 +1212,48 @@ void VecGaussIntegrationPhi23_PhiLCBar_PhiLSBar_Full(vector <double> &AResults,
 		r1Weights[m] = r1Weights[m] / (Powers[0].alpha + Lambda1);
 	}
 
-	#pragma omp parallel for shared(r1Abscissas,r1Weights,Powers) private(r12Array,r13Array,r2Abscissas,r2Weights,r3Abscissas,r3Weights,NumR2Points,NumR3Points) schedule(guided,1)
+	#pragma omp parallel for shared(r1Abscissas,r1Weights,Powers) private(r12Array,r13Array,r2Abscissas,r2Weights,r3Abscissas,r3Weights,r2Ratios,r3Ratios,NumR2Points,NumR3Points) schedule(guided,1)
 	for (int i = 0; i < nR1; i++) {  // r1 integration
+		ThreadTimer Busy;
 		vector <long double> TempAResults(2*NumPowers, 0.0L), TempBResults(2*NumPowers, 0.0L);
 		vector <long double> r1Pow(Omega+l+1), r2Pow(Omega+l+1), r3Pow(Omega+1), r12Pow(Omega+1), r13Pow(Omega+1), r23Pow(Omega+1);
+		ShortLongIntegrand Pt(l, kappa, mu, shpower, sf, Derivatives != 0);
+		vector <long double> PhiDist(nPhi23);
+		EmbeddedSums Emb(ErrorEstimate ? 4*NumPowers : 0);
+		// With error estimates, the innermost loop accumulates into the embedded sums instead.
+		long double *FineA = &TempAResults[0], *FineB = &TempBResults[0], *CoarseA = FineA, *CoarseB = FineB;
+		if (ErrorEstimate) {
+			FineA = &Emb.Sums.back()[0];
+			FineB = &Emb.Sums.back()[2*NumPowers];
+			CoarseA = PhiEstimate ? &Emb.Coarse[0] : FineA;
+			CoarseB = PhiEstimate ? &Emb.Coarse[2*NumPowers] : FineB;
+		}
+		ParamDerivSums Der(Derivatives ? 2*NumPowers : 0);
+		long double *MuA = Derivatives ? &Der.Sums[DERIV_MU][0] : NULL;
 
-		r2Abscissas.resize(nR2Leg + nR2Lag);
-		r2Weights.resize(nR2Leg + nR2Lag);
-		r3Abscissas.resize(nR3Leg + nR3Lag);
-		r3Weights.resize(nR3Leg + nR3Lag);
 		r12Array.resize(nR12);
 		r13Array.resize(nR13);
 
 		long double r1 = r1Abscissas[i];
 		CreateRPowerLUT(r1Pow, r1, Omega+l);
-		long double ExpR1L2 = expl(-(Powers[0].beta + Lambda2)*r1);
-		long double ExpR1L3 = expl(-(Powers[0].gamma + Lambda3)*r1);
-
-		// If r1 is large enough, we just do Gauss-Laguerre.
-		if (r1 > CuspR2) {
-			for (int m = 0; m < nR2Lag; m++) {
-				r2Weights[m] = LaguerreWeightsR2[m] / (Powers[0].beta + Lambda2);
-				r2Abscissas[m] = LaguerreAbscissasR2[m] / (Powers[0].beta + Lambda2);
-			}
-			NumR2Points = nR2Lag;
-		}
-		// Do Gauss-Legendre for r2 integration over [0,r1] and then Gauss-Laguerre over [r1,inf).
-		else {
-			ChangeOfIntervalNoResize(LegendreAbscissasR2, r2Abscissas, 0.0L, r1);
-			NumR2Points = nR2Leg + nR2Lag;
-			for (int m = 0; m < nR2Leg; m++) {
-				r2Weights[m] = LegendreWeightsR2[m] * expl(-(Powers[0].beta + Lambda2)*r2Abscissas[m]) * (r1-0.0L)/2.0L;
-			}
-			for (int m = nR2Leg; m < NumR2Points; m++) {
-				r2Abscissas[m] = (LaguerreAbscissasR2[m-nR2Leg] + r1*(Powers[0].beta + Lambda2)) / (Powers[0].beta + Lambda2);
-				r2Weights[m] = LaguerreWeightsR2[m-nR2Leg] * ExpR1L2 / (Powers[0].beta + Lambda2);
-			}
-		}
+
+		// Gauss-Laguerre only if r1 is large, or else split the r2 integration at r1 for the cusp.
+		NumR2Points = r2Rule.Build(r1, CuspR2, Powers[0].beta + Lambda2, r2Abscissas, r2Weights, r2Ratios);
 
 		for (int j = 0; j < NumR2Points; j++) {  // r2 integration
 			long double r2 = r2Abscissas[j];
+			if (Derivatives) Der.Start(1, Emb, TempAResults, TempBResults);
 			long double a12 = fabs(r1-r2);
 			long double b12 = fabs(r1+r2);
 			CreateRPowerLUT(r2Pow, r2, Omega+l);
 			ChangeOfIntervalNoResize(LegendreAbscissasR12, r12Array, a12, b12);
 
-			// Cusp unimportant, so only do Gauss-Laguerre integration
-			if (r1 > CuspR3) {
-				for (int m = 0; m < nR3Lag; m++) {
-					r3Weights[m] = LaguerreWeightsR3[m] / (Powers[0].gamma + Lambda3);
-					r3Abscissas[m] = LaguerreAbscissasR3[m] / (Powers[0].gamma + Lambda3);
-				}
-				NumR3Points = nR3Lag;
-			}
-			// Do Gauss-Legendre for r3 integration over [0,r1] and then Gauss-Laguerre over [r1,inf).
-			else {
-				ChangeOfIntervalNoResize(LegendreAbscissasR3, r3Abscissas, 0.0L, r1);
-				NumR3Points = nR3Leg + nR3Lag;
-				for (int m = 0; m < nR3Leg; m++) {
-					r3Weights[m] = LegendreWeightsR3[m] * expl(-(Powers[0].gamma + Lambda3)*r3Abscissas[m]) * (r1-0.0L)/2.0L;
-				}
-				for (int m = nR3Leg; m < NumR3Points; m++) {
-					r3Abscissas[m] = (LaguerreAbscissasR3[m-nR3Leg] + r1*(Powers[0].gamma + Lambda3)) / (Powers[0].gamma + Lambda3);
-					r3Weights[m] = LaguerreWeightsR3[m-nR3Leg] * ExpR1L3 / (Powers[0].gamma + Lambda3);
-				}
-			}
+			// Gauss-Laguerre only if r1 is large, or else split the r3 integration at r1 for the cusp.
+			NumR3Points = r3Rule.Build(r1, CuspR3, Powers[0].gamma + Lambda3, r3Abscissas, r3Weights, r3Ratios);
 
 			for (int g = 0; g < NumR3Points; g++) {  // r3 integration
 				long double r3 = r3Abscissas[g];
+				if (Derivatives) Der.Start(2, Emb, TempAResults, TempBResults);
 				long double a13 = fabs(r1-r3);
 				long double b13 = fabs(r1+r3);
 				long double Coeff = r3Weights[g] * r2Weights[j] * r1Weights[i] * SqrtKappa * 0.70710678118654752440L * PI/nPhi23 * expl(Lambda1*r1 + Lambda2*r2 + Lambda3*r3);
@@ -953,93 +1261,56 @@ void VecGaussIntegrationPhi23_PhiLCBar_PhiLSBar_Full(vector <double> &AResults,
 				ChangeOfIntervalNoResize(LegendreAbscissasR13, r13Array, a13, b13);
 
 				for (int k = 0; k < nR12; k++) {  // r12 integration
-					long double r12 = r12Array[k];
-					long double Cos12 = (r1*r1 + r2*r2 - r12*r12) / (2.0L*r1*r2);
-					long double Sin12 = sqrtl(1.0L - Cos12*Cos12);
-					long double rho = 0.5L * sqrtl(2.0L*(r1*r1 + r2*r2) - r12*r12);
-					long double jlrho = sf_bessel_jl(l, kappa*rho);
-					long double nlrho = sf_bessel_nl(l, kappa*rho);
-					long double ExpR12R3 = expl(-(r12/2.0L + r3));
-					CreateRPowerLUT(r12Pow, r12, Omega);
+					Pt.SetR12(r1, r2, r3, r12Array[k]);
+					CreateRPowerLUT(r12Pow, Pt.r12, Omega);
 
 					for (int p = 0; p < nR13; p++) {  // r13 integration
-						long double r13 = r13Array[p];
-						long double Cos13 = (r1*r1 + r3*r3 - r13*r13) / (2.0L*r1*r3);
-						long double Sin13 = sqrtl(1.0L - Cos13*Cos13);
-						long double rhop = 0.5L * sqrtl(2.0L*(r1*r1 + r3*r3) - r13*r13);
-						long double jlrhop = sf_bessel_jl(l, kappa*rhop);
-						long double nlrhop = sf_bessel_nl(l, kappa*rhop);
-						long double ExpR13R2 = expl(-(r13/2.0L + r2));
-						long double CoeffFinal = Coeff * LegendreWeightsR13[p] * (b13-a13) * LegendreWeightsR12[k] * (b12-a12) * r2 * r3 * r12 * r13;
-						CreateRPowerLUT(r13Pow, r13, Omega);
-
-						// Phi1LS part
-						long double S22 = ExpR12R3 * jlrho;  // S22
-						long double S23 = ExpR13R2 * jlrhop;  // S23
-						//long double AngPhi1S22 = 1.0L - 3.0L/8.0L * r2*r2 * Sin12*Sin12 / (rho*rho);
-						long double AngPhi1S22 = AngR1Rho(l, r1, r2, Cos12, Sin12, rho);
-						//long double AngPhi1S23 = 1.0L - 3.0L/8.0L * r3*r3 * Sin13*Sin13 / (rhop*rhop);
-						long double AngPhi1S23 = AngR1Rhop(l, r1, r3, Cos13, Sin13, rhop);
-						// Phi2LS part
-						//long double AngPhi2S22 = 1.0L - 3.0L/8.0L * r1*r1 * Sin12*Sin12 / (rho*rho);
-						long double AngPhi2S22 = AngR2Rho(l, r1, r2, Cos12, Sin12, rho);
-						// Phi1LC part
-						//@TODO: Would this be better to do as the other form with phi and P_23 phi?
-						long double fshrho = fshielding(rho, mu, shpower);
-						long double fshrhop = fshielding(rhop, mu, shpower);
-						//long double fsh1rho = fshielding1(rho, mu, shpower) / rho * (2.0L * n2rho - kappa*rho * n1rho) - 0.5L * fshielding2(rho, mu, shpower) * n2rho;
-						long double fsh1rho = LaplacianC(l, kappa, rho, mu, shpower);
-						//long double fsh1rhop = fshielding1(rhop, mu, shpower) / rhop * (2.0L * n2rhop - kappa*rhop * n1rhop) - 0.5L * fshielding2(rhop, mu, shpower) * n2rhop;
-						long double fsh1rhop = LaplacianC(l, kappa, rhop, mu, shpower);
-						long double AngPhi1C22 = AngPhi1S22;
-						long double AngPhi1C23 = AngPhi1S23;
-						// Phi2LC part
-						//@TODO: Same question as above
-						long double AngPhi2C22 = AngPhi2S22;
+						Pt.SetR13(r13Array[p]);
+						long double CoeffFinal = Coeff * LegendreWeightsR13[p] * (b13-a13) * LegendreWeightsR12[k] * (b12-a12) * r2 * r3 * Pt.r12 * Pt.r13;
+						CreateRPowerLUT(r13Pow, Pt.r13, Omega);
 
+						// The distances for every angle are found at once so that this vectorizes.
+						Pt.R23(Angles, &PhiDist[0]);
 						for (int m = 1; m <= nPhi23; m++) {  // phi_23 integration
-							long double Phi23 = (2.0L*m - 1.0L)*PI/(2.0L*nPhi23);
-							long double r23 = sqrtl(r2*r2 + r3*r3 - 2.0L*r2*r3*(Sin12*Sin13*cosl(Phi23) + Cos12*Cos13));
-							long double Cos23 = (r2*r2 + r3*r3 - r23*r23) / (2.0L*r2*r3);
+							// Every third angle is also an abscissa of the coarse midpoint rule.
+							bool IsCoarse = (m % 3 == 2);
+							long double *AccA = IsCoarse ? CoarseA : FineA, *AccB = IsCoarse ? CoarseB : FineB;
+							long double r23 = PhiDist[m-1];
+							long double fOuterC1, fOuterS1, fOuterC2, fOuterS2, fOuterMu[2];
 							CreateRPowerLUT(r23Pow, r23, Omega);
-
-							long double PotP = 2.0L/r1 - 2.0L/r3 - 2.0L/r12 + 2.0L/r23;
-							long double Pot = 2.0L/r1 - 2.0L/r2 - 2.0L/r13 + 2.0L/r23;
-
-							// Phi1LS part
-							long double fOuterS1 = AngPhi1S22 * Pot * S22 + sf * AngPhi1S23 * PotP * S23;
-
-							// Phi1LC part
-							long double fOuterC1 = -AngPhi1C22 * ExpR12R3 * (Pot * nlrho * fshrho + fsh1rho);
-							fOuterC1 -= sf * AngPhi1C23 * ExpR13R2 * (PotP * nlrhop * fshrhop + fsh1rhop);
-
-							// Phi2LS part
-							//long double AngPhi2S23 = r1 * Cos12 + r3 * Cos23;
-							//AngPhi2S23 = 3.0L/8.0L * AngPhi2S23 * AngPhi2S23 / (rhop*rhop) - 0.5L;
-							long double AngPhi2S23 = AngR2Rhop(l, r1, r3, Cos12, Cos13, Cos23, rhop);
-							long double fOuterS2 = AngPhi2S22 * Pot * S22 + sf * AngPhi2S23 * PotP * S23;
-
-							// Phi2LC part
-							long double AngPhi2C23 = AngPhi2S23;
-							long double fOuterC2 = -AngPhi2C22 * ExpR12R3 * (Pot * nlrho * fshrho + fsh1rho);
-							fOuterC2 -= sf * AngPhi2C23 * ExpR13R2 * (PotP * nlrhop * fshrhop + fsh1rhop);
+							Pt.OuterTerms(r23, fOuterC1, fOuterS1, fOuterC2, fOuterS2, Derivatives ? fOuterMu : NULL);
 
 							// Combine with phi for final values
-							for (int n = 0; n < NumPowers; n++) {
-								rPowers *rp = &Powers[n];
-								long double Common = r12Pow[rp->mi] * r3Pow[rp->ni] * r13Pow[rp->pi] * r23Pow[rp->qi] * CoeffFinal;
-								long double Phi1andCoeff = r1Pow[rp->ki] * r2Pow[rp->li] * Common;
-								TempAResults[n] += Phi1andCoeff * fOuterC1;
-								TempBResults[n] += Phi1andCoeff * fOuterS1;
-								rp = &Powers[NumPowers+n];
-								long double Phi2andCoeff = r1Pow[rp->ki] * r2Pow[rp->li] * Common;
-								TempAResults[NumPowers+n] += Phi2andCoeff * fOuterC2;
-								TempBResults[NumPowers+n] += Phi2andCoeff * fOuterS2;
-							}
+							AccumulatePowers(NumPowers, Powers, r1Pow, r2Pow, r3Pow, r12Pow, r13Pow, r23Pow, CoeffFinal * Angles.Weights[m-1], fOuterC1, fOuterS1, fOuterC2, fOuterS2, AccA, AccB);
+							if (Derivatives)
+								AccumulatePowersA(NumPowers, Powers, r1Pow, r2Pow, r3Pow, r12Pow, r13Pow, r23Pow, CoeffFinal * Angles.Weights[m-1], fOuterMu[0], fOuterMu[1], MuA);
+						}
+						if (ErrorEstimate) {
+							if (PhiEstimate) Emb.FoldCoarse();
+							Emb.Fold(4, LegendreRatiosR13[p]);
 						}
 					}
+					if (ErrorEstimate) Emb.Fold(3, LegendreRatiosR12[k]);
 				}
+				if (Derivatives) Der.Finish(2, r3, Emb, TempAResults, TempBResults);
+				if (ErrorEstimate) Emb.Fold(2, r3Ratios[g]);
 			}
+			if (Derivatives) Der.Finish(1, r2, Emb, TempAResults, TempBResults);
+			if (ErrorEstimate) Emb.Fold(1, r2Ratios[j]);
+		}
+
+		if (ErrorEstimate) {
+			for (int n = 0; n < 2*NumPowers; n++) {
+				TempAResults[n] = Emb.Sums[0][n];
+				TempBResults[n] = Emb.Sums[0][2*NumPowers+n];
+			}
+			#pragma omp critical(embedded)
+			Emb.AddDiff(Diff, r1Ratios[i]);
+		}
+		if (Derivatives) {
+			Der.Finish(0, r1, Emb, TempAResults, TempBResults);
+			#pragma omp critical(derivs)
+			Der.AddTo(ADerivs, BDerivs);
 		}
 
 		//#pragma omp critical(build)
@@ -1052,5 +1323,8 @@ void VecGaussIntegrationPhi23_PhiLCBar_PhiLSBar_Full(vector <double> &AResults,
 		WriteProgress(string("PhiLS and PhiLC Full"), Prog, i, nR1);
 	}
 
+	if (ErrorEstimate)
+		AddEmbeddedErrors(Diff, AErrors, BErrors, NumPowers);
+
 	return;
 }
@@ -6,8 +6,10 @@
 #include <iomanip>
 #include <string>
 #include <cerrno>
+#include <cfloat>
 #include <vector>
 #include <fstream>
+#include <sstream>
 #include <algorithm>
 #include <math.h>
 #include <mkl_lapack.h>
@@ -16,27 +18,150 @@
 #include <stdio.h>
 #include <boost/filesystem.hpp>
 #include <tinyxml2.h>
+#include "../Long-Range/Matrix Element File.h"
 #include <algorithm>
+#include <cctype>
+#include <cstring>
+#ifndef _WIN32
+	#include <sys/mman.h>
+	#include <sys/stat.h>
+	#include <fcntl.h>
+	#include <unistd.h>
+#endif
+#ifdef _OPENMP
+	#include <omp.h>
+	#include <mkl_service.h>
+#endif
 
 using namespace std;
 using namespace tinyxml2;
 
 typedef complex<double> dcmplx;
 
+// Everything the Kohn variants need from the short-range block once it has been factored.  G holds the four products
+//  v^T (ShortTerms)^-1 w with v and w each being B (0) or ARow (1), without the 0 entries.
+struct KohnFactors
+{
+	bool Factored;
+	double SLS, SLC, CLS, CLC;
+	double G[2][2];
+	vector <double> Y;  // ShortTerms^-1 B and ShortTerms^-1 ARow, which give G
+	double RCond, Correction;  // Reciprocal condition number, and the last relative correction from RefineKohn
+	int Refinements;
+};
+
+// LU factors of the short-range block (M = P L U, with M the transpose of ShortTerms as LAPACK sees it).  They are stored
+//  with leading dimension Capacity so that rows and columns can be bordered on in place as terms are added.  Used holds
+//  the terms M was formed for.
+struct BorderedLU
+{
+	int Capacity, n;
+	double MaxPivot;
+	vector <double> M, LU;
+	vector <int> ipiv, Used;
+};
+
+// A memory mapped input file.  For the short-range file, Data and DataEnd bracket the text of the <data> element.
+struct MappedFile
+{
+	char *Begin;
+	size_t Size;
+	bool Mapped;
+	vector <char> Buffer;  // Holds the file if it could not be mapped
+	const char *Data, *DataEnd;
+};
+
+#define SHORT_CACHE_MAGIC "PSHSHORT"
+#define SHORT_CACHE_VERSION 1
+
+// Terms listed in the energy file, in the order they were added (Todd's ordering) and sorted.  The file is only read
+//  once, and the terms used for any row are picked out of these.
+struct TermOrder
+{
+	vector <int> Terms, Sorted;
+};
+
+// One matrix element file (one kappa) and the results file written for it.  All of them share the short-range file.
+struct KappaRun
+{
+	string MatrixElemName, OutName;
+	ofstream *OutFile;
+	vector <double> ARow, B;
+	double SLS, Kappa, Mu;
+	int Shielding;
+	string LString, Lambda;
+	string TauScanText;  // Rows of the <tauscan> element, written after the data
+	string ConditionText;  // Rows of the <condition> element
+};
+
+// Dense scan of the generalized Kohn phase over tau in [0,pi).  The recommended phase is taken where the phase is
+//  stationary in the longest stretch of tau with no anomalies, and Spread is how far the phase moves over that stretch.
+struct TauScan
+{
+	bool Scanned;
+	double Tau, Phase, Spread;
+	vector <double> AnomalyStart, AnomalyEnd;  // tau ranges where the phase is singular or changing quickly
+};
+
+#define TAU_SCAN_POINTS 2000  // Default number of tau values for the scan
+#define TAU_ANOMALY_FACTOR 20.0  // A slope this many times the median slope over tau is an anomaly...
+#define TAU_ANOMALY_SLOPE 0.1  // ...if it is also larger than this (radians per radian)
+
+// Everything computed for one row and one kappa, held until the rows before it have been written
+struct KohnRowResult
+{
+	vector <double> Phases;
+	TauScan Scan;
+	double RCond, Correction;
+	int Refinements;
+};
+
+#define REFINE_MAX_ITER 10  // Most refinement steps for one row
+
+#define BORDER_PIVOT_TOL 1e-10  // Refactor if a bordered pivot is this small relative to the largest pivot
+#define BORDER_GROWTH 1e4  // Refactor if a bordered row of L has an entry larger than this
+
 int		CalcPowerTableSize(int Omega);
 int		ReadMatrixElem(ifstream &FileMatrixElem, int NumShortTerms, vector <double> &ARow, vector <double> &B, double &SLS, int &IsTriplet, int &Ordering, int &LValue, int &Formalism, int &Omega, int &NumSets, double &Alpha1, double &Beta1, double &Gamma1, double &Alpha2, double &Beta2, double &Gamma2, double &Kappa, double &Mu, string &LString, int &Shielding, string &Lambda, double &Epsilon12, double &Epsilon13, bool &ExtraExponential);
-int		ReadShortHeader(string &FileShort, string &ShortString, string &LString, int &Omega, int &LValue, int &IsTriplet, int &Formalism, int &Ordering, int &NumShortTerms, int &NumSets, int &Integration, double &Alpha1, double &Beta1, double &Gamma1, double &Alpha2, double &Beta2, double &Gamma2, bool &ExtraExponential, double &Epsilon12, double &Epsilon13, vector <int> &ExpLen);
-int		ParseShortData(string &Data, vector <double> &ShortTerms, int NumShortTerms, double Kappa);
+int		ReadMatrixElemBinary(MappedFile &File, int NumShortTerms, vector <double> &ARow, vector <double> &B, double &SLS, int &IsTriplet, int &Ordering, int &LValue, int &Omega, int &NumSets, double &Alpha1, double &Beta1, double &Gamma1, double &Kappa, double &Mu, string &LString, int &Shielding, string &Lambda);
+int		MapFile(string &FileName, MappedFile &File);
+void	UnmapFile(MappedFile &File);
+int		ReadShortHeader(string &FileShort, MappedFile &File, string &LString, int &Omega, int &LValue, int &IsTriplet, int &Formalism, int &Ordering, int &NumShortTerms, int &NumSets, int &Integration, double &Alpha1, double &Beta1, double &Gamma1, double &Alpha2, double &Beta2, double &Gamma2, bool &ExtraExponential, double &Epsilon12, double &Epsilon13, vector <int> &ExpLen);
+int		ParseShortData(MappedFile &File, vector <double> &PhiPhi, vector <double> &PhiHPhi, int NumShortTerms);
+double	ParseFortranDouble(const char *Token, int Len);
+int		LoadShortCache(string &FileShort, int NumShortTerms, vector <double> &PhiPhi, vector <double> &PhiHPhi);
+int		SaveShortCache(string &FileShort, int NumShortTerms, vector <double> &PhiPhi, vector <double> &PhiHPhi);
+void	FormShortTerms(vector <double> &PhiPhi, vector <double> &PhiHPhi, vector <double> &ShortTerms, double Kappa);
+inline double ShortTerm(double PhiPhi, double PhiHPhi, double Kappa);
+int		ReadFileList(char *ListName, vector <KappaRun> &Runs);
 void	WriteHeader(ofstream &OutFile, string &LString, int &LValue, char *FileShortName, char *FileMatrixElemName, char *EnergyFileName, bool &Paired, bool &Resorted,
 				int &ShortInt, int &NumTerms, double &Kappa, double &Mu, int &Shielding, string &Lambda, double &Alpha, double &Beta, double &Gamma, string &ProgName);
 int		CreateSubset(vector <double> &ARow, vector <double> &B, vector <double> &ShortTerms, vector <double> &ARowSub, vector <double> &BSub, vector <double> &ShortTermsSub, int NumShortTerms, int NSub);
-int		FindOrderedToddTerm(string EnergyFilename, int TermToFind);
-int		LoadToddTerms(int LValue, vector <double> &ARow, vector <double> &B, vector <double> &ShortTerms, vector <double> &ARowSub, vector <double> &BSub, vector <double> &ShortTermsSub, int NumShortTerms, int NSub, string EnergyFilename, bool Resorted, bool Paired, int ResortedSize);
-int		TestToddFile(string EnergyFilename, int NumShortTerms);
+int		LoadTermOrder(TermOrder &Order, string EnergyFilename, int NumTerms);
+int		FindOrderedToddTerm(TermOrder &Order, int TermToFind);
+void	SelectTerms(TermOrder &Order, int NSub, bool Resorted, bool Paired, int NumShortTotal, vector <int> &Used);
+void	GatherTerms(vector <double> &Full, int NumShortTotal, vector <int> &Used, vector <double> &Sub);
+void	GatherRow(vector <double> &Full, vector <int> &Used, vector <double> &Sub);
 void	uGenKohn(dcmplx (&u)[2][2], double Tau);
 void	uGenTKohn(dcmplx (&u)[2][2], double Tau);
 void	uGenSKohn(dcmplx (&u)[2][2], double Tau);
 double	CombinedKohn(dcmplx (&u)[2][2], int NumShortTerms, vector <double> &ARow, vector <double> &B, vector <double> &ShortTerms, double SLS, int LValue, int IsTriplet);
+void	InitBorderedLU(BorderedLU &Factor, int Capacity);
+void	GrowBorderedLU(BorderedLU &Factor, int Capacity);
+int		FillShortTerms(BorderedLU &Factor, vector <double> &PhiPhi, vector <double> &PhiHPhi, int NumShortTotal, vector <int> &Used, double Kappa);
+int		RefactorLU(BorderedLU &Factor, int N);
+int		BorderLU(BorderedLU &Factor, int N);
+int		FactorKohn(KohnFactors &Factors, BorderedLU &Factor, int FactorInfo, int NumShortTerms, vector <double> &ARow, vector <double> &B, vector <double> &ShortTerms, double SLS, bool Condition);
+int		RefineKohn(KohnFactors &Factors, BorderedLU &Factor, int NumShortTerms, vector <double> &ARow, vector <double> &B, vector <double> &PhiPhi, vector <double> &PhiHPhi, double Kappa);
+double	SchurKohn(dcmplx (&u)[2][2], KohnFactors &Factors, int NumShortTerms, vector <double> &ARow, vector <double> &B, vector <double> &ShortTerms, double SLS, int LValue, int IsTriplet);
+int		SpectralShort(vector <double> &PhiHPhi, vector <double> &PhiPhi, int N, vector <double> &Eigenvalues, vector <double> &Eigenvectors);
+int		SpectralKohn(KohnFactors &Factors, vector <double> &Eigenvalues, vector <double> &Eigenvectors, int NumShortTerms, vector <double> &ARow, vector <double> &B, double SLS, double Kappa);
+void	KohnRow(vector <double> &Phases, KohnFactors &Factors, int NumShortTerms, vector <double> &ARow, vector <double> &B, vector <double> &ShortTerms, double SLS, int LValue, int IsTriplet);
+void	WriteKohnRow(ofstream &OutFile, int Row, vector <double> &Phases);
+double	WrapPhase(double Diff);
+void	ScanTau(TauScan &Scan, int NumTau, KohnFactors &Factors, int NumShortTerms, vector <double> &ARow, vector <double> &B, vector <double> &ShortTerms, double SLS, int LValue, int IsTriplet);
+string	TauScanRow(int Row, TauScan &Scan);
+string	ConditionRow(int Row, KohnRowResult &Result);
 string	ShortIntString(int &Integration);
 void	FixPhase(double &PhaseShift, int &LValue, int &IsTriplet);
 string	GetDateTime(void);
@@ -94,44 +219,48 @@ std::string trim(const std::string& str,
 int main(int argc, char *argv[])
 {
 	ifstream FileMatrixElem;
-	ofstream OutFile;
-	string ShortDataString, LStringShort, LStringLong, Lambda;
-	double ShortAlpha1, ShortBeta1, ShortGamma1, ShortAlpha2, ShortBeta2, ShortGamma2, ShortEpsilon12, ShortEpsilon13, Kappa, Mu;
+	string LStringShort, ShortFileName;
+	MappedFile ShortData;
+	double ShortAlpha1, ShortBeta1, ShortGamma1, ShortAlpha2, ShortBeta2, ShortGamma2, ShortEpsilon12, ShortEpsilon13;
 	double LongAlpha1, LongBeta1, LongGamma1, LongAlpha2, LongBeta2, LongGamma2, LongEpsilon12, LongEpsilon13;
 	int ShortOmega, ShortLValue, ShortIsTriplet, ShortOrdering, /*ShortNumSets,*/ ShortFormalism;
 	int LongOmega, LongLValue, LongIsTriplet, LongOrdering, LongNumSets, LongFormalism;
-	int /*Ordering,*/ NumSets, NumShort, NumShortTotal, NumShortTermsFile, ShortInt, Shielding;
+	int /*Ordering,*/ NumSets, NumShort, NumShortTotal, NumShortTermsFile, ShortInt;
 	vector <int> ExpLen;
 	bool ExtraExponential;
 	int TotalTerms;
 
-	vector <double> ARow, B, ShortTerms;
-	double SLS;
-	vector <double> ARowSub, BSub, ShortTermsSub;
-	double GenKohnPhase;
-	bool Paired, Resorted = false;
-	int TermStep;
-	dcmplx u[2][2];
+	vector <KappaRun> Runs;
+	TermOrder Order;
+	vector <double> PhiPhi, PhiHPhi;
+	bool Paired, Resorted = false, Spectral = false, Refine = false, Condition = false;
+	int TermStep, NumTauScan = 0;
 
 	string ProgName = boost::filesystem::canonical(argv[0]).string();  // Get the absolute path of this program
 
 	// Initialize the second set of nonlinear parameters for the files that don't use them.
 	ShortAlpha2 = 0.0; LongAlpha2 = 0.0; ShortBeta2 = 0.0; LongBeta2 = 0.0; ShortGamma2 = 0.0; LongGamma2 = 0.0;
 
-	char *FileMatrixElemName = argv[2];
-	char *FileShortName = argv[3];
-	char *OutFileName = argv[4];
-	char *EnergyFileName = argv[6];
-
 	if (argc < 7) {
 		cerr << "Not enough parameters on the command line." << endl;
-		cerr << "Usage: Phase pairing matrixelements.txt shortrangefile.bin results.txt #terms (energyfile.txt) (resorted?)" << endl;
+		cerr << "Usage: Phase pairing matrixelements.txt/.psme shortrangefile.bin results.txt #terms (energyfile.txt) (resorted?) (spectral) (tauscan[=points]) (refine) (condition)" << endl;
 		cerr << "Example: Phase 1 matrixelements.txt shortrangefile.bin results.txt 84 energyfile.txt true" << endl << endl;
 		cerr << " The pairing parameter is 0 for no pairing of terms for the two symmetries and" << endl;
 		cerr << " 1 for pairing." << endl;
+		cerr << " Several kappas can be run against the same short-range file by giving @list.txt in place of" << endl;
+		cerr << " matrixelements.txt, where each line of list.txt has a matrix element file and its results file." << endl;
+		cerr << " The results.txt argument is then ignored.  With \"spectral\" as the last argument, the short-range" << endl;
+		cerr << " problem is diagonalized once per row and shared by all of the kappas.  With \"tauscan\", the generalized" << endl;
+		cerr << " Kohn phase is also scanned over " << TAU_SCAN_POINTS << " (or the given number of) tau values for each row, and the" << endl;
+		cerr << " anomalous tau ranges and a recommended phase are written after the data.  With \"refine\", the short-range" << endl;
+		cerr << " solves are refined with residuals in extended precision.  With \"refine\" or \"condition\", the condition" << endl;
+		cerr << " estimates of the short-range block are written after the data." << endl;
 		return 1;
 	}
 
+	char *FileShortName = argv[3];
+	char *EnergyFileName = argv[6];
+
 	if (atoi(argv[1]) == 0) {
 		Paired = false;
 		TermStep = 1;
@@ -145,21 +274,24 @@ int main(int argc, char *argv[])
 		return 2;
 	}
 
-	FileMatrixElem.open(FileMatrixElemName);
-	if (FileMatrixElem.fail()) {
-		cerr << "Unable to open file " << FileMatrixElemName << " for reading." << endl;
-		return 2;
+	if (argv[2][0] == '@') {
+		if (ReadFileList(argv[2]+1, Runs) != 0)
+			return 2;
 	}
-
-	OutFile.open(OutFileName);
-	if (!OutFile.is_open()) {
-		cout << "Could not open output file...exiting." << endl;
-		return 4;
+	else {
+		Runs.resize(1);
+		Runs[0].MatrixElemName = argv[2];
+		Runs[0].OutName = argv[4];
 	}
+
 	TotalTerms = atoi(argv[5]);
 
 	if (argc > 6) {
-		int ToddTermNum = TestToddFile(EnergyFileName, TotalTerms);
+		int ToddTermNum = LoadTermOrder(Order, EnergyFileName, TotalTerms);
+		if (ToddTermNum < 0) {
+			cerr << "Unable to open file " << EnergyFileName << " for reading." << endl;
+			return 2;
+		}
 		if (ToddTermNum < TotalTerms) {
 			cout << "Using less than the requested number of terms: " << ToddTermNum << " instead of " << TotalTerms << endl;
 			TotalTerms = ToddTermNum;
@@ -178,13 +310,40 @@ int main(int argc, char *argv[])
 		}
 	}
 
+	for (int a = 8; a < argc; a++) {
+		string Option = argv[a];
+		if (Option == "spectral") {
+			Spectral = true;
+			cout << "The short-range problem will be diagonalized once per row for all " << Runs.size() << " kappa values." << endl;
+		}
+		else if (Option.compare(0, 7, "tauscan") == 0) {
+			NumTauScan = Option.size() > 8 ? atoi(Option.c_str() + 8) : TAU_SCAN_POINTS;
+			if (NumTauScan < 3) {
+				cout << "The tau scan needs at least 3 points." << endl;
+				return 1;
+			}
+			cout << "The generalized Kohn phase will be scanned over " << NumTauScan << " values of tau." << endl;
+		}
+		else if (Option == "refine") {
+			Refine = Condition = true;
+			cout << "The short-range solves will be refined in extended precision." << endl;
+		}
+		else if (Option == "condition") {
+			Condition = true;
+			cout << "Condition estimates will be written after the data." << endl;
+		}
+		else {
+			cout << "Unknown option " << Option << endl;
+			return 1;
+		}
+	}
+
 	// Include trailing zeros so the columns line up in the output file.
 	cout.setf(ios::showpoint);
-	OutFile.setf(ios::showpoint);
 	cout << setprecision(18);
-	OutFile << setprecision(18);
 
-	int err = ReadShortHeader(string(FileShortName), ShortDataString, LStringShort, ShortOmega, ShortLValue, ShortIsTriplet, ShortFormalism, ShortOrdering, NumShortTermsFile, NumSets, ShortInt, ShortAlpha1, ShortBeta1, ShortGamma1, ShortAlpha2, ShortBeta2, ShortGamma2, ExtraExponential, ShortEpsilon12, ShortEpsilon13, ExpLen);
+	ShortFileName = FileShortName;
+	int err = ReadShortHeader(ShortFileName, ShortData, LStringShort, ShortOmega, ShortLValue, ShortIsTriplet, ShortFormalism, ShortOrdering, NumShortTermsFile, NumSets, ShortInt, ShortAlpha1, ShortBeta1, ShortGamma1, ShortAlpha2, ShortBeta2, ShortGamma2, ExtraExponential, ShortEpsilon12, ShortEpsilon13, ExpLen);
 	if (err == -1) {
 		return 8;
 	}
@@ -201,91 +360,408 @@ int main(int argc, char *argv[])
 	else
 		NumShortTotal = NumShort * 2;
 
-	ARow.resize(NumShortTotal+1);
-	B.resize(NumShortTotal+1);
-	ShortTerms.resize(NumShortTotal*NumShortTotal);
-	err = ReadMatrixElem(FileMatrixElem, NumShortTotal, ARow, B, SLS, LongIsTriplet, LongOrdering, LongLValue, LongFormalism, LongOmega, LongNumSets, LongAlpha1, LongBeta1, LongGamma1, LongAlpha2, LongBeta2, LongGamma2, Kappa, Mu, LStringLong, Shielding, Lambda, LongEpsilon12, LongEpsilon13, ExtraExponential);
-	if (err == -1)
-		return 6;
-
-	// Compare the short-range and long-range files to make sure they are describing the same problem.
-	if ((LongLValue != ShortLValue) || LongIsTriplet != ShortIsTriplet || LongOrdering != ShortOrdering || LongOmega != ShortOmega || LongAlpha1 != ShortAlpha1 || LongBeta1 != ShortBeta1 || LongGamma1 != ShortGamma1 || LongAlpha2 != ShortAlpha2 || LongBeta2 != ShortBeta2 || LongGamma2 != ShortGamma2) {
-		cout << "Short-range and long-range files describe different problems...exiting." << endl;
-		return 8;
+	// The short-range file does not depend on kappa, so it is only read once for all of the matrix element files.
+	//  The text is slow to parse for large omega, so the matrices are also kept in a binary cache next to it.
+	if (LoadShortCache(ShortFileName, NumShortTotal, PhiPhi, PhiHPhi) != 0) {
+		if (ParseShortData(ShortData, PhiPhi, PhiHPhi, NumShortTotal) != 0)
+			return 8;
+		SaveShortCache(ShortFileName, NumShortTotal, PhiPhi, PhiHPhi);
 	}
+	else {
+		cout << "Read the short-range terms from " << ShortFileName << ".cache" << endl;
+	}
+	UnmapFile(ShortData);
+
+	for (unsigned int r = 0; r < Runs.size(); r++) {
+		KappaRun &Run = Runs[r];
+
+		// Either the binary matrix element file from PsHScattering or its text results file
+		MappedFile ElemFile;
+		if (MapFile(Run.MatrixElemName, ElemFile) != 0)
+			return 2;
+		bool Binary = IsMatrixElemFile(ElemFile.Begin, ElemFile.Size);
+		if (Binary)
+			err = ReadMatrixElemBinary(ElemFile, NumShortTotal, Run.ARow, Run.B, Run.SLS, LongIsTriplet, LongOrdering, LongLValue, LongOmega, LongNumSets, LongAlpha1, LongBeta1, LongGamma1, Run.Kappa, Run.Mu, Run.LString, Run.Shielding, Run.Lambda);
+		UnmapFile(ElemFile);
+
+		if (!Binary) {
+			FileMatrixElem.open(Run.MatrixElemName.c_str());
+			if (FileMatrixElem.fail()) {
+				cerr << "Unable to open file " << Run.MatrixElemName << " for reading." << endl;
+				return 2;
+			}
 
-	ParseShortData(ShortDataString, ShortTerms, NumShortTotal, Kappa);
+			Run.ARow.resize(NumShortTotal+1);
+			Run.B.resize(NumShortTotal+1);
+			err = ReadMatrixElem(FileMatrixElem, NumShortTotal, Run.ARow, Run.B, Run.SLS, LongIsTriplet, LongOrdering, LongLValue, LongFormalism, LongOmega, LongNumSets, LongAlpha1, LongBeta1, LongGamma1, LongAlpha2, LongBeta2, LongGamma2, Run.Kappa, Run.Mu, Run.LString, Run.Shielding, Run.Lambda, LongEpsilon12, LongEpsilon13, ExtraExponential);
+			FileMatrixElem.close();
+		}
+		if (err == -1)
+			return 6;
 
-	WriteHeader(OutFile, LStringLong, ShortLValue, FileShortName, FileMatrixElemName, EnergyFileName, Paired, Resorted,
-				ShortInt, TotalTerms, Kappa, Mu, Shielding, Lambda, ShortAlpha1, ShortBeta1, ShortGamma1, ProgName);
+		// Compare the short-range and long-range files to make sure they are describing the same problem.
+		if ((LongLValue != ShortLValue) || LongIsTriplet != ShortIsTriplet || LongOrdering != ShortOrdering || LongOmega != ShortOmega || LongAlpha1 != ShortAlpha1 || LongBeta1 != ShortBeta1 || LongGamma1 != ShortGamma1 || LongAlpha2 != ShortAlpha2 || LongBeta2 != ShortBeta2 || LongGamma2 != ShortGamma2) {
+			cout << "Short-range and long-range files describe different problems...exiting." << endl;
+			return 8;
+		}
 
-	int FieldWidth = 25;
+		Run.OutFile = new ofstream(Run.OutName.c_str());
+		if (!Run.OutFile->is_open()) {
+			cout << "Could not open output file " << Run.OutName << "...exiting." << endl;
+			return 4;
+		}
+		Run.OutFile->setf(ios::showpoint);
+		*Run.OutFile << setprecision(18);
+
+		WriteHeader(*Run.OutFile, Run.LString, ShortLValue, FileShortName, (char*)Run.MatrixElemName.c_str(), EnergyFileName, Paired, Resorted,
+					ShortInt, TotalTerms, Run.Kappa, Run.Mu, Run.Shielding, Run.Lambda, ShortAlpha1, ShortBeta1, ShortGamma1, ProgName);
+	}
 
 	if (Resorted)
 		cout << "Reordering terms" << endl;
 
-	for (int i = 0; i <= TotalTerms; i++) {
-		LoadToddTerms(ShortLValue, ARow, B, ShortTerms, ARowSub, BSub, ShortTermsSub, NumShortTotal, i, EnergyFileName, Resorted, Paired, TotalTerms);
-		double KohnPhase = CombinedKohn(uKohn, i*TermStep, ARowSub, BSub, ShortTermsSub, SLS, ShortLValue, ShortIsTriplet);
-		double InvKohnPhase = CombinedKohn(uInvKohn, i*TermStep, ARowSub, BSub, ShortTermsSub, SLS, ShortLValue, ShortIsTriplet);
-		double CompKohnSPhase = CombinedKohn(uCompSKohn, i*TermStep, ARowSub, BSub, ShortTermsSub, SLS, ShortLValue, ShortIsTriplet);
-		double CompKohnTPhase = CombinedKohn(uCompTKohn, i*TermStep, ARowSub, BSub, ShortTermsSub, SLS, ShortLValue, ShortIsTriplet);
-		/*if ((KohnPhase == 0.0) || (InvKohnPhase == 0.0) || (CompKohnSPhase == 0.0) || (CompKohnTPhase == 0.0)) {
-			cout << "Terminating loop early due to LAPACK errors." << endl;
-			OutFile << "Terminating loop early due to LAPACK errors." << endl;
-			break;
-		}*/
-		cout << i << " " << KohnPhase << " " << InvKohnPhase << " " << CompKohnSPhase << " " << CompKohnTPhase << endl;
-		OutFile << setw(8) << i << setw(1) << " " << setw(FieldWidth) << KohnPhase << setw(1) << " " << setw(FieldWidth) << InvKohnPhase << setw(1) << " " << setw(FieldWidth)
-				<< CompKohnSPhase << setw(1) << " " << setw(FieldWidth) << CompKohnTPhase;
-
-		// Generalized Kohn
-		for (int t = 0; t < NUM_TAUARRAY; t++) {
-			LoadToddTerms(ShortLValue, ARow, B, ShortTerms, ARowSub, BSub, ShortTermsSub, NumShortTotal, i, EnergyFileName, Resorted, Paired, TotalTerms);
-			uGenKohn(u, TauArray[t]);
-			GenKohnPhase = CombinedKohn(u, i*TermStep, ARowSub, BSub, ShortTermsSub, SLS, ShortLValue, ShortIsTriplet);
-			/*if (GenKohnPhase == 0.0)
-				break;*/
-			OutFile << setw(1) << " " << setw(FieldWidth) << GenKohnPhase;
+	// The term sets grow by appending terms, so each row's short-range block has the last row's block as its leading
+	//  block.  One sequential pass borders the factors on from row to row.  Bordering never changes the entries already
+	//  factored, so the factors of a row are the leading block of the final ones, up to the next row that has to be
+	//  factored from scratch.  That row starts a new segment, and the earlier segment is kept for the rows before it
+	//  (there is usually only one).  The rows are then solved in parallel against their segment, which is only read,
+	//  so every row gets the same factors whatever the number of threads.  The spectral mode only uses the factors if
+	//  the diagonalization fails, but they are computed for every row.
+	vector <vector <BorderedLU> > Segments(Runs.size());
+	vector <vector <int> > RowSegment(Runs.size(), vector <int>(TotalTerms+1, 0)), FactorInfo(Runs.size(), vector <int>(TotalTerms+1, 0));
+	vector <int> NumFactored(Runs.size(), 0);
+
+	for (unsigned int r = 0; r < Runs.size(); r++) {
+		vector <int> Used;
+		vector <BorderedLU> &Segs = Segments[r];
+
+		Segs.resize(1);
+		InitBorderedLU(Segs[0], 0);  // This grows as needed in FillShortTerms.
+		for (int i = 1; i <= TotalTerms; i++) {
+			int N = i*TermStep;
+			SelectTerms(Order, i, Resorted, Paired, NumShortTotal, Used);
+			if (FillShortTerms(Segs.back(), PhiPhi, PhiHPhi, NumShortTotal, Used, Runs[r].Kappa) < Segs.back().n || BorderLU(Segs.back(), N) != 0) {
+				if (Segs.back().n > 0) {
+					vector <double>().swap(Segs.back().M);  // Only the factors are needed from here on.
+					Segs.resize(Segs.size()+1);
+					InitBorderedLU(Segs.back(), N);
+				}
+				Segs.back().Used.clear();  // Forms the whole block again.
+				FillShortTerms(Segs.back(), PhiPhi, PhiHPhi, NumShortTotal, Used, Runs[r].Kappa);
+				NumFactored[r]++;
+				FactorInfo[r][i] = RefactorLU(Segs.back(), N);
+			}
+			RowSegment[r][i] = Segs.size()-1;
 		}
+		vector <double>().swap(Segs.back().M);
+	}
+
+	// Finished rows wait in RowResults until every row before them has been written, so the <data> block keeps its
+	//  order.
+	vector <vector <KohnRowResult> > RowResults(TotalTerms+1);
+	vector <char> RowDone(TotalTerms+1, 0);
+	int NextRow = 0;
+
+	#pragma omp parallel
+	{
+		vector <int> Used;
+		vector <double> PhiPhiSub, PhiHPhiSub, ShortTermsSub, Eigenvalues, Eigenvectors, ARowSub, BSub;
+
+#ifdef _OPENMP
+		// Each row is already one thread's work, so MKL should not start more threads under it.
+		if (omp_get_num_threads() > 1)
+			mkl_set_num_threads_local(1);
+#endif
 
-		// Generalized T-matrix
-		for (int t = 0; t < NUM_TAUARRAY; t++) {
-			LoadToddTerms(ShortLValue, ARow, B, ShortTerms, ARowSub, BSub, ShortTermsSub, NumShortTotal, i, EnergyFileName, Resorted, Paired, TotalTerms);
-			uGenTKohn(u, TauArray[t]);
-			GenKohnPhase = CombinedKohn(u, i*TermStep, ARowSub, BSub, ShortTermsSub, SLS, ShortLValue, ShortIsTriplet);
-			/*if (GenKohnPhase == 0.0)
-				break;*/
-			OutFile << setw(1) << " " << setw(FieldWidth) << GenKohnPhase;
+		#pragma omp for schedule(dynamic, 1)
+		for (int i = 0; i <= TotalTerms; i++) {
+			int N = i*TermStep;
+			bool Diagonalized = false;
+			vector <KohnRowResult> Results(Runs.size());
+
+			SelectTerms(Order, i, Resorted, Paired, NumShortTotal, Used);
+			GatherTerms(PhiPhi, NumShortTotal, Used, PhiPhiSub);
+			GatherTerms(PhiHPhi, NumShortTotal, Used, PhiHPhiSub);
+			if (Spectral) {
+				Diagonalized = (SpectralShort(PhiHPhiSub, PhiPhiSub, N, Eigenvalues, Eigenvectors) == 0);
+			}
+
+			for (unsigned int r = 0; r < Runs.size(); r++) {
+				KappaRun &Run = Runs[r];
+				GatherRow(Run.ARow, Used, ARowSub);
+				GatherRow(Run.B, Used, BSub);
+				FormShortTerms(PhiPhiSub, PhiHPhiSub, ShortTermsSub, Run.Kappa);
+
+				// The short-range block is the same for every variant, so they all share its factors.
+				KohnFactors Factors;
+				if (!Diagonalized || SpectralKohn(Factors, Eigenvalues, Eigenvectors, N, ARowSub, BSub, Run.SLS, Run.Kappa) != 0) {
+					BorderedLU &Factor = Segments[r][RowSegment[r][i]];
+					if (FactorKohn(Factors, Factor, FactorInfo[r][i], N, ARowSub, BSub, ShortTermsSub, Run.SLS, Condition) == 0 && Refine)
+						RefineKohn(Factors, Factor, N, ARowSub, BSub, PhiPhiSub, PhiHPhiSub, Run.Kappa);
+				}
+				KohnRow(Results[r].Phases, Factors, N, ARowSub, BSub, ShortTermsSub, Run.SLS, ShortLValue, ShortIsTriplet);
+				if (NumTauScan > 0)
+					ScanTau(Results[r].Scan, NumTauScan, Factors, N, ARowSub, BSub, ShortTermsSub, Run.SLS, ShortLValue, ShortIsTriplet);
+				Results[r].RCond = Factors.RCond;
+				Results[r].Refinements = Factors.Refinements;
+				Results[r].Correction = Factors.Correction;
+			}
+
+			#pragma omp critical (RowWriter)
+			{
+				RowResults[i].swap(Results);
+				RowDone[i] = 1;
+				for (; NextRow <= TotalTerms && RowDone[NextRow]; NextRow++) {
+					for (unsigned int r = 0; r < Runs.size(); r++) {
+						WriteKohnRow(*Runs[r].OutFile, NextRow, RowResults[NextRow][r].Phases);
+						if (NumTauScan > 0)
+							Runs[r].TauScanText += TauScanRow(NextRow, RowResults[NextRow][r].Scan);
+						if (Condition)
+							Runs[r].ConditionText += ConditionRow(NextRow, RowResults[NextRow][r]);
+					}
+					vector <KohnRowResult>().swap(RowResults[NextRow]);
+				}
+			}
 		}
+	}
 
-		// Generalized S-matrix
-		for (int t = 0; t < NUM_TAUARRAY; t++) {
-			LoadToddTerms(ShortLValue, ARow, B, ShortTerms, ARowSub, BSub, ShortTermsSub, NumShortTotal, i, EnergyFileName, Resorted, Paired, TotalTerms);
-			uGenSKohn(u, TauArray[t]);
-			GenKohnPhase = CombinedKohn(u, i*TermStep, ARowSub, BSub, ShortTermsSub, SLS, ShortLValue, ShortIsTriplet);
-			/*if (GenKohnPhase == 0.0)
-				break;*/
-			OutFile << setw(1) << " " << setw(FieldWidth) << GenKohnPhase;
+	for (unsigned int r = 0; r < Runs.size(); r++) {
+		if (NumFactored[r] > 0)
+			cout << "Short-range block for " << Runs[r].MatrixElemName << " factored from scratch " << NumFactored[r] << " times for " << TotalTerms+1 << " rows." << endl;
+		*Runs[r].OutFile << "</data>" << endl;
+		if (NumTauScan > 0) {
+			*Runs[r].OutFile << "<tauscan points=\"" << NumTauScan << "\">" << endl;
+			*Runs[r].OutFile << "       n |     Recommended tau     |    Gen Kohn phase       |         Spread          | Anomalous tau ranges" << endl;
+			*Runs[r].OutFile << Runs[r].TauScanText << "</tauscan>" << endl;
+		}
+		if (Condition) {
+			*Runs[r].OutFile << "<condition refined=\"" << (Refine ? "true" : "false") << "\">" << endl;
+			*Runs[r].OutFile << "       n |   RCond   | Refinements | Last correction" << endl;
+			*Runs[r].OutFile << Runs[r].ConditionText << "</condition>" << endl;
 		}
-		/*if (GenKohnPhase == 0.0) {
-			cout << "Terminating loop early due to LAPACK errors." << endl;
-			OutFile << "Terminating loop early due to LAPACK errors." << endl;
+		*Runs[r].OutFile << "</psh_data>" << endl;
+		Runs[r].OutFile->close();
+		delete Runs[r].OutFile;
+	}
+
+	return 0;
+}
+
+
+// Reduces a difference of phase shifts to [-pi/2,pi/2), since the phase shifts are only defined modulo pi.
+double WrapPhase(double Diff)
+{
+	double Pi = 4.0 * atan(1.0);
+	return Diff - Pi * floor(Diff / Pi + 0.5);
+}
+
+
+// Samples the generalized Kohn phase at NumTau values of tau.  The phase is periodic in tau with period pi, and near a
+//  Schwartz-type anomaly it sweeps through pi over a short range of tau, so any sample whose slope stands far out from the
+//  median slope is marked as anomalous.  The recommended phase is at the flattest point of the longest unmarked stretch,
+//  refined with a parabola through its neighbors.
+void ScanTau(TauScan &Scan, int NumTau, KohnFactors &Factors, int NumShortTerms, vector <double> &ARow, vector <double> &B, vector <double> &ShortTerms, double SLS, int LValue, int IsTriplet)
+{
+	double Pi = 4.0 * atan(1.0);
+	double Step = Pi / NumTau;
+	dcmplx u[2][2];
+	vector <double> Phase(NumTau), Slope(NumTau);
+	vector <bool> Anomalous(NumTau);
+
+	Scan.Scanned = false;
+	Scan.AnomalyStart.clear();
+	Scan.AnomalyEnd.clear();
+	if (!Factors.Factored)  // Every tau would need its own solve.
+		return;
+
+	for (int k = 0; k < NumTau; k++) {
+		uGenKohn(u, k*Step);
+		Phase[k] = SchurKohn(u, Factors, NumShortTerms, ARow, B, ShortTerms, SLS, LValue, IsTriplet);
+	}
+	for (int k = 0; k < NumTau; k++) {
+		double Diff = WrapPhase(Phase[(k+1) % NumTau] - Phase[(k+NumTau-1) % NumTau]);
+		Slope[k] = fabs(Diff) / (2.0 * Step);
+		if (!(Slope[k] == Slope[k]))  // NaN from a singular point
+			Slope[k] = HUGE_VAL;
+	}
+
+	vector <double> Sorted(Slope);
+	nth_element(Sorted.begin(), Sorted.begin() + NumTau/2, Sorted.end());
+	double Threshold = max(TAU_ANOMALY_FACTOR * Sorted[NumTau/2], TAU_ANOMALY_SLOPE);
+	int NumAnomalous = 0, Start = 0;
+	for (int k = 0; k < NumTau; k++) {
+		Anomalous[k] = Slope[k] > Threshold;
+		if (Anomalous[k])
+			NumAnomalous++;
+	}
+	if (NumAnomalous == NumTau) {
+		Scan.AnomalyStart.push_back(0.0);
+		Scan.AnomalyEnd.push_back(Pi);
+		return;
+	}
+
+	// Walk once around the circle starting from the beginning of an anomalous range, so that no range is split at tau = 0.
+	for (int k = 0; k < NumTau && NumAnomalous > 0; k++)
+		if (Anomalous[k] && !Anomalous[(k+NumTau-1) % NumTau]) {
+			Start = k;
 			break;
-		}*/
+		}
+	int BestStart = 0, BestLength = 0, RunStart = 0, RunLength = 0;
+	for (int j = 0; j <= NumTau; j++) {
+		int k = (Start + j) % NumTau;
+		if (j < NumTau && !Anomalous[k]) {
+			if (RunLength == 0) RunStart = k;
+			RunLength++;
+		}
+		else {
+			if (RunLength > BestLength) {
+				BestStart = RunStart;
+				BestLength = RunLength;
+			}
+			RunLength = 0;
+		}
+		if (j < NumTau && Anomalous[k] && !Anomalous[(k+NumTau-1) % NumTau]) {
+			int End = k;
+			while (Anomalous[(End+1) % NumTau])
+				End++;
+			Scan.AnomalyStart.push_back(k*Step);
+			Scan.AnomalyEnd.push_back((End+1)*Step);  // Passes pi when the range wraps around.
+		}
+	}
 
-		OutFile << setw(1) << " " << endl;
+	int Best = BestStart;
+	for (int j = 0; j < BestLength; j++) {
+		int k = (BestStart + j) % NumTau;
+		if (Slope[k] < Slope[Best])
+			Best = k;
 	}
 
-	OutFile << "</data>" << endl << "</psh_data>" << endl;
+	// Parabola through the neighbors, in units of Step from Best
+	double Up = WrapPhase(Phase[(Best+1) % NumTau] - Phase[Best]), Down = WrapPhase(Phase[(Best+NumTau-1) % NumTau] - Phase[Best]);
+	double a = 0.5 * (Up + Down), b = 0.5 * (Up - Down), x = 0.0;
+	if (a != 0.0 && fabs(b / (2.0*a)) <= 1.0)
+		x = -b / (2.0*a);
+	Scan.Tau = (Best + x) * Step;
+	Scan.Phase = Phase[Best] + a*x*x + b*x;
+	FixPhase(Scan.Phase, LValue, IsTriplet);
+
+	Scan.Spread = 0.0;
+	for (int j = 0; j < BestLength; j++)
+		Scan.Spread = max(Scan.Spread, fabs(WrapPhase(Phase[(BestStart + j) % NumTau] - Scan.Phase)));
+	Scan.Scanned = true;
+	return;
+}
+
+
+// One row of the <tauscan> element
+string TauScanRow(int Row, TauScan &Scan)
+{
+	int FieldWidth = 25;
+	stringstream Line;
 
-	FileMatrixElem.close();
-	OutFile.close();
+	Line.setf(ios::showpoint);
+	Line << setprecision(18) << setw(8) << Row;
+	if (Scan.Scanned)
+		Line << setw(1) << " " << setw(FieldWidth) << Scan.Tau << setw(1) << " " << setw(FieldWidth) << Scan.Phase << setw(1) << " " << setw(FieldWidth) << Scan.Spread;
+	else
+		Line << setw(1) << " " << setw(3*FieldWidth + 2) << "No stable tau";
+	Line << setprecision(6);
+	for (unsigned int a = 0; a < Scan.AnomalyStart.size(); a++)
+		Line << " [" << Scan.AnomalyStart[a] << ", " << Scan.AnomalyEnd[a] << "]";
+	Line << endl;
 
+	return Line.str();
+}
+
+
+// One row of the <condition> element.  RCond is the LAPACK estimate of 1/cond_1 of the short-range block (or the
+//  ratio of the smallest to largest shifted eigenvalue in the spectral mode), and 0 if it could not be factored.
+string ConditionRow(int Row, KohnRowResult &Result)
+{
+	stringstream Line;
+
+	Line << setw(8) << Row << " " << scientific << setprecision(3) << setw(11) << Result.RCond << " " << setw(13) << Result.Refinements
+		<< " " << setw(15) << Result.Correction << endl;
+
+	return Line.str();
+}
+
+
+// Reads the list of matrix element files and the results file for each, one pair per line.
+int ReadFileList(char *ListName, vector <KappaRun> &Runs)
+{
+	ifstream ListFile;
+	string MatrixElemName, OutName;
+
+	ListFile.open(ListName);
+	if (ListFile.fail()) {
+		cerr << "Unable to open file " << ListName << " for reading." << endl;
+		return 1;
+	}
+
+	while (ListFile >> MatrixElemName >> OutName) {
+		Runs.resize(Runs.size()+1);
+		Runs.back().MatrixElemName = MatrixElemName;
+		Runs.back().OutName = OutName;
+	}
+	ListFile.close();
+
+	if (Runs.size() == 0) {
+		cerr << "No matrix element files listed in " << ListName << endl;
+		return 1;
+	}
 	return 0;
 }
 
 
+// Kohn, inverse Kohn, complex Kohn and generalized Kohn phase shifts for one term count, in the order of the columns.
+void KohnRow(vector <double> &Phases, KohnFactors &Factors, int NumShortTerms, vector <double> &ARow, vector <double> &B, vector <double> &ShortTerms, double SLS, int LValue, int IsTriplet)
+{
+	dcmplx u[2][2];
+
+	Phases.clear();
+	Phases.push_back(SchurKohn(uKohn, Factors, NumShortTerms, ARow, B, ShortTerms, SLS, LValue, IsTriplet));
+	Phases.push_back(SchurKohn(uInvKohn, Factors, NumShortTerms, ARow, B, ShortTerms, SLS, LValue, IsTriplet));
+	Phases.push_back(SchurKohn(uCompSKohn, Factors, NumShortTerms, ARow, B, ShortTerms, SLS, LValue, IsTriplet));
+	Phases.push_back(SchurKohn(uCompTKohn, Factors, NumShortTerms, ARow, B, ShortTerms, SLS, LValue, IsTriplet));
+
+	// Generalized Kohn
+	for (int t = 0; t < NUM_TAUARRAY; t++) {
+		uGenKohn(u, TauArray[t]);
+		Phases.push_back(SchurKohn(u, Factors, NumShortTerms, ARow, B, ShortTerms, SLS, LValue, IsTriplet));
+	}
+
+	// Generalized T-matrix
+	for (int t = 0; t < NUM_TAUARRAY; t++) {
+		uGenTKohn(u, TauArray[t]);
+		Phases.push_back(SchurKohn(u, Factors, NumShortTerms, ARow, B, ShortTerms, SLS, LValue, IsTriplet));
+	}
+
+	// Generalized S-matrix
+	for (int t = 0; t < NUM_TAUARRAY; t++) {
+		uGenSKohn(u, TauArray[t]);
+		Phases.push_back(SchurKohn(u, Factors, NumShortTerms, ARow, B, ShortTerms, SLS, LValue, IsTriplet));
+	}
+
+	return;
+}
+
+
+// Writes one row of phase shifts from KohnRow.
+void WriteKohnRow(ofstream &OutFile, int Row, vector <double> &Phases)
+{
+	int FieldWidth = 25;
+
+	cout << Row << " " << Phases[0] << " " << Phases[1] << " " << Phases[2] << " " << Phases[3] << endl;
+	OutFile << setw(8) << Row;
+	for (unsigned int p = 0; p < Phases.size(); p++)
+		OutFile << setw(1) << " " << setw(FieldWidth) << Phases[p];
+
+	OutFile << setw(1) << " " << endl;
+	return;
+}
+
+
 int CreateSubset(vector <double> &ARow, vector <double> &B, vector <double> &ShortTerms, vector <double> &ARowSub, vector <double> &BSub, vector <double> &ShortTermsSub, int NumShortTerms, int NSub)
 {
 	ARowSub.resize(NSub*2+1);
@@ -322,191 +798,102 @@ int CreateSubset(vector <double> &ARow, vector <double> &B, vector <double> &Sho
 }
 
 
-// Sort algorithm example code from http://www.cplusplus.com/reference/algorithm/sort/
-struct myclass {
-	bool operator() (int i,int j) { return (i<j);}
-} myobject;
-
-int FindOrderedToddTerm(string EnergyFilename, int TermToFind, int NumTerms)
+// Reads the first NumTerms terms from the energy file.  Returns the number read (fewer if the file ends early), or -1 if
+//  the file cannot be opened.
+int LoadTermOrder(TermOrder &Order, string EnergyFilename, int NumTerms)
 {
 	ifstream EnergyFile;
-	vector <int> UsedTerms, UsedTermsSub;
 	string Line;
 	int Term, Index;
 	double Energy;
 
-	if (TermToFind < 1) {
-		cout << "TermToFind must be 1 or greater." << endl;
-		return 1;
-	}
-
 	EnergyFile.open(EnergyFilename.c_str());
+	if (EnergyFile.fail())
+		return -1;
 	getline(EnergyFile, Line);
 	getline(EnergyFile, Line);  // Skip the first 4 lines
 	getline(EnergyFile, Line);  //  (unimportant for this)
 	getline(EnergyFile, Line);
 
-	UsedTerms.resize(NumTerms);
+	Order.Terms.clear();
 	for (int i = 0; i < NumTerms; i++) {
 		EnergyFile >> Term >> Index >> Energy;
-		UsedTerms[i] = Term;
+		if (EnergyFile.fail())  // End of terms to use
+			break;
+		Order.Terms.push_back(Term);
 	}
-
-	sort(UsedTerms.begin(), UsedTerms.end(), myobject);
-
 	EnergyFile.close();
 
-	// Now search for the term (or find where it would go).
-	for (int i = 0; i < NumTerms; i++) {
-		if (UsedTerms[i] == TermToFind)
-			return i+1;
-		if (UsedTerms[i] > TermToFind) {
-			if (i == 0)
-				return 1;  // Don't want to return 0.
-			return i;
-		}
-	}
+	Order.Sorted = Order.Terms;
+	sort(Order.Sorted.begin(), Order.Sorted.end());
 
-	return NumTerms+1;  // Term not found (larger than last used term).
+	return Order.Terms.size();
 }
 
 
-// We could just open the energy file in the main program instead of reopening it many times, but this is just easier.
-int TestToddFile(string EnergyFilename, int NumShortTerms)
+// Position (from 1) of a term in the sorted list, or where it would go.
+int FindOrderedToddTerm(TermOrder &Order, int TermToFind)
 {
-	ifstream EnergyFile;
-	string Line;
-	int Term, Index;
-	double Energy;
-
-	if (NumShortTerms < 1) {
-		cout << "NumShortTerms must be 1 or greater." << endl;
+	if (TermToFind < 1) {
+		cout << "TermToFind must be 1 or greater." << endl;
 		return 1;
 	}
 
-	EnergyFile.open(EnergyFilename.c_str());
-	if (EnergyFile.fail())
-		return 0;
-	getline(EnergyFile, Line);
-	getline(EnergyFile, Line);  // Skip the first 4 lines
-	getline(EnergyFile, Line);  //  (unimportant for this)
-	getline(EnergyFile, Line);
-
-	for (int i = 0; i < NumShortTerms; i++) {
-		EnergyFile >> Term >> Index >> Energy;
-		if (EnergyFile.fail())  // End of terms to use
-			return i;
-	}
-
-	EnergyFile.close();
-
-	return NumShortTerms;
+	int Pos = lower_bound(Order.Sorted.begin(), Order.Sorted.end(), TermToFind) - Order.Sorted.begin();
+	if (Pos < (int)Order.Sorted.size() && Order.Sorted[Pos] == TermToFind)
+		return Pos+1;
+	if (Pos == (int)Order.Sorted.size())
+		return Pos+1;  // Term not found (larger than last used term).
+	if (Pos == 0)
+		return 1;  // Don't want to return 0.
+	return Pos;
 }
 
 
-// We could just open the energy file in the main program instead of reopening it many times, but this is just easier.
-int LoadToddTerms(int ShortLValue, vector <double> &ARow, vector <double> &B, vector <double> &ShortTerms, vector <double> &ARowSub, vector <double> &BSub, 
-					vector <double> &ShortTermsSub, int NumShortTotal, int NSub, string EnergyFilename, bool Resorted, bool Paired, int ResortedSize)
+// Terms (counting from 1, as in the Fortran output) used for row NSub.  With Resorted, these are the first NSub of the
+//  sorted list instead of the first NSub in the energy file.  Paired runs take each term for both symmetries.
+void SelectTerms(TermOrder &Order, int NSub, bool Resorted, bool Paired, int NumShortTotal, vector <int> &Used)
 {
-	ifstream EnergyFile;
-	vector <int> UsedTerms, UsedTermsSub;
-	string Line;
-	int Term, Index, Size;
-	double Energy;
-
-	if (NSub < 0) {
-		cout << "NSub must be 0 or greater." << endl;
-		return 1;
-	}
-
-	EnergyFile.open(EnergyFilename.c_str());
-	if (EnergyFile.fail())
-		return 0;
-	getline(EnergyFile, Line);
-	getline(EnergyFile, Line);  // Skip the first 4 lines
-	getline(EnergyFile, Line);  //  (unimportant for this)
-	getline(EnergyFile, Line);
-
-	if (Resorted == false)
-		Size = NSub;
-	else
-		Size = ResortedSize;
-
-	UsedTerms.resize(Size);
-	for (int i = 0; i < Size; i++) {
-		EnergyFile >> Term >> Index >> Energy;
-		if (EnergyFile.fail())  // End of terms to use
-			return 0;
-		UsedTerms[i] = Term;
-	}
-
-	if (Paired == true) {
-		UsedTermsSub.resize(NSub*2);
-	
-		if (Resorted) {
-			cout << "Reordering terms" << endl;
-			sort(UsedTerms.begin(), UsedTerms.end(), myobject);
-		}
+	vector <int> &Terms = Resorted ? Order.Sorted : Order.Terms;
 
+	if (Paired) {
+		Used.resize(NSub*2);
 		for (int i = 0; i < NSub; i++) {
-			UsedTermsSub[i*2] = UsedTerms[i];
-			UsedTermsSub[i*2+1] = NumShortTotal/2+UsedTerms[i];
-		}
-
-		EnergyFile.close();
-
-		ARowSub.resize(NSub*2+1);
-		BSub.resize(NSub*2+1);
-		ShortTermsSub.resize(NSub*NSub*4);
-
-		ARowSub[0] = ARow[0];
-		BSub[0] = B[0];
-		for (int i = 0; i < NSub*2; i++) {
-			for (int j = 0; j < NSub*2; j++) {
-				// The Fortran output counts from 1, hence the -1 on the RHS.
-				ShortTermsSub[i*NSub*2 + j] = ShortTerms[(UsedTermsSub[i]-1)*NumShortTotal + (UsedTermsSub[j]-1)];
-			}
-			// Skips the 0 entry in ARow, so they line up.
-			ARowSub[i+1] = ARow[UsedTermsSub[i]];
-		}
-		for (int i = 0; i < NSub*2; i++) {
-			BSub[i+1] = B[UsedTermsSub[i]];
+			Used[i*2] = Terms[i];
+			Used[i*2+1] = NumShortTotal/2 + Terms[i];
 		}
 	}
 	else {
-		UsedTermsSub.resize(NSub);
-	
-		if (Resorted) {
-			//cout << "Reordering terms" << endl;
-			sort(UsedTerms.begin(), UsedTerms.end(), myobject);
-		}
-
-		for (int i = 0; i < NSub; i++) {
-			UsedTermsSub[i] = UsedTerms[i];
-		}
+		Used.assign(Terms.begin(), Terms.begin() + NSub);
+	}
+	return;
+}
 
-		EnergyFile.close();
 
-		ARowSub.resize(NSub+1);
-		BSub.resize(NSub+1);
-		ShortTermsSub.resize(NSub*NSub);
+// Picks the rows and columns of the used terms out of a NumShortTotal x NumShortTotal matrix.
+void GatherTerms(vector <double> &Full, int NumShortTotal, vector <int> &Used, vector <double> &Sub)
+{
+	int n = Used.size();
 
-		ARowSub[0] = ARow[0];
-		BSub[0] = B[0];
-		for (int i = 0; i < NSub; i++) {
-			for (int j = 0; j < NSub; j++) {
-				// The Fortran output counts from 1, hence the -1 on the RHS.
-				ShortTermsSub[i*NSub + j] = ShortTerms[(UsedTermsSub[i]-1)*NumShortTotal + (UsedTermsSub[j]-1)];
-			}
-			// Skips the 0 entry in ARow, so they line up.
-			ARowSub[i+1] = ARow[UsedTermsSub[i]];
-		}
-		for (int i = 0; i < NSub; i++) {
-			BSub[i+1] = B[UsedTermsSub[i]];
-		}
+	Sub.resize(n*n);
+	for (int i = 0; i < n; i++) {
+		// The Fortran output counts from 1, hence the -1.
+		int Row = (Used[i]-1)*NumShortTotal - 1;
+		for (int j = 0; j < n; j++)
+			Sub[i*n + j] = Full[Row + Used[j]];
 	}
+	return;
+}
+
 
-	return NSub;
+// Same for the A row or B vector, which keep their 0 (long-range) entry first.
+void GatherRow(vector <double> &Full, vector <int> &Used, vector <double> &Sub)
+{
+	Sub.resize(Used.size()+1);
+	Sub[0] = Full[0];
+	for (unsigned int i = 0; i < Used.size(); i++)
+		Sub[i+1] = Full[Used[i]];
+	return;
 }
 
 
@@ -748,6 +1135,47 @@ int ReadMatrixElem(ifstream &FileMatrixElem, int NumShortTerms, vector <double>
 }
 
 
+// Reads the binary container written by PsHScattering (Matrix Element File.h).  It has the same information as the
+//  text file, with the vectors stored exactly.
+int ReadMatrixElemBinary(MappedFile &File, int NumShortTerms, vector <double> &ARow, vector <double> &B, double &SLS, int &IsTriplet, int &Ordering, int &LValue, int &Omega, int &NumSets, double &Alpha1, double &Beta1, double &Gamma1, double &Kappa, double &Mu, string &LString, int &Shielding, string &Lambda)
+{
+	MatrixElemData M;
+
+	if (ParseMatrixElemFile(File.Begin, File.Size, M) != 0)
+		return -1;
+	if ((int)M.ARow.size() != NumShortTerms+1) {
+		cout << "Matrix element file has " << M.ARow.size()-1 << " terms instead of " << NumShortTerms << "...exiting." << endl;
+		return -1;
+	}
+
+	LString = M.Problem;
+	cout << LString << endl;
+	LValue = M.LValue;
+	IsTriplet = M.IsTriplet;
+	Ordering = M.Ordering;
+	Omega = M.Omega;
+	NumSets = M.NumSets;
+	Alpha1 = M.Alpha;
+	Beta1 = M.Beta;
+	Gamma1 = M.Gamma;
+	cout << Alpha1 << " " << Beta1 << " " << Gamma1 << endl;
+	Kappa = M.Kappa;
+	Mu = M.Mu;
+	Shielding = M.ShPower;
+	ARow = M.ARow;
+	B = M.B;
+	SLS = M.SLS;
+
+	// Same form as the Lambda line of the text file
+	stringstream LambdaStream;
+	LambdaStream.setf(ios::showpoint);
+	LambdaStream << setprecision(18) << " " << M.Lambda1 << " " << M.Lambda2 << " " << M.Lambda3 << " ";
+	Lambda = LambdaStream.str();
+
+	return 0;
+}
+
+
 #ifndef XMLCheckResult
 	#define XMLCheckResult(a_eResult) if (a_eResult != XML_SUCCESS) { cout << "Error parsing short-range file." << endl; return -1; }
 #endif
@@ -762,14 +1190,30 @@ int ReadMatrixElem(ifstream &FileMatrixElem, int NumShortTerms, vector <double>
 
 // Reads in the short-range file
 //  @TODO: Multiple formalisms (formalism tag), sectors, full exponential support
-int ReadShortHeader(string &FileShort, string &ShortString, string &LString, int &Omega, int &LValue, int &IsTriplet, int &Formalism, int &Ordering, int &NumShortTerms, int &NumSets, int &Integration, double &Alpha1, double &Beta1, double &Gamma1, double &Alpha2, double &Beta2, double &Gamma2, bool &ExtraExponential, double &Epsilon12, double &Epsilon13, vector <int> &ExpLen)
+int ReadShortHeader(string &FileShort, MappedFile &File, string &LString, int &Omega, int &LValue, int &IsTriplet, int &Formalism, int &Ordering, int &NumShortTerms, int &NumSets, int &Integration, double &Alpha1, double &Beta1, double &Gamma1, double &Alpha2, double &Beta2, double &Gamma2, bool &ExtraExponential, double &Epsilon12, double &Epsilon13, vector <int> &ExpLen)
 {
 	XMLDocument doc;
 	XMLError eResult;
 	XMLElement *Element;
 	string Entry;
 
-	eResult = doc.LoadFile(FileShort.c_str());
+	if (MapFile(FileShort, File) != 0)
+		return -1;
+
+	// Only the header goes through tinyxml2.  The data section is parsed directly from the mapped file.
+	const char *DataTag = "<data>", *DataEndTag = "</data>";
+	const char *FileEnd = File.Begin + File.Size;
+	File.Data = search((const char*)File.Begin, FileEnd, DataTag, DataTag + 6);
+	File.DataEnd = search(File.Data, FileEnd, DataEndTag, DataEndTag + 7);
+	if (File.Data == FileEnd || File.DataEnd == FileEnd) {
+		cout << "Could not find the data section in short-range file." << endl;
+		return -1;
+	}
+	string Header((const char*)File.Begin, File.Data);
+	Header += "</psh_data>";
+	File.Data += 6;
+
+	eResult = doc.Parse(Header.c_str(), Header.size());
 	XMLCheckResult(eResult);
 	XMLElement *titleElement = doc.FirstChildElement("psh_data");
 	XMLCheckResult2(titleElement);
@@ -855,56 +1299,225 @@ int ReadShortHeader(string &FileShort, string &ShortString, string &LString, int
 		cout << "This does not read in the extra exponential parameter data yet." << endl;
 	}
 
-	XMLElement *DataElement = titleElement->FirstChildElement("data");
-	XMLCheckResult2(DataElement);
-	const char *DataChar = DataElement->GetText();
-	ShortString = string(DataChar);
+	return 0;
+}
+
+
+// Maps a whole file into memory, or reads it into a buffer where mapping is not available.
+int MapFile(string &FileName, MappedFile &File)
+{
+	File.Mapped = false;
+	File.Begin = NULL;
+	File.Size = 0;
+
+#ifndef _WIN32
+	int fd = open(FileName.c_str(), O_RDONLY);
+	struct stat Info;
+	if (fd >= 0 && fstat(fd, &Info) == 0 && Info.st_size > 0) {
+		void *Map = mmap(NULL, Info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+		if (Map != MAP_FAILED) {
+			File.Begin = (char*)Map;
+			File.Size = Info.st_size;
+			File.Mapped = true;
+			madvise(Map, Info.st_size, MADV_SEQUENTIAL);
+		}
+	}
+	if (fd >= 0)
+		close(fd);
+	if (File.Mapped)
+		return 0;
+#endif
 
+	ifstream In(FileName.c_str(), ios::in | ios::binary);
+	if (In.fail()) {
+		cerr << "Unable to open file " << FileName << " for reading." << endl;
+		return -1;
+	}
+	In.seekg(0, ios::end);
+	File.Size = (size_t)In.tellg();
+	In.seekg(0, ios::beg);
+	File.Buffer.resize(File.Size + 1);
+	In.read(&File.Buffer[0], File.Size);
+	File.Begin = &File.Buffer[0];
 	return 0;
 }
 
 
-int ParseShortData(string &Data, vector <double> &ShortTerms, int NumShortTerms, double Kappa)
+void UnmapFile(MappedFile &File)
+{
+#ifndef _WIN32
+	if (File.Mapped)
+		munmap(File.Begin, File.Size);
+#endif
+	File.Mapped = false;
+	File.Begin = NULL;
+	File.Size = 0;
+	vector <char>().swap(File.Buffer);
+	return;
+}
+
+
+// strtod on a copy of the token, since Fortran uses D instead of E for scientific notation.
+double ParseFortranDouble(const char *Token, int Len)
+{
+	char Buf[64];
+
+	if (Len > 63)
+		Len = 63;
+	for (int i = 0; i < Len; i++)
+		Buf[i] = (Token[i] == 'D' || Token[i] == 'd') ? 'E' : Token[i];
+	Buf[Len] = 0;
+	return strtod(Buf, NULL);
+}
+
+
+// Each line of the data section is "i j PhiPhi PhiHPhi", in the same order as the matrices are stored.  The section is
+//  split into one chunk per thread at whitespace.  The tokens in each chunk are counted first, so that each thread knows
+//  which entry its first token belongs to, and then the chunks are parsed in place.
+int ParseShortData(MappedFile &File, vector <double> &PhiPhi, vector <double> &PhiHPhi, int NumShortTerms)
 {
-	double *PhiPhi, *PhiHPhi;
+	const char *Data = File.Data, *DataEnd = File.DataEnd;
+	long long NumEntries = (long long)NumShortTerms*NumShortTerms;
+	int NumChunks = 1;
 
-	// Allocate PhiPhi and PhiHPhi matrices
-	PhiPhi = new double[NumShortTerms*NumShortTerms];
-	PhiHPhi = new double[NumShortTerms*NumShortTerms];
-	if (PhiPhi == NULL || PhiHPhi == NULL) {
-		cout << "Memory allocation error" << endl;
-		return 5;
+	PhiPhi.resize(NumEntries);
+	PhiHPhi.resize(NumEntries);
+
+#ifdef _OPENMP
+	NumChunks = omp_get_max_threads();
+#endif
+	vector <const char*> Bounds(NumChunks+1);
+	vector <long long> FirstToken(NumChunks+1, 0);
+	Bounds[0] = Data;
+	Bounds[NumChunks] = DataEnd;
+	for (int k = 1; k < NumChunks; k++) {
+		const char *b = Data + (DataEnd - Data) / NumChunks * k;
+		while (b < DataEnd && !isspace((unsigned char)*b))
+			b++;
+		Bounds[k] = max(b, Bounds[k-1]);
+	}
+
+	#pragma omp parallel for schedule(static,1)
+	for (int k = 0; k < NumChunks; k++) {
+		long long Count = 0;
+		for (const char *c = Bounds[k]; c < Bounds[k+1]; ) {
+			while (c < Bounds[k+1] && isspace((unsigned char)*c)) c++;
+			if (c == Bounds[k+1]) break;
+			Count++;
+			while (c < Bounds[k+1] && !isspace((unsigned char)*c)) c++;
+		}
+		FirstToken[k+1] = Count;
 	}
+	for (int k = 0; k < NumChunks; k++)
+		FirstToken[k+1] += FirstToken[k];
 
-	replace(Data.begin(), Data.end(), 'D', 'E');  // Fortran uses D isntead of E for scientific notation
+	if (FirstToken[NumChunks] < 4*NumEntries) {
+		cout << "The short-range file has " << FirstToken[NumChunks]/4 << " entries instead of " << NumEntries << "...exiting." << endl;
+		return -1;
+	}
 
-	stringstream DataStream(Data);
-	string test;
-	int iC, jC;
-	double PhiPhiElem, PhiHPhiElem;
-	for (int i = 0; i < NumShortTerms; i++) {
-		for (int j = 0; j < NumShortTerms; j++) {
-			DataStream >> iC >> jC >> PhiPhiElem >> PhiHPhiElem;
-			//cout << iC << " " << jC << " " << PhiPhiElem << " " << PhiHPhiElem << endl;
-			int Idx = i * NumShortTerms + j;
-			PhiPhi[Idx] = PhiPhiElem;
-			PhiHPhi[Idx] = PhiHPhiElem;
+	#pragma omp parallel for schedule(static,1)
+	for (int k = 0; k < NumChunks; k++) {
+		long long t = FirstToken[k];
+		for (const char *c = Bounds[k]; c < Bounds[k+1] && t < 4*NumEntries; t++) {
+			while (c < Bounds[k+1] && isspace((unsigned char)*c)) c++;
+			if (c == Bounds[k+1]) break;
+			const char *Token = c;
+			while (c < Bounds[k+1] && !isspace((unsigned char)*c)) c++;
+			if (t % 4 == 2)  // The first two are the indices, which are not needed.
+				PhiPhi[t/4] = ParseFortranDouble(Token, c - Token);
+			else if (t % 4 == 3)
+				PhiHPhi[t/4] = ParseFortranDouble(Token, c - Token);
 		}
 	}
 
-	ShortTerms.resize(NumShortTerms*NumShortTerms);
+	return 0;
+}
+
+
+// The cache is the magic string, version, number of terms, size and modification time of the short-range file, and
+//  then PhiPhi and PhiHPhi as raw little-endian doubles.  It is ignored if it does not match the short-range file.
+int LoadShortCache(string &FileShort, int NumShortTerms, vector <double> &PhiPhi, vector <double> &PhiHPhi)
+{
+	string CacheName = FileShort + ".cache";
+	char Magic[8];
+	int Version, N;
+	long long Size, Time;
+	int Endian = 1;
+
+	if (*(char*)&Endian != 1)  // Big-endian machines do not use the cache.
+		return -1;
 
-	for (int i = 0; i < NumShortTerms*NumShortTerms; i++) {
-		ShortTerms[i] = PhiHPhi[i] - 0.5*Kappa*Kappa * PhiPhi[i] + 1.5*PhiPhi[i];
-		//ShortTerms[i] = PhiHPhi[i] - Kappa*Kappa * PhiPhi[i] + 1.5*PhiPhi[i];  // For electron or positron scattering
+	ifstream Cache(CacheName.c_str(), ios::in | ios::binary);
+	if (Cache.fail())
+		return -1;
+	Cache.read(Magic, 8);
+	Cache.read((char*)&Version, sizeof(int));
+	Cache.read((char*)&N, sizeof(int));
+	Cache.read((char*)&Size, sizeof(long long));
+	Cache.read((char*)&Time, sizeof(long long));
+	if (Cache.fail() || memcmp(Magic, SHORT_CACHE_MAGIC, 8) != 0 || Version != SHORT_CACHE_VERSION || N != NumShortTerms
+		|| Size != (long long)boost::filesystem::file_size(FileShort) || Time != (long long)boost::filesystem::last_write_time(FileShort)) {
+		cout << "The short-range cache " << CacheName << " is out of date and will be replaced." << endl;
+		return -1;
 	}
 
-	delete [] PhiPhi;
-	delete [] PhiHPhi;
+	PhiPhi.resize((long long)N*N);
+	PhiHPhi.resize((long long)N*N);
+	Cache.read((char*)&PhiPhi[0], (long long)N*N*sizeof(double));
+	Cache.read((char*)&PhiHPhi[0], (long long)N*N*sizeof(double));
+	if (Cache.fail())
+		return -1;
+	return 0;
+}
+
+
+int SaveShortCache(string &FileShort, int NumShortTerms, vector <double> &PhiPhi, vector <double> &PhiHPhi)
+{
+	string CacheName = FileShort + ".cache";
+	int Version = SHORT_CACHE_VERSION, N = NumShortTerms;
+	long long Size = boost::filesystem::file_size(FileShort), Time = boost::filesystem::last_write_time(FileShort);
+	int Endian = 1;
+
+	if (*(char*)&Endian != 1)
+		return -1;
+
+	ofstream Cache(CacheName.c_str(), ios::out | ios::binary);
+	if (Cache.fail()) {
+		cout << "Could not write the short-range cache " << CacheName << endl;
+		return -1;
+	}
+	Cache.write(SHORT_CACHE_MAGIC, 8);
+	Cache.write((char*)&Version, sizeof(int));
+	Cache.write((char*)&N, sizeof(int));
+	Cache.write((char*)&Size, sizeof(long long));
+	Cache.write((char*)&Time, sizeof(long long));
+	Cache.write((char*)&PhiPhi[0], (long long)N*N*sizeof(double));
+	Cache.write((char*)&PhiHPhi[0], (long long)N*N*sizeof(double));
+	Cache.close();
 
 	return 0;
 }
 
+
+// The short-range - short-range block of the Kohn matrix is the only place kappa enters the short-range terms.
+void FormShortTerms(vector <double> &PhiPhi, vector <double> &PhiHPhi, vector <double> &ShortTerms, double Kappa)
+{
+	ShortTerms.resize(PhiPhi.size());
+
+	for (unsigned int i = 0; i < PhiPhi.size(); i++)
+		ShortTerms[i] = ShortTerm(PhiPhi[i], PhiHPhi[i], Kappa);
+
+	return;
+}
+
+
+inline double ShortTerm(double PhiPhi, double PhiHPhi, double Kappa)
+{
+	return PhiHPhi - 0.5*Kappa*Kappa * PhiPhi + 1.5*PhiPhi;
+	//return PhiHPhi - Kappa*Kappa * PhiPhi + 1.5*PhiPhi;  // For electron or positron scattering
+}
+
 void WriteHeader(ofstream &OutFile, string &LString, int &LValue, char *FileShortName, char *FileMatrixElemName, char *EnergyFileName, bool &Paired, bool &Resorted,
 				int &ShortInt, int &NumTerms, double &Kappa, double &Mu, int &Shielding, string &Lambda, double &Alpha, double &Beta, double &Gamma, string &ProgName)
 {
@@ -1051,6 +1664,382 @@ double CombinedKohn(dcmplx (&u)[2][2], int NumShortTerms, vector <double> &ARow,
 }
 
 
+void InitBorderedLU(BorderedLU &Factor, int Capacity)
+{
+	Factor.Capacity = max(Capacity, 1);
+	Factor.n = 0;
+	Factor.MaxPivot = 0.0;
+	Factor.M.assign(Factor.Capacity*Factor.Capacity, 0.0);
+	Factor.LU.assign(Factor.Capacity*Factor.Capacity, 0.0);
+	Factor.ipiv.assign(Factor.Capacity, 0);
+	return;
+}
+
+
+// Makes room for Capacity terms.  The factors so far are copied over, so growing never changes the results.
+void GrowBorderedLU(BorderedLU &Factor, int Capacity)
+{
+	BorderedLU Old = Factor;
+	int n = Old.n, ld = Old.Capacity;
+
+	InitBorderedLU(Factor, Capacity);
+	for (int c = 0; c < n; c++) {
+		for (int r = 0; r < n; r++) {
+			Factor.M[c*Factor.Capacity + r] = Old.M[c*ld + r];
+			Factor.LU[c*Factor.Capacity + r] = Old.LU[c*ld + r];
+		}
+		Factor.ipiv[c] = Old.ipiv[c];
+	}
+	Factor.n = n;
+	Factor.MaxPivot = Old.MaxPivot;
+	return;
+}
+
+
+// Forms M for the terms in Used, straight from the full PhiPhi and PhiHPhi.  The terms only get appended from one row
+//  to the next, so the block for the terms already factored is kept and only the new rows and columns are formed.
+//  Returns the number of leading terms kept, which is less than Factor.n if the terms were not appended.
+int FillShortTerms(BorderedLU &Factor, vector <double> &PhiPhi, vector <double> &PhiHPhi, int NumShortTotal, vector <int> &Used, double Kappa)
+{
+	int N = Used.size(), n0 = min((int)Factor.Used.size(), Factor.n), ld;
+
+	if (n0 > N || !equal(Factor.Used.begin(), Factor.Used.begin() + n0, Used.begin()))
+		n0 = 0;
+	if (N > Factor.Capacity)
+		GrowBorderedLU(Factor, max(N, 2*Factor.Capacity));
+	ld = Factor.Capacity;
+
+	// Column c of M is row c of ShortTerms, as in GatherTerms.  The Fortran output counts from 1, hence the -1.
+	for (int c = 0; c < N; c++) {
+		int Row = (Used[c]-1)*NumShortTotal - 1;
+		for (int r = (c < n0 ? n0 : 0); r < N; r++)
+			Factor.M[c*ld + r] = ShortTerm(PhiPhi[Row + Used[r]], PhiHPhi[Row + Used[r]], Kappa);
+	}
+
+	Factor.Used = Used;
+	return n0;
+}
+
+
+// Factors the leading N x N block of M from scratch.
+int RefactorLU(BorderedLU &Factor, int N)
+{
+	MKL_INT n = N, lda = Factor.Capacity, info;
+	int ld = Factor.Capacity;
+
+	for (int c = 0; c < N; c++)
+		for (int r = 0; r < N; r++)
+			Factor.LU[c*ld + r] = Factor.M[c*ld + r];
+
+	dgetrf(&n, &n, &Factor.LU[0], &lda, &Factor.ipiv[0], &info);
+	if (info != 0) {
+		Factor.n = 0;
+		return info;
+	}
+
+	Factor.MaxPivot = 0.0;
+	for (int k = 0; k < N; k++)
+		Factor.MaxPivot = max(Factor.MaxPivot, fabs(Factor.LU[k*ld + k]));
+	Factor.n = N;
+	return 0;
+}
+
+
+// Brings the factors up to the leading N x N block of M, which has to start with the block already factored (see
+//  FillShortTerms).  Each new term borders the factors with a row of L and a column of U in O(N^2):
+//   y = L^-1 P^T a,  U^T z = b,  pivot = d - z^T y
+//  with a, b and d the new column, row and diagonal of M.  The existing row interchanges are kept, so the new pivot
+//  cannot be chosen.  Returns 1 if the block has to be factored from scratch instead: if nothing is factored yet, or
+//  for a small pivot or a large entry of z.  The factors of the leading blocks are never changed, even then.
+int BorderLU(BorderedLU &Factor, int N)
+{
+	int ld = Factor.Capacity, n0 = Factor.n;
+
+	if (n0 == 0 || N < n0)
+		return 1;
+
+	vector <double> y(N), z(N);
+	for (int k = n0; k < N; k++) {
+		for (int r = 0; r < k; r++)
+			y[r] = Factor.M[k*ld + r];
+		for (int r = 0; r < k; r++)
+			swap(y[r], y[Factor.ipiv[r]-1]);
+		for (int r = 0; r < k; r++)
+			for (int c = 0; c < r; c++)
+				y[r] -= Factor.LU[c*ld + r] * y[c];
+
+		double Growth = 0.0;
+		for (int c = 0; c < k; c++) {
+			z[c] = Factor.M[c*ld + k];
+			for (int r = 0; r < c; r++)
+				z[c] -= Factor.LU[c*ld + r] * z[r];
+			z[c] /= Factor.LU[c*ld + c];
+			Growth = max(Growth, fabs(z[c]));
+		}
+
+		double Pivot = Factor.M[k*ld + k];
+		for (int r = 0; r < k; r++)
+			Pivot -= z[r] * y[r];
+
+		if (fabs(Pivot) <= BORDER_PIVOT_TOL * max(Factor.MaxPivot, fabs(Factor.M[k*ld + k])) || Growth > BORDER_GROWTH)
+			return 1;
+
+		for (int r = 0; r < k; r++) {
+			Factor.LU[k*ld + r] = y[r];
+			Factor.LU[r*ld + k] = z[r];
+		}
+		Factor.LU[k*ld + k] = Pivot;
+		Factor.ipiv[k] = k+1;
+		Factor.MaxPivot = max(Factor.MaxPivot, fabs(Pivot));
+		Factor.n = k+1;
+	}
+
+	return 0;
+}
+
+
+// Solves the short-range block of the Kohn matrix against B and ARow with its LU factors, the leading block of Factor.
+//  The matrix solved in CombinedKohn is this block bordered by one row and column that depend on u, so with the Schur
+//  complement every u-variant only needs the four scalars in G.  FactorInfo is the LAPACK info from factoring the
+//  block.  RCond is only estimated with Condition, since it costs about as much as the solve.  Returns the LAPACK info,
+//  and CombinedKohn is used if it is nonzero.
+int FactorKohn(KohnFactors &Factors, BorderedLU &Factor, int FactorInfo, int NumShortTerms, vector <double> &ARow, vector <double> &B, vector <double> &ShortTerms, double SLS, bool Condition)
+{
+	MKL_INT n, nrhs, lda, ldb, info = 0;
+	int N = NumShortTerms;
+
+	Factors.SLS = SLS;
+	Factors.CLC = ARow[0];
+	Factors.CLS = B[0];
+	Factors.SLC = Factors.CLS + 1.0;  // Use (S,LC) = (C,LS) + 1
+	Factors.G[0][0] = Factors.G[0][1] = Factors.G[1][0] = Factors.G[1][1] = 0.0;
+	Factors.Factored = true;
+	Factors.RCond = 1.0;
+	Factors.Correction = 0.0;
+	Factors.Refinements = 0;
+	if (N == 0)
+		return 0;
+
+	// ShortTerms is stored by rows, so LAPACK sees its transpose and the solve uses 'T'.
+	vector <double> &Y = Factors.Y;
+	Y.resize(2*N);
+	for (int i = 0; i < N; i++) {
+		Y[i] = B[i+1];
+		Y[N+i] = ARow[i+1];
+	}
+
+	n = ldb = N;
+	nrhs = 2;
+	info = FactorInfo;
+	lda = Factor.Capacity;
+	if (info == 0)
+		dgetrs("T", &n, &nrhs, &Factor.LU[0], &lda, &Factor.ipiv[0], &Y[0], &ldb, &info);
+	if (info != 0) {
+		cout << "LAPACK Error factoring the short-range terms: " << info << "...solving each variant separately." << endl;
+		Factors.Factored = false;
+		Factors.RCond = 0.0;
+		return info;
+	}
+
+	// 1-norm estimate of the condition number from the factors.  The 1-norm of M is the largest row sum of ShortTerms.
+	if (Condition) {
+		double ANorm = 0.0;
+		for (int r = 0; r < N; r++) {
+			double Sum = 0.0;
+			for (int c = 0; c < N; c++)
+				Sum += fabs(ShortTerms[r*N + c]);
+			ANorm = max(ANorm, Sum);
+		}
+		vector <double> Work(4*N);
+		vector <MKL_INT> IWork(N);
+		dgecon("1", &n, &Factor.LU[0], &lda, &ANorm, &Factors.RCond, &Work[0], &IWork[0], &info);
+	}
+
+	for (int i = 0; i < N; i++) {
+		Factors.G[0][0] += B[i+1] * Y[i];
+		Factors.G[0][1] += B[i+1] * Y[N+i];
+		Factors.G[1][0] += ARow[i+1] * Y[i];
+		Factors.G[1][1] += ARow[i+1] * Y[N+i];
+	}
+
+	return 0;
+}
+
+
+// Mixed-precision iterative refinement of the solves in FactorKohn.  The residuals are taken against the short-range
+//  block formed in long double straight from PhiPhi and PhiHPhi, so the rounding of ShortTerms to double is corrected
+//  as well, and each correction reuses the double LU factors.  This stops when the correction no longer shrinks by at
+//  least half or is down to the double rounding level.  G is then summed again in long double.
+int RefineKohn(KohnFactors &Factors, BorderedLU &Factor, int NumShortTerms, vector <double> &ARow, vector <double> &B, vector <double> &PhiPhi, vector <double> &PhiHPhi, double Kappa)
+{
+	MKL_INT n, nrhs = 2, lda, ldb, info;
+	int N = NumShortTerms;
+	long double Shift = 0.5L*(long double)Kappa*Kappa - 1.5L;
+	vector <double> &Y = Factors.Y;
+	vector <double> R(2*N);
+	double LastCorrection = HUGE_VAL;
+
+	if (N == 0 || !Factors.Factored)
+		return 0;
+	n = ldb = N;
+	lda = Factor.Capacity;
+
+	for (int Iter = 0; Iter < REFINE_MAX_ITER; Iter++) {
+		for (int i = 0; i < N; i++) {
+			long double rB = B[i+1], rA = ARow[i+1];
+			for (int j = 0; j < N; j++) {
+				long double S = (long double)PhiHPhi[i*N + j] - Shift * (long double)PhiPhi[i*N + j];
+				rB -= S * Y[j];
+				rA -= S * Y[N+j];
+			}
+			R[i] = (double)rB;
+			R[N+i] = (double)rA;
+		}
+
+		dgetrs("T", &n, &nrhs, &Factor.LU[0], &lda, &Factor.ipiv[0], &R[0], &ldb, &info);
+		if (info != 0)
+			return info;
+
+		double MaxY = 0.0, MaxCorrection = 0.0;
+		for (int i = 0; i < 2*N; i++) {
+			Y[i] += R[i];
+			MaxY = max(MaxY, fabs(Y[i]));
+			MaxCorrection = max(MaxCorrection, fabs(R[i]));
+		}
+		Factors.Correction = MaxY > 0.0 ? MaxCorrection / MaxY : 0.0;
+		Factors.Refinements = Iter+1;
+		if (Factors.Correction <= DBL_EPSILON || Factors.Correction > 0.5*LastCorrection)
+			break;
+		LastCorrection = Factors.Correction;
+	}
+
+	long double G00 = 0.0L, G01 = 0.0L, G10 = 0.0L, G11 = 0.0L;
+	for (int i = 0; i < N; i++) {
+		G00 += (long double)B[i+1] * Y[i];
+		G01 += (long double)B[i+1] * Y[N+i];
+		G10 += (long double)ARow[i+1] * Y[i];
+		G11 += (long double)ARow[i+1] * Y[N+i];
+	}
+	Factors.G[0][0] = (double)G00;  Factors.G[0][1] = (double)G01;
+	Factors.G[1][0] = (double)G10;  Factors.G[1][1] = (double)G11;
+
+	return 0;
+}
+
+
+// Same result as CombinedKohn, but from the factors of FactorKohn.  With the border c = u10 B + u11 ARow, the right-hand
+//  side s = u00 B + u01 ARow and S the short-range block, the first unknown is
+//  X0 = (c^T S^-1 s - CLSt) / (CLCt - c^T S^-1 c), and PsiLS = X0 CLSt - s^T S^-1 s - X0 s^T S^-1 c.
+double SchurKohn(dcmplx (&u)[2][2], KohnFactors &Factors, int NumShortTerms, vector <double> &ARow, vector <double> &B, vector <double> &ShortTerms, double SLS, int LValue, int IsTriplet)
+{
+	if (!Factors.Factored)
+		return CombinedKohn(u, NumShortTerms, ARow, B, ShortTerms, SLS, LValue, IsTriplet);
+
+	double CLC = Factors.CLC, CLS = Factors.CLS, SLC = Factors.SLC;
+	dcmplx SLSt, CLSt, CLCt;
+	dcmplx c[2] = { u[1][0], u[1][1] }, s[2] = { u[0][0], u[0][1] };
+	dcmplx cGs = 0.0, cGc = 0.0, sGs = 0.0, sGc = 0.0;
+
+	dcmplx detu = u[0][0]*u[1][1] - u[0][1]*u[1][0];  // Determinant
+
+	SLSt = u[0][0]*u[0][0]*SLS + u[0][0]*u[0][1]*SLC + u[0][1]*u[0][0]*CLS + u[0][1]*u[0][1]*CLC;
+	CLSt = u[1][0]*u[0][0]*SLS + u[1][0]*u[0][1]*SLC + u[1][1]*u[0][0]*CLS + u[1][1]*u[0][1]*CLC;
+	CLCt = u[1][0]*u[1][0]*SLS + u[1][0]*u[1][1]*SLC + u[1][1]*u[1][0]*CLS + u[1][1]*u[1][1]*CLC;
+
+	for (int i = 0; i < 2; i++) {
+		for (int j = 0; j < 2; j++) {
+			cGs += c[i] * Factors.G[i][j] * s[j];
+			cGc += c[i] * Factors.G[i][j] * c[j];
+			sGs += s[i] * Factors.G[i][j] * s[j];
+			sGc += s[i] * Factors.G[i][j] * c[j];
+		}
+	}
+
+	dcmplx Denom = CLCt - cGc;
+	if (Denom == 0.0) {
+		cout << "Singular Kohn matrix" << endl;
+		return 0.0;
+	}
+	dcmplx X0 = (cGs - CLSt) / Denom;
+	dcmplx PsiLS = X0 * CLSt - sGs - X0 * sGc;
+	dcmplx L = -(PsiLS + SLSt) / detu;
+	// Go from general L matrix element to K.
+	dcmplx K = (u[0][1] + u[1][1]*L) / (u[0][0] + u[1][0]*L);
+
+	double PhaseShift = atan(K.real());
+	FixPhase(PhaseShift, LValue, IsTriplet);
+	return PhaseShift;
+}
+
+
+// Solves PhiHPhi x = lambda PhiPhi x for the leading N x N block.  The eigenvectors are normalized so that
+//  X^T PhiPhi X = I and are stored by columns.  Returns the LAPACK info.
+int SpectralShort(vector <double> &PhiHPhi, vector <double> &PhiPhi, int N, vector <double> &Eigenvalues, vector <double> &Eigenvectors)
+{
+	MKL_INT itype = 1, n = N, lda = N, ldb = N, lwork = -1, info;
+	double WorkSize;
+
+	if (N == 0)
+		return 0;
+
+	Eigenvectors.assign(PhiHPhi.begin(), PhiHPhi.begin() + N*N);
+	vector <double> Overlap(PhiPhi.begin(), PhiPhi.begin() + N*N);
+	Eigenvalues.resize(N);
+
+	// Workspace query first
+	dsygv(&itype, "V", "U", &n, &Eigenvectors[0], &lda, &Overlap[0], &ldb, &Eigenvalues[0], &WorkSize, &lwork, &info);
+	lwork = (MKL_INT)WorkSize;
+	vector <double> Work(lwork);
+	dsygv(&itype, "V", "U", &n, &Eigenvectors[0], &lda, &Overlap[0], &ldb, &Eigenvalues[0], &Work[0], &lwork, &info);
+	if (info != 0)
+		cout << "LAPACK Error diagonalizing the short-range terms: " << info << "...factoring each kappa separately." << endl;
+
+	return info;
+}
+
+
+// Fills in Factors from the eigenvectors of SpectralShort instead of FactorKohn.  With ShortTerms = PhiHPhi - E PhiPhi
+//  and E = kappa^2/2 - 1.5, the inverse is X (Lambda - E)^-1 X^T, so each kappa only needs X^T B and X^T ARow.
+int SpectralKohn(KohnFactors &Factors, vector <double> &Eigenvalues, vector <double> &Eigenvectors, int NumShortTerms, vector <double> &ARow, vector <double> &B, double SLS, double Kappa)
+{
+	int N = NumShortTerms;
+	double E = 0.5*Kappa*Kappa - 1.5;
+
+	Factors.SLS = SLS;
+	Factors.CLC = ARow[0];
+	Factors.CLS = B[0];
+	Factors.SLC = Factors.CLS + 1.0;  // Use (S,LC) = (C,LS) + 1
+	Factors.G[0][0] = Factors.G[0][1] = Factors.G[1][0] = Factors.G[1][1] = 0.0;
+	Factors.Factored = true;
+	Factors.Correction = 0.0;
+	Factors.Refinements = 0;
+
+	double MinShift = HUGE_VAL, MaxShift = 0.0;
+	for (int k = 0; k < N; k++) {
+		MinShift = min(MinShift, fabs(Eigenvalues[k] - E));
+		MaxShift = max(MaxShift, fabs(Eigenvalues[k] - E));
+	}
+	Factors.RCond = N == 0 ? 1.0 : MinShift / MaxShift;
+
+	for (int k = 0; k < N; k++) {
+		double XB = 0.0, XA = 0.0;
+		for (int r = 0; r < N; r++) {
+			XB += Eigenvectors[k*N + r] * B[r+1];
+			XA += Eigenvectors[k*N + r] * ARow[r+1];
+		}
+		if (Eigenvalues[k] == E)
+			return 1;
+		double Shift = 1.0 / (Eigenvalues[k] - E);
+		Factors.G[0][0] += XB * XB * Shift;
+		Factors.G[0][1] += XB * XA * Shift;
+		Factors.G[1][1] += XA * XA * Shift;
+	}
+	Factors.G[1][0] = Factors.G[0][1];
+
+	return 0;
+}
+
+
 string ShortIntString(int &Integration)
 {
 	switch (Integration)
@@ -19,51 +19,59 @@
 #endif
 
 
-module variables
-	type PMatrix
-	   real*8, pointer, dimension(:,:) :: P
-	end type PMatrix
-	
-	type Ptr1D
-		real*8, pointer, dimension(:) :: P
-	end type Ptr1D
-end module variables
-
-
 program Energy
 	use omp_lib
 	!use mpi
-	use variables
+	use iso_c_binding
 	implicit none
+
+	! These are in ShortCache.c and share the binary cache of the short-range file with Phase.
+	interface
+		integer(c_int) function LoadShortCache(FileShort, NumShortTerms, PhiPhi, PhiHPhi) bind(c, name='LoadShortCache')
+		use iso_c_binding
+		character(kind=c_char), dimension(*) :: FileShort
+		integer(c_int), value :: NumShortTerms
+		real(c_double), dimension(*) :: PhiPhi, PhiHPhi
+		end function LoadShortCache
+		integer(c_int) function SaveShortCache(FileShort, NumShortTerms, PhiPhi, PhiHPhi) bind(c, name='SaveShortCache')
+		use iso_c_binding
+		character(kind=c_char), dimension(*) :: FileShort
+		integer(c_int), value :: NumShortTerms
+		real(c_double), dimension(*) :: PhiPhi, PhiHPhi
+		end function SaveShortCache
+	end interface
+
 #ifdef USE_MPI
 	include 'mpif.h'
 	integer MpiError, MpiStatus(MPI_STATUS_SIZE)
 	character(len=MPI_MAX_PROCESSOR_NAME) ProcessorName
+	integer NodeComm, LeaderComm, NodeRank, SharedWin, DispUnit
+	integer(kind=MPI_ADDRESS_KIND) WinSize, BasePtr
 #endif
 	integer Node, TotalNodes, NodeStart, NodeEnd
 	integer outputtxt, energyfile, prevresults
 	integer i, j, k, m, i1, j1, ThreadNum, iargc, EnergyMinIndex, CurTerm, Omega, NumTerms, NumSets
 	integer Ordering, IsTriplet, Reserved
-	integer ProcNameLen, NumUsed, NumUnused, Info, Tid, MaxThreads
+	integer ProcNameLen, NumUsed, NumUnused, Info, MaxThreads
 	integer, allocatable, dimension(:) :: UsedTerms, UsedTerms2, UnusedTerms
 	integer, allocatable, dimension(:) :: EnergyMinIndexArray
-	real*8, allocatable, dimension(:,:) :: PhiPhi, PhiHPhi
+	real*8, pointer, dimension(:,:) :: PhiPhi, PhiHPhi  ! Shared by all of the processes on a node with MPI
+	real*8, pointer, dimension(:) :: SharedBuf
 	real*8, dimension(5) :: Alpha, Beta, Gamma  ! @TODO: Variable length
-	real*8 Upper, Lower, Tolerance, StartTime, EndTime, EnergyMin, NumTermsNode
-	real*8 RemoveMe
+	real*8 Upper, Lower, Tolerance, StartTime, EndTime, EnergyMin
 	real*8, allocatable, dimension(:) :: EnergyMinArray
 	real*8, pointer, dimension(:,:) :: PhiPhi8, PhiHPhi8  !, PhiPhiTemp, PhiHPhiTemp
 	real*8, pointer, dimension(:) :: Energies, Workspace
+	real*8, allocatable, dimension(:,:) :: XUpper, XLower  ! Eigenvectors of the chosen basis for both triangles
+	real*8, allocatable, dimension(:) :: LambdaUpper, LambdaLower  ! and the matching eigenvalues
+	real*8 BorderedLowest
 	logical, allocatable, dimension(:) :: IsTermUsed
 	logical Error
-	character *100 Temp1, Temp2, Temp3, IOBuffer, EBuffer
-	type(PMatrix), allocatable, dimension(:) :: PhiPhiMat, PhiHPhiMat
-	type(Ptr1D), allocatable, dimension(:) :: EnergiesArray, WorkspaceArray
+	character *100 Temp1, Temp2, Temp3, IOBuffer, EBuffer, ShortFileName
 	integer CalcPowerTableSize
 	integer, allocatable, dimension(:,:) :: PowerTable
 	integer Cond1, Cond2, Cond3, Cond4, Cond5, ReadShortHeader, Res, LValue, Formalism
-	integer*8 MemUsed, nt, mt
-	integer RemoveMeInt
+	integer*8 MemUsed, nt
 
 	Node = 0
 	TotalNodes = 1
@@ -103,22 +111,23 @@ program Energy
 	!  command-line arguments, it uses the default filenames.
 	if (Node == 0) then
 		if (iargc() == 2) then
-			call getarg(1, IOBuffer)
+			call getarg(1, ShortFileName)
 			!open (outputtxt, FILE=IOBuffer)
-			open(unit=outputtxt, file=IOBuffer, status="old")
+			open(unit=outputtxt, file=ShortFileName, status="old")
 			call getarg(2, IOBuffer)
 			open (energyfile, FILE=IOBuffer, status='unknown')
 		else if (iargc() == 3) then
-			call getarg(1, IOBuffer)
+			call getarg(1, ShortFileName)
 			!open (outputtxt, FILE=IOBuffer)
-			open (unit=outputtxt, file=IOBuffer, status="old")
+			open (unit=outputtxt, file=ShortFileName, status="old")
 			call getarg(2, IOBuffer)
 			open (energyfile, FILE=IOBuffer, status='unknown')
 			call getarg(3, IOBuffer)  ! Use previous output as an input to continue computation.
 			open (prevresults, FILE=IOBuffer)
 		else
 			!open (outputtxt, FILE='output.txt')
-			open (unit=outputtxt, file='output.psh', status="old")
+			ShortFileName = 'output.psh'
+			open (unit=outputtxt, file=ShortFileName, status="old")
 			open (energyfile, FILE='energies.txt', status='unknown')
 			IOBuffer = 'energies.txt'
 		endif
@@ -155,39 +164,58 @@ program Energy
 	call MPI_BCAST(NumTerms, 1, MPI_INTEGER, 0, MPI_COMM_WORLD, MpiError)
 #endif
 
-	allocate(PhiPhi(NumTerms*2,NumTerms*2))
-	allocate(PhiHPhi(NumTerms*2,NumTerms*2))
+#ifdef USE_MPI
+	! PhiPhi and PhiHPhi are only stored once per node, in a window shared by all of the processes on that node.  The
+	!  first process on each node allocates it, and the others map the same memory.
+	call MPI_Comm_split_type(MPI_COMM_WORLD, MPI_COMM_TYPE_SHARED, 0, MPI_INFO_NULL, NodeComm, MpiError)
+	call MPI_Comm_rank(NodeComm, NodeRank, MpiError)
+	WinSize = 0
+	if (NodeRank == 0) WinSize = 8_MPI_ADDRESS_KIND * NumTerms * NumTerms * 8  ! 2 matrices of (2*NumTerms)^2 doubles
+	call MPI_Win_allocate_shared(WinSize, 8, MPI_INFO_NULL, NodeComm, BasePtr, SharedWin, MpiError)
+	if (NodeRank /= 0) call MPI_Win_shared_query(SharedWin, 0, WinSize, DispUnit, BasePtr, MpiError)
+	call c_f_pointer(transfer(BasePtr, c_null_ptr), SharedBuf, [8_8 * NumTerms * NumTerms])
+#else
+	allocate(SharedBuf(8_8 * NumTerms * NumTerms))
+#endif
+	PhiPhi(1:NumTerms*2,1:NumTerms*2) => SharedBuf(1:4_8*NumTerms*NumTerms)
+	PhiHPhi(1:NumTerms*2,1:NumTerms*2) => SharedBuf(4_8*NumTerms*NumTerms+1:8_8*NumTerms*NumTerms)
 	allocate(UsedTerms(NumTerms))
 	allocate(UsedTerms2(NumTerms*2))
 	allocate(UnusedTerms(NumTerms))
 	allocate(IsTermUsed(NumTerms))
-	allocate(PhiPhiMat(0:MaxThreads))
-	allocate(PhiHPhiMat(0:MaxThreads))
-	allocate(EnergiesArray(0:MaxThreads))
-	allocate(WorkspaceArray(0:MaxThreads))
-	do i = 0, MaxThreads-1, 1
-		allocate(PhiPhiMat(i)%P(NumTerms*2,NumTerms*2))
-		allocate(PhiHPhiMat(i)%P(NumTerms*2,NumTerms*2))
-		allocate(EnergiesArray(i)%P(NumTerms*2))
-		allocate(WorkspaceArray(i)%P(3*NumTerms*2))
-	end do
+	! The candidates are tested with a bordered update of the eigenpairs of the chosen basis (see BorderedLowest), so
+	!  the threads no longer need their own copies of the sub-matrices.  These are only used for the full solves.
+	allocate(PhiPhi8(NumTerms*2,NumTerms*2))
+	allocate(PhiHPhi8(NumTerms*2,NumTerms*2))
+	allocate(Energies(NumTerms*2))
+	allocate(Workspace(3*NumTerms*2))
+	allocate(XUpper(NumTerms*2,NumTerms*2))
+	allocate(XLower(NumTerms*2,NumTerms*2))
+	allocate(LambdaUpper(NumTerms*2))
+	allocate(LambdaLower(NumTerms*2))
 
 	nt = NumTerms
-	mt = MaxThreads
 	if (Node==0) write (*,*) "NumTerms and MaxThreads:", NumTerms, MaxThreads
+	MemUsed = 0
+#ifdef USE_MPI
+	if (NodeRank == 0) then  ! Only stored once per node
+#endif
 	MemUsed = nt*nt*8_8  !PhiPhi
 	MemUsed = MemUsed + nt*nt*8_8  !PhiHPhi
+#ifdef USE_MPI
+	endif
+#endif
 	MemUsed = MemUsed + nt*8_8  !UsedTerms
 	MemUsed = MemUsed + nt*8_8  !UnusedTerms
 	MemUsed = MemUsed + nt*4_8  !IsTermUsed
-	MemUsed = MemUsed + mt*8_8  !PhiPhiMat
-	MemUsed = MemUsed + mt*8_8  !PhiHPhiMat
-	MemUsed = MemUsed + mt*8_8  !EnergiesArray
-	MemUsed = MemUsed + mt*8_8  !WorkspaceArray
-	MemUsed = MemUsed + nt*nt*mt*8_8  !PhiPhiMat
-	MemUsed = MemUsed + nt*nt*mt*8_8  !PhiHPhiMat
-	MemUsed = MemUsed + nt*mt*8_8  !EnergiesArray
-	MemUsed = MemUsed + 3*nt*mt*8_8  !WorkspaceArray
+	MemUsed = MemUsed + nt*nt*8_8  !PhiPhi8
+	MemUsed = MemUsed + nt*nt*8_8  !PhiHPhi8
+	MemUsed = MemUsed + nt*8_8  !Energies
+	MemUsed = MemUsed + 3*nt*8_8  !Workspace
+	MemUsed = MemUsed + nt*nt*8_8  !XUpper
+	MemUsed = MemUsed + nt*nt*8_8  !XLower
+	MemUsed = MemUsed + nt*8_8  !LambdaUpper
+	MemUsed = MemUsed + nt*8_8  !LambdaLower
 	if (Node == 0) then
 		MemUsed = MemUsed + TotalNodes*8_8 !EnergyMinArray
 		MemUsed = MemUsed + TotalNodes*4_8 !EnergyMinIndexArray
@@ -198,14 +226,23 @@ program Energy
 	IsTermUsed = .false.
 
 	! Read in our matrices.
+#ifdef USE_MPI
+	call MPI_Win_fence(0, SharedWin, MpiError)
+#endif
 	if (Node == 0) then
-		write (*,*) "Reading in matrices..."
-		do i = 1, NumTerms*2, 1
-			do j = 1, NumTerms*2, 1
-				read (outputtxt,*) i1, j1, PhiPhi(i,j), PhiHPhi(i,j)
-				!read (outputtxt) PhiPhi(i,j)
+		! The text is slow to read for large omega, so the matrices are kept in a binary cache next to it.
+		if (LoadShortCache(trim(ShortFileName)//c_null_char, NumTerms*2, PhiPhi, PhiHPhi) == 0) then
+			write (*,*) "Read the matrices from ", trim(ShortFileName)//".cache"
+		else
+			write (*,*) "Reading in matrices..."
+			do i = 1, NumTerms*2, 1
+				do j = 1, NumTerms*2, 1
+					read (outputtxt,*) i1, j1, PhiPhi(i,j), PhiHPhi(i,j)
+					!read (outputtxt) PhiPhi(i,j)
+				enddo
 			enddo
-		enddo
+			Res = SaveShortCache(trim(ShortFileName)//c_null_char, NumTerms*2, PhiPhi, PhiHPhi)
+		endif
 
 		! Divide every entry in PhiHPhi by 2, since we calculated <phi_i|2H|phi_j> in equation (3.22).
 		PhiHPhi = PhiHPhi / 2.0d0
@@ -213,27 +250,20 @@ program Energy
 	endif
 	
 #ifdef USE_MPI
-	! Broadcast these matrices to all processes.
-	if (Node == 0) then
-		write (*,*) 'TotalNodes', TotalNodes
-		do i = 1, TotalNodes-1, 1
-			write (*,*) 'Rank', i
-			do j = 1, NumTerms*2, 1
-				!call MPI_BCAST(PhiPhi(1,j), NumTerms, MPI_DOUBLE_PRECISION, 0, MPI_COMM_WORLD, MpiError)
-				!call MPI_BCAST(PhiHPhi(1,j), NumTerms, MPI_DOUBLE_PRECISION, 0, MPI_COMM_WORLD, MpiError)
-				call MPI_Send(PhiPhi(1,j), NumTerms*2, MPI_DOUBLE_PRECISION, i, 0, MPI_COMM_WORLD, MpiError)
-				call MPI_Send(PhiHPhi(1,j), NumTerms*2, MPI_DOUBLE_PRECISION, i, 0, MPI_COMM_WORLD, MpiError)
-			enddo
-		enddo
+	! Each node has one copy of the matrices, so they only have to be sent to the first process on the other nodes.
+	if (NodeRank == 0) then
+		call MPI_Comm_split(MPI_COMM_WORLD, 0, Node, LeaderComm, MpiError)
 	else
-		do j = 1, NumTerms*2, 1
-			call MPI_Recv(PhiPhi(1,j), NumTerms*2, MPI_DOUBLE_PRECISION, 0, 0, MPI_COMM_WORLD, MpiStatus, MpiError)
-			call MPI_Recv(PhiHPhi(1,j), NumTerms*2, MPI_DOUBLE_PRECISION, 0, 0, MPI_COMM_WORLD, MpiStatus, MpiError)
-		enddo
+		call MPI_Comm_split(MPI_COMM_WORLD, MPI_UNDEFINED, Node, LeaderComm, MpiError)
 	endif
-
-	call MPI_BCAST(PhiPhi,  NumTerms*NumTerms*4, MPI_DOUBLE_PRECISION, 0, MPI_COMM_WORLD, MpiError)
-	call MPI_BCAST(PhiHPhi, NumTerms*NumTerms*4, MPI_DOUBLE_PRECISION, 0, MPI_COMM_WORLD, MpiError)
+	if (NodeRank == 0) then
+		if (Node == 0) write (*,*) 'TotalNodes', TotalNodes
+		call MPI_BCAST(PhiPhi,  NumTerms*NumTerms*4, MPI_DOUBLE_PRECISION, 0, LeaderComm, MpiError)
+		call MPI_BCAST(PhiHPhi, NumTerms*NumTerms*4, MPI_DOUBLE_PRECISION, 0, LeaderComm, MpiError)
+		call MPI_Comm_free(LeaderComm, MpiError)
+	endif
+	! Makes the matrices visible to the rest of the processes on each node.
+	call MPI_Win_fence(0, SharedWin, MpiError)
 #endif
 	! Allocate space to collate the lowest energies from each node.
 	if (Node == 0) then
@@ -302,20 +332,38 @@ program Energy
 		EnergyMin = 0.0d0
 		EnergyMinIndex = -1
 
+		! The chosen basis only changes when a term is committed, so this is the only full solve per iteration.  Every
+		!  node rebuilds UsedTerms2 itself, since only UsedTerms is broadcast.  The upper and lower triangles are solved
+		!  separately, because the matrices are not exactly symmetric and the two energies are compared below.
+		do i = 1, NumUsed, 1
+			UsedTerms2(2*i-1) = UsedTerms(i)
+			UsedTerms2(2*i) = UsedTerms(i) + NumTerms
+		enddo
+		call BasisEigen(PhiPhi, PhiHPhi, NumTerms, UsedTerms2, NumUsed*2, 'U', XUpper, LambdaUpper, PhiPhi8, Workspace, Info)
+		if (Info == 0) call BasisEigen(PhiPhi, PhiHPhi, NumTerms, UsedTerms2, NumUsed*2, 'L', XLower, LambdaLower, PhiPhi8, Workspace, Info)
+		if (Info /= 0) then
+			if (Node == 0) then
+				write (*,*) 'dsygv error code for the chosen basis:', Info
+				write (energyfile,*) 'dsygv error code for the chosen basis:', Info
+			endif
+			exit
+		endif
+
 		! Determine for each process which terms it should investigate.
 		if (Node == 0) then
-			NumTermsNode = NumUnused / real(TotalNodes)
+			! Integer division, so that the last node always ends at NumUnused.  Splitting a real NumUnused / TotalNodes
+			!  could round down and drop the last term.
 #ifdef USE_MPI
 			do k = 1, TotalNodes - 1, 1
-				NodeStart = NumTermsNode * k + 1
-				NodeEnd = NumTermsNode * (k+1)
+				NodeStart = NumUnused * k / TotalNodes + 1
+				NodeEnd = NumUnused * (k+1) / TotalNodes
 				call MPI_Send(NodeStart, 1, MPI_INTEGER, k, 1, MPI_COMM_WORLD, MpiError)
 				call MPI_Send(NodeEnd, 1, MPI_INTEGER, k, 2, MPI_COMM_WORLD, MpiError)
 			enddo
 #endif
 			! This is the set of values for the root node to take.
 			NodeStart = 1
-			NodeEnd = NumTermsNode * (Node+1)
+			NodeEnd = NumUnused / TotalNodes
 #ifdef USE_MPI
 		else
 			call MPI_Recv(NodeStart, 1, MPI_INTEGER, 0, 1, MPI_COMM_WORLD, MpiStatus, MpiError)
@@ -324,131 +372,36 @@ program Energy
 		endif
 
 
-		!$omp parallel shared(i,NumTerms,PhiPhi,PhiHPhi,UsedTerms,UsedTerms2,NumUsed,EnergyMin,EnergyMinIndex,m,IsTermUsed,PhiPhiMat,PhiHPhiMat)
-		!$omp do private(PhiPhi8,PhiHPhi8,j,k,Upper,Lower,Energies,Workspace,Info,Tid,Error,CurTerm)
+		!$omp parallel shared(NumTerms,PhiPhi,PhiHPhi,UsedTerms2,NumUsed,EnergyMin,EnergyMinIndex,IsTermUsed,XUpper,XLower,LambdaUpper,LambdaLower)
+		!$omp do private(Upper,Lower,Info,Error,CurTerm)
 		do i = NodeStart, NodeEnd, 1
-			Tid = omp_get_thread_num()
 			CurTerm = UnusedTerms(i)
 			if (IsTermUsed(CurTerm) .eqv. .true.) cycle  ! Not really needed anymore
-			!write (*,*) "Checking term", i, "on thread", Tid
-
-			! Assign our pointers to the array of structures so that each thread has its own copy of PhiPhi and PhiHPhi.
-			PhiPhi8 => PhiPhiMat(Tid)%P
-			PhiHPhi8 => PhiHPhiMat(Tid)%P
-			Energies => EnergiesArray(Tid)%P
-			Workspace => WorkspaceArray(Tid)%P
-
-			! Have to clear out these matrices, because LAPACK gives strange results if the rest of the
-			!  matrix we are not using is non-zero.  We are only using the sub-matrix of size
-			!  (NumUsed+1)x(NumUsed+1).
-			PhiPhi8 = 0.0d0
-			PhiHPhi8 = 0.0d0
-
-			! Create our sub-matrix with the terms chosen for lowest energies.  The terms are stored in
-			!  the UsedTerms2 array.  This sub-matrix is the same for every iteration in this loop.
-			do j = 1, NumUsed*2, 1
-				do k = 1, NumUsed*2, 1
-					PhiPhi8(j,k) = PhiPhi(UsedTerms2(j),UsedTerms2(k))
-					PhiHPhi8(j,k) = PhiHPhi(UsedTerms2(j),UsedTerms2(k))
-				enddo
-			enddo
-
-			!$omp critical(build)
-			!@TODO: Is there a more efficient way to do this?
-			! If this is not enclosed by critical sections, then it will give really strange results.
-			! Construct new row with term to test. - phi1
-			UsedTerms(NumUsed+1) = CurTerm
-			UsedTerms2(NumUsed*2+1) = CurTerm
-			do j = 1, NumUsed*2+1, 1
-				RemoveMeInt = UsedTerms2(j)
-				PhiPhi8(NumUsed*2+1,j) = PhiPhi(CurTerm,UsedTerms2(j))
-				PhiHPhi8(NumUsed*2+1,j) = PhiHPhi(CurTerm,UsedTerms2(j))
-			enddo
-			! Construct new column. - phi1
-			do j = 1, NumUsed*2+1, 1
-				RemoveMeInt = UsedTerms2(j)
-				PhiPhi8(j,NumUsed*2+1) = PhiPhi(UsedTerms2(j),CurTerm)
-				PhiHPhi8(j,NumUsed*2+1) = PhiHPhi(UsedTerms2(j),CurTerm)
-			enddo
-			! Construct new row with term to test. - phi2
-			UsedTerms2(NumUsed*2+2) = CurTerm + NumTerms
-			do j = 1, NumUsed*2+2, 1
-				RemoveMeInt = UsedTerms2(j)
-				PhiPhi8(NumUsed*2+2,j) = PhiPhi(CurTerm+NumTerms,UsedTerms2(j))
-				PhiHPhi8(NumUsed*2+2,j) = PhiHPhi(CurTerm+NumTerms,UsedTerms2(j))
-			enddo
-			! Construct new column. - phi2
-			do j = 1, NumUsed*2+2, 1
-				RemoveMeInt = UsedTerms2(j)
-				PhiPhi8(j,NumUsed*2+2) = PhiPhi(UsedTerms2(j),CurTerm+NumTerms)
-				PhiHPhi8(j,NumUsed*2+2) = PhiHPhi(UsedTerms2(j),CurTerm+NumTerms)
-			enddo
-			!$omp end critical(build)
+			!write (*,*) "Checking term", i, "on thread", omp_get_thread_num()
 
+			! Finds the lowest eigenvalue with this term added, using the upper triangular matrix.
 			Error = .false.
-			! Finds the NumUsed+1 eigenvalues of the upper triangular matrix.
-			call dsygv(1, 'N', 'U', 2*(NumUsed+1), PhiHPhi8, NumTerms*2, PhiPhi8, NumTerms*2, Energies, Workspace, 3*NumTerms*2, Info)
+			Upper = BorderedLowest(PhiPhi, PhiHPhi, NumTerms, UsedTerms2, NumUsed*2, CurTerm, 'U', XUpper, LambdaUpper, Info)
 			if (Info /= 0) then
-				write (energyfile,*) 'Upper dsygv error code:', Info, 'Term:', CurTerm
+				write (energyfile,*) 'Upper overlap not positive definite:', Info, 'Term:', CurTerm
 				Error = .true.
 			endif
-			Upper = Energies(1)
-
-			! Create our sub-matrix with the terms chosen for lowest energies.  The terms are stored in
-			!  the UsedTerms array.  This sub-matrix is the same for every iteration in this loop.
-			do j = 1, NumUsed*2, 1
-				do k = 1, NumUsed*2, 1
-					PhiPhi8(j,k) = PhiPhi(UsedTerms2(j),UsedTerms2(k))
-					PhiHPhi8(j,k) = PhiHPhi(UsedTerms2(j),UsedTerms2(k))
-				enddo
-			enddo
-
-			!$omp critical(build)
-			! Exact same building code as before.
-			! Construct new row with term to test.
-			UsedTerms(NumUsed+1) = CurTerm
-			UsedTerms2(NumUsed*2+1) = CurTerm
-			do j = 1, NumUsed*2+1, 1
-				RemoveMeInt = UsedTerms2(j)
-				PhiPhi8(NumUsed*2+1,j) = PhiPhi(CurTerm,UsedTerms2(j))
-				PhiHPhi8(NumUsed*2+1,j) = PhiHPhi(CurTerm,UsedTerms2(j))
-			enddo
-			! Construct new column. - phi1
-			do j = 1, NumUsed*2+1, 1
-				RemoveMeInt = UsedTerms2(j)
-				PhiPhi8(j,NumUsed*2+1) = PhiPhi(UsedTerms2(j),CurTerm)
-				PhiHPhi8(j,NumUsed*2+1) = PhiHPhi(UsedTerms2(j),CurTerm)
-			enddo
-			! Construct new row with term to test. - phi2
-			UsedTerms2(NumUsed*2+2) = CurTerm + NumTerms
-			do j = 1, NumUsed*2+2, 1
-				RemoveMeInt = UsedTerms2(j)
-				PhiPhi8(NumUsed*2+2,j) = PhiPhi(CurTerm+NumTerms,UsedTerms2(j))
-				PhiHPhi8(NumUsed*2+2,j) = PhiHPhi(CurTerm+NumTerms,UsedTerms2(j))
-			enddo
-			! Construct new column. - phi2
-			do j = 1, NumUsed*2+2, 1
-				RemoveMeInt = UsedTerms2(j)
-				PhiPhi8(j,NumUsed*2+2) = PhiPhi(UsedTerms2(j),CurTerm+NumTerms)
-				PhiHPhi8(j,NumUsed*2+2) = PhiHPhi(UsedTerms2(j),CurTerm+NumTerms)
-			enddo
-			!$omp end critical(build)
 
 			! If there was an error for the upper triangular matrix eigenvalues, there is no reason to waste computation
 			!  time finding the lower triangular matrix eigenvalues.  This term is not used if Error = true.
 			if (Error .eqv. .false.) then
-				! Finds the NumUsed+1 eigenvalues of the lower triangular matrix.
-				call dsygv(1, 'N', 'L', 2*(NumUsed+1), PhiHPhi8, NumTerms*2, PhiPhi8, NumTerms*2, Energies, Workspace, 3*NumTerms*2, Info)
+				Lower = BorderedLowest(PhiPhi, PhiHPhi, NumTerms, UsedTerms2, NumUsed*2, CurTerm, 'L', XLower, LambdaLower, Info)
 				if (Info /= 0) then
-					write (energyfile,*) 'Lower dsygv error code:', Info, 'Term:', CurTerm
+					write (energyfile,*) 'Lower overlap not positive definite:', Info, 'Term:', CurTerm
 					Error = .true.
 				endif
-				Lower = Energies(1)
 			endif
 
-			if (dabs(Upper-Lower) > Tolerance .and. (Upper /= 0 .and. Lower /= 0)) then
-				Error = .true.
-				write (energyfile,*) 'Upper and Lower Difference:', CurTerm, dabs(Upper-Lower)
+			if (Error .eqv. .false.) then
+				if (dabs(Upper-Lower) > Tolerance .and. (Upper /= 0 .and. Lower /= 0)) then
+					Error = .true.
+					write (energyfile,*) 'Upper and Lower Difference:', CurTerm, dabs(Upper-Lower)
+				endif
 			endif
 			
 			if (Error .eqv. .false.) then
@@ -566,10 +519,6 @@ program Energy
 		write (energyfile,*)
 		do j = 1, NumUsed, 1
 			! Recreate final matrices.
-			PhiPhi8 => PhiPhiMat(0)%P
-			PhiHPhi8 => PhiHPhiMat(0)%P
-			Energies => EnergiesArray(0)%P
-			Workspace => WorkspaceArray(0)%P
 			PhiPhi8 = 0.0d0
 			PhiHPhi8 = 0.0d0
 
@@ -605,18 +554,20 @@ program Energy
 	deallocate(IsTermUsed)
 	deallocate(UnusedTerms)
 	deallocate(UsedTerms)
-	deallocate(PhiPhi)
-	deallocate(PhiHPhi)
-	do i = 0, MaxThreads-1, 1
-		deallocate(PhiPhiMat(i)%P)
-		deallocate(PhiHPhiMat(i)%P)
-		deallocate(EnergiesArray(i)%P)
-		deallocate(WorkspaceArray(i)%P)
-	end do
-	deallocate(PhiPhiMat)
-	deallocate(PhiHPhiMat)
-	deallocate(EnergiesArray)
-	deallocate(WorkspaceArray)
+#ifdef USE_MPI
+	call MPI_Win_free(SharedWin, MpiError)
+	call MPI_Comm_free(NodeComm, MpiError)
+#else
+	deallocate(SharedBuf)
+#endif
+	deallocate(PhiPhi8)
+	deallocate(PhiHPhi8)
+	deallocate(Energies)
+	deallocate(Workspace)
+	deallocate(XUpper)
+	deallocate(XLower)
+	deallocate(LambdaUpper)
+	deallocate(LambdaLower)
 
 	! ...and close all open files.
 	if (Node == 0) then  ! Do not want to try closing it from every process.
@@ -634,6 +585,178 @@ stop
 end program
 
 
+! Solves the generalized eigenvalue problem for the n chosen terms (listed in UsedTerms2), using only the upper or
+!  lower triangle depending on Uplo.  The S-orthonormal eigenvectors are returned in X and the eigenvalues in Lambda,
+!  which is what BorderedLowest needs to test the candidate terms.  ScratchS holds the overlap sub-matrix.
+subroutine BasisEigen(PhiPhi, PhiHPhi, NumTerms, UsedTerms2, n, Uplo, X, Lambda, ScratchS, Workspace, Info)
+	implicit none
+	integer NumTerms, n, Info
+	real*8, dimension(NumTerms*2,NumTerms*2) :: PhiPhi, PhiHPhi, X, ScratchS
+	integer, dimension(NumTerms*2) :: UsedTerms2
+	real*8, dimension(NumTerms*2) :: Lambda
+	real*8, dimension(3*NumTerms*2) :: Workspace
+	character Uplo
+	integer j, k
+
+	Info = 0
+	if (n == 0) return  ! Nothing chosen yet
+
+	do k = 1, n, 1
+		do j = 1, n, 1
+			X(j,k) = PhiHPhi(UsedTerms2(j),UsedTerms2(k))
+			ScratchS(j,k) = PhiPhi(UsedTerms2(j),UsedTerms2(k))
+		enddo
+	enddo
+
+	! dsygv overwrites X with the eigenvectors.
+	call dsygv(1, 'V', Uplo, n, X, NumTerms*2, ScratchS, NumTerms*2, Lambda, Workspace, 3*NumTerms*2, Info)
+	return
+end
+
+
+! Finds the lowest eigenvalue of the chosen basis with the pair of functions for CurTerm added, without solving the
+!  full problem again.  X and Lambda come from BasisEigen with the same Uplo.  Removing the components of the two new
+!  functions along the eigenvectors and orthonormalizing what is left with a 2x2 Cholesky factorization leaves
+!     [ Lambda  b ]
+!     [ b^T     D ]
+!  with unit overlap.  Its lowest eigenvalue mu is where the 2x2 secular matrix
+!     M(mu) = D - mu I - sum_k b_k^T b_k / (Lambda_k - mu)
+!  stops being positive definite below Lambda(1).  M decreases with mu, so this is found by bisection in O(n) per
+!  step, and only the projections onto X cost O(n^2).  Info is nonzero if the overlap with this term is not positive
+!  definite, which is where dsygv would fail.
+real*8 function BorderedLowest(PhiPhi, PhiHPhi, NumTerms, UsedTerms2, n, CurTerm, Uplo, X, Lambda, Info)
+	implicit none
+	integer NumTerms, n, CurTerm, Info
+	real*8, dimension(NumTerms*2,NumTerms*2) :: PhiPhi, PhiHPhi, X
+	integer, dimension(NumTerms*2) :: UsedTerms2
+	real*8, dimension(NumTerms*2) :: Lambda
+	character Uplo
+	! These are allocated instead of automatic arrays, since the thread stacks can be small (see the note at the top).
+	real*8, allocatable, dimension(:,:) :: SBorder, HBorder, P, Q
+	real*8, dimension(2,2) :: Sd, Hd, C, D, E
+	real*8 L11, L21, L22, Lo, Hi, Mid, W, M11, M12, M22, Mu0
+	integer i, j, k, Iter
+	integer, dimension(2) :: Term
+
+	Info = 0
+	BorderedLowest = 0.0d0
+	Term(1) = CurTerm
+	Term(2) = CurTerm + NumTerms
+	allocate(SBorder(max(n,1),2), HBorder(max(n,1),2), P(max(n,1),2), Q(max(n,1),2))
+
+	! The new columns (or rows for the lower triangle) and the 2x2 block for the candidate term itself.
+	do j = 1, 2, 1
+		do i = 1, n, 1
+			if (Uplo == 'U') then
+				SBorder(i,j) = PhiPhi(UsedTerms2(i),Term(j))
+				HBorder(i,j) = PhiHPhi(UsedTerms2(i),Term(j))
+			else
+				SBorder(i,j) = PhiPhi(Term(j),UsedTerms2(i))
+				HBorder(i,j) = PhiHPhi(Term(j),UsedTerms2(i))
+			endif
+		enddo
+		do k = 1, 2, 1
+			if ((Uplo == 'U' .and. j <= k) .or. (Uplo /= 'U' .and. j >= k)) then
+				Sd(j,k) = PhiPhi(Term(j),Term(k))
+				Hd(j,k) = PhiHPhi(Term(j),Term(k))
+			else
+				Sd(j,k) = PhiPhi(Term(k),Term(j))
+				Hd(j,k) = PhiHPhi(Term(k),Term(j))
+			endif
+		enddo
+	enddo
+
+	! P = X^T s and Q = X^T h
+	P = 0.0d0
+	Q = 0.0d0
+	if (n > 0) then
+		call dgemm('T', 'N', n, 2, n, 1.0d0, X, NumTerms*2, SBorder, max(n,1), 0.0d0, P, max(n,1))
+		call dgemm('T', 'N', n, 2, n, 1.0d0, X, NumTerms*2, HBorder, max(n,1), 0.0d0, Q, max(n,1))
+	endif
+
+	! Overlap and Hamiltonian of the new functions once their parts along the chosen basis are removed.  The coupling
+	!  to the eigenvectors, b = Q - Lambda P, replaces Q.
+	do j = 1, 2, 1
+		do k = 1, 2, 1
+			C(j,k) = Sd(j,k)
+			D(j,k) = Hd(j,k)
+			do i = 1, n, 1
+				C(j,k) = C(j,k) - P(i,j)*P(i,k)
+				D(j,k) = D(j,k) - Q(i,j)*P(i,k) - P(i,j)*Q(i,k) + P(i,j)*Lambda(i)*P(i,k)
+			enddo
+		enddo
+	enddo
+	do j = 1, 2, 1
+		do i = 1, n, 1
+			Q(i,j) = Q(i,j) - Lambda(i)*P(i,j)
+		enddo
+	enddo
+
+	! C = L L^T
+	if (C(1,1) <= 0.0d0) then
+		Info = 1
+		goto 100
+	endif
+	L11 = dsqrt(C(1,1))
+	L21 = C(2,1) / L11
+	L22 = C(2,2) - L21*L21
+	if (L22 <= 0.0d0) then
+		Info = 2
+		goto 100
+	endif
+	L22 = dsqrt(L22)
+
+	! b L^-T and L^-1 D L^-T
+	do i = 1, n, 1
+		Q(i,1) = Q(i,1) / L11
+		Q(i,2) = (Q(i,2) - L21*Q(i,1)) / L22
+	enddo
+	do k = 1, 2, 1
+		E(1,k) = D(1,k) / L11
+		E(2,k) = (D(2,k) - L21*E(1,k)) / L22
+	enddo
+	do j = 1, 2, 1
+		D(j,1) = E(j,1) / L11
+		D(j,2) = (E(j,2) - L21*D(j,1)) / L22
+	enddo
+	D(1,2) = (D(1,2) + D(2,1)) / 2.0d0
+
+	! Lowest eigenvalue of the new functions by themselves, which is the answer if nothing has been chosen yet
+	Mu0 = (D(1,1) + D(2,2)) / 2.0d0 - dsqrt(((D(1,1) - D(2,2)) / 2.0d0)**2 + D(1,2)**2)
+	if (n == 0) then
+		BorderedLowest = Mu0
+		goto 100
+	endif
+
+	! The coupling can lower the eigenvalue by at most its norm, so M is positive definite at Lo.
+	Hi = Lambda(1)
+	Lo = min(Lambda(1), Mu0) - dsqrt(sum(Q(1:n,:)**2))
+	Lo = Lo - 1.0d-6 * (1.0d0 + dabs(Lo))
+	do Iter = 1, 200, 1
+		Mid = (Lo + Hi) / 2.0d0
+		if (Mid <= Lo .or. Mid >= Hi) exit
+		M11 = D(1,1) - Mid
+		M12 = D(1,2)
+		M22 = D(2,2) - Mid
+		do i = 1, n, 1
+			W = 1.0d0 / (Lambda(i) - Mid)
+			M11 = M11 - Q(i,1)*Q(i,1)*W
+			M12 = M12 - Q(i,1)*Q(i,2)*W
+			M22 = M22 - Q(i,2)*Q(i,2)*W
+		enddo
+		if (M11 > 0.0d0 .and. M11*M22 - M12*M12 > 0.0d0) then
+			Lo = Mid
+		else
+			Hi = Mid
+		endif
+	enddo
+	BorderedLowest = (Lo + Hi) / 2.0d0
+
+100	deallocate(SBorder, HBorder, P, Q)
+	return
+end
+
+
 integer function CalcPowerTableSize(Omega)
 	integer Omega  ! This sets the limits on the terms.
 	integer NumTerms  ! The total number of terms
@@ -0,0 +1,141 @@
+// Binary cache of the short-range matrices, called from Energy.f90.  This is the same file that Phase keeps next to the
+//  short-range file ("<file>.cache"), so whichever program reads the text first saves the other one the parsing.  The
+//  layout is the magic string, version, number of terms, size and modification time of the short-range file, and then
+//  PhiPhi and PhiHPhi as raw little-endian doubles with each row of the text file stored contiguously.  The Fortran
+//  arrays are column-major, so the rows are scattered into (and gathered from) PhiPhi(i,:) here.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+
+#define SHORT_CACHE_MAGIC "PSHSHORT"
+#define SHORT_CACHE_VERSION 1
+
+
+static int IsLittleEndian(void)
+{
+	int Endian = 1;
+	return *(char*)&Endian == 1;
+}
+
+
+static char *CacheName(const char *FileShort)
+{
+	char *Name = malloc(strlen(FileShort) + 7);
+	if (Name != NULL)
+		sprintf(Name, "%s.cache", FileShort);
+	return Name;
+}
+
+
+// Reads one matrix of the cache into a column-major N x N array.
+static int ReadMatrix(FILE *Cache, int N, double *Matrix, double *Row)
+{
+	int i, j;
+	for (i = 0; i < N; i++) {
+		if (fread(Row, sizeof(double), N, Cache) != (size_t)N)
+			return -1;
+		for (j = 0; j < N; j++)
+			Matrix[(long long)j*N + i] = Row[j];
+	}
+	return 0;
+}
+
+
+static int WriteMatrix(FILE *Cache, int N, double *Matrix, double *Row)
+{
+	int i, j;
+	for (i = 0; i < N; i++) {
+		for (j = 0; j < N; j++)
+			Row[j] = Matrix[(long long)j*N + i];
+		if (fwrite(Row, sizeof(double), N, Cache) != (size_t)N)
+			return -1;
+	}
+	return 0;
+}
+
+
+// Returns 0 if the cache exists and matches the short-range file, and -1 otherwise.  The matrices are left as they
+//  are in the raw file (PhiHPhi is not divided by 2).
+int LoadShortCache(const char *FileShort, int NumShortTerms, double *PhiPhi, double *PhiHPhi)
+{
+	char *Name, Magic[8];
+	int Version, N, Res = -1;
+	long long Size, Time;
+	struct stat Info;
+	double *Row;
+	FILE *Cache;
+
+	if (!IsLittleEndian() || stat(FileShort, &Info) != 0)
+		return -1;
+	Name = CacheName(FileShort);
+	if (Name == NULL)
+		return -1;
+	Cache = fopen(Name, "rb");
+	if (Cache == NULL) {
+		free(Name);
+		return -1;
+	}
+
+	if (fread(Magic, 1, 8, Cache) != 8 || fread(&Version, sizeof(int), 1, Cache) != 1 || fread(&N, sizeof(int), 1, Cache) != 1
+		|| fread(&Size, sizeof(long long), 1, Cache) != 1 || fread(&Time, sizeof(long long), 1, Cache) != 1
+		|| memcmp(Magic, SHORT_CACHE_MAGIC, 8) != 0 || Version != SHORT_CACHE_VERSION || N != NumShortTerms
+		|| Size != (long long)Info.st_size || Time != (long long)Info.st_mtime) {
+		printf("The short-range cache %s is out of date and will be replaced.\n", Name);
+	}
+	else {
+		Row = malloc(N * sizeof(double));
+		if (Row != NULL && ReadMatrix(Cache, N, PhiPhi, Row) == 0 && ReadMatrix(Cache, N, PhiHPhi, Row) == 0)
+			Res = 0;
+		free(Row);
+	}
+
+	fclose(Cache);
+	free(Name);
+	return Res;
+}
+
+
+int SaveShortCache(const char *FileShort, int NumShortTerms, double *PhiPhi, double *PhiHPhi)
+{
+	char *Name;
+	int Version = SHORT_CACHE_VERSION, N = NumShortTerms, Res = -1;
+	long long Size, Time;
+	struct stat Info;
+	double *Row;
+	FILE *Cache;
+
+	if (!IsLittleEndian() || stat(FileShort, &Info) != 0)
+		return -1;
+	Size = Info.st_size;
+	Time = Info.st_mtime;
+	Name = CacheName(FileShort);
+	if (Name == NULL)
+		return -1;
+	Cache = fopen(Name, "wb");
+	if (Cache == NULL) {
+		printf("Could not write the short-range cache %s\n", Name);
+		free(Name);
+		return -1;
+	}
+
+	Row = malloc(N * sizeof(double));
+	fwrite(SHORT_CACHE_MAGIC, 1, 8, Cache);
+	fwrite(&Version, sizeof(int), 1, Cache);
+	fwrite(&N, sizeof(int), 1, Cache);
+	fwrite(&Size, sizeof(long long), 1, Cache);
+	fwrite(&Time, sizeof(long long), 1, Cache);
+	if (Row != NULL && WriteMatrix(Cache, N, PhiPhi, Row) == 0 && WriteMatrix(Cache, N, PhiHPhi, Row) == 0)
+		Res = 0;
+	free(Row);
+
+	if (fclose(Cache) != 0)
+		Res = -1;
+	if (Res != 0) {
+		printf("Could not write the short-range cache %s\n", Name);
+		remove(Name);
+	}
+	free(Name);
+	return Res;
+}
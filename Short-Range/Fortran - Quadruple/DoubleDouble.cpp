@@ -0,0 +1,91 @@
+// Double-double version of the W function from equation (8) of Drake and Yan '95 (W and WPartial in
+//  HylleraasIntegral.f90), which is what fills the W matrices.  It follows the real*16 code step for step, including
+//  the recurrence for the 2F1 hypergeometric function.  Most values agree with real*16 to better than 1e-29; for large
+//  l the 2F1 recurrence loses precision in both versions (to about 1e-17 in real*16), and they differ by up to 1e-19.
+//  This is called from CalcWMatrices in PsHMain.f90 when PSH_WKERNEL is "dd" or "check".
+// The real*16 parameters are split into hi + lo in Fortran before calling this, since C has no portable real*16.
+
+#include <vector>
+#include "DoubleDouble.h"
+using namespace std;
+
+
+// Gauss's hypergeometric function 2F1(1, b; c; z) for integer b and c, as in Hypergeometric2F1 and
+//  Hypergeometric2F1First in HylleraasIntegral.f90.
+static DoubleDouble Hypergeometric2F1(int b, int c, const DoubleDouble &z)
+{
+	DoubleDouble Sum(1.0), Prev(0.0), Term(1.0), Hyper, InvZ;
+	int n, cc;
+
+	// Direct summation for c > b, with the same stopping criterion as Hypergeometric2F1Sum.
+	if (c > b) {
+		for (n = 1; n <= 10000; n++) {
+			Term = Term * z * double(b+n-1) / double(c+n-1);
+			Sum = Sum + Term;
+			if (abs(Sum - Prev).hi <= 1e-30)
+				break;
+			Prev = Sum;
+		}
+		return Sum;
+	}
+
+	// Otherwise this starts from c = 1, where 2F1(1, b; 1; z) = (1-z)^-b, and goes up in b and c together.
+	Hyper = pow(DoubleDouble(1.0) - z, -(b-c+1));
+	InvZ = DoubleDouble(1.0) / z;
+	for (cc = 2; cc <= c; cc++)
+		Hyper = (Hyper - DoubleDouble(1.0)) * InvZ * double(cc-1) / double(b-c+cc-1);
+	return Hyper;
+}
+
+
+// (l+m+n+p+2)! / (l+1+p)!, which is 0 if l+m+n+p+2 < 0 (the factorial function returns 0 there).
+static DoubleDouble FactorialRatio(int Num, int Den)
+{
+	DoubleDouble Ratio(1.0);
+	int i;
+
+	if (Num < 0)
+		return DoubleDouble(0.0);
+	for (i = Den+1; i <= Num; i++)
+		Ratio = Ratio * double(i);
+	for (i = Num+1; i <= Den; i++)
+		Ratio = Ratio / double(i);
+	return Ratio;
+}
+
+
+// Alpha, Beta, Gamma and W are (hi, lo) pairs.
+extern "C" void WDoubleDouble(int l, int m, int n, const double *Alpha, const double *Beta, const double *Gamma, int pmax, double *W)
+{
+	DoubleDouble a(Alpha[0], Alpha[1]), b(Beta[0], Beta[1]), g(Gamma[0], Gamma[1]);
+	DoubleDouble Sum = a + b + g;
+	DoubleDouble z = (a + b) / Sum, x = a / Sum;
+	DoubleDouble Hyper, Ratio, LeadingFactor, Summation(0.0);
+	int bh = l+m+n+pmax+3, ch = l+m+pmax+3;
+	int p;
+	vector <DoubleDouble> Powers(pmax+1);  // (alpha / (alpha + beta + gamma))^p
+
+	LeadingFactor = FactorialRatio(l, 0) / pow(Sum, l+m+n+3);
+
+	// Backwards in p, as in W, so that the recurrence relation in (9) can be used for 2F1.  The ratio of factorials
+	//  is also updated with a recurrence instead of being recalculated for every p.
+	Powers[0] = DoubleDouble(1.0);
+	for (p = 1; p <= pmax; p++)
+		Powers[p] = Powers[p-1] * x;
+
+	Hyper = Hypergeometric2F1(bh, ch, z);
+	Ratio = FactorialRatio(l+m+n+pmax+2, l+1+pmax);
+	for (p = pmax; p >= 0; p--) {
+		if (l+m+n+p+2 < 0)
+			break;  // The factorial in the numerator is 0 for this and every smaller p.
+		Summation = Summation + Ratio / double(l+m+2+p) * Powers[p] * Hyper;
+		bh--;  ch--;
+		Hyper = DoubleDouble(1.0) + z * Hyper * double(bh) / double(ch);
+		if (p > 0)
+			Ratio = Ratio * double(l+1+p) / double(l+m+n+p+2);
+	}
+
+	Summation = LeadingFactor * Summation;
+	W[0] = Summation.hi;
+	W[1] = Summation.lo;
+}
@@ -0,0 +1,128 @@
+#ifndef DOUBLE_DOUBLE_H
+#define DOUBLE_DOUBLE_H
+
+// Double-double numbers: an unevaluated sum hi + lo of two doubles, giving about 106 bits of mantissa (real*16 has 113)
+//  with only hardware double operations.  The algorithms are the standard error-free transformations from Dekker and
+//  from Hida, Li and Bailey's QD library.  These must not be compiled with -ffast-math or anything similar, since that
+//  lets the compiler simplify away the error terms.
+
+#include <cmath>
+
+struct DoubleDouble
+{
+	double hi, lo;
+	DoubleDouble() { hi = lo = 0.0; }
+	DoubleDouble(double h) { hi = h; lo = 0.0; }
+	DoubleDouble(double h, double l) { hi = h; lo = l; }
+};
+
+
+// a + b = s + e exactly, assuming |a| >= |b|
+inline DoubleDouble QuickTwoSum(double a, double b)
+{
+	double s = a + b;
+	return DoubleDouble(s, b - (s - a));
+}
+
+
+inline DoubleDouble TwoSum(double a, double b)
+{
+	double s = a + b;
+	double bb = s - a;
+	return DoubleDouble(s, (a - (s - bb)) + (b - bb));
+}
+
+
+inline DoubleDouble TwoProd(double a, double b)
+{
+	double p = a * b;
+	return DoubleDouble(p, std::fma(a, b, -p));
+}
+
+
+inline DoubleDouble operator + (const DoubleDouble &a, const DoubleDouble &b)
+{
+	DoubleDouble s = TwoSum(a.hi, b.hi);
+	DoubleDouble t = TwoSum(a.lo, b.lo);
+	s.lo += t.hi;
+	s = QuickTwoSum(s.hi, s.lo);
+	s.lo += t.lo;
+	return QuickTwoSum(s.hi, s.lo);
+}
+
+
+inline DoubleDouble operator - (const DoubleDouble &a)
+{
+	return DoubleDouble(-a.hi, -a.lo);
+}
+
+
+inline DoubleDouble operator - (const DoubleDouble &a, const DoubleDouble &b)
+{
+	return a + (-b);
+}
+
+
+inline DoubleDouble operator * (const DoubleDouble &a, const DoubleDouble &b)
+{
+	DoubleDouble p = TwoProd(a.hi, b.hi);
+	p.lo += a.hi * b.lo + a.lo * b.hi;
+	return QuickTwoSum(p.hi, p.lo);
+}
+
+
+inline DoubleDouble operator * (const DoubleDouble &a, double b)
+{
+	DoubleDouble p = TwoProd(a.hi, b);
+	p.lo += a.lo * b;
+	return QuickTwoSum(p.hi, p.lo);
+}
+
+
+inline DoubleDouble operator / (const DoubleDouble &a, double b)
+{
+	double q1 = a.hi / b;
+	DoubleDouble p = TwoProd(q1, b);
+	DoubleDouble r = TwoSum(a.hi, -p.hi);
+	r.lo = r.lo - p.lo + a.lo;
+	double q2 = (r.hi + r.lo) / b;
+	return QuickTwoSum(q1, q2);
+}
+
+
+// Long division with three partial quotients, which is accurate to the full double-double precision.
+inline DoubleDouble operator / (const DoubleDouble &a, const DoubleDouble &b)
+{
+	double q1 = a.hi / b.hi;
+	DoubleDouble r = a - DoubleDouble(q1) * b;
+	double q2 = r.hi / b.hi;
+	r = r - DoubleDouble(q2) * b;
+	double q3 = r.hi / b.hi;
+	return QuickTwoSum(q1, q2) + DoubleDouble(q3);
+}
+
+
+inline DoubleDouble abs(const DoubleDouble &a)
+{
+	return a.hi < 0.0 ? -a : a;
+}
+
+
+// Integer powers by repeated squaring, as the ** operator does for real*16.
+inline DoubleDouble pow(const DoubleDouble &a, int n)
+{
+	DoubleDouble Result(1.0), x = a;
+	int m = n < 0 ? -n : n;
+
+	while (m > 0) {
+		if (m & 1)
+			Result = Result * x;
+		x = x * x;
+		m >>= 1;
+	}
+	if (n < 0)
+		Result = DoubleDouble(1.0) / Result;
+	return Result;
+}
+
+#endif
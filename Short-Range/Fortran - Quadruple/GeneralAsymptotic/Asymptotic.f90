@@ -80,14 +80,20 @@ end
 	
 
 ! This is the Riemann zeta function shown in (18) with its first N terms removed.
+! Without a hardcoded table for N, each value takes up to a few hundred thousand real*16 powers in ZetaTail, and
+!  AsymptoticPart asks for the same few values (i is always a half-integer) for every integral.  Those are kept once
+!  calculated, so they are only summed once per run.
 real*16 function ModifiedRiemannZeta(N, i, ZetaUpperBound)
 	implicit none
 	include 'ModifiedZeta.h'
 	integer N
 	real*16 i
 	integer ZetaUpperBound
-	real*16 Sum, Term, Zeta2
-	integer j
+	real*16 ZetaTail
+	integer, parameter :: MaxKey = 400, MaxN = 200
+	real*16, save :: Saved(0:MaxKey, 0:MaxN)
+	logical, save :: Known(0:MaxKey, 0:MaxN) = .false.
+	integer Key
 	logical, save :: FirstCall = .true.
 
 	select case (N)
@@ -165,7 +171,32 @@ real*16 function ModifiedRiemannZeta(N, i, ZetaUpperBound)
 		write (*,*) ' The accuracy of the results will be less than if hardcoded values are used.'
 		FirstCall = .false.
 	end if
-		
+
+	Key = int(2*i)
+	if (real(Key,16) /= 2*i .or. Key < 0 .or. Key > MaxKey .or. N < 0 .or. N > MaxN) then
+		ModifiedRiemannZeta = ZetaTail(N, i)
+		return
+	end if
+
+	!$omp critical (ZetaCache)
+	if (.not. Known(Key, N)) then
+		Saved(Key, N) = ZetaTail(N, i)
+		Known(Key, N) = .true.
+	end if
+	ModifiedRiemannZeta = Saved(Key, N)
+	!$omp end critical (ZetaCache)
+	return
+end
+
+
+! The sum for ModifiedRiemannZeta when there is no hardcoded table for N.
+real*16 function ZetaTail(N, i)
+	implicit none
+	integer N
+	real*16 i
+	real*16 Sum, Term, Zeta2
+	integer j
+
 	Sum = 0.0q0
 
 	! For the special case of i == 2, we have a p-series with a definite sum (Zeta2 below).
@@ -175,7 +206,7 @@ real*16 function ModifiedRiemannZeta(N, i, ZetaUpperBound)
 		do j = 1, N, 1
 			Zeta2 = Zeta2 - 1.0q0 / real(j**i,16)
 		enddo
-		ModifiedRiemannZeta = Zeta2
+		ZetaTail = Zeta2
 		return
 	endif
 
@@ -189,7 +220,7 @@ real*16 function ModifiedRiemannZeta(N, i, ZetaUpperBound)
 		j = j + 1
 	enddo
 
-	ModifiedRiemannZeta = Sum
+	ZetaTail = Sum
 	return
 end
 
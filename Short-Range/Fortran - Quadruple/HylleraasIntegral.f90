@@ -260,6 +260,53 @@ real*16 function WPartial(l, m, n, alpha, beta, gamma, p, hyper)
 end
 
 
+! Same as W, but calculated with double-double arithmetic in DoubleDouble.cpp.  This is several times faster and
+!  usually agrees with W to better than 1e-29 (see the notes there).
+real*16 function WDD(l, m, n, alpha, beta, gamma, pmax)
+	use iso_c_binding
+	implicit none
+
+	interface
+		subroutine WDoubleDouble(l, m, n, Alpha, Beta, Gamma, pmax, W) bind(c, name='WDoubleDouble')
+		use iso_c_binding
+		integer(c_int), value :: l, m, n, pmax
+		real(c_double), dimension(2) :: Alpha, Beta, Gamma, W
+		end subroutine WDoubleDouble
+	end interface
+
+	integer l, m, n, pmax
+	real*16 alpha, beta, gamma
+	real(c_double), dimension(2) :: a, b, g, Res
+
+	! Split each parameter into hi + lo parts.
+	a(1) = alpha;  a(2) = alpha - real(a(1),16)
+	b(1) = beta;  b(2) = beta - real(b(1),16)
+	g(1) = gamma;  g(2) = gamma - real(g(1),16)
+	call WDoubleDouble(l, m, n, a, b, g, pmax, Res)
+	WDD = real(Res(1),16) + real(Res(2),16)
+
+	return
+end
+
+
+! Calls either W or WDD.
+real*16 function WSelect(UseDD, l, m, n, alpha, beta, gamma, pmax)
+	implicit none
+	logical UseDD
+	integer l, m, n, pmax
+	real*16 alpha, beta, gamma
+	real*16 W, WDD
+
+	if (UseDD) then
+		WSelect = WDD(l, m, n, alpha, beta, gamma, pmax)
+	else
+		WSelect = W(l, m, n, alpha, beta, gamma, pmax)
+	end if
+
+	return
+end
+
+
 ! The T function from equation (6)
 real*16 function T(q, j1, j2, j3, j12, j23, j31, alpha, beta, gamma, pmax, WMatrix)
 	use WLimits
@@ -1,9 +1,21 @@
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
 #include <gsl/gsl_math.h>
+#include <gsl/gsl_blas.h>
 #include <gsl/gsl_multimin.h>
+#ifndef _WIN32
+#include <fcntl.h>
+#include <spawn.h>
+#include <unistd.h>
+#include <sys/wait.h>
+extern char **environ;
+#endif
 
 
-double ederivwrapper_(int *Omega, int *NumTerms, int *qmax, int *pmax, int *IsTriplet, int *Ordering, int *Method, int *EigenRoutine, double *Alpha, double *Beta, double *Gamma, int *Iter, double *Energy);
+void ederivwrapper(int *Omega, int *NumTerms, int *LValue, int *M12max, int *M23max, int *M31max, int *pmax, int *IsTriplet, int *Ordering, int *Method, int *EigenRoutine, double *Alpha, double *Beta, double *Gamma, int *Iter, double *Energy);
+void logenergy(int *Iter, double *Alpha, double *Beta, double *Gamma, double *Energy);
 
 
 void testfortran(int *x)
@@ -12,32 +24,249 @@ void testfortran(int *x)
 }
 
 
-double test(const gsl_vector *v, void *params)
+// Energies that have already been calculated.  Every evaluation rebuilds all of the matrices, so it is worth not
+//  repeating one.  The BFGS line search in particular asks for the energy at points it already has.
+#define NUM_SAVED 64
+static double SavedParams[NUM_SAVED][3], SavedEnergy[NUM_SAVED];
+static int NumSaved = 0;
+
+// Step size for the central differences in the gradient
+#define GRAD_STEP 1e-4
+
+// Largest number of energies calculated at once by EnergyBatch
+#define MAX_BATCH 8
+
+// The program and input file for the worker processes, from setenergyworker
+static char WorkerProgram[256], WorkerInput[256];
+
+
+// Called by PsHMain before the optimization starts.  Every worker runs "Program -energy Input result alpha beta gamma".
+void setenergyworker(const char *Program, const char *Input)
 {
-	double a1, b1, g1, Energy;
-	int *p = (int*)params;
-	int Omega = p[0], NumTerms = p[1], LValue = p[2], M12max = p[3], M23max = p[4], M31max = p[5], pmax = p[6], IsTriplet = p[7], Ordering = p[8], Method = p[9], Iter = p[10], EigenRoutine = p[11];
+	strncpy(WorkerProgram, Program, sizeof(WorkerProgram) - 1);
+	strncpy(WorkerInput, Input, sizeof(WorkerInput) - 1);
+}
 
-	a1 = gsl_vector_get(v, 0);
-	b1 = gsl_vector_get(v, 1);
-	g1 = gsl_vector_get(v, 2);
 
-	//@TODO: REMOVE THIS!
-	//printf("Parameters: %d %d %d %d %d %d\n", p[0], p[1], p[2], p[3], p[4], p[5], p[6]);
-	
-	//@TODO: Make this into a subroutine?
-	ederivwrapper(&Omega, &NumTerms, &LValue, &M12max, &M23max, &M31max, &pmax, &IsTriplet, &Ordering, &Method, &EigenRoutine, &a1, &b1, &g1, &Iter, &Energy);
-	//printf("Test: %f %f %f\n", a1, b1, g1);
+static int FindSaved(double a1, double b1, double g1)
+{
+	int i;
+	for (i = 0; i < NumSaved && i < NUM_SAVED; i++) {
+		if (SavedParams[i][0] == a1 && SavedParams[i][1] == b1 && SavedParams[i][2] == g1)
+			return i;
+	}
+	return -1;
+}
+
+
+static void SaveEnergy(double a1, double b1, double g1, double Energy, int *p)
+{
+	int i = NumSaved++ % NUM_SAVED;
+	SavedParams[i][0] = a1;  SavedParams[i][1] = b1;  SavedParams[i][2] = g1;
+	SavedEnergy[i] = Energy;
 	printf("Energy: %f\n", Energy);
+	logenergy(&p[10], &a1, &b1, &g1, &Energy);
+}
+
+
+double EnergyAt(double a1, double b1, double g1, int *p)
+{
+	double Energy;
+	int Omega = p[0], NumTerms = p[1], LValue = p[2], M12max = p[3], M23max = p[4], M31max = p[5], pmax = p[6], IsTriplet = p[7], Ordering = p[8], Method = p[9], Iter = p[10], EigenRoutine = p[11];
+	int i;
+
+	i = FindSaved(a1, b1, g1);
+	if (i >= 0)
+		return SavedEnergy[i];
 
+	ederivwrapper(&Omega, &NumTerms, &LValue, &M12max, &M23max, &M31max, &pmax, &IsTriplet, &Ordering, &Method, &EigenRoutine, &a1, &b1, &g1, &Iter, &Energy);
+	SaveEnergy(a1, b1, g1, Energy, p);
 	return Energy;
 }
 
 
-int optimizewavefn(int MaxIter, int Omega, int NumTerms, int LValue, int M12max, int M23max, int M31max, int pmax, int IsTriplet, int Ordering, int Method, int EigenRoutine, double alpha, double beta, double gamma)
+// Calculates the energies at Num points, so that the EnergyAt calls for them afterwards are free.  The matrices are
+//  built in module variables on the Fortran side, so two energies cannot be calculated in one process.  If
+//  PSH_OPT_PROCS is more than 1, up to that many points are instead calculated at once by running this program again
+//  as a worker for each one, with the OpenMP threads split between the workers.  Any point a worker fails on is
+//  calculated here afterwards.
+void EnergyBatch(double Points[][3], int Num, int *p)
+{
+#ifndef _WIN32
+	const char *Setting = getenv("PSH_OPT_PROCS");
+	int Procs = Setting != NULL ? atoi(Setting) : 1;
+	pid_t Pids[MAX_BATCH];
+	char Results[MAX_BATCH][64], Args[3][32], Threads[32], Mode[] = "-energy";
+	char *Argv[8], **Env;
+	int Todo[MAX_BATCH], NumTodo = 0, NumEnv, Start, i, j, Status;
+	long NumCores;
+	double Energy;
+	FILE *Result;
+	posix_spawn_file_actions_t Actions;
+
+	for (i = 0; i < Num && i < MAX_BATCH; i++)
+		if (FindSaved(Points[i][0], Points[i][1], Points[i][2]) < 0)
+			Todo[NumTodo++] = i;
+
+	if (Procs > 1 && NumTodo > 1 && WorkerProgram[0] != '\0') {
+		// Each worker gets its share of the threads that this process would use.
+		NumCores = getenv("OMP_NUM_THREADS") != NULL ? atol(getenv("OMP_NUM_THREADS")) : sysconf(_SC_NPROCESSORS_ONLN);
+		if (Procs > NumTodo)
+			Procs = NumTodo;
+		sprintf(Threads, "OMP_NUM_THREADS=%ld", NumCores / Procs > 1 ? NumCores / Procs : 1);
+		for (NumEnv = 0; environ[NumEnv] != NULL; NumEnv++);
+		Env = malloc((NumEnv + 2) * sizeof(char*));
+		for (i = 0, j = 0; i < NumEnv; i++)
+			if (strncmp(environ[i], "OMP_NUM_THREADS=", 16) != 0)
+				Env[j++] = environ[i];
+		Env[j++] = Threads;
+		Env[j] = NULL;
+
+		// The progress output of the workers would be interleaved, so it is thrown away.
+		posix_spawn_file_actions_init(&Actions);
+		posix_spawn_file_actions_addopen(&Actions, 1, "/dev/null", O_WRONLY, 0);
+
+		for (Start = 0; Start < NumTodo; Start += Procs) {
+			for (i = Start; i < NumTodo && i < Start + Procs; i++) {
+				sprintf(Results[i], "psh_energy_%ld_%d.txt", (long)getpid(), i);
+				for (j = 0; j < 3; j++)
+					sprintf(Args[j], "%.17g", Points[Todo[i]][j]);
+				Argv[0] = WorkerProgram;  Argv[1] = Mode;  Argv[2] = WorkerInput;  Argv[3] = Results[i];
+				Argv[4] = Args[0];  Argv[5] = Args[1];  Argv[6] = Args[2];  Argv[7] = NULL;
+				if (posix_spawnp(&Pids[i], WorkerProgram, &Actions, NULL, Argv, Env) != 0)
+					Pids[i] = -1;
+			}
+			for (i = Start; i < NumTodo && i < Start + Procs; i++) {
+				if (Pids[i] < 0 || waitpid(Pids[i], &Status, 0) < 0 || !WIFEXITED(Status))
+					continue;
+				Result = fopen(Results[i], "r");
+				if (Result != NULL) {
+					if (fscanf(Result, "%lf", &Energy) == 1)
+						SaveEnergy(Points[Todo[i]][0], Points[Todo[i]][1], Points[Todo[i]][2], Energy, p);
+					fclose(Result);
+				}
+				remove(Results[i]);
+			}
+		}
+		posix_spawn_file_actions_destroy(&Actions);
+		free(Env);
+	}
+#endif
+
+	for (i = 0; i < Num; i++)
+		EnergyAt(Points[i][0], Points[i][1], Points[i][2], p);
+}
+
+
+double test(const gsl_vector *v, void *params)
+{
+	return EnergyAt(gsl_vector_get(v, 0), gsl_vector_get(v, 1), gsl_vector_get(v, 2), (int*)params);
+}
+
+
+// Fills Points with the 6 points of the central difference stencil around v, after v itself.
+static void Stencil(const gsl_vector *v, double Points[7][3])
+{
+	int i, j;
+	for (i = 0; i < 7; i++)
+		for (j = 0; j < 3; j++)
+			Points[i][j] = gsl_vector_get(v, j);
+	for (i = 0; i < 3; i++) {
+		Points[2*i+1][i] += GRAD_STEP;
+		Points[2*i+2][i] -= GRAD_STEP;
+	}
+}
+
+
+// Gradient of the energy by central differences, which takes 6 energy evaluations.  These are independent, so they
+//  are calculated together by EnergyBatch.
+void testgrad(const gsl_vector *v, void *params, gsl_vector *df)
+{
+	double Points[7][3];
+	int i;
+
+	Stencil(v, Points);
+	EnergyBatch(Points + 1, 6, (int*)params);
+	for (i = 0; i < 3; i++)
+		gsl_vector_set(df, i, (EnergyAt(Points[2*i+1][0], Points[2*i+1][1], Points[2*i+1][2], (int*)params)
+			- EnergyAt(Points[2*i+2][0], Points[2*i+2][1], Points[2*i+2][2], (int*)params)) / (2.0 * GRAD_STEP));
+}
+
+
+void testfdf(const gsl_vector *v, void *params, double *f, gsl_vector *df)
+{
+	double Points[7][3];
+
+	Stencil(v, Points);
+	EnergyBatch(Points, 7, (int*)params);
+	*f = test(v, params);
+	testgrad(v, params, df);
+}
+
+
+// Minimizes the energy with BFGS instead of the simplex method.  This needs 7 energies per gradient, but it usually
+//  takes far fewer iterations than Nelder-Mead once the parameters are close to the minimum.  With PSH_OPT_PROCS set,
+//  the 7 energies are calculated at the same time.  This is experimental: the gradient is a central difference with a
+//  step of 1e-4, and it has not been checked against Nelder-Mead on a real run, so it is left out of input.txt.example.
+int optimizebfgs(int MaxIter, int *par, double alpha, double beta, double gamma)
+{
+	const gsl_multimin_fdfminimizer_type *T = gsl_multimin_fdfminimizer_vector_bfgs2;
+	gsl_multimin_fdfminimizer *s = NULL;
+	gsl_vector *x;
+	gsl_multimin_function_fdf minex_func;
+	size_t iter = 0;
+	int status;
+
+	x = gsl_vector_alloc(3);
+	gsl_vector_set(x, 0, alpha);
+	gsl_vector_set(x, 1, beta);
+	gsl_vector_set(x, 2, gamma);
+
+	minex_func.n = 3;
+	minex_func.f = test;
+	minex_func.df = testgrad;
+	minex_func.fdf = testfdf;
+	minex_func.params = par;
+
+	s = gsl_multimin_fdfminimizer_alloc(T, 3);
+	gsl_multimin_fdfminimizer_set(s, &minex_func, x, 0.05, 0.1);
+
+	do
+	{
+		iter++;
+		par[10] = iter;
+		status = gsl_multimin_fdfminimizer_iterate(s);
+
+		if (status)
+			break;
+
+		status = gsl_multimin_test_gradient(s->gradient, 1e-5);
+
+		if (status == GSL_SUCCESS) {
+			printf ("converged to minimum at\n");
+		}
+
+		printf ("%5d %10.5f %10.5f %10.5f f() = %12.7f |grad| = %.5e\n",
+				(int)iter,
+				gsl_vector_get (s->x, 0),
+				gsl_vector_get (s->x, 1),
+				gsl_vector_get (s->x, 2),
+				s->f, gsl_blas_dnrm2(s->gradient));
+	} while (status == GSL_CONTINUE && iter < MaxIter);
+
+	gsl_vector_free(x);
+	gsl_multimin_fdfminimizer_free(s);
+
+	return 0;
+}
+
+
+// Optimize is 1 for the Nelder-Mead simplex and 2 for BFGS (experimental).
+int optimizewavefn(int MaxIter, int Optimize, int Omega, int NumTerms, int LValue, int M12max, int M23max, int M31max, int pmax, int IsTriplet, int Ordering, int Method, int EigenRoutine, double alpha, double beta, double gamma)
 {
 	int par[12] = { Omega, NumTerms, LValue, M12max, M23max, M31max, pmax, IsTriplet, Ordering, Method, 0, EigenRoutine };
-	//printf("Test: %f %f %f\n", alpha, beta, gamma);
+	double Vertices[4][3];
+	int i;
 
 	const gsl_multimin_fminimizer_type *T = gsl_multimin_fminimizer_nmsimplex;  //gsl_multimin_fminimizer_nmsimplex2;
 	gsl_multimin_fminimizer *s = NULL;
@@ -47,6 +276,11 @@ int optimizewavefn(int MaxIter, int Omega, int NumTerms, int LValue, int M12max,
 	size_t iter = 0;
 	int status;
 	double size;
+
+	if (Optimize == 2) {
+		printf("Optimizing with BFGS, which is experimental and not yet validated against Nelder-Mead.\n");
+		return optimizebfgs(MaxIter, par, alpha, beta, gamma);
+	}
 	
 	x = gsl_vector_alloc(3);
 	gsl_vector_set(x, 0, alpha);
@@ -66,6 +300,14 @@ int optimizewavefn(int MaxIter, int Omega, int NumTerms, int LValue, int M12max,
 	 
 	//s = gsl_multimin_fminimizer_alloc (T, 2);
 	s = gsl_multimin_fminimizer_alloc(T, 3);
+	// The starting simplex is x and x plus each step, which can all be calculated at once.  The later points depend on
+	//  each other, so those are calculated one at a time.
+	for (i = 0; i < 4; i++) {
+		Vertices[i][0] = alpha;  Vertices[i][1] = beta;  Vertices[i][2] = gamma;
+		if (i > 0)
+			Vertices[i][i-1] += gsl_vector_get(ss, i-1);
+	}
+	EnergyBatch(Vertices, 4, par);
 	gsl_multimin_fminimizer_set(s, &minex_func, x, ss);
 	 
 	do
@@ -84,8 +326,8 @@ int optimizewavefn(int MaxIter, int Omega, int NumTerms, int LValue, int M12max,
 			printf ("converged to minimum at\n");
 		}
 	 
-		printf ("%5d %10.5e f() = %12.7f size = %.5f\n", 
-				iter,
+		printf ("%5d %10.5f %10.5f %10.5f f() = %12.7f size = %.5f\n", 
+				(int)iter,
 				gsl_vector_get (s->x, 0), 
 				gsl_vector_get (s->x, 1), 
 				gsl_vector_get (s->x, 2), 
@@ -16,16 +16,129 @@ module WLimits
 end module WLimits
 
 
+! Hash table of the Hylleraas integrals for one call of CalcMatricesSub.  Many (i,j) pairs give the same powers, so each
+!  integral only needs to be calculated once.  The nonlinear parameters, angular momenta and W matrices are fixed during
+!  a call, so the key is just the six powers of r and the spherical harmonic term (n, sl, sr).  This uses open
+!  addressing and doubles in size when it is half full.
+module HylleraasCache
+	implicit none
+	integer, parameter :: CacheKeyLen = 9
+	integer, allocatable, dimension(:,:) :: CacheKeys
+	real*16, allocatable, dimension(:) :: CacheValues
+	logical, allocatable, dimension(:) :: CacheUsed
+	integer CacheSize, CacheCount
+	integer*8 CacheLookups, CacheHits
+
+contains
+
+	subroutine CacheInit(Size)
+		integer Size
+
+		CacheSize = Size
+		CacheCount = 0
+		CacheLookups = 0
+		CacheHits = 0
+		allocate(CacheKeys(CacheKeyLen,CacheSize), CacheValues(CacheSize), CacheUsed(CacheSize))
+		CacheUsed = .false.
+		return
+	end subroutine CacheInit
+
+
+	subroutine CacheFree()
+		deallocate(CacheKeys, CacheValues, CacheUsed)
+		return
+	end subroutine CacheFree
+
+
+	! Returns the slot holding Key, or the empty slot where it should go.
+	integer function CacheSlot(Key)
+		integer, dimension(CacheKeyLen) :: Key
+		integer*8 Hash
+		integer k
+
+		Hash = 0
+		do k = 1, CacheKeyLen, 1
+			Hash = mod(Hash * 1000003_8 + (Key(k) + 1000), 2147483647_8)  ! The powers can be negative.
+		end do
+		CacheSlot = mod(Hash, int(CacheSize,8)) + 1
+		do while (CacheUsed(CacheSlot))
+			if (all(CacheKeys(:,CacheSlot) == Key)) exit
+			CacheSlot = mod(CacheSlot, CacheSize) + 1
+		end do
+		return
+	end function CacheSlot
+
+
+	! These two must be called inside the hylcache critical section.
+	logical function CacheLookup(Key, Value)
+		integer, dimension(CacheKeyLen) :: Key
+		real*16 Value
+		integer Slot
+
+		CacheLookups = CacheLookups + 1
+		Slot = CacheSlot(Key)
+		CacheLookup = CacheUsed(Slot)
+		if (CacheLookup) then
+			Value = CacheValues(Slot)
+			CacheHits = CacheHits + 1
+		end if
+		return
+	end function CacheLookup
+
+
+	subroutine CacheInsert(Key, Value)
+		integer, dimension(CacheKeyLen) :: Key
+		real*16 Value
+		integer, allocatable, dimension(:,:) :: OldKeys
+		real*16, allocatable, dimension(:) :: OldValues
+		logical, allocatable, dimension(:) :: OldUsed
+		integer Slot, i, OldSize
+
+		Slot = CacheSlot(Key)
+		if (CacheUsed(Slot)) return  ! Another thread already calculated it.
+		CacheKeys(:,Slot) = Key
+		CacheValues(Slot) = Value
+		CacheUsed(Slot) = .true.
+		CacheCount = CacheCount + 1
+
+		if (CacheCount * 2 > CacheSize) then
+			OldSize = CacheSize
+			call move_alloc(CacheKeys, OldKeys)
+			call move_alloc(CacheValues, OldValues)
+			call move_alloc(CacheUsed, OldUsed)
+			CacheSize = CacheSize * 2
+			allocate(CacheKeys(CacheKeyLen,CacheSize), CacheValues(CacheSize), CacheUsed(CacheSize))
+			CacheUsed = .false.
+			do i = 1, OldSize, 1
+				if (OldUsed(i)) then
+					Slot = CacheSlot(OldKeys(:,i))
+					CacheKeys(:,Slot) = OldKeys(:,i)
+					CacheValues(Slot) = OldValues(i)
+					CacheUsed(Slot) = .true.
+				end if
+			end do
+			deallocate(OldKeys, OldValues, OldUsed)
+		end if
+		return
+	end subroutine CacheInsert
+end module HylleraasCache
+
+
 program PsHMain
 	use WLimits
+	use iso_c_binding, only: c_null_char
 	implicit none
 
 	interface
-		integer(c_int) function optimizewavefn(MaxIter, Omega, NumTerms, LValue, M12max, M23max, M31max, pmax, IsTriplet, Ordering, Method, EigenRoutine, alpha, beta, gamma) bind(c, name='optimizewavefn')
+		integer(c_int) function optimizewavefn(MaxIter, Optimize, Omega, NumTerms, LValue, M12max, M23max, M31max, pmax, IsTriplet, Ordering, Method, EigenRoutine, alpha, beta, gamma) bind(c, name='optimizewavefn')
 		use iso_c_binding
-		integer(c_int), value :: MaxIter, Omega, NumTerms, LValue, M12max, M23max, M31max, pmax, IsTriplet, Ordering, Method, EigenRoutine
+		integer(c_int), value :: MaxIter, Optimize, Omega, NumTerms, LValue, M12max, M23max, M31max, pmax, IsTriplet, Ordering, Method, EigenRoutine
 		real(c_double), value :: alpha, beta, gamma
 		end function optimizewavefn
+		subroutine setenergyworker(Program, Input) bind(c, name='setenergyworker')
+		use iso_c_binding
+		character(kind=c_char), dimension(*) :: Program, Input
+		end subroutine setenergyworker
 	end interface
 	
 	real*16 omp_get_wtime
@@ -43,6 +156,7 @@ program PsHMain
 	real*8 StartTime, EndTime
 	integer iargc, IsTriplet, Method, LowerEigen, UpperEigen, Info, AllEnergies, EigenRoutine
 	character *100 IOBuffer
+	character *256 ProgName, InputName
 	integer Optimize, EigenNum, Ordering, Iter, MaxIter, MaxIterOuter, M12max, M23max, M31max, pmax, StartEnergy, LValue
 	real*16 Tol, Err, h, EDeriv, fa, fh, y, Divisor, ederivwrapper
 	real*16, dimension(3) :: Del, Delta, f1, f0, x1, x0, x, C31, C13
@@ -59,6 +173,18 @@ program PsHMain
 !								2, 0, 0, 0, 0, 0, 0, 2, 0, 0, 0, 0, 10, 150, 5, 51, 0, 0, 0, WMatrix, 1)
 !    deallocate(WMatrix)
     
+	! The optimizer (Minimize.c) runs this program as "PsHMain -energy input result alpha beta gamma" to calculate
+	!  energies in separate processes.
+	if (iargc() == 6) then
+		call getarg(1, IOBuffer)
+		if (IOBuffer /= '-energy') then
+			write (*,*) 'Usage: PsHMain [input output] or PsHMain -energy input result alpha beta gamma - exiting.'
+			stop
+		end if
+		call EnergyWorker()
+		stop
+	end if
+
 	iread = 9
 	iwrite = 10
 	! This allows the possibility of using different input and output files than the defaults.
@@ -66,12 +192,13 @@ program PsHMain
 	!  one overwriting the results from another.  If the program is called without any
 	!  command-line arguments, it uses the default filenames.
 	if (iargc() == 2) then
-		call getarg(1, IOBuffer)
-		open(iread, FILE=IOBuffer)
+		call getarg(1, InputName)
+		open(iread, FILE=InputName)
 		call getarg(2, IOBuffer)
 		open(iwrite, FILE=IOBuffer)
 	else
-		open(iread, FILE='input.txt')
+		InputName = 'input.txt'
+		open(iread, FILE=InputName)
 		open(iwrite, FILE='output.txt')
 	endif
 
@@ -84,7 +211,7 @@ program PsHMain
 		stop
 	endif
 
-	if (Optimize == 1) write (iwrite,*) 'Optimizing eigenvalue', EigenNum
+	if (Optimize /= 0) write (iwrite,*) 'Optimizing eigenvalue', EigenNum
 
 	Tol = 1e-3
 	Err = 1  ! Just has to be larger than tol.
@@ -109,10 +236,12 @@ program PsHMain
 		goto 200  ! No short-range terms, so no need to do these calculations (just a header)
 	end if
 
-	if (Optimize == 1) then
+	if (Optimize /= 0) then  ! 1 for Nelder-Mead, 2 for BFGS (experimental)
 		Alpha8 = Alpha;  Beta8 = Beta;  Gamma8 = Gamma;
 		write (*,*) "Beginning optimization of nonlinear parameters"
-		fa = optimizewavefn(MaxIter, Omega, NumTerms, LValue, M12max, M23max, M31max, pmax, IsTriplet, Ordering, Method, EigenRoutine, Alpha8, Beta8, Gamma8)
+		call getarg(0, ProgName)
+		call setenergyworker(trim(ProgName)//c_null_char, trim(InputName)//c_null_char)
+		fa = optimizewavefn(MaxIter, Optimize, Omega, NumTerms, LValue, M12max, M23max, M31max, pmax, IsTriplet, Ordering, Method, EigenRoutine, Alpha8, Beta8, Gamma8)
 		!fa = EDeriv(Omega, NumTerms, Alpha, Beta, Gamma, EigenNum, PhiPhi, Phi2HPhi, M12max, M23max, M31max, pmax, &
 		!			IsTriplet, Ordering, Method, EigenRoutine, LValue)
 		goto 200
@@ -260,7 +389,7 @@ subroutine WriteHeader(iwrite, Optimize, EigenNum, LValue, IsTriplet, Ordering,
 	character (len=8) cdate
 	character (len=8) ctime
 	
-	if (Optimize == 1) write (iwrite,*) 'Optimizing eigenvalue - not a valid XML file!', EigenNum
+	if (Optimize /= 0) write (iwrite,*) 'Optimizing eigenvalue - not a valid XML file!', EigenNum
 
 	write (iwrite,'(a)') '<?xml version="1.0" encoding="UTF-8"?>'
 	write (iwrite,'(a)') "<psh_data>"
@@ -931,7 +1060,12 @@ subroutine ClearWMatrix(WMatrix)
 end
 
 
-! This precalculates the W matrices, since the W function is computationally expensive.
+! This precalculates the W matrices, since the W function is computationally expensive.  The tables are also kept
+!  on disk if PSH_WCACHE is set (WCache.c), so only the entries that are not in the cache for these parameters are
+!  calculated here.
+! The PSH_WKERNEL environment variable chooses how W is calculated: "quad" (the default) uses real*16, "dd" uses the
+!  faster double-double code in DoubleDouble.cpp, and "check" uses real*16 but also recalculates the table with
+!  double-double and reports the largest relative difference and the time taken by each.
 !@TODO: Precalculate C coefficients?
 subroutine CalcWMatrices(Omega, WMatrix, Alpha, Beta, Gamma, pmax)
 	use WLimits
@@ -940,15 +1074,42 @@ subroutine CalcWMatrices(Omega, WMatrix, Alpha, Beta, Gamma, pmax)
 	real*16, dimension(lmin:lmax, mmin:mmax, nmin:nmax, 6) :: WMatrix
 	real*16 Alpha, Beta, Gamma
 	integer pmax
-	real*16 W
+	real*16 WSelect, WDD
 	integer l, m, n, k
-	
-	!$omp parallel do shared(lmin,lmax,mmin,mmax,nmin,nmax,pmax,Alpha,Beta,Gamma,WMatrix) private(m,n) schedule(dynamic,5)
+	real*16, dimension(3) :: Params
+	integer, dimension(6) :: Bounds, Found
+	integer LoadWCache, SaveWCache, Info  ! In WCache.c
+	character(len=16) Kernel
+	logical UseDD, CheckDD
+	integer KernelId
+	integer, dimension(3,6) :: Order
+	real*16 Diff, MaxDiff
+	real*8 omp_get_wtime, StartTime, QuadTime
+
+	call get_environment_variable('PSH_WKERNEL', Kernel)
+	UseDD = (Kernel == 'dd')
+	CheckDD = (Kernel == 'check')
+	KernelId = merge(1, 0, UseDD)  ! Tables from the two kernels are cached separately.
+	if (UseDD) write (*,*) "Calculating the W matrices with double-double arithmetic"
+
+	! Found is the part of the table that came from the cache (empty if there was no cache file).
+	Params = (/ Alpha, Beta, Gamma /)
+	Bounds = (/ lmin, lmax, mmin, mmax, nmin, nmax /)
+	Found = (/ 0, -1, 0, -1, 0, -1 /)
+	if (LoadWCache(Params, pmax, KernelId, Bounds, WMatrix, Found) == 0) then
+		write (*,*) "Loaded W matrix entries from the cache for l, m, n in:", Found
+	else
+		Found = (/ 0, -1, 0, -1, 0, -1 /)
+	end if
+
+	StartTime = omp_get_wtime()
+	!$omp parallel do shared(lmin,lmax,mmin,mmax,nmin,nmax,pmax,Alpha,Beta,Gamma,WMatrix,Found,UseDD) private(m,n) schedule(dynamic,5)
 	do l = lmin, lmax, 1
 		write (*,*) "wmatrix l:", l, "/", lmax
 		!write (*,"(a)",advance='no') '.'
 		do m = mmin, mmax, 1
 			do n = nmin, nmax, 1
+				if (l >= Found(1) .and. l <= Found(2) .and. m >= Found(3) .and. m <= Found(4) .and. n >= Found(5) .and. n <= Found(6)) cycle
 				if (l + m + n + 2 >= 0 .and. l + m + 1 >= 0) then  ! TODO: Needed?
 					do k = 1, 6, 1
 						! Note that the ordering of alpha, beta and gamma is the same as the ordering
@@ -956,17 +1117,17 @@ subroutine CalcWMatrices(Omega, WMatrix, Alpha, Beta, Gamma, pmax)
 						!if (WMatrix(l, m, n, k) /= 0.0q0) then
 							select case(k)
 								case (1)
-									WMatrix(l, m, n, 1) = W(l, m, n, Alpha, Beta, Gamma, pmax)
+									WMatrix(l, m, n, 1) = WSelect(UseDD, l, m, n, Alpha, Beta, Gamma, pmax)
 								case (2)
-									WMatrix(l, m, n, 2) = W(l, m, n, Alpha, Gamma, Beta, pmax)
+									WMatrix(l, m, n, 2) = WSelect(UseDD, l, m, n, Alpha, Gamma, Beta, pmax)
 								case (3)
-									WMatrix(l, m, n, 3) = W(l, m, n, Beta, Alpha, Gamma, pmax)
+									WMatrix(l, m, n, 3) = WSelect(UseDD, l, m, n, Beta, Alpha, Gamma, pmax)
 								case (4)
-									WMatrix(l, m, n, 4) = W(l, m, n, Beta, Gamma, Alpha, pmax)
+									WMatrix(l, m, n, 4) = WSelect(UseDD, l, m, n, Beta, Gamma, Alpha, pmax)
 								case (5)
-									WMatrix(l, m, n, 5) = W(l, m, n, Gamma, Alpha, Beta, pmax)
+									WMatrix(l, m, n, 5) = WSelect(UseDD, l, m, n, Gamma, Alpha, Beta, pmax)
 								case (6)
-									WMatrix(l, m, n, 6) = W(l, m, n, Gamma, Beta, Alpha, pmax)
+									WMatrix(l, m, n, 6) = WSelect(UseDD, l, m, n, Gamma, Beta, Alpha, pmax)
 							end select  ! There is no need for a default case.
 						!end if
 					end do
@@ -976,13 +1137,78 @@ subroutine CalcWMatrices(Omega, WMatrix, Alpha, Beta, Gamma, pmax)
 	end do
 	write (*,*)
 
+	if (CheckDD) then
+		! The same order of the parameters as in the select statement above
+		Order = reshape((/ 1,2,3, 1,3,2, 2,1,3, 2,3,1, 3,1,2, 3,2,1 /), (/ 3, 6 /))
+		QuadTime = omp_get_wtime() - StartTime
+		StartTime = omp_get_wtime()
+		MaxDiff = 0.0q0
+		!$omp parallel do shared(lmin,lmax,mmin,mmax,nmin,nmax,pmax,Params,Order,WMatrix,Found) private(m,n,k,Diff) reduction(max:MaxDiff) schedule(dynamic,5)
+		do l = lmin, lmax, 1
+			do m = mmin, mmax, 1
+				do n = nmin, nmax, 1
+					if (l >= Found(1) .and. l <= Found(2) .and. m >= Found(3) .and. m <= Found(4) .and. n >= Found(5) .and. n <= Found(6)) cycle
+					if (l + m + n + 2 >= 0 .and. l + m + 1 >= 0) then
+						do k = 1, 6, 1
+							Diff = WDD(l, m, n, Params(Order(1,k)), Params(Order(2,k)), Params(Order(3,k)), pmax) - WMatrix(l, m, n, k)
+							if (WMatrix(l, m, n, k) /= 0.0q0) Diff = Diff / WMatrix(l, m, n, k)
+							MaxDiff = max(MaxDiff, abs(Diff))
+						end do
+					end if
+				end do
+			end do
+		end do
+		write (*,*) "Double-double W check: largest relative difference", real(MaxDiff,8)
+		write (*,*) "  Time taken (s) with real*16:", QuadTime, " with double-double:", omp_get_wtime() - StartTime
+	end if
+
+	Info = SaveWCache(Params, pmax, KernelId, Bounds, WMatrix, Found)
+
+	return
+end
+
+
+! Same as HylleraasIntegralGeneral, but looks the integral up in the HylleraasCache table first.  Everything except the
+!  powers and the spherical harmonic term must be the same for every call between CacheInit and CacheFree.
+real*16 function CachedHylleraasIntegral(RunCalc, UsePreCalc, j1, j2, j3, j12, j23, j31, alpha, beta, gamma, &
+								l1p, l2p, l3p, m1p, m2p, m3p, l1, l2, l3, m1, m2, m3, M12max, M23max, M31max, pmax, SphHarm, sl, sr, WMatrix, Method)
+	use WLimits
+	use HylleraasCache
+	implicit none
+	real*16, dimension(lmin:lmax, mmin:mmax, nmin:nmax, 6) :: WMatrix
+	integer j1, j2, j3, j12, j23, j31, l1p, m1p, l2p, m2p, l3p, m3p, l1, m1, l2, m2, l3, m3, M12max, M23max, M31max, pmax, sl, sr
+	integer SphHarm, Method
+	logical RunCalc, UsePreCalc
+	real*16 alpha, beta, gamma, HylleraasIntegralGeneral
+	integer, dimension(CacheKeyLen) :: Key
+	logical Found
+
+	Key = (/ j1, j2, j3, j12, j23, j31, SphHarm, sl, sr /)
+	Found = .false.
+	if (RunCalc .eqv. .true.) then  ! Nothing is calculated otherwise.
+		!$omp critical(hylcache)
+		Found = CacheLookup(Key, CachedHylleraasIntegral)
+		!$omp end critical(hylcache)
+	end if
+	if (Found) return
+
+	CachedHylleraasIntegral = HylleraasIntegralGeneral(RunCalc, UsePreCalc, j1, j2, j3, j12, j23, j31, alpha, beta, gamma, &
+								l1p, l2p, l3p, m1p, m2p, m3p, l1, l2, l3, m1, m2, m3, M12max, M23max, M31max, pmax, SphHarm, sl, sr, WMatrix, Method)
+
+	if (RunCalc .eqv. .true.) then
+		!$omp critical(hylcache)
+		call CacheInsert(Key, CachedHylleraasIntegral)
+		!$omp end critical(hylcache)
+	end if
 	return
 end
 
 
-subroutine CalcMatricesSub(RunCalc, UsePreCalc, CalcSH, PowerTablei, PowerTablej, WMatrix, PhiPhi, Phi2HPhi, NumTerms, OffI, OffJ, Alphai, Alphaj, Betai, Betaj, &
+! If LowerOnly is true, this is a diagonal block, and only j <= i is calculated.  The rest is filled in by MirrorLower.
+subroutine CalcMatricesSub(RunCalc, UsePreCalc, CalcSH, LowerOnly, PowerTablei, PowerTablej, WMatrix, PhiPhi, Phi2HPhi, NumTerms, OffI, OffJ, Alphai, Alphaj, Betai, Betaj, &
 							Gammai, Gammaj, l1l, l2l, l3l, m1l, m2l, m3l, l1r, l2r, l3r, m1r, m2r, m3r, M12max, M23max, M31max, pmax, IsTriplet, Method)
 	use WLimits
+	use HylleraasCache
 	implicit none
 	real*16, dimension(34) :: CoeffTable
 	real*16, dimension(6) :: CoeffTableSH
@@ -993,10 +1219,10 @@ subroutine CalcMatricesSub(RunCalc, UsePreCalc, CalcSH, PowerTablei, PowerTablej
 	real*16, dimension(lmin:lmax, mmin:mmax, nmin:nmax, 6) :: WMatrix
 	real*16, dimension(NumTerms*2,NumTerms*2) :: PhiPhi, Phi2HPhi
 	integer M12max, M23max, M31max, pmax, NumTerms, OffI, OffJ, Method
-	logical RunCalc, UsePreCalc, CalcSH
+	logical RunCalc, UsePreCalc, CalcSH, LowerOnly
 	integer l1l, l2l, l3l, m1l, m2l, m3l, l1r, l2r, l3r, m1r, m2r, m3r
 	real*16 Alphai, Alphaj, Betai, Betaj, Gammai, Gammaj
-	real*16 HylleraasIntegral, HylleraasIntegralGeneral, CP12Angular
+	real*16 HylleraasIntegral, CachedHylleraasIntegral, CP12Angular
 	real*16 Sum, SumPiHalf
 	real*16 PI
 	integer i, j, n, IsTriplet
@@ -1009,13 +1235,14 @@ subroutine CalcMatricesSub(RunCalc, UsePreCalc, CalcSH, PowerTablei, PowerTablej
 	PiHalf = 0.1591549430918953357688837633725143620345_16
 	
 	!call omp_set_num_threads(1)
+
+	call CacheInit(65536)
 	
 	!$omp parallel do shared(NumTerms) private(j,Sum,SHPart,RemoveMe,CoeffTable,CoeffTableSH,rPowers,rPowersSH) schedule(dynamic,10)
 	do i = 1, NumTerms, 1
 		write (*,*) i
 		!write (*,"(i7)",advance='no') i
-		!do j = 1, i, 1
-		do j = 1, NumTerms, 1
+		do j = 1, merge(i, NumTerms, LowerOnly), 1
 			Sum = 0.0q0
 			call GenCoeffTable(CoeffTable, PowerTablei, i, PowerTablej, j, NumTerms, &
 								Alphai, Alphaj, Betai, Betaj, Gammai, Gammaj, l1r, l2r, l3r)
@@ -1033,7 +1260,7 @@ subroutine CalcMatricesSub(RunCalc, UsePreCalc, CalcSH, PowerTablei, PowerTablej
 					!  with the fifth and sixth.
    
 					! Do the PhiPhi inner product
-					RemoveMe = HylleraasIntegralGeneral(RunCalc, UsePreCalc, rPowers(n,1), rPowers(n,2), rPowers(n,4), rPowers(n,3), rPowers(n,6), &
+					RemoveMe = CachedHylleraasIntegral(RunCalc, UsePreCalc, rPowers(n,1), rPowers(n,2), rPowers(n,4), rPowers(n,3), rPowers(n,6), &
 												  rPowers(n,5), Alphai+Alphaj, Betai+Betaj, Gammai+Gammaj, &
 												  l1l, l2l, l3l, m1l, m2l, m3l, l1r, l2r, l3r, m1r, m2r, m3r, M12max, M23max, M31max, pmax, 0, 0, 0, WMatrix, Method)
 					Sum = Sum + RemoveMe * CoeffTable(n)
@@ -1046,7 +1273,7 @@ subroutine CalcMatricesSub(RunCalc, UsePreCalc, CalcSH, PowerTablei, PowerTablej
 				SHPart = 0.0q0
 				do n = 1, 6, 1
 					if (CoeffTableSH(n) /= 0.0q0) then
-						RemoveMe = HylleraasIntegralGeneral(RunCalc, UsePreCalc, rPowersSH(n,1), rPowersSH(n,2), rPowersSH(n,4), rPowersSH(n,3), rPowersSH(n,6), &
+						RemoveMe = CachedHylleraasIntegral(RunCalc, UsePreCalc, rPowersSH(n,1), rPowersSH(n,2), rPowersSH(n,4), rPowersSH(n,3), rPowersSH(n,6), &
 															  rPowersSH(n,5), Alphai+Alphaj, Betai+Betaj, Gammai+Gammaj, &
 															  l1l, l2l, l3l, m1l, m2l, m3l, l1r, l2r, l3r, m1r, m2r, m3r, M12max, M23max, M31max, pmax, n, sldata(n), srdata(n), WMatrix, Method)
 						SHPart = SHPart + RemoveMe * CoeffTableSH(n)
@@ -1064,7 +1291,7 @@ subroutine CalcMatricesSub(RunCalc, UsePreCalc, CalcSH, PowerTablei, PowerTablej
 			end if
 
 			! Do the PhiPhi inner product
-			RemoveMe = HylleraasIntegralGeneral(RunCalc, UsePreCalc, PowerTablei(i,1)+PowerTablej(j,1), PowerTablei(i,2)+PowerTablej(j,2), &
+			RemoveMe = CachedHylleraasIntegral(RunCalc, UsePreCalc, PowerTablei(i,1)+PowerTablej(j,1), PowerTablei(i,2)+PowerTablej(j,2), &
 						PowerTablei(i,4)+PowerTablej(j,4), PowerTablei(i,3)+PowerTablej(j,3), &
 						PowerTablei(i,6)+PowerTablej(j,6), PowerTablei(i,5)+PowerTablej(j,5), Alphai+Alphaj, Betai+Betaj, Gammai+Gammaj, &
 						l1l, l2l, l3l, m1l, m2l, m3l, l1r, l2r, l3r, m1r, m2r, m3r, M12max, M23max, M31max, pmax, 0, 0, 0, WMatrix, Method)
@@ -1077,11 +1304,32 @@ subroutine CalcMatricesSub(RunCalc, UsePreCalc, CalcSH, PowerTablei, PowerTablej
 	enddo
 	
 	write (*,*)
+	if (CacheLookups > 0) then
+		write (*,'(a,i12,a,i12,a,f6.2,a)') ' Hylleraas integral cache:', CacheHits, ' hits of', CacheLookups, ' lookups (', &
+			100.0d0 * CacheHits / CacheLookups, '%)'
+	end if
+	call CacheFree()
 	return
 end
 
 
 						
+! Fills in the upper triangle of the matrices from the lower triangle.
+subroutine MirrorLower(PhiPhi, Phi2HPhi, NumTerms)
+	implicit none
+	integer NumTerms, i, j
+	real*16, dimension(NumTerms,NumTerms) :: PhiPhi, Phi2HPhi
+
+	do j = 2, NumTerms, 1
+		do i = 1, j-1, 1
+			PhiPhi(i,j) = PhiPhi(j,i)
+			Phi2HPhi(i,j) = Phi2HPhi(j,i)
+		end do
+	end do
+	return
+end
+
+
 subroutine CalcMatrices(RunCalc, UsePreCalc, PowerTabler1i, PowerTabler1j, PowerTabler2i, PowerTabler2j, WMatrix, PhiPhi, Phi2HPhi, NumTerms, &
 						Alphai, Alphaj, Betai, Betaj, Gammai, Gammaj, LValue, M12max, M23max, M31max, pmax, IsTriplet, Method, Exchanged)
 	use WLimits
@@ -1096,7 +1344,7 @@ subroutine CalcMatrices(RunCalc, UsePreCalc, PowerTabler1i, PowerTabler1j, Power
 	
 	! 1-1 matrix elements
 	write (*,*) "Calculating 1-1 matrix elements"
-	call CalcMatricesSub(RunCalc, UsePreCalc, .false., PowerTabler1i, PowerTabler1j, WMatrix, PhiPhi, Phi2HPhi, NumTerms/2, 0, 0, Alphai, Alphaj, Betai, Betaj, &
+	call CalcMatricesSub(RunCalc, UsePreCalc, .false., .true., PowerTabler1i, PowerTabler1j, WMatrix, PhiPhi, Phi2HPhi, NumTerms/2, 0, 0, Alphai, Alphaj, Betai, Betaj, &
 						Gammai, Gammaj, LValue, 0, 0, 0, 0, 0, LValue, 0, 0, 0, 0, 0, M12max, M23max, M31max, pmax, IsTriplet, Method)
 	
     if (LValue == 0) return  ! S-wave only has one symmetry
@@ -1104,26 +1352,18 @@ subroutine CalcMatrices(RunCalc, UsePreCalc, PowerTabler1i, PowerTabler1j, Power
 	! 2-2 matrix elements
 	write (*,*) "Calculating 2-2 matrix elements"
 	if (Exchanged == .true.) then  ! Swap l2r and l3r
-		call CalcMatricesSub(RunCalc, UsePreCalc, .true., PowerTabler2i, PowerTabler2j, WMatrix, PhiPhi, Phi2HPhi, NumTerms/2, NumTerms/2, NumTerms/2, Alphai, Alphaj, Betai, Betaj, &
+		call CalcMatricesSub(RunCalc, UsePreCalc, .true., .true., PowerTabler2i, PowerTabler2j, WMatrix, PhiPhi, Phi2HPhi, NumTerms/2, NumTerms/2, NumTerms/2, Alphai, Alphaj, Betai, Betaj, &
 							Gammai, Gammaj, 0, LValue, 0, 0, 0, 0, 0, 0, LValue, 0, 0, 0, M12max, M23max, M31max, pmax, IsTriplet, Method)
 	else
-		call CalcMatricesSub(RunCalc, UsePreCalc, .false., PowerTabler2i, PowerTabler2j, WMatrix, PhiPhi, Phi2HPhi, NumTerms/2, NumTerms/2, NumTerms/2, Alphai, Alphaj, Betai, Betaj, &
+		call CalcMatricesSub(RunCalc, UsePreCalc, .false., .true., PowerTabler2i, PowerTabler2j, WMatrix, PhiPhi, Phi2HPhi, NumTerms/2, NumTerms/2, NumTerms/2, Alphai, Alphaj, Betai, Betaj, &
 							Gammai, Gammaj, 0, LValue, 0, 0, 0, 0, 0, LValue, 0, 0, 0, 0, M12max, M23max, M31max, pmax, IsTriplet, Method)
 	end if
 		
-	! 1-2 matrix elements
-	write (*,*) "Calculating 1-2 matrix elements"
-	if (Exchanged == .true.) then  ! Swap l2r and l3r
-		call CalcMatricesSub(RunCalc, UsePreCalc, .true., PowerTabler1i, PowerTabler2j, WMatrix, PhiPhi, Phi2HPhi, NumTerms/2, 0, NumTerms/2, Alphai, Alphaj, Betai, Betaj, &
-							Gammai, Gammaj, LValue, 0, 0, 0, 0, 0, 0, 0, LValue, 0, 0, 0, M12max, M23max, M31max, pmax, IsTriplet, Method)
-	else
-		call CalcMatricesSub(RunCalc, UsePreCalc, .true.,  PowerTabler1i, PowerTabler2j, WMatrix, PhiPhi, Phi2HPhi, NumTerms/2, 0, NumTerms/2, Alphai, Alphaj, Betai, Betaj, &
-							Gammai, Gammaj, LValue, 0, 0, 0, 0, 0, 0, LValue, 0, 0, 0, 0, M12max, M23max, M31max, pmax, IsTriplet, Method)
-	end if
+	! The 1-2 matrix elements are the transpose of the 2-1 matrix elements, so they are filled in by MirrorLower.
 	
 	! 2-1 matrix elements
 	write (*,*) "Calculating 2-1 matrix elements"
-	call CalcMatricesSub(RunCalc, UsePreCalc, .true., PowerTabler2i, PowerTabler1j, WMatrix, PhiPhi, Phi2HPhi, NumTerms/2, NumTerms/2, 0, Alphai, Alphaj, Betai, Betaj, &
+	call CalcMatricesSub(RunCalc, UsePreCalc, .true., .false., PowerTabler2i, PowerTabler1j, WMatrix, PhiPhi, Phi2HPhi, NumTerms/2, NumTerms/2, 0, Alphai, Alphaj, Betai, Betaj, &
 						Gammai, Gammaj, 0, LValue, 0, 0, 0, 0, LValue, 0, 0, 0, 0, 0, M12max, M23max, M31max, pmax, IsTriplet, Method)
 		
 	return
@@ -1174,15 +1414,66 @@ subroutine ederivwrapper(Omega, NumTerms, LValue, M12max, M23max, M31max, pmax,
 	Energy = Energies(1)
 
 	write (*,"(A,3F8.5)") "Alpha, Beta, Gamma: ", Alpha, Beta, Gamma
+	
+	deallocate(PhiPhi, Phi2HPhi, Energies, Workspace)
+end
+
+
+! Writes one energy from the optimization to the output file and standard error.  This is called from Minimize.c
+!  for every new energy, whether it was calculated in this process or by EnergyWorker.
+subroutine logenergy(Iter, Alpha, Beta, Gamma, Energy) bind(C)
+	implicit none
+	integer Iter
+	real*8 Alpha, Beta, Gamma, Energy
+
 	write (10,"(I4,A,3F8.5)") Iter, "; Alpha, Beta, Gamma: ", Alpha, Beta, Gamma  ! I dislike hardcoding the 10, but it's easier at this point.
 	write (10,"(A,F16.12)") "Energy: ", Energy
 	write (10,*)
-	write (0,"(I4,A,3F8.5)") Iter, "; Alpha, Beta, Gamma: ", Alpha, Beta, Gamma  ! I dislike hardcoding the 10, but it's easier at this point.
+	write (0,"(I4,A,3F8.5)") Iter, "; Alpha, Beta, Gamma: ", Alpha, Beta, Gamma
 	write (0,"(A,F16.12)") "Energy: ", Energy
 	write (0,*)
 	flush(10)
-	
-	deallocate(PhiPhi, Phi2HPhi, Energies, Workspace)
+end
+
+
+! Calculates the energy for one set of nonlinear parameters in its own process, for the optimizer.  The arguments
+!  are "-energy input result alpha beta gamma", and the energy is the only line written to the result file.
+subroutine EnergyWorker()
+	implicit none
+	interface
+		subroutine ederivwrapper(Omega, NumTerms, LValue, M12max, M23max, M31max, pmax, IsTriplet, Ordering, Method, EigenRoutine, Alpha, Beta, Gamma, Iter, Energy) bind(C)
+		integer Omega, NumTerms, LValue, M12max, M23max, M31max, pmax, IsTriplet, Ordering, Method, EigenRoutine, Iter
+		real*8 Alpha, Beta, Gamma, Energy
+		end subroutine ederivwrapper
+	end interface
+	character *256 IOBuffer
+	integer Omega, LValue, M12max, M23max, M31max, pmax, Method, IsTriplet, LowerEigen, UpperEigen, AllEnergies
+	integer Optimize, EigenNum, MaxIter, Ordering, EigenRoutine, NumTerms, Iter, CalcPowerTableSize
+	real*16 Alpha, Beta, Gamma
+	real*8 Alpha8, Beta8, Gamma8, Energy
+
+	call getarg(2, IOBuffer)
+	open(9, FILE=IOBuffer, status='old')
+	call ReadParamFile(9, Omega, LValue, Alpha, Beta, Gamma, M12max, M23max, M31max, pmax, Method, IsTriplet, LowerEigen, UpperEigen, &
+						 AllEnergies, Optimize, EigenNum, MaxIter, Ordering, EigenRoutine)
+	close(9)
+	! The parameters to use replace the starting values from the input file.
+	call getarg(4, IOBuffer)
+	read (IOBuffer,*) Alpha8
+	call getarg(5, IOBuffer)
+	read (IOBuffer,*) Beta8
+	call getarg(6, IOBuffer)
+	read (IOBuffer,*) Gamma8
+
+	NumTerms = CalcPowerTableSize(Omega) * 2
+	Iter = 0
+	call ederivwrapper(Omega, NumTerms, LValue, M12max, M23max, M31max, pmax, IsTriplet, Ordering, Method, EigenRoutine, &
+						Alpha8, Beta8, Gamma8, Iter, Energy)
+
+	call getarg(3, IOBuffer)
+	open(11, FILE=IOBuffer)
+	write (11,"(ES26.17E3)") Energy
+	close(11)
 end
 
 
@@ -1342,6 +1633,9 @@ real*16 function EDeriv(Omega, NumTerms, Alpha, Beta, Gamma, EigenNum, PhiPhi, P
 
 !@TODO: Change to a subroutine
 300	EDeriv = 1.0d0  ! Random value, return not used in this case.
+
+	! Only the lower triangle was calculated, since both matrices are symmetric.
+	call MirrorLower(PhiPhi, Phi2HPhi, NumTerms)
 	
 	! Clean up memory before exiting
 	deallocate(WMatrix)
@@ -0,0 +1,434 @@
+// On-disk cache of the W matrices from CalcWMatrices in PsHMain.f90.  The W function only depends on (l, m, n), the
+//  three summed nonlinear parameters and pmax, so a table calculated once can be reused by later runs with the same
+//  alpha, beta, gamma and pmax (restarts of the optimization, runs with a larger Omega, etc.).  Tables calculated with
+//  the double-double kernel are kept apart from the real*16 ones.
+// The cache is only used if the PSH_WCACHE environment variable is set, and each table is in its own file in the
+//  directory it gives.  The file starts with the magic string, version, pmax, the kernel (0 for real*16, 1 for double-double),
+//  the three parameters as raw real*16 values and the l, m and n bounds, followed by the 6 blocks of WMatrix(lmin:lmax, mmin:mmax, nmin:nmax, k) in Fortran order.
+//  Only the overlap with the requested bounds is read, so a file from a run with smaller bounds still saves
+//  computing part of the table.  The file is memory mapped where possible.
+// The optimizer makes a new table at every step, so the directory is kept under PSH_WCACHE_MAX megabytes (1024 by
+//  default) by removing the least recently used tables after each write.  PSH_WCACHE_MAX=0 stops tables from being
+//  written at all, which is useful for long optimizations.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#ifdef _WIN32
+#include <direct.h>
+#include <io.h>
+#include <process.h>
+#include <sys/utime.h>
+#define utime _utime
+#define getpid _getpid
+#else
+#include <dirent.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <utime.h>
+#include <sys/mman.h>
+#endif
+
+#define W_CACHE_MAGIC "PSHWMAT\0"
+#define W_CACHE_VERSION 2
+#define W_CACHE_HEADER 96  // Keeps the real*16 data 16-byte aligned
+#define W_REAL_SIZE 16
+#define W_CACHE_MAX_MB 1024  // Default limit on the size of the cache directory
+
+typedef struct
+{
+	char Magic[8];
+	int Version;
+	int pmax;
+	int Kernel;
+	unsigned char Params[3*W_REAL_SIZE];
+	int Bounds[6];  // lmin, lmax, mmin, mmax, nmin, nmax
+} WCacheHeader;
+
+
+typedef struct
+{
+	char *Name;
+	long long Size;
+	time_t Used;
+} WCacheFile;
+
+
+// Returns NULL if caching is not turned on.  The directory is announced the first time it is used.
+static const char *CacheDir(void)
+{
+	static int Announced = 0;
+	const char *Dir = getenv("PSH_WCACHE");
+	if (Dir == NULL || Dir[0] == '\0')
+		return NULL;
+	if (!Announced) {
+		printf("Using the W matrix cache in %s\n", Dir);
+		Announced = 1;
+	}
+	return Dir;
+}
+
+
+static long long CacheLimit(void)
+{
+	const char *Limit = getenv("PSH_WCACHE_MAX");
+	if (Limit == NULL || Limit[0] == '\0')
+		return (long long)W_CACHE_MAX_MB << 20;
+	return atoll(Limit) << 20;
+}
+
+
+// The filename is a hash of the parameters, pmax and the kernel.  The header still has to be checked, since different parameters
+//  can give the same hash.
+static char *CacheName(const unsigned char *Params, int pmax, int Kernel)
+{
+	unsigned long long Hash = 14695981039346656037ULL;  // FNV-1a
+	const char *Dir = CacheDir();
+	char *Name;
+	int i;
+
+	if (Dir == NULL)
+		return NULL;
+
+	for (i = 0; i < 3*W_REAL_SIZE; i++)
+		Hash = (Hash ^ Params[i]) * 1099511628211ULL;
+	for (i = 0; i < (int)sizeof(int); i++)
+		Hash = (Hash ^ ((unsigned char*)&pmax)[i]) * 1099511628211ULL;
+	Hash = (Hash ^ (unsigned char)Kernel) * 1099511628211ULL;
+
+	Name = malloc(strlen(Dir) + 32);
+	if (Name != NULL)
+		sprintf(Name, "%s/W_%016llx.bin", Dir, Hash);
+	return Name;
+}
+
+
+static long long BlockSize(const int *Bounds)
+{
+	return (long long)(Bounds[1] - Bounds[0] + 1) * (Bounds[3] - Bounds[2] + 1) * (Bounds[5] - Bounds[4] + 1);
+}
+
+
+static long long Index(const int *Bounds, int l, int m, int n, int k)
+{
+	return (((long long)k * (Bounds[5] - Bounds[4] + 1) + (n - Bounds[4])) * (Bounds[3] - Bounds[2] + 1) + (m - Bounds[2]))
+		* (Bounds[1] - Bounds[0] + 1) + (l - Bounds[0]);
+}
+
+
+static int Inside(const int *Bounds, int l, int m, int n)
+{
+	return l >= Bounds[0] && l <= Bounds[1] && m >= Bounds[2] && m <= Bounds[3] && n >= Bounds[4] && n <= Bounds[5];
+}
+
+
+// Finds the overlap of the two sets of bounds.  Returns 0 if they do not overlap.
+static int Overlap(const int *A, const int *B, int *Both)
+{
+	int i;
+	for (i = 0; i < 6; i += 2) {
+		Both[i] = A[i] > B[i] ? A[i] : B[i];
+		Both[i+1] = A[i+1] < B[i+1] ? A[i+1] : B[i+1];
+	}
+	return Both[0] <= Both[1] && Both[2] <= Both[3] && Both[4] <= Both[5];
+}
+
+
+// Copies the entries in Box (which must be inside both sets of bounds) from Src to Dest, one row of l at a time.
+static void CopyBox(unsigned char *Dest, const int *DestBounds, const unsigned char *Src, const int *SrcBounds, const int *Box)
+{
+	int m, n, k;
+	for (k = 0; k < 6; k++)
+		for (n = Box[4]; n <= Box[5]; n++)
+			for (m = Box[2]; m <= Box[3]; m++)
+				memcpy(Dest + Index(DestBounds, Box[0], m, n, k) * W_REAL_SIZE, Src + Index(SrcBounds, Box[0], m, n, k) * W_REAL_SIZE,
+					(size_t)(Box[1] - Box[0] + 1) * W_REAL_SIZE);
+}
+
+
+// Maps the cache file and checks its header against the parameters.  Returns NULL if there is no usable file.  The
+//  header is copied to Header, and the map must be released with UnmapCache.
+static void *MapCache(const char *Name, const unsigned char *Params, int pmax, int Kernel, WCacheHeader *Header, long long *Size)
+{
+	struct stat Info;
+	void *Map;
+
+	if (stat(Name, &Info) != 0 || Info.st_size < W_CACHE_HEADER)
+		return NULL;
+	*Size = Info.st_size;
+
+#ifdef _WIN32
+	{
+		FILE *Cache = fopen(Name, "rb");
+		Map = malloc(Info.st_size);
+		if (Cache == NULL || Map == NULL || fread(Map, 1, Info.st_size, Cache) != (size_t)Info.st_size) {
+			if (Cache != NULL)
+				fclose(Cache);
+			free(Map);
+			return NULL;
+		}
+		fclose(Cache);
+	}
+#else
+	{
+		int fd = open(Name, O_RDONLY);
+		if (fd < 0)
+			return NULL;
+		Map = mmap(NULL, Info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+		close(fd);
+		if (Map == MAP_FAILED)
+			return NULL;
+	}
+#endif
+
+	memcpy(Header, Map, sizeof(WCacheHeader));
+	if (memcmp(Header->Magic, W_CACHE_MAGIC, 8) != 0 || Header->Version != W_CACHE_VERSION || Header->pmax != pmax || Header->Kernel != Kernel
+		|| memcmp(Header->Params, Params, 3*W_REAL_SIZE) != 0
+		|| Info.st_size != W_CACHE_HEADER + 6 * BlockSize(Header->Bounds) * W_REAL_SIZE) {
+		printf("The W matrix cache %s does not match and will be replaced.\n", Name);
+#ifdef _WIN32
+		free(Map);
+#else
+		munmap(Map, Info.st_size);
+#endif
+		return NULL;
+	}
+	return Map;
+}
+
+
+static void UnmapCache(void *Map, long long Size)
+{
+#ifdef _WIN32
+	free(Map);
+#else
+	munmap(Map, Size);
+#endif
+}
+
+
+static int CompareUsed(const void *a, const void *b)
+{
+	const WCacheFile *A = a, *B = b;
+	return (A->Used > B->Used) - (A->Used < B->Used);
+}
+
+
+// Removes the least recently used tables until the directory is under the size limit.  Keep (the table that was just
+//  written) is never removed.
+static void EvictCache(const char *Keep, long long Limit)
+{
+	const char *Dir = CacheDir();
+	WCacheFile *Files = NULL, *Larger;
+	int NumFiles = 0, MaxFiles = 0, i;
+	long long Total = 0;
+	struct stat Info;
+	char *Path;
+#ifdef _WIN32
+	struct _finddata_t Entry;
+	intptr_t Handle;
+	char *Pattern = malloc(strlen(Dir) + 16);
+
+	if (Pattern == NULL)
+		return;
+	sprintf(Pattern, "%s/W_*.bin", Dir);
+	Handle = _findfirst(Pattern, &Entry);
+	free(Pattern);
+	if (Handle == -1)
+		return;
+	do {
+		const char *FileName = Entry.name;
+#else
+	struct dirent *Entry;
+	DIR *Listing = opendir(Dir);
+
+	if (Listing == NULL)
+		return;
+	while ((Entry = readdir(Listing)) != NULL) {
+		const char *FileName = Entry->d_name;
+		size_t Len = strlen(FileName);
+		if (strncmp(FileName, "W_", 2) != 0 || Len < 4 || strcmp(FileName + Len - 4, ".bin") != 0)
+			continue;
+#endif
+		Path = malloc(strlen(Dir) + strlen(FileName) + 2);
+		if (Path == NULL)
+			break;
+		sprintf(Path, "%s/%s", Dir, FileName);
+		if (stat(Path, &Info) != 0) {
+			free(Path);
+			continue;
+		}
+		if (NumFiles == MaxFiles) {
+			MaxFiles = MaxFiles ? 2 * MaxFiles : 64;
+			Larger = realloc(Files, MaxFiles * sizeof(WCacheFile));
+			if (Larger == NULL) {
+				free(Path);
+				break;
+			}
+			Files = Larger;
+		}
+		Files[NumFiles].Name = Path;
+		Files[NumFiles].Size = Info.st_size;
+		Files[NumFiles].Used = Info.st_mtime;
+		NumFiles++;
+		Total += Info.st_size;
+#ifdef _WIN32
+	} while (_findnext(Handle, &Entry) == 0);
+	_findclose(Handle);
+#else
+	}
+	closedir(Listing);
+#endif
+
+	qsort(Files, NumFiles, sizeof(WCacheFile), CompareUsed);
+	for (i = 0; i < NumFiles && Total > Limit; i++) {
+		if (strcmp(Files[i].Name, Keep) == 0)
+			continue;
+		if (remove(Files[i].Name) == 0) {
+			printf("Removed the W matrix cache %s to stay under the size limit\n", Files[i].Name);
+			Total -= Files[i].Size;
+		}
+	}
+	for (i = 0; i < NumFiles; i++)
+		free(Files[i].Name);
+	free(Files);
+}
+
+
+// These are called from Fortran, so every argument is passed by reference.
+
+// Copies the part of the cached table that overlaps Bounds into WMatrix.  Returns 0 and the overlap in Found if any
+//  of the table could be used, and -1 if there is no usable cache file.
+int loadwcache_(const unsigned char *Params, const int *pmax, const int *Kernel, const int *Bounds, unsigned char *WMatrix, int *Found)
+{
+	char *Name;
+	WCacheHeader Header;
+	long long Size;
+	int Res = -1;
+	void *Map;
+
+	Name = CacheName(Params, *pmax, *Kernel);
+	if (Name == NULL)
+		return -1;
+	Map = MapCache(Name, Params, *pmax, *Kernel, &Header, &Size);
+	if (Map != NULL) {
+		if (Overlap(Header.Bounds, Bounds, Found)) {
+			CopyBox(WMatrix, Bounds, (const unsigned char*)Map + W_CACHE_HEADER, Header.Bounds, Found);
+			utime(Name, NULL);  // Marks the table as recently used for EvictCache.
+			Res = 0;
+		}
+		UnmapCache(Map, Size);
+	}
+	free(Name);
+	return Res;
+}
+
+
+// Writes WMatrix to the cache, unless the existing file already has all of it.  The bounds of a table only grow: if
+//  the existing file has entries outside of Bounds, the new file covers both sets of bounds.  That is only possible if
+//  the two tables together fill the combined bounds.  If they do not, the larger of the two tables is kept.
+int savewcache_(const unsigned char *Params, const int *pmax, const int *Kernel, const int *Bounds, const unsigned char *WMatrix, const int *Found)
+{
+	char *Name, *TempName;
+	WCacheHeader Header, Old;
+	unsigned char Pad[W_CACHE_HEADER - sizeof(WCacheHeader)];
+	const unsigned char *Table = WMatrix;
+	unsigned char *Union = NULL;
+	long long Size, OldSize, Limit = CacheLimit();
+	int NewBounds[6], l, m, n, i, Filled = 1, Res = -1;
+	void *Map = NULL;
+	FILE *Cache;
+
+	if (memcmp(Found, Bounds, 6 * sizeof(int)) == 0 || Limit <= 0 || CacheDir() == NULL)
+		return 0;  // Everything came from the cache, or caching is turned off.
+
+#ifdef _WIN32
+	_mkdir(CacheDir());
+#else
+	mkdir(CacheDir(), 0777);
+#endif
+	Name = CacheName(Params, *pmax, *Kernel);
+	if (Name == NULL)
+		return -1;
+	// The process id keeps runs sharing the directory from writing the same temporary file.
+	TempName = malloc(strlen(Name) + 32);
+	if (TempName == NULL) {
+		free(Name);
+		return -1;
+	}
+	sprintf(TempName, "%s.%ld.tmp", Name, (long)getpid());
+
+	// The combined bounds, if the old table and this one fill them between them
+	memcpy(NewBounds, Bounds, 6 * sizeof(int));
+	Map = MapCache(Name, Params, *pmax, *Kernel, &Old, &OldSize);
+	if (Map != NULL) {
+		for (i = 0; i < 6; i += 2) {
+			NewBounds[i] = Old.Bounds[i] < Bounds[i] ? Old.Bounds[i] : Bounds[i];
+			NewBounds[i+1] = Old.Bounds[i+1] > Bounds[i+1] ? Old.Bounds[i+1] : Bounds[i+1];
+		}
+		for (l = NewBounds[0]; l <= NewBounds[1] && Filled; l++)
+			for (m = NewBounds[2]; m <= NewBounds[3] && Filled; m++)
+				for (n = NewBounds[4]; n <= NewBounds[5] && Filled; n++)
+					Filled = Inside(Bounds, l, m, n) || Inside(Old.Bounds, l, m, n);
+		if (Filled)
+			Union = calloc(1, (size_t)(6 * BlockSize(NewBounds) * W_REAL_SIZE));
+		if (Union != NULL) {
+			CopyBox(Union, NewBounds, (const unsigned char*)Map + W_CACHE_HEADER, Old.Bounds, Old.Bounds);
+			CopyBox(Union, NewBounds, WMatrix, Bounds, Bounds);
+			Table = Union;
+		}
+		else
+			memcpy(NewBounds, Bounds, 6 * sizeof(int));
+		UnmapCache(Map, OldSize);
+
+		if (!Filled && BlockSize(Old.Bounds) > BlockSize(Bounds)) {
+			free(TempName);
+			free(Name);
+			return 0;
+		}
+	}
+	Size = 6 * BlockSize(NewBounds) * W_REAL_SIZE;
+
+	// Written to a temporary file first so that another run never sees a partial table.
+	Cache = fopen(TempName, "wb");
+	if (Cache == NULL) {
+		printf("Could not write the W matrix cache %s\n", Name);
+		free(Union);
+		free(TempName);
+		free(Name);
+		return -1;
+	}
+	memset(&Header, 0, sizeof(WCacheHeader));
+	memset(Pad, 0, sizeof(Pad));
+	memcpy(Header.Magic, W_CACHE_MAGIC, 8);
+	Header.Version = W_CACHE_VERSION;
+	Header.pmax = *pmax;
+	Header.Kernel = *Kernel;
+	memcpy(Header.Params, Params, 3*W_REAL_SIZE);
+	memcpy(Header.Bounds, NewBounds, 6 * sizeof(int));
+	if (fwrite(&Header, sizeof(WCacheHeader), 1, Cache) == 1 && fwrite(Pad, 1, sizeof(Pad), Cache) == sizeof(Pad)
+		&& fwrite(Table, 1, (size_t)Size, Cache) == (size_t)Size)
+		Res = 0;
+	if (fclose(Cache) != 0)
+		Res = -1;
+
+	if (Res == 0) {
+#ifdef _WIN32
+		remove(Name);
+#endif
+		if (rename(TempName, Name) != 0)
+			Res = -1;
+	}
+	if (Res != 0) {
+		printf("Could not write the W matrix cache %s\n", Name);
+		remove(TempName);
+	}
+	else
+		EvictCache(Name, Limit);
+	free(Union);
+	free(TempName);
+	free(Name);
+	return Res;
+}